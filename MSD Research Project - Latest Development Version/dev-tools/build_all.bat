@@ -14,6 +14,8 @@
 @call %VS_DIR%\VC\Auxiliary\Build\vcvars64.bat
 @cl /EHsc /Fe"bin/iterate.exe" src/iterate.cpp
 @cl /EHsc /Fe"bin/heat.exe" src/heat.cpp
+@cl /EHsc /Fe"bin/wang-landau.exe" src/wang-landau.cpp
+@cl /EHsc /Fe"bin/population-annealing.exe" src/population-annealing.cpp
 @cl /EHsc /Fe"bin/magnetize.exe" src/magnetize.cpp
 @cl /EHsc /Fe"bin/magnetize2.exe" src/magnetize2.cpp
 @cl /EHsc /Fe"bin/metropolis.exe" src/metropolis.cpp
@@ -28,6 +30,8 @@
 @call %VS_DIR%\VC\Auxiliary\Build\vcvars32.bat
 @cl /EHsc /Fe"bin/iterate_x86.exe" src/iterate.cpp
 @cl /EHsc /Fe"bin/heat_x86.exe" src/heat.cpp
+@cl /EHsc /Fe"bin/wang-landau_x86.exe" src/wang-landau.cpp
+@cl /EHsc /Fe"bin/population-annealing_x86.exe" src/population-annealing.cpp
 @cl /EHsc /Fe"bin/magnetize_x86.exe" src/magnetize.cpp
 @cl /EHsc /Fe"bin/magnetize2_x86.exe" src/magnetize2.cpp
 @cl /EHsc /Fe"bin/metropolis_x86.exe" src/metropolis.cpp
@@ -37,7 +41,7 @@
 
 
 @rem Remove .obj, .exp, and .lib files
-@del iterate.obj heat.obj magnetize.obj magnetize2.obj metropolis.obj extract.obj mfm_aggregator.obj MSD-export.obj mmt_compiler.obj mmb_inspector.obj
+@del iterate.obj heat.obj wang-landau.obj population-annealing.obj magnetize.obj magnetize2.obj metropolis.obj extract.obj mfm_aggregator.obj MSD-export.obj mmt_compiler.obj mmb_inspector.obj
 @del lib\python\MSD-export.exp lib\python\MSD-export.lib lib\python\MSD-export_x86.exp lib\python\MSD-export_x86.lib
 
 
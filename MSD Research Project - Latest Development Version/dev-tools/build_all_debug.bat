@@ -14,6 +14,8 @@
 @call %VS_DIR%\VC\Auxiliary\Build\vcvars64.bat
 @cl /EHsc /Z7 /Fe"bin/iterate.exe" src/iterate.cpp
 @cl /EHsc /Z7 /Fe"bin/heat.exe" src/heat.cpp
+@cl /EHsc /Z7 /Fe"bin/wang-landau.exe" src/wang-landau.cpp
+@cl /EHsc /Z7 /Fe"bin/population-annealing.exe" src/population-annealing.cpp
 @cl /EHsc /Z7 /Fe"bin/magnetize.exe" src/magnetize.cpp
 @cl /EHsc /Z7 /Fe"bin/magnetize2.exe" src/magnetize2.cpp
 @cl /EHsc /Z7 /Fe"bin/metropolis.exe" src/metropolis.cpp
@@ -26,6 +28,8 @@
 @call %VS_DIR%\VC\Auxiliary\Build\vcvars32.bat
 @cl /EHsc /Z7 /Fe"bin/iterate_x86.exe" src/iterate.cpp
 @cl /EHsc /Z7 /Fe"bin/heat_x86.exe" src/heat.cpp
+@cl /EHsc /Z7 /Fe"bin/wang-landau_x86.exe" src/wang-landau.cpp
+@cl /EHsc /Z7 /Fe"bin/population-annealing_x86.exe" src/population-annealing.cpp
 @cl /EHsc /Z7 /Fe"bin/magnetize_x86.exe" src/magnetize.cpp
 @cl /EHsc /Z7 /Fe"bin/magnetize2_x86.exe" src/magnetize2.cpp
 @cl /EHsc /Z7 /Fe"bin/metropolis_x86.exe" src/metropolis.cpp
@@ -34,7 +38,7 @@
 
 
 @rem Remove .obj file
-@del iterate.obj heat.obj magnetize.obj magnetize2.obj metropolis.obj extract.obj mfm_aggregator.obj
+@del iterate.obj heat.obj wang-landau.obj population-annealing.obj magnetize.obj magnetize2.obj metropolis.obj extract.obj mfm_aggregator.obj
 
 
 @rem End of file
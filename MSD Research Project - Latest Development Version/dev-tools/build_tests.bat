@@ -13,17 +13,92 @@
 @set VSCMD_START_DIR=%CD%
 @call %VS_DIR%\VC\Auxiliary\Build\vcvars64.bat
 @cl /EHsc /Fe"bin/tests/test-setLocalM.exe" src/tests/test-setLocalM.cpp
+@cl /EHsc /Fe"bin/tests/cluster-test.exe" src/tests/cluster-test.cpp
+@cl /EHsc /Fe"bin/tests/overrelax-test.exe" src/tests/overrelax-test.cpp
+@cl /EHsc /Fe"bin/tests/heatbath-test.exe" src/tests/heatbath-test.cpp
+@cl /EHsc /Fe"bin/tests/cone-test.exe" src/tests/cone-test.cpp
+@cl /EHsc /Fe"bin/tests/nfoldway-test.exe" src/tests/nfoldway-test.cpp
+@cl /EHsc /Fe"bin/tests/wang-landau-test.exe" src/tests/wang-landau-test.cpp
+@cl /EHsc /Fe"bin/tests/reweight-test.exe" src/tests/reweight-test.cpp
+@cl /EHsc /Fe"bin/tests/coupling-test.exe" src/tests/coupling-test.cpp
+@cl /EHsc /Fe"bin/tests/population-annealing-test.exe" src/tests/population-annealing-test.cpp
+@cl /EHsc /Fe"bin/tests/batch-test.exe" src/tests/batch-test.cpp
+@cl /EHsc /Fe"bin/tests/ising-test.exe" src/tests/ising-test.cpp
+@cl /EHsc /Fe"bin/tests/schedule-test.exe" src/tests/schedule-test.cpp
+@cl /EHsc /Fe"bin/tests/replicas-test.exe" src/tests/replicas-test.cpp
+@cl /EHsc /Fe"bin/tests/adaptive-field-test.exe" src/tests/adaptive-field-test.cpp
+@cl /EHsc /Fe"bin/tests/sweep-design-test.exe" src/tests/sweep-design-test.cpp
+@cl /EHsc /Fe"bin/tests/result-cache-test.exe" src/tests/result-cache-test.cpp
+@cl /EHsc /Fe"bin/tests/state-library-test.exe" src/tests/state-library-test.cpp
+@cl /EHsc /Fe"bin/tests/site-weight-test.exe" src/tests/site-weight-test.cpp
+@cl /EHsc /Fe"bin/tests/macrospin-test.exe" src/tests/macrospin-test.cpp
+@cl /EHsc /Fe"bin/tests/sweep-mode-test.exe" src/tests/sweep-mode-test.cpp
+@cl /EHsc /Fe"bin/tests/site-order-test.exe" src/tests/site-order-test.cpp
+@cl /EHsc /Fe"bin/tests/huge-lattice-test.exe" src/tests/huge-lattice-test.cpp
+@cl /EHsc /Fe"bin/tests/domain-test.exe" src/tests/domain-test.cpp
+@cl /EHsc /Fe"bin/tests/voxel-mask-test.exe" src/tests/voxel-mask-test.cpp
+@cl /EHsc /Fe"bin/tests/periodic-test.exe" src/tests/periodic-test.cpp
 
 
 @rem Compile 32-bit versions
 @set VSCMD_START_DIR=%CD%
 @call %VS_DIR%\VC\Auxiliary\Build\vcvars32.bat
 @cl /EHsc /Fe"bin/tests/test-setLocalM_x86.exe" src/tests/test-setLocalM.cpp
+@cl /EHsc /Fe"bin/tests/cluster-test_x86.exe" src/tests/cluster-test.cpp
+@cl /EHsc /Fe"bin/tests/overrelax-test_x86.exe" src/tests/overrelax-test.cpp
+@cl /EHsc /Fe"bin/tests/heatbath-test_x86.exe" src/tests/heatbath-test.cpp
+@cl /EHsc /Fe"bin/tests/cone-test_x86.exe" src/tests/cone-test.cpp
+@cl /EHsc /Fe"bin/tests/nfoldway-test_x86.exe" src/tests/nfoldway-test.cpp
+@cl /EHsc /Fe"bin/tests/wang-landau-test_x86.exe" src/tests/wang-landau-test.cpp
+@cl /EHsc /Fe"bin/tests/reweight-test_x86.exe" src/tests/reweight-test.cpp
+@cl /EHsc /Fe"bin/tests/coupling-test_x86.exe" src/tests/coupling-test.cpp
+@cl /EHsc /Fe"bin/tests/population-annealing-test_x86.exe" src/tests/population-annealing-test.cpp
+@cl /EHsc /Fe"bin/tests/batch-test_x86.exe" src/tests/batch-test.cpp
+@cl /EHsc /Fe"bin/tests/ising-test_x86.exe" src/tests/ising-test.cpp
+@cl /EHsc /Fe"bin/tests/schedule-test_x86.exe" src/tests/schedule-test.cpp
+@cl /EHsc /Fe"bin/tests/replicas-test_x86.exe" src/tests/replicas-test.cpp
+@cl /EHsc /Fe"bin/tests/adaptive-field-test_x86.exe" src/tests/adaptive-field-test.cpp
+@cl /EHsc /Fe"bin/tests/sweep-design-test_x86.exe" src/tests/sweep-design-test.cpp
+@cl /EHsc /Fe"bin/tests/result-cache-test_x86.exe" src/tests/result-cache-test.cpp
+@cl /EHsc /Fe"bin/tests/state-library-test_x86.exe" src/tests/state-library-test.cpp
+@cl /EHsc /Fe"bin/tests/site-weight-test_x86.exe" src/tests/site-weight-test.cpp
+@cl /EHsc /Fe"bin/tests/macrospin-test_x86.exe" src/tests/macrospin-test.cpp
+@cl /EHsc /Fe"bin/tests/sweep-mode-test_x86.exe" src/tests/sweep-mode-test.cpp
+@cl /EHsc /Fe"bin/tests/site-order-test_x86.exe" src/tests/site-order-test.cpp
+@cl /EHsc /Fe"bin/tests/huge-lattice-test_x86.exe" src/tests/huge-lattice-test.cpp
+@cl /EHsc /Fe"bin/tests/domain-test_x86.exe" src/tests/domain-test.cpp
+@cl /EHsc /Fe"bin/tests/voxel-mask-test_x86.exe" src/tests/voxel-mask-test.cpp
+@cl /EHsc /Fe"bin/tests/periodic-test_x86.exe" src/tests/periodic-test.cpp
 
 
 
 @rem Remove .obj file
 @del test-setLocalM.obj
+@del cluster-test.obj
+@del overrelax-test.obj
+@del heatbath-test.obj
+@del cone-test.obj
+@del nfoldway-test.obj
+@del wang-landau-test.obj
+@del reweight-test.obj
+@del coupling-test.obj
+@del population-annealing-test.obj
+@del batch-test.obj
+@del ising-test.obj
+@del schedule-test.obj
+@del replicas-test.obj
+@del adaptive-field-test.obj
+@del sweep-design-test.obj
+@del result-cache-test.obj
+@del state-library-test.obj
+@del site-weight-test.obj
+@del macrospin-test.obj
+@del sweep-mode-test.obj
+@del site-order-test.obj
+@del huge-lattice-test.obj
+@del domain-test.obj
+@del voxel-mask-test.obj
+@del periodic-test.obj
 
 
 @rem End of file
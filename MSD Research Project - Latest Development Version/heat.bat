@@ -1,7 +1,10 @@
 @rem /** ---- Docs ----
-@rem  * model=CONTINUOUS_SPIN_MODEL|UP_DOWN_MODEL
+@rem  * model=CONTINUOUS_SPIN_MODEL|UP_DOWN_MODEL|HEAT_BATH_MODEL|CONE_MODEL
 @rem  * reset=noop|reinitialize|randomize
 @rem  * mol_type=LINEAR|CIRCULAR|__PATH__.mmb
+@rem  * cache=none|__PATH__   (result cache file: reruns of the same parameters are loaded from it)
+@rem  * cache_mb=0|<MB>       (size limit of the cache; 0 for none)
+@rem  * library=none|__PATH__ (state library file: runs start from the nearest equilibrated state in it)
 @rem  */
 
 
@@ -9,6 +12,9 @@
 @set model=CONTINUOUS_SPIN_MODEL
 @set reset=noop
 @set mol_type=LINEAR
+@set cache=none
+@set cache_mb=0
+@set library=none
 
 @set out_head=heat
 
@@ -35,6 +41,9 @@
 @cd "%projDir%"
 :STAY
 
+@set warm=
+@if not "%library%" == "none" set warm=--warm-start-from-library "%library%"
+
 @rem -- Find the next open file name
 @set prgm=heat
 @set id=0
@@ -48,7 +57,7 @@
 @date /t
 @time /t
 @echo ----------------------------------------
-bin\%prgm% %out_file% %model% %reset% %mol_type%
+bin\%prgm% %out_file% %model% %reset% %mol_type% %cache% %cache_mb% %warm%
 @echo ----------------------------------------
 @date /t
 @time /t
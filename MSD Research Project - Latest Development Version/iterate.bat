@@ -1,8 +1,11 @@
 @rem /** ---- Docs ----
-@rem  * model=CONTINUOUS_SPIN_MODEL|UP_DOWN_MODEL
+@rem  * model=CONTINUOUS_SPIN_MODEL|UP_DOWN_MODEL|HEAT_BATH_MODEL|CONE_MODEL
 @rem  * mol_type=LINEAR|CIRCULAR|__PATH__.mmb
 @rem  * randomize=0|1
 @rem  * seed=unique|<uint64>
+@rem  * cache=none|__PATH__   (result cache file: reruns of the same parameters are loaded from it)
+@rem  * cache_mb=0|<MB>       (size limit of the cache; 0 for none)
+@rem  * library=none|__PATH__ (state library file: runs start from the nearest equilibrated state in it)
 @rem  */
 
 
@@ -11,6 +14,9 @@
 @set mol_type=LINEAR
 @set randomize=1
 @set seed=unique
+@set cache=none
+@set cache_mb=0
+@set library=none
 
 @set input_file=parameters-iterate.txt
 @set out_head=iteration
@@ -38,6 +44,9 @@
 @cd "%projDir%"
 :STAY
 
+@set warm=
+@if not "%library%" == "none" set warm=--warm-start-from-library "%library%"
+
 @rem -- Find the next open file name
 @set prgm=iterate
 @set id=0
@@ -51,7 +60,7 @@
 @date /t
 @time /t
 @echo ----------------------------------------
-bin\%prgm% %out_file% %model% %mol_type% %randomize% %seed% %input_file%
+bin\%prgm% %out_file% %model% %mol_type% %randomize% %seed% %input_file% %cache% %cache_mb% %warm%
 @echo ----------------------------------------
 @date /t
 @time /t
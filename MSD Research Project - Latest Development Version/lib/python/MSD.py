@@ -518,6 +518,61 @@ class Molecule:
 
 		return mmt
 
+class ResultCache:
+	'''
+	A persistent, on-disk cache of simulation results (see: ResultCache.h).
+	Pass it to MSD.metropolis or MSD.nFoldWay to load a run that was already done
+	(with the same parameters, state, and arguments) instead of simulating it again.
+	'''
+
+	def __init__(self, path, maxMB = 0):
+		'''
+		Open (or create) the cache file at path.
+		If maxMB > 0, the least recently used results are evicted to keep the cache under maxMB megabytes.
+		'''
+		self._cache: c_void_p = msd_clib.createResultCache(os.fsencode(path), int(maxMB * 1024 * 1024))
+		if not self._cache:
+			raise OSError(f"Not a result cache, or can't be created: {path}")
+
+	def __del__(self):
+		if self._cache:
+			msd_clib.destroyResultCache(self._cache)
+
+	def flush(self):
+		''' Rewrite the cache file with only the cached results '''
+		if not msd_clib.flushResultCache(self._cache):
+			raise OSError("Couldn't rewrite the cache file")
+
+	hits = property(fget = lambda self: msd_clib.getCacheHits(self._cache))
+	misses = property(fget = lambda self: msd_clib.getCacheMisses(self._cache))
+	def __len__(self): return msd_clib.getCacheSize(self._cache)
+
+
+class StateLibrary:
+	'''
+	A persistent, on-disk library of equilibrated states (see: StateLibrary.h).
+	Store states with MSD.storeState, and start new runs from the nearest one
+	(in parameter space) with MSD.warmStart instead of MSD.reinitialize or MSD.randomize.
+	'''
+
+	def __init__(self, path):
+		''' Open (or create) the library file at path. '''
+		self._library: c_void_p = msd_clib.createStateLibrary(os.fsencode(path))
+		if not self._library:
+			raise OSError(f"Not a state library, or can't be created: {path}")
+
+	def __del__(self):
+		if self._library:
+			msd_clib.destroyStateLibrary(self._library)
+
+	def flush(self):
+		''' Rewrite the library file without the replaced states '''
+		if not msd_clib.flushStateLibrary(self._library):
+			raise OSError("Couldn't rewrite the library file")
+
+	def __len__(self): return msd_clib.getLibrarySize(self._library)
+
+
 class MSD:
 
 	# static typedef
@@ -529,6 +584,17 @@ class MSD:
 
 	UP_DOWN_MODEL = c_void_p.in_dll(msd_clib, "UP_DOWN_MODEL")
 	CONTINUOUS_SPIN_MODEL = c_void_p.in_dll(msd_clib, "CONTINUOUS_SPIN_MODEL")
+	HEAT_BATH_MODEL = c_void_p.in_dll(msd_clib, "HEAT_BATH_MODEL")
+	CONE_MODEL = c_void_p.in_dll(msd_clib, "CONE_MODEL")
+
+	# MSD::SweepMode
+	RANDOM_SITE, TYPEWRITER, CHECKERBOARD, RANDOM_PERMUTATION, BLOCKED = range(5)
+
+	# MSD::SiteOrder
+	ROW_MAJOR, MORTON, HILBERT, COMPACT = range(4)
+
+	# MSD::PeriodicAxes (combined with |)
+	OPEN, PERIODIC_X, PERIODIC_Y, PERIODIC_Z = 0, 1, 2, 4
 
 
 	# inner classes
@@ -750,10 +816,25 @@ class MSD:
 		else:
 			self._msd = msd_clib.createMSD_i(width, height, depth, molPosL, molPosR, topL, bottomL, frontR, backR)
 		
+		self._seeded = False  # was the seed given? (only then is it part of a ResultCache key)
+
 		# get iterators at construction because msd dimensions are immutable
 		self._begin = msd_clib.createBeginMSDIter(self._msd)
 		self._end = msd_clib.createEndMSDIter(self._msd)
 
+	@classmethod
+	def fromVoxelMask(cls, path, molType: Optional[c_void_p] = None, siteOrder = 3):
+		''' MSD of any shape, from a voxel mask file (see: MSD::VoxelMask). COMPACT (3) siteOrder by default. '''
+		msd = msd_clib.createMSD_m(os.fsencode(path), molType, siteOrder)
+		if not msd:
+			raise ValueError(f"Not a valid voxel mask, or can't be read: {path}")
+		self = cls.__new__(cls)
+		self._msd = msd
+		self._seeded = False
+		self._begin = msd_clib.createBeginMSDIter(self._msd)
+		self._end = msd_clib.createEndMSDIter(self._msd)
+		return self
+
 	def __del__(self):
 		msd_clib.destroyMSDIter(self._end)
 		msd_clib.destroyMSDIter(self._begin)
@@ -872,6 +953,58 @@ class MSD:
 		else:
 			msd_clib.setLocalM_v(self._msd, x, y, z, spin, flux)
 	
+	def getSiteWeight(self, x, y = None, z = None):
+		if y is None:
+			return msd_clib.getSiteWeight_i(self._msd, x)
+		return msd_clib.getSiteWeight_v(self._msd, x, y, z)
+	
+	def setSiteWeight(self, x, y = None, z = None, weight = None):
+		'''
+		Version 1: setSiteWeight(a, weight)
+		Version 2: setSiteWeight(x, y, z, weight)
+		
+		Relative probability of picking the atom for a metropolis step (1 by default). 0 freezes it.
+		'''
+		if weight is None:
+			if y is None:
+				raise ArgumentError("weight must be passed as second positional argument, or as named parameter")
+			weight = y
+		
+		if z is None:
+			msd_clib.setSiteWeight_i(self._msd, x, weight)
+		else:
+			msd_clib.setSiteWeight_v(self._msd, x, y, z, weight)
+	
+	def setRegionWeights(self, weightL = 1, weightR = 1, weight_m = 1):
+		msd_clib.setRegionWeights(self._msd, weightL, weightR, weight_m)
+	
+	skipZeroSpins = property(
+		fget = lambda self: msd_clib.getSkipZeroSpins(self._msd),
+		fset = lambda self, skip: msd_clib.setSkipZeroSpins(self._msd, skip)
+		)
+	
+	# memory layout (see: MSD::setSiteOrder); indices from before a change are no longer valid
+	siteOrder = property(
+		fget = lambda self: msd_clib.getSiteOrder(self._msd),
+		fset = lambda self, order: msd_clib.setSiteOrder(self._msd, order)
+		)
+	capacity = property(fget = lambda self: msd_clib.getCapacity(self._msd))
+	
+	# bytes an MSD with this geometry and siteOrder would allocate (see: MSD::estimateMemory)
+	@staticmethod
+	def estimateMemory(width, height, depth, molPosL, molPosR, topL, bottomL, frontR, backR, siteOrder = 0):
+		return msd_clib.estimateMemory(width, height, depth, molPosL, molPosR, topL, bottomL, frontR, backR, siteOrder)
+
+	def hasAtom(self, x, y, z): return msd_clib.hasAtom(self._msd, x, y, z)
+	hasVoxelMask = property(fget = lambda self: msd_clib.hasVoxelMask(self._msd))
+
+	# periodic boundaries of FM_L and FM_R (see: MSD::setPeriodic)
+	def setPeriodic(self, axesL, axesR):
+		if not msd_clib.setPeriodic(self._msd, axesL, axesR):
+			raise ValueError(f"Periodic axes not allowed: {axesL}, {axesR}")
+	periodicL = property(fget = lambda self: msd_clib.getPeriodicL(self._msd))
+	periodicR = property(fget = lambda self: msd_clib.getPeriodicR(self._msd))
+	
 	def __getitem__(self, idx):
 		if isinstance(idx, Iterable):
 			return (self.getSpin(*idx), self.getFlux(*idx))
@@ -907,19 +1040,95 @@ class MSD:
 	mol_exists = property(fget = lambda self: msd_clib.getMol_exists(self._msd))
 	regions = property(fget = lambda self: _tupler(msd_clib.getRegions, self._msd, 3 * [c_bool]))
 
+	def setSeed(self, seed):
+		msd_clib.setSeed(self._msd, seed)
+		self._seeded = True
+
 	seed = property(
 		fget = lambda self : msd_clib.getSeed(self._msd),
-		fset = lambda self, seed: msd_clib.setSeed(self._msd, seed)
+		fset = setSeed
+		)
+
+	def reinitialize(self, reseed = True):
+		msd_clib.reinitialize(self._msd, reseed)
+		self._seeded = self._seeded and not reseed
+
+	def randomize(self, reseed = True):
+		msd_clib.randomize(self._msd, reseed)
+		self._seeded = self._seeded and not reseed
+
+	def storeState(self, library: StateLibrary):
+		''' Store the current (e.g. just equilibrated) state in the library '''
+		if not msd_clib.storeState(library._library, self._msd):
+			raise OSError("Couldn't write to the library file")
+
+	def warmStart(self, library: StateLibrary):
+		'''
+		Start from the nearest state in the library with the same geometry, molecule, and model (see: StateLibrary.h).
+		Returns its distance in parameter space, or None (leaving this MSD unchanged) if there's no such state.
+		'''
+		distance = c_double()
+		if msd_clib.warmStart(library._library, self._msd, byref(distance)):
+			return distance.value
+		return None
+
+	def _cached(self, cache: Optional[ResultCache], run: str, simulate):
+		'''
+		Call simulate(), unless the cache has its results (by the parameters and state of this MSD,
+		the run description, and the seed if it was given), which are then loaded instead.
+		Returns True iff the results were loaded from the cache.
+		'''
+		if cache is None:
+			simulate()
+			return False
+		key = msd_clib.resultKey(self._msd, run.encode(), self._seeded)
+		if msd_clib.loadResult(cache._cache, key, self._msd):
+			return True
+		recordFrom = msd_clib.getRecordSize(self._msd)
+		simulate()
+		msd_clib.storeResult(cache._cache, key, self._msd, recordFrom)
+		return False
+
+	def metropolis(self, N, freq = None, cache: Optional[ResultCache] = None):
+		''' Returns True iff the results were loaded from the given cache (see: ResultCache) '''
+		if freq is None:
+			return self._cached(cache, f"metropolis,N={N}", lambda: msd_clib.metropolis_o(self._msd, N))
+		else:
+			return self._cached(cache, f"metropolis,N={N},freq={freq}", lambda: msd_clib.metropolis_r(self._msd, N, freq))
+
+	def sweep(self, sweeps, freq = None, cache: Optional[ResultCache] = None):
+		''' metropolis, with sweeps and freq counted in sweeps (see: sweepLength). Returns True iff the results were loaded from the given cache '''
+		if freq is None:
+			return self._cached(cache, f"sweep,sweeps={sweeps}", lambda: msd_clib.sweep_o(self._msd, sweeps))
+		else:
+			return self._cached(cache, f"sweep,sweeps={sweeps},freq={freq}", lambda: msd_clib.sweep_r(self._msd, sweeps, freq))
+
+	sweepLength = property(fget = lambda self: msd_clib.sweepLength(self._msd))
+	sweeps = property(fget = lambda self: msd_clib.getSweeps(self._msd))
+	sweepMode = property(
+		fget = lambda self: msd_clib.getSweepMode(self._msd),
+		fset = lambda self, mode: msd_clib.setSweepMode(self._msd, mode)
+		)
+	blockSize = property(
+		fget = lambda self: msd_clib.getBlockSize(self._msd),
+		fset = lambda self, size: msd_clib.setBlockSize(self._msd, size)
 		)
 
-	def reinitialize(self, reseed = True): msd_clib.reinitialize(self._msd, reseed)
-	def randomize(self, reseed = True): msd_clib.randomize(self._msd, reseed)
+	def tuneProposals(self, N, targetRate = 0.5): msd_clib.tuneProposals(self._msd, N, targetRate)
 
-	def metropolis(self, N, freq = None):
+	def nFoldWay(self, N, freq = None, cache: Optional[ResultCache] = None):
+		''' Returns True iff the results were loaded from the given cache (see: ResultCache) '''
 		if freq is None:
-			msd_clib.metropolis_o(self._msd, N)
+			return self._cached(cache, f"nFoldWay,N={N}", lambda: msd_clib.nFoldWay_o(self._msd, N))
 		else:
-			msd_clib.metropolis_r(self._msd, N, freq)
+			return self._cached(cache, f"nFoldWay,N={N},freq={freq}", lambda: msd_clib.nFoldWay_r(self._msd, N, freq))
+
+	proposalSteps = property(
+		fget = lambda self: _tupler(msd_clib.getProposalSteps, self._msd, 3 * [c_double]),
+		fset = lambda self, steps: msd_clib.setProposalSteps(self._msd, *steps)
+		)
+	acceptanceRates = property(fget = lambda self: _tupler(msd_clib.getAcceptanceRates, self._msd, 3 * [c_double]))
+	def resetAcceptanceStats(self): msd_clib.resetAcceptanceStats(self._msd)
 	
 	specificHeat = property(fget = lambda self : msd_clib.specificHeat(self._msd))
 	specificHeat_L = property(fget = lambda self : msd_clib.specificHeat_L(self._msd))
@@ -966,6 +1175,7 @@ _sig(c_void_p, msd_clib.createMSD_f, 3 * [c_uint] + [c_void_p] + 6 * [c_uint])
 _sig(c_void_p, msd_clib.createMSD_i, 9 * [c_uint])
 _sig(c_void_p, msd_clib.createMSD_c, 5 * [c_uint])
 _sig(c_void_p, msd_clib.createMSD_d, 3 * [c_uint])
+_sig(c_void_p, msd_clib.createMSD_m, [c_char_p, c_void_p, c_uint])
 _sig(None, msd_clib.destroyMSD, [c_void_p])
 
 _sig(POINTER(MSD.Results), msd_clib.getRecord, [c_void_p])  # returns c-array
@@ -997,6 +1207,23 @@ _sig(None, msd_clib.setFlux_v, [c_void_p] + 3 * [c_uint] + [POINTER(Vector)])
 _sig(None, msd_clib.setLocalM_i, [c_void_p, c_uint] + 2 * [POINTER(Vector)])
 _sig(None, msd_clib.setLocalM_v, [c_void_p] + 3 * [c_uint] + 2 * [POINTER(Vector)])
 
+_sig(c_double, msd_clib.getSiteWeight_i, [c_void_p, c_uint])
+_sig(c_double, msd_clib.getSiteWeight_v, [c_void_p] + 3 * [c_uint])
+_sig(None, msd_clib.setSiteWeight_i, [c_void_p, c_uint, c_double])
+_sig(None, msd_clib.setSiteWeight_v, [c_void_p] + 3 * [c_uint] + [c_double])
+_sig(None, msd_clib.setRegionWeights, [c_void_p] + 3 * [c_double])
+_sig(c_bool, msd_clib.getSkipZeroSpins, [c_void_p])
+_sig(None, msd_clib.setSkipZeroSpins, [c_void_p, c_bool])
+_sig(c_uint, msd_clib.getSiteOrder, [c_void_p])
+_sig(None, msd_clib.setSiteOrder, [c_void_p, c_uint])
+_sig(c_uint, msd_clib.getCapacity, [c_void_p])
+_sig(c_ulonglong, msd_clib.estimateMemory, 10 * [c_uint])
+_sig(c_bool, msd_clib.hasAtom, [c_void_p] + 3 * [c_uint])
+_sig(c_bool, msd_clib.hasVoxelMask, [c_void_p])
+_sig(c_bool, msd_clib.setPeriodic, [c_void_p, c_uint, c_uint])
+_sig(c_uint, msd_clib.getPeriodicL, [c_void_p])
+_sig(c_uint, msd_clib.getPeriodicR, [c_void_p])
+
 _sig(c_uint, msd_clib.getN, [c_void_p])
 _sig(c_uint, msd_clib.getNL, [c_void_p])
 _sig(c_uint, msd_clib.getNR, [c_void_p])
@@ -1028,6 +1255,38 @@ _sig(None, msd_clib.reinitialize, [c_void_p, c_bool])
 _sig(None, msd_clib.randomize, [c_void_p, c_bool])
 _sig(None, msd_clib.metropolis_o, [c_void_p, c_ulonglong])
 _sig(None, msd_clib.metropolis_r, [c_void_p] + 2 * [c_ulonglong])
+_sig(None, msd_clib.sweep_o, [c_void_p, c_ulonglong])
+_sig(None, msd_clib.sweep_r, [c_void_p] + 2 * [c_ulonglong])
+_sig(c_ulonglong, msd_clib.sweepLength, [c_void_p])
+_sig(c_double, msd_clib.getSweeps, [c_void_p])
+_sig(c_uint, msd_clib.getSweepMode, [c_void_p])
+_sig(None, msd_clib.setSweepMode, [c_void_p, c_uint])
+_sig(c_uint, msd_clib.getBlockSize, [c_void_p])
+_sig(None, msd_clib.setBlockSize, [c_void_p, c_uint])
+_sig(None, msd_clib.tuneProposals, [c_void_p, c_ulonglong, c_double])
+_sig(None, msd_clib.nFoldWay_o, [c_void_p, c_ulonglong])
+_sig(None, msd_clib.nFoldWay_r, [c_void_p] + 2 * [c_ulonglong])
+_sig(None, msd_clib.getProposalSteps, [c_void_p] + 3 * [POINTER(c_double)])
+_sig(None, msd_clib.setProposalSteps, [c_void_p] + 3 * [c_double])
+_sig(None, msd_clib.getAcceptanceRates, [c_void_p] + 3 * [POINTER(c_double)])
+_sig(None, msd_clib.resetAcceptanceStats, [c_void_p])
+
+_sig(c_void_p, msd_clib.createResultCache, [c_char_p, c_ulonglong])
+_sig(None, msd_clib.destroyResultCache, [c_void_p])
+_sig(c_bool, msd_clib.flushResultCache, [c_void_p])
+_sig(c_ulonglong, msd_clib.getCacheHits, [c_void_p])
+_sig(c_ulonglong, msd_clib.getCacheMisses, [c_void_p])
+_sig(c_size_t, msd_clib.getCacheSize, [c_void_p])
+_sig(c_ulonglong, msd_clib.resultKey, [c_void_p, c_char_p, c_bool])
+_sig(c_bool, msd_clib.loadResult, [c_void_p, c_ulonglong, c_void_p])
+_sig(c_bool, msd_clib.storeResult, [c_void_p, c_ulonglong, c_void_p, c_size_t])
+
+_sig(c_void_p, msd_clib.createStateLibrary, [c_char_p])
+_sig(None, msd_clib.destroyStateLibrary, [c_void_p])
+_sig(c_bool, msd_clib.flushStateLibrary, [c_void_p])
+_sig(c_size_t, msd_clib.getLibrarySize, [c_void_p])
+_sig(c_bool, msd_clib.storeState, [c_void_p, c_void_p])
+_sig(c_bool, msd_clib.warmStart, [c_void_p, c_void_p, POINTER(c_double)])
 
 _sig(c_double, msd_clib.specificHeat, [c_void_p])
 _sig(c_double, msd_clib.specificHeat_L, [c_void_p])
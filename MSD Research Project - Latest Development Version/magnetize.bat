@@ -1,7 +1,10 @@
 @rem /** ---- Docs ----
-@rem  * model=CONTINUOUS_SPIN_MODEL|UP_DOWN_MODEL
+@rem  * model=CONTINUOUS_SPIN_MODEL|UP_DOWN_MODEL|HEAT_BATH_MODEL|CONE_MODEL
 @rem  * reset=noop|reinitialize|randomize
 @rem  * mol_type=LINEAR|CIRCULAR|__PATH__.mmb
+@rem  * replicas=1|2|...
+@rem  * start=fork|independent
+@rem  * steps=uniform|adaptive  (adaptive asks for B_inc_min, B_inc_max, dm, and budget (0 for default) after B_phi)
 @rem  */
 
 
@@ -9,6 +12,9 @@
 @set model=CONTINUOUS_SPIN_MODEL
 @set reset=noop
 @set mol_type=LINEAR
+@set replicas=1
+@set start=fork
+@set steps=uniform
 
 @set out_head=magnetization
 
@@ -48,7 +54,7 @@
 @date /t
 @time /t
 @echo ----------------------------------------
-bin\%prgm% %out_file% %model% %reset% %mol_type%
+bin\%prgm% %out_file% %model% %reset% %mol_type% %replicas% %start% %steps%
 @echo ----------------------------------------
 @date /t
 @time /t
@@ -1,8 +1,10 @@
 @rem /** ---- Docs ----
-@rem  * model=CONTINUOUS_SPIN_MODEL|UP_DOWN_MODEL
+@rem  * model=CONTINUOUS_SPIN_MODEL|UP_DOWN_MODEL|HEAT_BATH_MODEL|CONE_MODEL
 @rem  * randomize=0|1
 @rem  * startAtMaxB=0|1
 @rem  * mol_type=LINEAR|CIRCULAR|__PATH__.mmb
+@rem  * replicas=1|2|...
+@rem  * start=fork|independent
 @rem  */
 
 @rem // ---- Edit Here ----
@@ -10,6 +12,8 @@
 @set randomize=0
 @set startAtMaxB=0
 @set mol_type=LINEAR
+@set replicas=1
+@set start=fork
 
 @set out_head=magnetization2
 
@@ -49,7 +53,7 @@
 @date /t
 @time /t
 @echo ----------------------------------------
-bin\%prgm% %out_file% %model% %randomize% %startAtMaxB% %mol_type%
+bin\%prgm% %out_file% %model% %randomize% %startAtMaxB% %mol_type% %replicas% %start%
 @echo ----------------------------------------
 @date /t
 @time /t
@@ -1,8 +1,9 @@
 @rem /** ---- Docs ----
-@rem  * model=CONTINUOUS_SPIN_MODEL|UP_DOWN_MODEL
+@rem  * model=CONTINUOUS_SPIN_MODEL|UP_DOWN_MODEL|HEAT_BATH_MODEL|CONE_MODEL
 @rem  * mode=RANDOMIZE|REINITIALIZE
 @rem  * mol_type=LINEAR|CIRCULAR|__PATH__.mmb
 @rem  * threadCount=<uint32 >= 1>
+@rem  * library=none|__PATH__ (state library file: runs start from the nearest equilibrated state in it)
 @rem  */
 
 
@@ -11,6 +12,7 @@
 @set mode=RANDOMIZE
 @set mol_type=LINEAR
 @set threadCount=3
+@set library=none
 
 @set paramFile=parameters-metropolis.txt
 @set out_head=metropolis
@@ -18,6 +20,9 @@
 
 
 @rem ------ Don't Edit Below This ------
+@set warm=
+@if not "%library%" == "none" set warm=--warm-start-from-library "%library%"
+
 @rem -- Find the next open file name
 @set prgm=metropolis
 @set id=0
@@ -30,7 +35,7 @@
 @date /t
 @time /t
 @echo ----------------------------------------
-bin\%prgm% %paramFile% %out_file% %model% %mode% %mol_type% %threadCount%
+bin\%prgm% %paramFile% %out_file% %model% %mode% %mol_type% %threadCount% %warm%
 @echo ----------------------------------------
 @date /t
 @time /t
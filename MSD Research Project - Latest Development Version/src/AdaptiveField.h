@@ -0,0 +1,227 @@
+#ifndef UDC_ADAPTIVE_FIELD
+#define UDC_ADAPTIVE_FIELD
+
+#include <algorithm>
+#include <cmath>
+#include <functional>
+#include <stdexcept>
+#include <vector>
+#include "MSD.h"
+
+namespace udc {
+
+/*
+ * A hysteresis sweep like MSD::Schedule::fieldSteps (|B| from B_max down to B_min, then back up to B_max, with an
+ * equilibration stage of t_eq steps and a recorded stage of simCount steps at each field), but with a step in |B|
+ * that adapts to the loop: small where the magnetization switches, and large on the plateaus.
+ *
+ * After each field, m = <M> * axis / n (the mean magnetization per atom along the field) is compared to m at the
+ * last field. The change, less its noise (2 standard errors, by batch means over the record), is the error, e (or
+ * the standard error itself, if that's larger: M drifting during the record, e.g. while switching, is an error too):
+ *  - if e > 2 * dm and the step is larger than stepMin, the field is rejected: the state from before it is restored,
+ *    and it's retried with a smaller step;
+ *  - otherwise, it's accepted, and the next step is scaled by about dm / e (by a factor from 1/4 to 2).
+ * Steps are kept within [stepMin, stepMax], and end exactly at B_min and B_max.
+ *
+ * Every field (including rejected ones) costs t_eq + simCount steps from the budget, and each branch gets half of
+ * it (plus what the down branch didn't use). Fields are only rejected if the rest of the branch would still fit, and
+ * when the budget is short, the step is increased so the rest of the branch still fits (up to stepMax; if it still
+ * doesn't fit, the sweep stops early, and isComplete() is false).
+ */
+class AdaptiveFieldSweep {
+ public:
+	struct Point {
+		double rho;  // |B| (signed, along the axis)
+		double m, mError;  // mean magnetization per atom along the axis, and its standard error
+		bool down;  // on the branch where |B| is decreasing
+		unsigned int rejected;  // fields rejected before this one was accepted
+	};
+
+	double stepMin, stepMax;  // (default: step / 16, and step * 4)
+	double dm;  // tolerance for the change in m between fields (default: 0.05)
+	unsigned long long budget;  // total metropolis steps (default: as many as fieldSteps would use with the initial step)
+	std::function<void(const MSD &, const Point &)> onPoint;  // optional: after each accepted field (with its record)
+
+	AdaptiveFieldSweep(double B_min, double B_max, double step, double theta, double phi, double kT,
+			unsigned long long t_eq, unsigned long long simCount, unsigned long long freq,
+			MSD::Schedule::Reset reset = MSD::Schedule::NOOP);
+
+	void run(MSD &msd);
+
+	const std::vector<Point> & getPoints() const;  // accepted fields, in order
+	unsigned long long getSteps() const;  // metropolis steps used by the last run
+	unsigned int getRejected() const;  // fields rejected in the last run
+	bool isComplete() const;  // did the last run reach the end of the loop within the budget?
+
+ private:
+	double B_min, B_max, step, theta, phi, kT;
+	unsigned long long t_eq, simCount, freq;
+	MSD::Schedule::Reset reset;
+	std::vector<Point> points;
+	unsigned long long used;
+	unsigned int rejected;
+	bool complete;
+
+	void measure(const MSD &msd, const Vector &axis, double &m, double &mError) const;
+};
+
+
+AdaptiveFieldSweep::AdaptiveFieldSweep(double B_min, double B_max, double step, double theta, double phi, double kT,
+		unsigned long long t_eq, unsigned long long simCount, unsigned long long freq, MSD::Schedule::Reset reset)
+	: stepMin(step / 16), stepMax(step * 4), dm(0.05), B_min(B_min), B_max(B_max), step(step), theta(theta),
+	  phi(phi), kT(kT), t_eq(t_eq), simCount(simCount), freq(freq), reset(reset), used(0), rejected(0), complete(false)
+{
+	if( !(step > 0) )
+		throw std::invalid_argument("AdaptiveFieldSweep: step <= 0");
+	if( !(B_min < B_max) )
+		throw std::invalid_argument("AdaptiveFieldSweep: B_min >= B_max");
+	unsigned long long fields = 2 * static_cast<unsigned long long>(std::ceil((B_max - B_min) / step)) + 1;
+	budget = fields * (t_eq + simCount);
+}
+
+void AdaptiveFieldSweep::measure(const MSD &msd, const Vector &axis, double &m, double &mError) const {
+	const std::vector<MSD::Results> &record = msd.record;
+	const double n = msd.getN();
+	m = mError = 0;
+	if( record.empty() )
+		return;
+	// batch means, so that correlated records don't make the error look too small
+	const size_t B = std::min<size_t>(8, record.size());
+	std::vector<double> batch(B, 0);
+	std::vector<size_t> count(B, 0);
+	for( size_t i = 0; i < record.size(); i++ ) {
+		size_t b = i * B / record.size();
+		batch[b] += record[i].M * axis / n;
+		count[b]++;
+	}
+	for( size_t b = 0; b < B; b++ ) {
+		batch[b] /= count[b];
+		m += batch[b];
+	}
+	m /= B;
+	if( B > 1 ) {
+		double sum2 = 0;
+		for( double x : batch )
+			sum2 += (x - m) * (x - m);
+		mError = std::sqrt(sum2 / (B - 1) / B);
+	}
+}
+
+void AdaptiveFieldSweep::run(MSD &msd) {
+	if( !(stepMin > 0) || stepMin > stepMax )
+		throw std::invalid_argument("AdaptiveFieldSweep: requires 0 < stepMin <= stepMax");
+	const Vector axis = Vector::sphericalForm(1, theta, phi);
+	const unsigned long long cost = t_eq + simCount;
+	// each branch gets half of the budget (and the up branch also gets what the down branch didn't use)
+	auto left = [&](bool down) {
+		unsigned long long limit = down ? budget / 2 : budget;
+		return used < limit ? limit - used : 0;
+	};
+	points.clear();
+	used = 0;
+	rejected = 0;
+	complete = false;
+
+	std::vector<Vector> spins, fluxes;  // state before the current field
+	double h = std::min(std::max(step, stepMin), stepMax);
+	double rho = B_max;
+	bool down = true;
+	unsigned int tries = 0;
+	while( true ) {
+		if( used + cost > budget )
+			return;  // out of budget
+		if( !points.empty() ) {
+			// save the state, in case this field is rejected
+			spins.clear();
+			fluxes.clear();
+			for( auto iter = msd.begin(); iter != msd.end(); ++iter ) {
+				spins.push_back(iter.getSpin());
+				fluxes.push_back(iter.getFlux());
+			}
+		}
+
+		MSD::Schedule s;
+		s.hold(t_eq, kT, rho * axis);
+		s.stages.back().reset = reset;
+		s.stages.back().clearRecord = true;
+		s.hold(simCount, kT, rho * axis, freq);
+		msd.run(s);
+		used += cost;
+
+		Point pt;
+		pt.rho = rho;
+		pt.down = down;
+		pt.rejected = tries;
+		measure(msd, axis, pt.m, pt.mError);
+
+		double e = 0;  // error of this step
+		double last = 0;  // size of this step
+		if( !points.empty() ) {
+			const Point &prev = points.back();
+			double noise = 2 * std::sqrt(pt.mError * pt.mError + prev.mError * prev.mError);
+			e = std::max(std::abs(pt.m - prev.m) - noise, pt.mError);  // (M drifting during the record is an error too)
+			last = std::abs(rho - prev.rho);
+			// the retry, and then the rest of the branch (from prev) at stepMax, must still fit in its budget
+			double remaining = down ? prev.rho - B_min : B_max - prev.rho;
+			unsigned long long fields = static_cast<unsigned long long>(std::ceil(remaining / stepMax - 1e-9)) + 1;
+			bool affordable = fields * cost <= left(down);
+			if( e > 2 * dm && last > stepMin * (1 + 1e-9) && affordable ) {
+				// reject: restore the last state, and retry with a smaller step
+				size_t i = 0;
+				for( auto iter = msd.begin(); iter != msd.end(); ++iter, ++i )
+					msd.setLocalM(iter.getIndex(), spins[i], fluxes[i]);
+				rejected++;
+				tries++;
+				h = std::max(stepMin, last * std::max(0.25, 0.9 * dm / e));
+				rho = down ? std::max(B_min, prev.rho - h) : std::min(B_max, prev.rho + h);
+				continue;
+			}
+		}
+		points.push_back(pt);
+		tries = 0;
+		if( onPoint )
+			onPoint(msd, pt);
+		if( !down && rho >= B_max )
+			break;
+
+		// ----- next step -----
+		if( last > 0 )
+			h = last * (e > 0 ? std::min(2.0, std::max(0.25, 0.9 * dm / e)) : 2.0);
+		if( down && rho <= B_min )
+			down = false;
+		double dist = down ? rho - B_min : B_max - rho;
+		unsigned long long affordable = left(down) / cost;
+		if( affordable > 0 )
+			h = std::max(h, dist / affordable);
+		h = std::min(std::max(h, stepMin), stepMax);
+		// don't leave a short step at the end of a branch
+		if( dist <= stepMax && dist < 1.5 * h )
+			h = dist;
+		else if( dist - h < stepMin )
+			h = dist / 2;
+		rho = down ? rho - h : rho + h;
+		if( dist == h )
+			rho = down ? B_min : B_max;
+	}
+	complete = true;
+}
+
+const std::vector<AdaptiveFieldSweep::Point> & AdaptiveFieldSweep::getPoints() const {
+	return points;
+}
+
+unsigned long long AdaptiveFieldSweep::getSteps() const {
+	return used;
+}
+
+unsigned int AdaptiveFieldSweep::getRejected() const {
+	return rejected;
+}
+
+bool AdaptiveFieldSweep::isComplete() const {
+	return complete;
+}
+
+}  // end of namespace udc
+
+#endif
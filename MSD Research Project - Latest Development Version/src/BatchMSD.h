@@ -0,0 +1,297 @@
+#ifndef UDC_BATCH_MSD
+#define UDC_BATCH_MSD
+
+#include <cmath>
+#include <functional>
+#include <random>
+#include <stdexcept>
+#include <vector>
+#include "MSD.h"
+#include "MSDGraph.h"
+
+namespace udc {
+
+/*
+ * K replicas of the same MSD (geometry, molecule, and couplings), simulated in lockstep.
+ *
+ * The MSD is flattened into a list of sites and bonds (see: MSDGraph), which all replicas share. The spins and
+ * fluxes are stored site-major, replica-minor (e.g. sx[a * K + k] is the x-component of the spin of site a in
+ * replica k), so every metropolis step picks one site and updates it in all K replicas at once: the energy change
+ * of each bond is computed by a loop over the K replicas of contiguous memory, which the compiler can vectorize
+ * (e.g. /O2 /arch:AVX2, or -O3 -march=native).
+ *
+ * Each replica has its own prng (for its proposals and acceptance), kT, and B. All replicas visit the same sequence
+ * of sites, which doesn't bias any one of them; it only means a site is never updated in some replicas but not
+ * others. Only CONTINUOUS_SPIN_MODEL and UP_DOWN_MODEL are supported.
+ */
+class BatchMSD {
+ public:
+	std::vector< std::vector<MSD::Results> > record;  // record[k] is the record of replica k (see: MSD::record)
+
+	BatchMSD(const MSD &msd, unsigned int replicas);  // every replica starts as a copy of msd's current state
+
+	unsigned int getReplicas() const;
+	unsigned int getN() const;  // atoms per replica
+
+	const MSD::Results & getResults(unsigned int k) const;
+	double get_kT(unsigned int k) const;
+	Vector getB(unsigned int k) const;
+	void set_kT(unsigned int k, double kT);
+	void setB(unsigned int k, const Vector &B);
+	void setSeed(unsigned long seed);  // replica k uses seed + k, and the site sequence uses seed + K
+
+	void metropolis(unsigned long long N);  // N steps in every replica
+	void metropolis(unsigned long long N, unsigned long long freq);  // also records every freq steps (see: MSD::metropolis)
+
+	Vector getSpin(unsigned int k, unsigned int a) const;  // a is an MSD index
+	Vector getFlux(unsigned int k, unsigned int a) const;
+	void exportState(unsigned int k, MSD &msd) const;  // copies the spins and fluxes of replica k into msd (of the same geometry)
+
+ private:
+	typedef MSDGraph::Region Region;
+
+	unsigned int K;
+	MSDGraph graph;
+
+	std::vector<double> sx, sy, sz, fx, fy, fz;  // [a * K + k]
+	std::vector<MSD::Results> results;  // [k]
+	std::vector<double> kT;
+	std::vector<Vector> B;
+	bool upDown;
+
+	std::vector<std::mt19937_64> prngs;  // [k]
+	std::mt19937_64 sitePrng;
+	std::uniform_real_distribution<double> rand;
+
+	static void update(MSD::Results &r);  // aggregates (M, MS, MF, U, etc.) from the regional values
+};
+
+
+BatchMSD::BatchMSD(const MSD &msd, unsigned int replicas) : K(replicas), graph(msd), rand(0, 1) {
+	if( K == 0 )
+		throw std::invalid_argument("BatchMSD: requires at least 1 replica");
+	if( msd.flippingAlgorithm.target_type() == MSD::UP_DOWN_MODEL.target_type() )
+		upDown = true;
+	else if( msd.flippingAlgorithm.target_type() == MSD::CONTINUOUS_SPIN_MODEL.target_type() )
+		upDown = false;
+	else
+		throw std::invalid_argument("BatchMSD: only CONTINUOUS_SPIN_MODEL and UP_DOWN_MODEL are supported");
+
+	const MSD::Parameters p = msd.getParameters();
+	const unsigned int n = graph.size();
+	const std::vector<unsigned int> &indices = graph.indices;
+
+	// ----- state -----
+	sx.resize(n * K); sy.resize(n * K); sz.resize(n * K);
+	fx.resize(n * K); fy.resize(n * K); fz.resize(n * K);
+	for( unsigned int a = 0; a < n; a++ ) {
+		Vector s = msd.getSpin(indices[a]), f = msd.getFlux(indices[a]);
+		for( unsigned int k = 0; k < K; k++ ) {
+			size_t i = a * K + k;
+			sx[i] = s.x; sy[i] = s.y; sz[i] = s.z;
+			fx[i] = f.x; fy[i] = f.y; fz[i] = f.z;
+		}
+	}
+	results.assign(K, msd.getResults());
+	kT.assign(K, p.kT);
+	B.assign(K, p.B);
+	record.resize(K);
+	prngs.resize(K);
+	setSeed(msd.getSeed());
+}
+
+void BatchMSD::update(MSD::Results &r) {
+	r.ML = r.MSL + r.MFL;
+	r.MR = r.MSR + r.MFR;
+	r.Mm = r.MSm + r.MFm;
+	r.MS = r.MSL + r.MSR + r.MSm;
+	r.MF = r.MFL + r.MFR + r.MFm;
+	r.M = r.ML + r.MR + r.Mm;
+	r.U = r.UL + r.UR + r.Um + r.UmL + r.UmR + r.ULR;
+}
+
+unsigned int BatchMSD::getReplicas() const {
+	return K;
+}
+
+unsigned int BatchMSD::getN() const {
+	return graph.size();
+}
+
+const MSD::Results & BatchMSD::getResults(unsigned int k) const {
+	return results.at(k);
+}
+
+double BatchMSD::get_kT(unsigned int k) const {
+	return kT.at(k);
+}
+
+Vector BatchMSD::getB(unsigned int k) const {
+	return B.at(k);
+}
+
+void BatchMSD::set_kT(unsigned int k, double kT) {
+	this->kT.at(k) = kT;
+}
+
+// same as MSD::setB
+void BatchMSD::setB(unsigned int k, const Vector &B) {
+	MSD::Results &r = results.at(k);
+	Vector deltaB = B - this->B[k];
+	r.UL -= deltaB * r.ML;
+	r.UR -= deltaB * r.MR;
+	r.Um -= deltaB * r.Mm;
+	update(r);
+	this->B[k] = B;
+}
+
+void BatchMSD::setSeed(unsigned long seed) {
+	for( unsigned int k = 0; k < K; k++ )
+		prngs[k].seed(seed + k);
+	sitePrng.seed(seed + K);
+}
+
+void BatchMSD::metropolis(unsigned long long N) {
+	const unsigned int n = getN();
+	const std::vector<Region> &regions = graph.regions;
+	const std::vector<MSDGraph::Bond> &bonds = graph.bonds;
+	const std::vector<size_t> &bondStart = graph.bondStart;
+	const std::vector<double> &F = graph.F, &Je0 = graph.Je0;
+	const std::vector<Vector> &A = graph.A;
+	// per replica: the proposed state, the change in energy of each region, and the total
+	std::vector<double> nsx(K), nsy(K), nsz(K), nfx(K), nfy(K), nfz(K);
+	std::vector<double> dU[6], dUsum(K);
+	for( auto &d : dU )
+		d.resize(K);
+
+	for( unsigned long long i = 0; i < N; i++ ) {
+		const unsigned int a = static_cast<unsigned int>( rand(sitePrng) * n );
+		const size_t base = a * K;
+
+		// proposals (scalar, since each replica has its own prng)
+		for( unsigned int k = 0; k < K; k++ ) {
+			std::mt19937_64 &prng = prngs[k];
+			Vector s(sx[base + k], sy[base + k], sz[base + k]);
+			if( upDown )
+				s = -s;
+			else
+				s = Vector::sphericalForm( s.norm(), 2 * PI * rand(prng), std::asin(2 * rand(prng) - 1) );
+			Vector f = Vector::sphericalForm( F[a] * rand(prng), 2 * PI * rand(prng), std::asin(2 * rand(prng) - 1) );
+			nsx[k] = s.x; nsy[k] = s.y; nsz[k] = s.z;
+			nfx[k] = f.x; nfy[k] = f.y; nfz[k] = f.z;
+		}
+
+		// local energy: B, A, Je0 (goes to the region of the site)
+		{	double *d = dU[regions[a]].data();
+			const double Ax = A[a].x, Ay = A[a].y, Az = A[a].z, je0 = Je0[a];
+			for( unsigned int k = 0; k < K; k++ ) {
+				const size_t j = base + k;
+				double mx0 = sx[j] + fx[j], my0 = sy[j] + fy[j], mz0 = sz[j] + fz[j];
+				double mx1 = nsx[k] + nfx[k], my1 = nsy[k] + nfy[k], mz1 = nsz[k] + nfz[k];
+				d[k] = -( B[k].x * (mx1 - mx0) + B[k].y * (my1 - my0) + B[k].z * (mz1 - mz0) )
+				       - ( Ax * (mx1 * mx1 - mx0 * mx0) + Ay * (my1 * my1 - my0 * my0) + Az * (mz1 * mz1 - mz0 * mz0) )
+				       - je0 * ( nsx[k] * nfx[k] + nsy[k] * nfy[k] + nsz[k] * nfz[k]
+				                 - sx[j] * fx[j] - sy[j] * fy[j] - sz[j] * fz[j] );
+			}
+		}
+		for( int r = 0; r < 6; r++ )
+			if( r != regions[a] )
+				std::fill(dU[r].begin(), dU[r].end(), 0.0);
+
+		// bonds (vectorized across replicas)
+		for( size_t e = bondStart[a]; e < bondStart[a + 1]; e++ ) {
+			const MSDGraph::Bond &bond = bonds[e];
+			const size_t nb = bond.site * K;
+			const double J = bond.J, Je1 = bond.Je1, Jee = bond.Jee, bq = bond.b;
+			const double Dx = bond.D.x, Dy = bond.D.y, Dz = bond.D.z;
+			double *d = dU[bond.region].data();
+			for( unsigned int k = 0; k < K; k++ ) {
+				const size_t j = base + k, o = nb + k;
+				double dsx = nsx[k] - sx[j], dsy = nsy[k] - sy[j], dsz = nsz[k] - sz[j];
+				double dfx = nfx[k] - fx[j], dfy = nfy[k] - fy[j], dfz = nfz[k] - fz[j];
+				double mx = sx[o] + fx[o], my = sy[o] + fy[o], mz = sz[o] + fz[o];
+				double m0 = (sx[j] + fx[j]) * mx + (sy[j] + fy[j]) * my + (sz[j] + fz[j]) * mz;
+				double m1 = (nsx[k] + nfx[k]) * mx + (nsy[k] + nfy[k]) * my + (nsz[k] + nfz[k]) * mz;
+				double dmx = dsx + dfx, dmy = dsy + dfy, dmz = dsz + dfz;
+				d[k] -= J * (dsx * sx[o] + dsy * sy[o] + dsz * sz[o])
+				      + Je1 * (dsx * fx[o] + dsy * fy[o] + dsz * fz[o] + dfx * sx[o] + dfy * sy[o] + dfz * sz[o])
+				      + Jee * (dfx * fx[o] + dfy * fy[o] + dfz * fz[o])
+				      + bq * (m1 * m1 - m0 * m0)
+				      + Dx * (dmy * mz - dmz * my) + Dy * (dmz * mx - dmx * mz) + Dz * (dmx * my - dmy * mx);
+			}
+		}
+
+		// accept or reject (scalar)
+		for( unsigned int k = 0; k < K; k++ ) {
+			double sum = 0;
+			for( const auto &d : dU )
+				sum += d[k];
+			if( !(sum <= 0 || rand(prngs[k]) < std::exp(-sum / kT[k])) )
+				continue;
+			const size_t j = base + k;
+			MSD::Results &r = results[k];
+			Vector ds(nsx[k] - sx[j], nsy[k] - sy[j], nsz[k] - sz[j]);
+			Vector df(nfx[k] - fx[j], nfy[k] - fy[j], nfz[k] - fz[j]);
+			switch( regions[a] ) {
+				case MSDGraph::L:  r.MSL += ds;  r.MFL += df;  break;
+				case MSDGraph::R:  r.MSR += ds;  r.MFR += df;  break;
+				default: r.MSm += ds;  r.MFm += df;  break;
+			}
+			r.UL += dU[MSDGraph::L][k];
+			r.UR += dU[MSDGraph::R][k];
+			r.Um += dU[MSDGraph::M][k];
+			r.UmL += dU[MSDGraph::ML][k];
+			r.UmR += dU[MSDGraph::MR][k];
+			r.ULR += dU[MSDGraph::LR][k];
+			update(r);
+			sx[j] = nsx[k]; sy[j] = nsy[k]; sz[j] = nsz[k];
+			fx[j] = nfx[k]; fy[j] = nfy[k]; fz[j] = nfz[k];
+		}
+	}
+	for( MSD::Results &r : results )
+		r.t += N;
+}
+
+void BatchMSD::metropolis(unsigned long long N, unsigned long long freq) {
+	if( freq == 0 ) {
+		metropolis(N);
+		return;
+	}
+	while(true) {
+		for( unsigned int k = 0; k < K; k++ )
+			record[k].push_back(results[k]);
+		if( N >= freq ) {
+			metropolis(freq);
+			N -= freq;
+		} else {
+			if( N != 0 )
+				metropolis(N);
+			break;
+		}
+	}
+}
+
+Vector BatchMSD::getSpin(unsigned int k, unsigned int a) const {
+	int s = graph.site(a);
+	if( s < 0 || k >= K )
+		throw std::out_of_range("BatchMSD: no such atom or replica");
+	size_t j = s * K + k;
+	return Vector(sx[j], sy[j], sz[j]);
+}
+
+Vector BatchMSD::getFlux(unsigned int k, unsigned int a) const {
+	int s = graph.site(a);
+	if( s < 0 || k >= K )
+		throw std::out_of_range("BatchMSD: no such atom or replica");
+	size_t j = s * K + k;
+	return Vector(fx[j], fy[j], fz[j]);
+}
+
+void BatchMSD::exportState(unsigned int k, MSD &msd) const {
+	for( unsigned int a : graph.indices )
+		msd.setLocalM(a, getSpin(k, a), getFlux(k, a));
+}
+
+}  // end of namespace udc
+
+#endif
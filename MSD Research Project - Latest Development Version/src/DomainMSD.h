@@ -0,0 +1,487 @@
+#ifndef UDC_DOMAIN_MSD
+#define UDC_DOMAIN_MSD
+
+#include <algorithm>
+#include <cmath>
+#include <condition_variable>
+#include <exception>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <random>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+#include "MSD.h"
+#include "MSDGraph.h"
+
+#if defined(_WIN32)
+	#ifndef NOMINMAX
+		#define NOMINMAX
+	#endif
+	#ifndef WIN32_LEAN_AND_MEAN
+		#define WIN32_LEAN_AND_MEAN
+	#endif
+	#include <windows.h>
+#elif defined(__linux__)
+	#include <pthread.h>
+	#include <sched.h>
+#endif
+
+namespace udc {
+
+/*
+ * One (large) MSD split into slabs of planes along z (or along y, if the MSD is taller than it is deep), each owned
+ * and updated by its own thread.
+ *
+ * Every bond except the FM bonds in y and z joins two atoms of the same (y, z) row, so a slab only shares bonds with
+ * the slabs next to it, through its first and last plane. Periodic boundaries (see: MSD::setPeriodic) may also bond
+ * the first and last slabs; if they'd bond any other planes, the slabs are along the other axis (or, if neither axis
+ * works, there's only one slab). Each sweep has 3 phases, separated by barriers, in which every thread makes one
+ * metropolis step per atom on random atoms of:
+ *   1. the inner planes of its slab, whose bonds are all within the slab,
+ *   2. the first plane of its slab,
+ *   3. the last plane of its slab.
+ * Slabs are at least 2 planes thick, so in any phase no two threads update atoms that share a bond, and every step is
+ * an exact metropolis step of the whole MSD. Each slab also stores a halo: copies of the atoms of the neighboring
+ * slabs it has bonds with, which it copies from their owners after the phase which changed them (halo exchange).
+ * So during a phase, each thread only touches the memory of its own slab, which it allocated (first touch puts it
+ * on the thread's NUMA node), and with pinThreads the thread of slab i is pinned to logical CPU i (on Windows and
+ * Linux), so it stays next to that memory. Slabs are chosen to have about the same number of atoms.
+ *
+ * The Results are the sum of each slab's changes, so they match MSD::getResults for the same state. Only
+ * CONTINUOUS_SPIN_MODEL and UP_DOWN_MODEL are supported, as in BatchMSD.
+ */
+class DomainMSD {
+ public:
+	std::vector<MSD::Results> record;  // (see: MSD::record)
+
+	// every atom starts in msd's current state; threads == 0 uses one per hardware thread, but slabs are at least
+	// 2 planes thick, so a small MSD may use fewer (see: getSlabs)
+	DomainMSD(const MSD &msd, unsigned int threads = 0, bool pinThreads = false);
+
+	unsigned int getN() const;
+	unsigned int getSlabs() const;  // (i.e. threads)
+
+	const MSD::Results & getResults() const;
+	MSD::Parameters getParameters() const;  // only kT and B can be changed
+	void set_kT(double kT);
+	void setB(const Vector &B);
+	void setSeed(unsigned long seed);  // slab i uses seed + i
+
+	void sweep(unsigned long long sweeps);  // each sweep is getN() metropolis steps (see: MSD::sweep)
+	void sweep(unsigned long long sweeps, unsigned long long freq);  // also records every freq sweeps
+
+	Vector getSpin(unsigned int a) const;  // a is an MSD index
+	Vector getFlux(unsigned int a) const;
+	void exportState(MSD &msd) const;  // copies the spins and fluxes into msd (of the same geometry)
+
+ private:
+	typedef MSDGraph::Region Region;
+
+	struct Halo {
+		unsigned int site;  // local site (in this slab)
+		unsigned int owner, source;  // slab, and local site there
+	};
+
+	struct Slab {
+		// local sites: [0, firstEnd) is the first plane, [firstEnd, innerEnd) the inner planes, [innerEnd, owned) the
+		// last plane, and then the halo
+		std::vector<unsigned int> sites;  // MSDGraph site of each local site
+		unsigned int owned, firstEnd, innerEnd;
+		std::vector<Vector> s, f;
+		std::vector<Region> regions;  // (of owned sites only, as are F, Je0, A, and bondStart)
+		std::vector<double> F, Je0;
+		std::vector<Vector> A;
+		std::vector<size_t> bondStart;
+		std::vector<MSDGraph::Bond> bonds;  // Bond::site is a local site
+		std::vector<Halo> haloFirst, haloLast;  // copies of the first or last plane of another slab
+		std::mt19937_64 prng;
+		double dU[6];  // changes since the last sweep(), by Region
+		Vector dMS[3], dMF[3];  // L, R, m
+	};
+
+	class Barrier {
+	 public:
+		explicit Barrier(unsigned int count);
+		void wait();
+
+	 private:
+		std::mutex mutex;
+		std::condition_variable cv;
+		unsigned int count, waiting;
+		unsigned long long generation;
+	};
+
+	MSDGraph graph;
+	MSD::Parameters parameters;
+	MSD::Results results;
+	bool upDown, pin;
+	std::vector<Slab> slabs;
+	std::vector<unsigned int> slabOf, localOf;  // [MSDGraph site]
+
+	void run(const std::function<void(unsigned int)> &task);  // task(i) on a thread for each slab i; then joins
+	void step(Slab &slab, unsigned int begin, unsigned int end) const;  // end - begin steps on random sites of [begin, end)
+	static void pinThread(unsigned int cpu);
+	static void update(MSD::Results &r);  // aggregates (M, MS, MF, U, etc.) from the regional values
+};
+
+
+DomainMSD::Barrier::Barrier(unsigned int count) : count(count), waiting(0), generation(0) {
+}
+
+void DomainMSD::Barrier::wait() {
+	std::unique_lock<std::mutex> lock(mutex);
+	const unsigned long long g = generation;
+	if( ++waiting == count ) {
+		waiting = 0;
+		generation++;
+		cv.notify_all();
+	} else {
+		cv.wait(lock, [this, g]() { return generation != g; });
+	}
+}
+
+
+DomainMSD::DomainMSD(const MSD &msd, unsigned int threads, bool pinThreads)
+		: graph(msd), parameters(msd.getParameters()), results(msd.getResults()), pin(pinThreads) {
+	if( msd.flippingAlgorithm.target_type() == MSD::UP_DOWN_MODEL.target_type() )
+		upDown = true;
+	else if( msd.flippingAlgorithm.target_type() == MSD::CONTINUOUS_SPIN_MODEL.target_type() )
+		upDown = false;
+	else
+		throw std::invalid_argument("DomainMSD: only CONTINUOUS_SPIN_MODEL and UP_DOWN_MODEL are supported");
+	const unsigned int n = graph.size();
+
+	// ----- planes -----
+	// Periodic boundaries (see: MSD::setPeriodic) also bond the first and last planes of a region, which may only be
+	// in slabs next to each other (or in the first and last slab) if they're the first and last planes of the MSD.
+	std::vector<unsigned int> planeY(n), planeZ(n);
+	for( auto iter = msd.begin(); iter != msd.end(); ++iter ) {
+		const int a = graph.site(iter.getIndex());
+		planeY[a] = iter.getY();
+		planeZ[a] = iter.getZ();
+	}
+	auto slabbable = [&](const std::vector<unsigned int> &plane, unsigned int planes) {
+		for( unsigned int a = 0; a < n; a++ )
+			for( size_t e = graph.bondStart[a]; e < graph.bondStart[a + 1]; e++ ) {
+				const unsigned int p = plane[a], q = plane[graph.bonds[e].site];
+				if( p + 1 < q && !(p == 0 && q + 1 == planes) )
+					return false;
+			}
+		return true;
+	};
+	bool alongZ = graph.depth >= graph.height;
+	if( !slabbable(alongZ ? planeZ : planeY, alongZ ? graph.depth : graph.height) ) {
+		alongZ = !alongZ;
+		if( !slabbable(alongZ ? planeZ : planeY, alongZ ? graph.depth : graph.height) )
+			threads = 1;  // (one slab has no such bonds between slabs)
+	}
+	const unsigned int planes = alongZ ? graph.depth : graph.height;
+	const std::vector<unsigned int> &plane = alongZ ? planeZ : planeY;
+	std::vector<unsigned long long> before(planes + 1, 0);  // atoms before each plane
+	for( unsigned int a = 0; a < n; a++ )
+		before[plane[a] + 1]++;
+	for( unsigned int p = 0; p < planes; p++ )
+		before[p + 1] += before[p];
+
+	// ----- slabs: at least 2 planes, and about n / T atoms each -----
+	if( threads == 0 )
+		threads = std::max(1u, std::thread::hardware_concurrency());
+	const unsigned int T = std::max(1u, std::min(threads, planes / 2));
+	std::vector<unsigned int> start(T + 1, planes);  // first plane of each slab
+	start[0] = 0;
+	for( unsigned int i = 1; i < T; i++ ) {
+		unsigned int p = start[i - 1] + 2;
+		while( p < planes - 2 * (T - i) && before[p] * T < static_cast<unsigned long long>(n) * i )
+			p++;
+		start[i] = p;
+	}
+	std::vector<unsigned int> slabOfPlane(planes);
+	for( unsigned int i = 0; i < T; i++ )
+		for( unsigned int p = start[i]; p < start[i + 1]; p++ )
+			slabOfPlane[p] = i;
+
+	// ----- owned sites, by phase -----
+	std::vector< std::vector<unsigned int> > first(T), inner(T), last(T);
+	for( unsigned int a = 0; a < n; a++ ) {
+		const unsigned int i = slabOfPlane[plane[a]];
+		if( plane[a] == start[i] )
+			first[i].push_back(a);
+		else if( plane[a] + 1 == start[i + 1] )
+			last[i].push_back(a);
+		else
+			inner[i].push_back(a);
+	}
+	slabs.resize(T);
+	slabOf.resize(n);
+	localOf.resize(n);
+	for( unsigned int i = 0; i < T; i++ ) {
+		Slab &slab = slabs[i];
+		slab.firstEnd = static_cast<unsigned int>(first[i].size());
+		slab.innerEnd = slab.firstEnd + static_cast<unsigned int>(inner[i].size());
+		slab.owned = slab.innerEnd + static_cast<unsigned int>(last[i].size());
+		unsigned int k = 0;
+		for( const auto *group : { &first[i], &inner[i], &last[i] } )
+			for( unsigned int a : *group ) {
+				slabOf[a] = i;
+				localOf[a] = k++;
+			}
+	}
+
+	// ----- everything else is allocated by the thread which uses it (first touch) -----
+	run([&](unsigned int i) {
+		Slab &slab = slabs[i];
+		slab.sites.reserve(slab.owned);
+		for( const auto *group : { &first[i], &inner[i], &last[i] } )
+			slab.sites.insert(slab.sites.end(), group->begin(), group->end());
+		std::map<unsigned int, unsigned int> halo;  // MSDGraph site -> local site
+		slab.bondStart.push_back(0);
+		for( unsigned int k = 0; k < slab.owned; k++ ) {
+			const unsigned int a = slab.sites[k];
+			slab.regions.push_back(graph.regions[a]);
+			slab.F.push_back(graph.F[a]);
+			slab.Je0.push_back(graph.Je0[a]);
+			slab.A.push_back(graph.A[a]);
+			for( size_t e = graph.bondStart[a]; e < graph.bondStart[a + 1]; e++ ) {
+				MSDGraph::Bond bond = graph.bonds[e];
+				const unsigned int b = bond.site;
+				if( slabOf[b] == i ) {
+					bond.site = localOf[b];
+				} else if( halo.count(b) != 0 ) {
+					bond.site = halo[b];
+				} else {
+					Halo h;
+					h.site = bond.site = halo[b] = static_cast<unsigned int>(slab.sites.size());
+					h.owner = slabOf[b];
+					h.source = localOf[b];
+					(h.source < slabs[h.owner].firstEnd ? slab.haloFirst : slab.haloLast).push_back(h);
+					slab.sites.push_back(b);
+				}
+				slab.bonds.push_back(bond);
+			}
+			slab.bondStart.push_back(slab.bonds.size());
+		}
+		slab.s.resize(slab.sites.size());
+		slab.f.resize(slab.sites.size());
+		for( size_t k = 0; k < slab.sites.size(); k++ ) {
+			slab.s[k] = msd.getSpin(graph.indices[slab.sites[k]]);
+			slab.f[k] = msd.getFlux(graph.indices[slab.sites[k]]);
+		}
+		std::fill(slab.dU, slab.dU + 6, 0.0);
+		std::fill(slab.dMS, slab.dMS + 3, Vector::ZERO);
+		std::fill(slab.dMF, slab.dMF + 3, Vector::ZERO);
+	});
+	setSeed(msd.getSeed());
+}
+
+void DomainMSD::run(const std::function<void(unsigned int)> &task) {
+	const unsigned int T = getSlabs();
+	const unsigned int cpus = std::max(1u, std::thread::hardware_concurrency());
+	std::vector<std::exception_ptr> errors(T);
+	std::vector<std::thread> pool;
+	for( unsigned int i = 0; i < T; i++ )
+		pool.push_back( std::thread([this, &task, &errors, cpus, i]() {
+			try {
+				if( pin )
+					pinThread(i % cpus);
+				task(i);
+			} catch(...) {
+				errors[i] = std::current_exception();
+			}
+		}) );
+	for( std::thread &t : pool )
+		t.join();
+	for( const std::exception_ptr &e : errors )
+		if( e )
+			std::rethrow_exception(e);
+}
+
+void DomainMSD::pinThread(unsigned int cpu) {
+#if defined(_WIN32)
+	// (only the first 64 CPUs, i.e. the first processor group)
+	SetThreadAffinityMask(GetCurrentThread(), static_cast<DWORD_PTR>(1) << (cpu % (8 * sizeof(DWORD_PTR))));
+#elif defined(__linux__)
+	cpu_set_t set;
+	CPU_ZERO(&set);
+	CPU_SET(cpu % CPU_SETSIZE, &set);
+	pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+#else
+	(void) cpu;  // not supported: threads aren't pinned
+#endif
+}
+
+void DomainMSD::update(MSD::Results &r) {
+	r.ML = r.MSL + r.MFL;
+	r.MR = r.MSR + r.MFR;
+	r.Mm = r.MSm + r.MFm;
+	r.MS = r.MSL + r.MSR + r.MSm;
+	r.MF = r.MFL + r.MFR + r.MFm;
+	r.M = r.ML + r.MR + r.Mm;
+	r.U = r.UL + r.UR + r.Um + r.UmL + r.UmR + r.ULR;
+}
+
+unsigned int DomainMSD::getN() const {
+	return graph.size();
+}
+
+unsigned int DomainMSD::getSlabs() const {
+	return static_cast<unsigned int>(slabs.size());
+}
+
+const MSD::Results & DomainMSD::getResults() const {
+	return results;
+}
+
+MSD::Parameters DomainMSD::getParameters() const {
+	return parameters;
+}
+
+void DomainMSD::set_kT(double kT) {
+	parameters.kT = kT;
+}
+
+// same as MSD::setB
+void DomainMSD::setB(const Vector &B) {
+	Vector deltaB = B - parameters.B;
+	results.UL -= deltaB * results.ML;
+	results.UR -= deltaB * results.MR;
+	results.Um -= deltaB * results.Mm;
+	update(results);
+	parameters.B = B;
+}
+
+void DomainMSD::setSeed(unsigned long seed) {
+	for( unsigned int i = 0; i < getSlabs(); i++ )
+		slabs[i].prng.seed(seed + i);
+}
+
+void DomainMSD::step(Slab &slab, unsigned int begin, unsigned int end) const {
+	std::uniform_real_distribution<double> rand(0, 1);
+	std::mt19937_64 &prng = slab.prng;
+	const Vector &B = parameters.B;
+	const double kT = parameters.kT;
+	double dU[6];
+
+	for( unsigned int i = begin; i < end; i++ ) {
+		const unsigned int k = begin + static_cast<unsigned int>( rand(prng) * (end - begin) );
+		const Vector s0 = slab.s[k], f0 = slab.f[k];
+		const Vector s1 = upDown ? -s0 : Vector::sphericalForm( s0.norm(), 2 * PI * rand(prng), std::asin(2 * rand(prng) - 1) );
+		const Vector f1 = slab.F[k] == 0 ? Vector::ZERO
+				: Vector::sphericalForm( slab.F[k] * rand(prng), 2 * PI * rand(prng), std::asin(2 * rand(prng) - 1) );
+		const Vector m0 = s0 + f0, m1 = s1 + f1, ds = s1 - s0, df = f1 - f0, dm = m1 - m0;
+		const Vector &A = slab.A[k];
+
+		// local energy: B, A, Je0 (goes to the region of the site)
+		std::fill(dU, dU + 6, 0.0);
+		dU[slab.regions[k]] = -(B * dm)
+				- ( A.x * (m1.x * m1.x - m0.x * m0.x) + A.y * (m1.y * m1.y - m0.y * m0.y) + A.z * (m1.z * m1.z - m0.z * m0.z) )
+				- slab.Je0[k] * (s1 * f1 - s0 * f0);
+
+		// bonds
+		for( size_t e = slab.bondStart[k]; e < slab.bondStart[k + 1]; e++ ) {
+			const MSDGraph::Bond &bond = slab.bonds[e];
+			const Vector &so = slab.s[bond.site], &fo = slab.f[bond.site];
+			const Vector mo = so + fo;
+			const double u0 = m0 * mo, u1 = m1 * mo;
+			dU[bond.region] -= bond.J * (ds * so) + bond.Je1 * (ds * fo + df * so) + bond.Jee * (df * fo)
+					+ bond.b * (u1 * u1 - u0 * u0) + bond.D * dm.crossProduct(mo);
+		}
+
+		// accept or reject
+		const double sum = dU[0] + dU[1] + dU[2] + dU[3] + dU[4] + dU[5];
+		if( !(sum <= 0 || rand(prng) < std::exp(-sum / kT)) )
+			continue;
+		const int r = slab.regions[k] == MSDGraph::L ? 0 : slab.regions[k] == MSDGraph::R ? 1 : 2;
+		slab.dMS[r] += ds;
+		slab.dMF[r] += df;
+		for( int j = 0; j < 6; j++ )
+			slab.dU[j] += dU[j];
+		slab.s[k] = s1;
+		slab.f[k] = f1;
+	}
+}
+
+void DomainMSD::sweep(unsigned long long sweeps) {
+	Barrier barrier(getSlabs());
+	run([&](unsigned int i) {
+		Slab &slab = slabs[i];
+		for( unsigned long long t = 0; t < sweeps; t++ ) {
+			step(slab, slab.firstEnd, slab.innerEnd);
+			barrier.wait();
+			step(slab, 0, slab.firstEnd);
+			barrier.wait();
+			for( const Halo &h : slab.haloFirst ) {
+				slab.s[h.site] = slabs[h.owner].s[h.source];
+				slab.f[h.site] = slabs[h.owner].f[h.source];
+			}
+			step(slab, slab.innerEnd, slab.owned);
+			barrier.wait();
+			for( const Halo &h : slab.haloLast ) {
+				slab.s[h.site] = slabs[h.owner].s[h.source];
+				slab.f[h.site] = slabs[h.owner].f[h.source];
+			}
+		}
+	});
+
+	for( Slab &slab : slabs ) {
+		results.UL += slab.dU[MSDGraph::L];
+		results.UR += slab.dU[MSDGraph::R];
+		results.Um += slab.dU[MSDGraph::M];
+		results.UmL += slab.dU[MSDGraph::ML];
+		results.UmR += slab.dU[MSDGraph::MR];
+		results.ULR += slab.dU[MSDGraph::LR];
+		results.MSL += slab.dMS[0];
+		results.MSR += slab.dMS[1];
+		results.MSm += slab.dMS[2];
+		results.MFL += slab.dMF[0];
+		results.MFR += slab.dMF[1];
+		results.MFm += slab.dMF[2];
+		std::fill(slab.dU, slab.dU + 6, 0.0);
+		std::fill(slab.dMS, slab.dMS + 3, Vector::ZERO);
+		std::fill(slab.dMF, slab.dMF + 3, Vector::ZERO);
+	}
+	update(results);
+	results.t += sweeps * getN();
+}
+
+void DomainMSD::sweep(unsigned long long sweeps, unsigned long long freq) {
+	if( freq == 0 ) {
+		sweep(sweeps);
+		return;
+	}
+	while(true) {
+		record.push_back(results);
+		if( sweeps >= freq ) {
+			sweep(freq);
+			sweeps -= freq;
+		} else {
+			if( sweeps != 0 )
+				sweep(sweeps);
+			break;
+		}
+	}
+}
+
+Vector DomainMSD::getSpin(unsigned int a) const {
+	int s = graph.site(a);
+	if( s < 0 )
+		throw std::out_of_range("DomainMSD: no such atom");
+	return slabs[slabOf[s]].s[localOf[s]];
+}
+
+Vector DomainMSD::getFlux(unsigned int a) const {
+	int s = graph.site(a);
+	if( s < 0 )
+		throw std::out_of_range("DomainMSD: no such atom");
+	return slabs[slabOf[s]].f[localOf[s]];
+}
+
+void DomainMSD::exportState(MSD &msd) const {
+	for( unsigned int a : graph.indices )
+		msd.setLocalM(a, getSpin(a), getFlux(a));
+}
+
+}  // end of namespace udc
+
+#endif
@@ -0,0 +1,388 @@
+#ifndef UDC_ISING_MSD
+#define UDC_ISING_MSD
+
+#include <cmath>
+#include <cstdint>
+#include <map>
+#include <random>
+#include <stdexcept>
+#include <vector>
+#include "MSD.h"
+#include "MSDGraph.h"
+
+namespace udc {
+
+/*
+ * Multi-spin coded UP_DOWN_MODEL: 64 replicas of an MSD whose spins are all along one axis and whose fluxes are 0.
+ *
+ * Then each spin is s_i = sigma_i * S_i * u (sigma_i = +1 or -1), and the energy reduces to an Ising model:
+ *     U = U0 - sum_i( h_i sigma_i ) - sum_<ij>( K_ij sigma_i sigma_j ),
+ * with h_i = S_i B * u and K_ij = J_ij S_i S_j. (Anisotropy and biquadratic terms are constant, and DMI is 0.)
+ * Bit k of state[a] is 1 iff sigma_a == -1 in replica k, so one metropolis step updates a site in all 64 replicas
+ * with bitwise operations: the bonds of each site are grouped by K, the number of anti-parallel bonds in each group
+ * is counted with bit-sliced adders, and each combination of counts (and sigma_a) is a class with a fixed dU, whose
+ * acceptance probability is precomputed (when kT or B changes). The random number for each replica (bit) is compared
+ * to its acceptance probability one binary digit at a time, using one random word for all 64 replicas per digit,
+ * which takes about 8 random words per step on average.
+ *
+ * All replicas share kT and B, and each has an independent stream of random bits. Results are found from the bits
+ * when asked for (O(n) each), so record is best used with freq >= n.
+ */
+class IsingMSD {
+ public:
+	static const unsigned int REPLICAS = 64;
+
+	std::vector< std::vector<MSD::Results> > record;  // record[k] is the record of replica k (see: MSD::record)
+
+	IsingMSD(const MSD &msd);  // every replica starts as a copy of msd's current state
+
+	unsigned int getN() const;  // atoms per replica
+
+	MSD::Results getResults(unsigned int k) const;
+	MSD::Parameters getParameters() const;  // only kT and B can be changed
+	void set_kT(double kT);
+	void setB(const Vector &B);
+	void setSeed(unsigned long seed);
+	void randomize();  // independent random sigma for every atom of every replica
+
+	void metropolis(unsigned long long N);  // N steps in every replica
+	void metropolis(unsigned long long N, unsigned long long freq);  // also records every freq steps (see: MSD::metropolis)
+
+	Vector getSpin(unsigned int k, unsigned int a) const;  // a is an MSD index
+	void exportState(unsigned int k, MSD &msd) const;  // copies the spins of replica k into msd (of the same geometry)
+
+ private:
+	struct Group {
+		double K;
+		std::vector<unsigned int> sites;
+	};
+	struct Table {
+		std::vector<double> dU;  // of each class; class = (((c_0 * (deg_1 + 1) + c_1) * ...) * 2 + bit)
+		std::vector<uint64_t> threshold;  // floor(2^64 exp(-dU / kT)), or 0 if dU <= 0
+	};
+
+	MSDGraph graph;
+	MSD::Parameters parameters;
+	unsigned long long t;
+	Vector axis;
+	std::vector<double> S;  // |s_i|
+	std::vector<uint64_t> state;  // [site]
+	std::vector< std::vector<Group> > groups;  // [site]
+	std::vector<unsigned int> tableOf;  // [site]
+	std::vector<Table> tables;
+	std::vector< std::vector<double> > tableKeys;  // h, K_0, deg_0, K_1, deg_1, ...
+	double offsets[6];  // constant energy of each region (anisotropy, biquadratic)
+	std::mt19937_64 prng;
+
+	void buildTables();
+	void energy(unsigned int k, double U[6], Vector MS[3]) const;  // the non-constant part of each region
+};
+
+
+IsingMSD::IsingMSD(const MSD &msd) : graph(msd), parameters(msd.getParameters()), t(msd.getResults().t) {
+	if( msd.flippingAlgorithm.target_type() != MSD::UP_DOWN_MODEL.target_type() )
+		throw std::invalid_argument("IsingMSD: requires UP_DOWN_MODEL");
+	const unsigned int n = graph.size();
+	for( unsigned int a = 0; a < n; a++ )
+		if( graph.F[a] != 0 || msd.getFlux(graph.indices[a]) != Vector::ZERO )
+			throw std::invalid_argument("IsingMSD: requires all fluxes (and FL, FR, Fm) to be 0");
+
+	// ----- spins: find the common axis -----
+	axis = Vector::ZERO;
+	S.resize(n);
+	state.assign(n, 0);
+	for( unsigned int a = 0; a < n; a++ ) {
+		Vector s = msd.getSpin(graph.indices[a]);
+		S[a] = s.norm();
+		if( S[a] == 0 )
+			continue;
+		if( axis == Vector::ZERO )
+			axis = s * (1 / S[a]);
+		double cos = s * axis / S[a];
+		if( std::fabs(std::fabs(cos) - 1) > 1e-9 )
+			throw std::invalid_argument("IsingMSD: requires all spins to be parallel or anti-parallel");
+		if( cos < 0 )
+			state[a] = ~uint64_t(0);
+	}
+
+	// ----- group bonds by K = J S_i S_j -----
+	groups.resize(n);
+	for( unsigned int a = 0; a < n; a++ )
+		for( size_t e = graph.bondStart[a]; e < graph.bondStart[a + 1]; e++ ) {
+			const MSDGraph::Bond &bond = graph.bonds[e];
+			double K = bond.J * S[a] * S[bond.site];
+			if( K == 0 )
+				continue;
+			size_t g = 0;
+			while( g < groups[a].size() && groups[a][g].K != K )
+				g++;
+			if( g == groups[a].size() ) {
+				groups[a].push_back(Group());
+				groups[a][g].K = K;
+			}
+			groups[a][g].sites.push_back(bond.site);
+		}
+
+	// ----- constant energies -----
+	{	MSD::Results r = msd.getResults();
+		double U[6];
+		Vector MS[3];
+		energy(0, U, MS);  // all replicas are the same so far
+		offsets[MSDGraph::L] = r.UL - U[MSDGraph::L];
+		offsets[MSDGraph::R] = r.UR - U[MSDGraph::R];
+		offsets[MSDGraph::M] = r.Um - U[MSDGraph::M];
+		offsets[MSDGraph::ML] = r.UmL - U[MSDGraph::ML];
+		offsets[MSDGraph::MR] = r.UmR - U[MSDGraph::MR];
+		offsets[MSDGraph::LR] = r.ULR - U[MSDGraph::LR];
+	}
+
+	record.resize(REPLICAS);
+	prng.seed(msd.getSeed());
+	buildTables();
+}
+
+// (Re)builds the acceptance table of every distinct (h, groups) combination
+void IsingMSD::buildTables() {
+	const unsigned int n = graph.size();
+	const double kT = parameters.kT;
+	tables.clear();
+	tableKeys.clear();
+	tableOf.resize(n);
+	std::map<std::vector<double>, unsigned int> known;
+	for( unsigned int a = 0; a < n; a++ ) {
+		std::vector<double> key;
+		key.push_back(S[a] * (parameters.B * axis));
+		for( const Group &g : groups[a] ) {
+			key.push_back(g.K);
+			key.push_back(static_cast<double>(g.sites.size()));
+		}
+		auto iter = known.find(key);
+		if( iter != known.end() ) {
+			tableOf[a] = iter->second;
+			continue;
+		}
+		unsigned int index = static_cast<unsigned int>(tables.size());
+		known[key] = index;
+		tableOf[a] = index;
+		tableKeys.push_back(key);
+
+		// every combination of (c_0, c_1, ..., bit): dU = 2 h sigma_a + sum_g( 2 K_g (deg_g - 2 c_g) )
+		Table table;
+		size_t classes = 2;
+		for( const Group &g : groups[a] )
+			classes *= g.sites.size() + 1;
+		table.dU.resize(classes);
+		table.threshold.resize(classes);
+		for( size_t c = 0; c < classes; c++ ) {
+			size_t rest = c;
+			double sigma = rest % 2 == 0 ? 1 : -1;
+			rest /= 2;
+			double dU = 2 * key[0] * sigma;
+			for( size_t g = groups[a].size(); g-- > 0; ) {
+				size_t deg = groups[a][g].sites.size();
+				size_t count = rest % (deg + 1);
+				rest /= deg + 1;
+				dU += 2 * groups[a][g].K * (static_cast<double>(deg) - 2.0 * count);
+			}
+			table.dU[c] = dU;
+			if( dU <= 0 )
+				table.threshold[c] = 0;
+			else {
+				double p = std::ldexp(std::exp(-dU / kT), 64);
+				table.threshold[c] = p >= 18446744073709551615.0 ? ~uint64_t(0) : static_cast<uint64_t>(p);
+			}
+		}
+		tables.push_back(table);
+	}
+}
+
+void IsingMSD::metropolis(unsigned long long N) {
+	const unsigned int n = graph.size();
+	std::uniform_int_distribution<unsigned int> randSite(0, n - 1);
+	std::vector<uint64_t> classMask, positiveMask, positiveThreshold;
+	std::vector< std::vector<uint64_t> > onehot;  // [group][count]: bits with that many anti-parallel bonds
+
+	for( unsigned long long i = 0; i < N; i++ ) {
+		const unsigned int a = randSite(prng);
+		const uint64_t s = state[a];
+		const std::vector<Group> &gs = groups[a];
+		const Table &table = tables[tableOf[a]];
+
+		// count the anti-parallel bonds of each group (bit-sliced), and decode the counts
+		onehot.resize(gs.size());
+		for( size_t g = 0; g < gs.size(); g++ ) {
+			uint64_t planes[8] = { 0 };  // supports up to 255 bonds per group
+			unsigned int bits = 0;
+			for( unsigned int b : gs[g].sites ) {
+				uint64_t carry = s ^ state[b];
+				for( unsigned int p = 0; carry != 0 && p < 8; p++ ) {
+					uint64_t next = planes[p] & carry;
+					planes[p] ^= carry;
+					carry = next;
+					if( p + 1 > bits )
+						bits = p + 1;
+				}
+			}
+			const size_t deg = gs[g].sites.size();
+			onehot[g].assign(deg + 1, 0);
+			for( size_t c = 0; c <= deg; c++ ) {
+				uint64_t mask = ~uint64_t(0);
+				for( unsigned int p = 0; p < 8 && (mask != 0); p++ )
+					mask &= (c >> p & 1) ? planes[p] : ~planes[p];
+				onehot[g][c] = mask;
+			}
+		}
+
+		// class of every bit: accept dU <= 0, and collect the rest
+		uint64_t accept = 0, undecided = 0;
+		positiveMask.clear();
+		positiveThreshold.clear();
+		const size_t classes = table.dU.size();
+		for( size_t c = 0; c < classes; c++ ) {
+			size_t rest = c;
+			uint64_t mask = rest % 2 == 0 ? ~s : s;
+			rest /= 2;
+			for( size_t g = gs.size(); g-- > 0 && mask != 0; ) {
+				size_t deg = gs[g].sites.size();
+				mask &= onehot[g][rest % (deg + 1)];
+				rest /= deg + 1;
+			}
+			if( mask == 0 )
+				continue;
+			if( table.dU[c] <= 0 )
+				accept |= mask;
+			else if( table.threshold[c] != 0 ) {
+				positiveMask.push_back(mask);
+				positiveThreshold.push_back(table.threshold[c]);
+				undecided |= mask;
+			}
+		}
+
+		// compare a uniform random number (per bit) to the threshold, from the most significant digit
+		for( int d = 63; d >= 0 && undecided != 0; d-- ) {
+			uint64_t P = 0;
+			for( size_t v = 0; v < positiveMask.size(); v++ )
+				if( positiveThreshold[v] >> d & 1 )
+					P |= positiveMask[v];
+			uint64_t r = prng();
+			accept |= undecided & P & ~r;  // random digit 0 < threshold digit 1
+			undecided &= ~(P ^ r);  // still equal
+		}
+
+		state[a] = s ^ accept;
+	}
+	t += N;
+}
+
+void IsingMSD::metropolis(unsigned long long N, unsigned long long freq) {
+	if( freq == 0 ) {
+		metropolis(N);
+		return;
+	}
+	while(true) {
+		for( unsigned int k = 0; k < REPLICAS; k++ )
+			record[k].push_back(getResults(k));
+		if( N >= freq ) {
+			metropolis(freq);
+			N -= freq;
+		} else {
+			if( N != 0 )
+				metropolis(N);
+			break;
+		}
+	}
+}
+
+void IsingMSD::energy(unsigned int k, double U[6], Vector MS[3]) const {
+	for( int r = 0; r < 6; r++ )
+		U[r] = 0;
+	double sumL = 0, sumR = 0, sumM = 0;  // sum(sigma S) of each region
+	const unsigned int n = graph.size();
+	for( unsigned int a = 0; a < n; a++ ) {
+		double sa = (state[a] >> k & 1) ? -1 : 1;
+		switch( graph.regions[a] ) {
+			case MSDGraph::L:  sumL += sa * S[a];  break;
+			case MSDGraph::R:  sumR += sa * S[a];  break;
+			default:           sumM += sa * S[a];  break;
+		}
+		for( size_t e = graph.bondStart[a]; e < graph.bondStart[a + 1]; e++ ) {
+			const MSDGraph::Bond &bond = graph.bonds[e];
+			if( bond.site < a )
+				continue;  // each bond is listed for both sites
+			double sb = (state[bond.site] >> k & 1) ? -1 : 1;
+			U[bond.region] -= bond.J * S[a] * S[bond.site] * sa * sb;
+		}
+	}
+	MS[0] = sumL * axis;
+	MS[1] = sumR * axis;
+	MS[2] = sumM * axis;
+	U[MSDGraph::L] -= parameters.B * MS[0];
+	U[MSDGraph::R] -= parameters.B * MS[1];
+	U[MSDGraph::M] -= parameters.B * MS[2];
+}
+
+MSD::Results IsingMSD::getResults(unsigned int k) const {
+	if( k >= REPLICAS )
+		throw std::out_of_range("IsingMSD: no such replica");
+	double U[6];
+	Vector MS[3];
+	energy(k, U, MS);
+	MSD::Results r;
+	r.t = t;
+	r.MSL = r.ML = MS[0];
+	r.MSR = r.MR = MS[1];
+	r.MSm = r.Mm = MS[2];
+	r.MFL = r.MFR = r.MFm = r.MF = Vector::ZERO;
+	r.MS = r.M = MS[0] + MS[1] + MS[2];
+	r.UL = U[MSDGraph::L] + offsets[MSDGraph::L];
+	r.UR = U[MSDGraph::R] + offsets[MSDGraph::R];
+	r.Um = U[MSDGraph::M] + offsets[MSDGraph::M];
+	r.UmL = U[MSDGraph::ML] + offsets[MSDGraph::ML];
+	r.UmR = U[MSDGraph::MR] + offsets[MSDGraph::MR];
+	r.ULR = U[MSDGraph::LR] + offsets[MSDGraph::LR];
+	r.U = r.UL + r.UR + r.Um + r.UmL + r.UmR + r.ULR;
+	return r;
+}
+
+unsigned int IsingMSD::getN() const {
+	return graph.size();
+}
+
+MSD::Parameters IsingMSD::getParameters() const {
+	return parameters;
+}
+
+void IsingMSD::set_kT(double kT) {
+	parameters.kT = kT;
+	buildTables();
+}
+
+void IsingMSD::setB(const Vector &B) {
+	parameters.B = B;
+	buildTables();
+}
+
+void IsingMSD::setSeed(unsigned long seed) {
+	prng.seed(seed);
+}
+
+void IsingMSD::randomize() {
+	for( uint64_t &s : state )
+		s = prng();
+}
+
+Vector IsingMSD::getSpin(unsigned int k, unsigned int a) const {
+	int s = graph.site(a);
+	if( s < 0 || k >= REPLICAS )
+		throw std::out_of_range("IsingMSD: no such atom or replica");
+	return ((state[s] >> k & 1) ? -S[s] : S[s]) * axis;
+}
+
+void IsingMSD::exportState(unsigned int k, MSD &msd) const {
+	for( unsigned int a : graph.indices )
+		msd.setLocalM(a, getSpin(k, a), Vector::ZERO);
+}
+
+}  // end of namespace udc
+
+#endif
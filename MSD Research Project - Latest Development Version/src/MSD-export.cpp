@@ -14,6 +14,9 @@
 
 #include "MSD-export.h"
 #include <cstdlib>
+#include <fstream>
+#include <stdexcept>
+#include <string>
 #include <vector>
 
 using namespace std;
@@ -26,6 +29,8 @@ const MSD::MolProtoFactory * const CIRCULAR_MOL = &MSD::CIRCULAR_MOL;
 
 const MSD::FlippingAlgorithm * const UP_DOWN_MODEL = &MSD::UP_DOWN_MODEL;
 const MSD::FlippingAlgorithm * const CONTINUOUS_SPIN_MODEL = &MSD::CONTINUOUS_SPIN_MODEL;
+const MSD::FlippingAlgorithm * const HEAT_BATH_MODEL = &MSD::HEAT_BATH_MODEL;
+const MSD::FlippingAlgorithm * const CONE_MODEL = &MSD::CONE_MODEL;
 
 // MolProto Globals
 const char * const HEADER = MolProto::HEADER;
@@ -81,6 +86,16 @@ MSD* createMSD_d(
 	return new MSD(width, height, depth);
 }
 
+MSD* createMSD_m(const char *maskFile, const MSD::MolProtoFactory *molType, uint order) {
+	std::ifstream in(maskFile);
+	try {
+		return new MSD(MSD::VoxelMask::read(in), molType != NULL ? *molType : MSD::LINEAR_MOL,
+				static_cast<MSD::SiteOrder>(order));
+	} catch(invalid_argument &) {
+		return NULL;
+	}
+}
+
 void destroyMSD(MSD *msd) { delete msd; }
 
 const MSD::Results* getRecord(const MSD *msd) { return &msd->record[0]; }
@@ -112,6 +127,38 @@ void setFlux_v(MSD *msd, uint x, uint y, uint z, const Vector *flux) { msd->setF
 void setLocalM_i(MSD *msd, uint a, const Vector *spin, const Vector *flux) { msd->setLocalM(a, *spin, *flux); }
 void setLocalM_v(MSD *msd, uint x, uint y, uint z, const Vector *spin, const Vector *flux) { msd->setLocalM(x, y, z, *spin, *flux); }
 
+double getSiteWeight_i(const MSD *msd, uint a) { return msd->getSiteWeight(a); }
+double getSiteWeight_v(const MSD *msd, uint x, uint y, uint z) { return msd->getSiteWeight(x, y, z); }
+void setSiteWeight_i(MSD *msd, uint a, double weight) { msd->setSiteWeight(a, weight); }
+void setSiteWeight_v(MSD *msd, uint x, uint y, uint z, double weight) { msd->setSiteWeight(x, y, z, weight); }
+void setRegionWeights(MSD *msd, double weightL, double weightR, double weight_m) { msd->setRegionWeights(weightL, weightR, weight_m); }
+bool getSkipZeroSpins(const MSD *msd) { return msd->skipZeroSpins; }
+void setSkipZeroSpins(MSD *msd, bool skip) { msd->skipZeroSpins = skip; }
+uint getSiteOrder(const MSD *msd) { return msd->getSiteOrder(); }
+void setSiteOrder(MSD *msd, uint order) { msd->setSiteOrder(static_cast<MSD::SiteOrder>(order)); }
+uint getCapacity(const MSD *msd) { return msd->getCapacity(); }
+
+unsigned long long estimateMemory(
+		uint width, uint height, uint depth,
+		uint molPosL, uint molPosR,
+		uint topL, uint bottomL, uint frontR, uint backR, uint order
+) {
+	return MSD::estimateMemory(width, height, depth, molPosL, molPosR, topL, bottomL, frontR, backR,
+			static_cast<MSD::SiteOrder>(order));
+}
+bool hasAtom(const MSD *msd, uint x, uint y, uint z) { return msd->hasAtom(x, y, z); }
+bool hasVoxelMask(const MSD *msd) { return msd->hasVoxelMask(); }
+bool setPeriodic(MSD *msd, uint axesL, uint axesR) {
+	try {
+		msd->setPeriodic(axesL, axesR);
+		return true;
+	} catch(invalid_argument &) {
+		return false;
+	}
+}
+uint getPeriodicL(const MSD *msd) { return msd->getPeriodicL(); }
+uint getPeriodicR(const MSD *msd) { return msd->getPeriodicR(); }
+
 uint getN(const MSD *msd) { return msd->getN(); }
 uint getNL(const MSD *msd) { return msd->getNL(); }
 uint getNR(const MSD *msd) { return msd->getNR(); }
@@ -143,6 +190,26 @@ void reinitialize(MSD *msd, bool reseed) { msd->reinitialize(reseed); }
 void randomize(MSD *msd, bool reseed) { msd->randomize(reseed); }
 void metropolis_o(MSD *msd, ulonglong N) { msd->metropolis(N); }
 void metropolis_r(MSD *msd, ulonglong N, ulonglong freq) { msd->metropolis(N, freq); }
+void sweep_o(MSD *msd, ulonglong sweeps) { msd->sweep(sweeps); }
+void sweep_r(MSD *msd, ulonglong sweeps, ulonglong freq) { msd->sweep(sweeps, freq); }
+ulonglong sweepLength(MSD *msd) { return msd->sweepLength(); }
+double getSweeps(MSD *msd) { return msd->getSweeps(); }
+uint getSweepMode(const MSD *msd) { return msd->sweepMode; }
+void setSweepMode(MSD *msd, uint mode) { msd->sweepMode = static_cast<MSD::SweepMode>(mode); }
+uint getBlockSize(const MSD *msd) { return msd->blockSize; }
+void setBlockSize(MSD *msd, uint size) { msd->blockSize = size; }
+void tuneProposals(MSD *msd, ulonglong N, double targetRate) { msd->tuneProposals(N, targetRate); }
+void nFoldWay_o(MSD *msd, ulonglong N) { msd->nFoldWay(N); }
+void nFoldWay_r(MSD *msd, ulonglong N, ulonglong freq) { msd->nFoldWay(N, freq); }
+void getProposalSteps(const MSD *msd, double *L, double *R, double *m) { *L = msd->proposalSteps.L; *R = msd->proposalSteps.R; *m = msd->proposalSteps.m; }
+void setProposalSteps(MSD *msd, double L, double R, double m) { msd->proposalSteps.L = L; msd->proposalSteps.R = R; msd->proposalSteps.m = m; }
+void getAcceptanceRates(const MSD *msd, double *L, double *R, double *m) {
+	MSD::AcceptanceStats stats = msd->getAcceptanceStats();
+	*L = stats.rateL();
+	*R = stats.rateR();
+	*m = stats.rate_m();
+}
+void resetAcceptanceStats(MSD *msd) { msd->resetAcceptanceStats(); }
 
 double specificHeat(const MSD *msd) { return msd->specificHeat(); }
 double specificHeat_L(const MSD *msd) { return msd->specificHeat_L(); }
@@ -177,6 +244,86 @@ double meanUmR(const MSD *msd) { return msd->meanUmR(); }
 double meanULR(const MSD *msd) { return msd->meanULR(); }
 
 
+// ResultCache Methods
+ResultCache* createResultCache(const char *path, ulonglong maxBytes) {
+	try {
+		return new ResultCache(path, maxBytes);
+	} catch(runtime_error &) {
+		return NULL;
+	}
+}
+
+void destroyResultCache(ResultCache *cache) { delete cache; }
+
+bool flushResultCache(ResultCache *cache) {
+	try {
+		cache->flush();
+		return true;
+	} catch(runtime_error &) {
+		return false;
+	}
+}
+
+ulonglong getCacheHits(const ResultCache *cache) { return cache->getHits(); }
+ulonglong getCacheMisses(const ResultCache *cache) { return cache->getMisses(); }
+size_t getCacheSize(const ResultCache *cache) { return cache->size(); }
+ulonglong resultKey(const MSD *msd, const char *run, bool withSeed) { return ResultCache::key(*msd, run, withSeed); }
+
+bool loadResult(ResultCache *cache, ulonglong key, MSD *msd) {
+	string payload;
+	return cache->get(key, payload) && ResultCache::load(*msd, payload);
+}
+
+bool storeResult(ResultCache *cache, ulonglong key, const MSD *msd, size_t recordFrom) {
+	try {
+		cache->put(key, ResultCache::save(*msd, recordFrom));
+		return true;
+	} catch(runtime_error &) {
+		return false;
+	}
+}
+
+
+// StateLibrary Methods
+StateLibrary* createStateLibrary(const char *path) {
+	try {
+		return new StateLibrary(path);
+	} catch(runtime_error &) {
+		return NULL;
+	}
+}
+
+void destroyStateLibrary(StateLibrary *library) { delete library; }
+
+bool flushStateLibrary(StateLibrary *library) {
+	try {
+		library->flush();
+		return true;
+	} catch(runtime_error &) {
+		return false;
+	}
+}
+
+size_t getLibrarySize(const StateLibrary *library) { return library->size(); }
+
+bool storeState(StateLibrary *library, const MSD *msd) {
+	try {
+		library->store(*msd);
+		return true;
+	} catch(runtime_error &) {
+		return false;
+	}
+}
+
+bool warmStart(StateLibrary *library, MSD *msd, double *distance) {
+	try {
+		return library->warmStart(*msd, distance);
+	} catch(runtime_error &) {
+		return false;
+	}
+}
+
+
 // MolProto Methods
 MolProto* createMolProto_e() { return new MolProto(); }
 MolProto* createMolProto_n(size_t nodeCount) { return new MolProto(nodeCount); }
@@ -18,6 +18,8 @@
 #include "udc.h"
 #include "Vector.h"
 #include "MSD.h"
+#include "ResultCache.h"
+#include "StateLibrary.h"
 
 typedef unsigned char uchar;
 typedef unsigned int uint;
@@ -35,6 +37,8 @@ typedef MolProto::NodeIterable Nodes;
 typedef MolProto::EdgeIterable Edges;
 typedef MolProto::NodeIterator NodeIter;
 typedef MolProto::EdgeIterator EdgeIter;
+typedef udc::ResultCache ResultCache;
+typedef udc::StateLibrary StateLibrary;
 
 #define C extern "C"
 #define DLL __declspec(dllexport)
@@ -46,6 +50,8 @@ C DLL const MSD::MolProtoFactory * const CIRCULAR_MOL;
 
 C DLL const MSD::FlippingAlgorithm * const UP_DOWN_MODEL;
 C DLL const MSD::FlippingAlgorithm * const CONTINUOUS_SPIN_MODEL;
+C DLL const MSD::FlippingAlgorithm * const HEAT_BATH_MODEL;
+C DLL const MSD::FlippingAlgorithm * const CONE_MODEL;
 
 // MolProto Globals
 C DLL const char * const HEADER;
@@ -91,6 +97,9 @@ C DLL MSD* createMSD_d(
 		uint width, uint height, uint depth
 );
 
+// from a voxel mask file (see: MSD::VoxelMask), or NULL if it can't be read, or isn't a valid mask; molType may be NULL
+C DLL MSD* createMSD_m(const char *maskFile, const MSD::MolProtoFactory *molType, uint order);
+
 C DLL void destroyMSD(MSD *msd);
 
 C DLL const MSD::Results* getRecord(const MSD *msd);
@@ -122,6 +131,28 @@ C DLL void setFlux_v(MSD *msd, uint x, uint y, uint z, const Vector *flux);
 C DLL void setLocalM_i(MSD *msd, uint a, const Vector *spin, const Vector *flux);
 C DLL void setLocalM_v(MSD *msd, uint x, uint y, uint z, const Vector *spin, const Vector *flux);
 
+C DLL double getSiteWeight_i(const MSD *msd, uint a);
+C DLL double getSiteWeight_v(const MSD *msd, uint x, uint y, uint z);
+C DLL void setSiteWeight_i(MSD *msd, uint a, double weight);
+C DLL void setSiteWeight_v(MSD *msd, uint x, uint y, uint z, double weight);
+C DLL void setRegionWeights(MSD *msd, double weightL, double weightR, double weight_m);
+C DLL bool getSkipZeroSpins(const MSD *msd);
+C DLL void setSkipZeroSpins(MSD *msd, bool skip);
+C DLL uint getSiteOrder(const MSD *msd);
+C DLL void setSiteOrder(MSD *msd, uint order);
+C DLL uint getCapacity(const MSD *msd);
+C DLL unsigned long long estimateMemory(
+		uint width, uint height, uint depth,
+		uint molPosL, uint molPosR,
+		uint topL, uint bottomL, uint frontR, uint backR, uint order
+);
+C DLL bool hasAtom(const MSD *msd, uint x, uint y, uint z);
+C DLL bool hasVoxelMask(const MSD *msd);
+// see: MSD::setPeriodic; returns false (and changes nothing) if the axes aren't allowed
+C DLL bool setPeriodic(MSD *msd, uint axesL, uint axesR);
+C DLL uint getPeriodicL(const MSD *msd);
+C DLL uint getPeriodicR(const MSD *msd);
+
 C DLL uint getN(const MSD *msd);
 C DLL uint getNL(const MSD *msd);
 C DLL uint getNR(const MSD *msd);
@@ -153,6 +184,21 @@ C DLL void reinitialize(MSD *msd, bool reseed);
 C DLL void randomize(MSD *msd, bool reseed);
 C DLL void metropolis_o(MSD *msd, ulonglong N);
 C DLL void metropolis_r(MSD *msd, ulonglong N, ulonglong freq);
+C DLL void sweep_o(MSD *msd, ulonglong sweeps);
+C DLL void sweep_r(MSD *msd, ulonglong sweeps, ulonglong freq);
+C DLL ulonglong sweepLength(MSD *msd);
+C DLL double getSweeps(MSD *msd);
+C DLL uint getSweepMode(const MSD *msd);
+C DLL void setSweepMode(MSD *msd, uint mode);
+C DLL uint getBlockSize(const MSD *msd);
+C DLL void setBlockSize(MSD *msd, uint size);
+C DLL void tuneProposals(MSD *msd, ulonglong N, double targetRate);
+C DLL void nFoldWay_o(MSD *msd, ulonglong N);
+C DLL void nFoldWay_r(MSD *msd, ulonglong N, ulonglong freq);
+C DLL void getProposalSteps(const MSD *msd, double *L, double *R, double *m);
+C DLL void setProposalSteps(MSD *msd, double L, double R, double m);
+C DLL void getAcceptanceRates(const MSD *msd, double *L, double *R, double *m);
+C DLL void resetAcceptanceStats(MSD *msd);
 
 C DLL double specificHeat(const MSD *msd);
 C DLL double specificHeat_L(const MSD *msd);
@@ -187,6 +233,27 @@ C DLL double meanUmR(const MSD *msd);
 C DLL double meanULR(const MSD *msd);
 
 
+// ResultCache Methods
+C DLL ResultCache* createResultCache(const char *path, ulonglong maxBytes);  // NULL if path isn't a cache, or can't be created
+C DLL void destroyResultCache(ResultCache *cache);  // (flushes)
+C DLL bool flushResultCache(ResultCache *cache);
+C DLL ulonglong getCacheHits(const ResultCache *cache);
+C DLL ulonglong getCacheMisses(const ResultCache *cache);
+C DLL size_t getCacheSize(const ResultCache *cache);
+C DLL ulonglong resultKey(const MSD *msd, const char *run, bool withSeed);
+C DLL bool loadResult(ResultCache *cache, ulonglong key, MSD *msd);  // false on a miss
+C DLL bool storeResult(ResultCache *cache, ulonglong key, const MSD *msd, size_t recordFrom);
+
+
+// StateLibrary Methods
+C DLL StateLibrary* createStateLibrary(const char *path);  // NULL if path isn't a library, or can't be created
+C DLL void destroyStateLibrary(StateLibrary *library);  // (flushes)
+C DLL bool flushStateLibrary(StateLibrary *library);
+C DLL size_t getLibrarySize(const StateLibrary *library);
+C DLL bool storeState(StateLibrary *library, const MSD *msd);
+C DLL bool warmStart(StateLibrary *library, MSD *msd, double *distance);  // false if there's no state of the same shape
+
+
 // MolProto Methods
 C DLL MolProto* createMolProto_e();
 C DLL MolProto* createMolProto_n(size_t nodeCount);
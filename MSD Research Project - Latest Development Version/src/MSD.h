@@ -15,21 +15,27 @@
 
 #define UDC_MSD_VERSION "6.2a"
 
+#include <algorithm>
+#include <bitset>
+#include <climits>
 #include <cstdlib>
 #include <cmath>
 #include <ctime>
 #include <cstring>
 #include <exception>
 #include <functional>
+#include <future>
 #include <iostream>
 #include <memory>
 #include <random>
 #include <stdexcept>
 #include <string>
+#include <thread>
 #include <vector>
 #include "Vector.h"
 #include "udc.h"
 #include "SparseArray.h"
+#include "SumTree.h"
 
 
 namespace udc {
@@ -42,6 +48,7 @@ using std::istream;
 using std::ostream;
 using std::streampos;
 using std::out_of_range;
+using std::length_error;
 using std::ref;
 using std::string;
 using std::uniform_int_distribution;
@@ -55,6 +62,7 @@ using udc::PI;
 using udc::sq;
 using udc::Vector;
 using udc::SparseArray;
+using udc::SumTree;
 using udc::bread;
 using udc::bwrite;
 
@@ -488,9 +496,158 @@ class MSD {
 	 public:
 		MoleculeException(const char *message) : UDCException(message) {}
 	};
-	
+
+	/**
+	 * Step sizes used by CONE_MODEL for each region, in (0, 1]:
+	 * a spin moves to a (uniformly) random direction within a cone of half-angle (step * PI) around itself,
+	 * and a flux moves to a random point in a ball of radius (step * 2F) around itself.
+	 * Step size 1 proposes (almost) the same moves as CONTINUOUS_SPIN_MODEL.
+	 */
+	struct ProposalSteps {
+		double L, R, m;  // FM_L, FM_R, mol.
+
+		ProposalSteps();
+	};
+
+	/**
+	 * Number of metropolis steps tried and accepted in each region.
+	 * Rejections include moves which left the allowed flux ball (CONE_MODEL).
+	 */
+	struct AcceptanceStats {
+		unsigned long long triedL, triedR, triedm;
+		unsigned long long acceptedL, acceptedR, acceptedm;
+
+		AcceptanceStats();
+		double rate() const;  // for the whole device
+		double rateL() const;
+		double rateR() const;
+		double rate_m() const;
+	};
+
+	/**
+	 * The partial derivative of U with respect to each coupling, e.g. JmL = dU/dJmL = -sum(s_i * s_j) over the
+	 * mL bonds. Since U is linear in every coupling, U == sum(coupling * component) (using dot products for vectors).
+	 * The mol. components (Jm, Je0m, Am, etc.) are summed over every node or edge, i.e. they are derivatives with
+	 * respect to changing that parameter on all nodes or edges together. See: MSD::couplingEnergies
+	 */
+	struct CouplingEnergies {
+		Vector B;
+		double JL, JR, Jm, JmL, JmR, JLR;
+		double Je0L, Je0R, Je0m;
+		double Je1L, Je1R, Je1m, Je1mL, Je1mR, Je1LR;
+		double JeeL, JeeR, Jeem, JeemL, JeemR, JeeLR;
+		double bL, bR, bm, bmL, bmR, bLR;
+		Vector AL, AR, Am;
+		Vector DL, DR, Dm, DmL, DmR, DLR;
+
+		CouplingEnergies();  // all 0
+	};
+	typedef double CouplingEnergies::*Coupling;  // e.g. &MSD::CouplingEnergies::JmL
+
+	/**
+	 * A kT/B protocol for MSD::run: a list of stages, each of which does "steps" metropolis steps while kT and B
+	 * change linearly from (kT, B) at its first step to (kT_end, B_end) after its last step, i.e. step i uses
+	 * kT + (kT_end - kT) * i / steps. (A stage with kT == kT_end and B == B_end holds them constant.)
+	 * Within a stage, Results are pushed to record (and couplingRecord) exactly as metropolis(steps, freq) would,
+	 * with the kT and B of that moment, and onRecord is called with each.
+	 * The builders append stages for the common protocols (heat, magnetize, magnetize2) and return *this.
+	 */
+	struct Schedule {
+		enum Reset { NOOP, REINITIALIZE, RANDOMIZE };
+
+		struct Stage {
+			unsigned long long steps;
+			double kT, kT_end;
+			Vector B, B_end;
+			unsigned long long freq;  // 0 for no recording
+			Reset reset;  // done before the stage
+			bool clearRecord;  // (after reset) clear record and couplingRecord before the stage
+
+			Stage();  // 0 steps, kT = 0.25, B = 0, no recording, no reset
+		};
+
+		std::vector<Stage> stages;
+		std::function<void(size_t stage, const Results &)> onRecord;  // optional
+		std::function<void(size_t stage)> onStageEnd;  // optional
+
+		Schedule & hold(unsigned long long steps, double kT, const Vector &B, unsigned long long freq = 0);
+		Schedule & ramp(unsigned long long steps, double kT, double kT_end, const Vector &B, const Vector &B_end,
+				unsigned long long freq = 0);
+		// For each kT from kT_min to kT_max (or back down, if kT_inc < 0): an equilibration stage of t_eq steps,
+		// then a recorded stage of simCount steps. Every kT clears the record, and starts with the given reset.
+		Schedule & temperatureSteps(double kT_min, double kT_max, double kT_inc, const Vector &B,
+				unsigned long long t_eq, unsigned long long simCount, unsigned long long freq, Reset reset = NOOP);
+		// Same as temperatureSteps, but for each |B| from B_max down to B_min, then back up to B_max, along the
+		// direction given by the spherical angles theta and phi (in radians; see: Vector::sphericalForm).
+		Schedule & fieldSteps(double B_min, double B_max, double B_inc, double theta, double phi, double kT,
+				unsigned long long t_eq, unsigned long long simCount, unsigned long long freq, Reset reset = NOOP);
+		// One continuous ramp of |B| from B_from to B_to (along theta, phi), changing by about B_rate every step.
+		Schedule & fieldRamp(double B_from, double B_to, double B_rate, double theta, double phi, double kT,
+				unsigned long long freq = 0);
+		Schedule & repeat(unsigned int cycles);  // the stages so far are done "cycles" times in total, e.g. for hysteresis loops
+	};
+
+	/**
+	 * Order in which metropolis picks atoms (see: MSD::sweepMode). A sweep is one step for every atom that can be
+	 * picked (see: MSD::sweepLength). Every mode except RANDOM_SITE visits each atom exactly once per sweep.
+	 */
+	enum SweepMode {
+		RANDOM_SITE,         // each step picks an atom at random (see: MSD::setSiteWeight); the default
+		TYPEWRITER,          // memory order (see: MSD::setSiteOrder; x, then y, then z by default)
+		CHECKERBOARD,        // atoms with even x + y + z (in memory order), then odd ones
+		RANDOM_PERMUTATION,  // a new random order for every sweep
+		BLOCKED              // tile by tile (blockSize^3 atoms each), in memory order within each tile
+	};
+
+	/**
+	 * How atoms are laid out in memory, i.e. which index each (x, y, z) gets (see: MSD::setSiteOrder).
+	 * MORTON and HILBERT number the atoms along a space-filling curve, so that neighbors are (mostly) close in memory.
+	 */
+	enum SiteOrder {
+		ROW_MAJOR,  // index (z * height + y) * width + x; the default
+		MORTON,     // Z-order curve: the bits of x, y, and z interleaved
+		HILBERT,    // Hilbert curve: like MORTON, but consecutive atoms are always neighbors (within a power of 2 cube)
+		COMPACT     // row-major, but without the empty positions, so only atoms take memory (see: MSD::estimateMemory)
+	};
+
+	/**
+	 * Axes along which FM_L or FM_R wraps around (see: MSD::setPeriodic), combined with |. Each atom at an edge of
+	 * the region is then also bonded to the atom at the opposite edge, so a small FM behaves more like bulk. An axis
+	 * shorter than 3 atoms stays open, since its edges are already neighbors (or the same atom).
+	 */
+	enum PeriodicAxes {
+		OPEN = 0,        // the default
+		PERIODIC_X = 1,  // only for FM_L, when it's the whole device (no mol. or FM_R)
+		PERIODIC_Y = 2,
+		PERIODIC_Z = 4
+	};
+
+	/**
+	 * Region of every position in a device's bounding box, for MSDs which aren't the default box shape, e.g. tapered
+	 * or rounded leads, or leads with holes (see: MSD::MSD(const VoxelMask &, ...)). The regions keep their order
+	 * along x: every FM_L voxel must be left of every MOL voxel, and every FM_R voxel right of them. Each mol. is a
+	 * row (y, z) which is MOL for every x from the first to the last MOL column, or else has no MOL voxels.
+	 *
+	 * Text format (see: VoxelMask::read): "width height depth", then "depth" blocks of "height" rows of "width"
+	 * characters each ('.' EMPTY, 'L' FM_L, 'M' MOL, 'R' FM_R), separated by whitespace. '#' starts a comment.
+	 */
+	struct VoxelMask {
+		enum Label : unsigned char { EMPTY, FM_L, MOL, FM_R };
+
+		unsigned int width, height, depth;
+		std::vector<unsigned char> labels;  // Label of (x, y, z) at (z * height + y) * width + x
+
+		VoxelMask(unsigned int width = 0, unsigned int height = 0, unsigned int depth = 0);  // every voxel EMPTY
+		Label get(unsigned int x, unsigned int y, unsigned int z) const;
+		void set(unsigned int x, unsigned int y, unsigned int z, Label label);
+		static VoxelMask read(istream &in);  // throws invalid_argument if "in" isn't in the text format
+		ostream& write(ostream &out) const;  // in the text format
+	};
+
 	static const FlippingAlgorithm UP_DOWN_MODEL;
 	static const FlippingAlgorithm CONTINUOUS_SPIN_MODEL;
+	static const FlippingAlgorithm HEAT_BATH_MODEL;  // see: MSD::metropolis and MSD::heatBathSpin
+	static const FlippingAlgorithm CONE_MODEL;  // see: MSD::metropolis and MSD::ProposalSteps
 	
 	static const MolProtoFactory LINEAR_MOL;
 	static const MolProtoFactory CIRCULAR_MOL;
@@ -506,7 +663,8 @@ class MSD {
 	unsigned int width, height, depth;
 	unsigned int molPosL, molPosR;
 	unsigned int topL, bottomL, frontR, backR;  // "inner sizes/boundaries"
-	
+	unsigned int periodicL, periodicR;  // PeriodicAxes of FM_L and FM_R (see: MSD::setPeriodic)
+
 	MolProto molProto;                  // Contains the prototype for the molecule instances
 	SparseArray<shared_ptr<Mol>> mols;  // Contains the molecule instances. Uses the same indexing as spins and fluxes.
 	                                    // Note: Mol the same Mol object is pointed for all x where y,z remain constant.
@@ -526,6 +684,24 @@ class MSD {
 	unsigned long seed; //store seed so that every run can follow the same sequence
 	unsigned char seed_count; //to help keep seeds from repeating because of temporal proximity
 	
+	SiteOrder siteOrder;
+	std::vector<unsigned int> spreadX, spreadY, spreadZ;  // MORTON: index(x, y, z) == spreadX[x] | spreadY[y] | spreadZ[z]; else empty
+	std::vector<unsigned int> siteIndex;   // HILBERT: index of the atom at (z * height + y) * width + x (UINT_MAX if none); else empty
+	std::vector<unsigned int> rowStart;    // COMPACT: index of the first atom of each row, at z * height + y; else empty
+	std::vector<unsigned int> siteCoords;  // x, y, z of each index (3 per atom); empty for ROW_MAJOR
+	static unsigned long long curveKey(SiteOrder order, unsigned int x, unsigned int y, unsigned int z, unsigned int bits);  // position along the curve
+	static unsigned int curveBits(unsigned int width, unsigned int height, unsigned int depth);  // bits per coordinate of curveKey
+	unsigned long long layout(SiteOrder order);  // builds the tables for "order" (see: MSD::setSiteOrder), and returns the capacity
+	unsigned int rowAtoms(unsigned int y, unsigned int z) const;  // number of atoms with this (y, z)
+	unsigned int compactIndex(unsigned int x, unsigned int y, unsigned int z) const;  // index for COMPACT, or UINT_MAX if empty
+
+	// occupied positions, one bit per x (rowWords words per row, at z * height + y); empty for the default box shape
+	std::vector<unsigned long long> occupancy;
+	unsigned int rowWords;
+	bool inMask(unsigned int x, unsigned int y, unsigned int z) const;  // (x, y, z) is occupied, or there's no mask
+	unsigned int maskRank(unsigned int y, unsigned int z, unsigned int x) const;  // occupied positions before x in row (y, z)
+	static void checkMask(const VoxelMask &mask, unsigned int &molPosL, unsigned int &molPosR);  // see: MSD::VoxelMask
+
 	unsigned int index(unsigned int x, unsigned int y, unsigned int z) const;
 	unsigned int x(unsigned int a) const;
 	unsigned int y(unsigned int a) const;
@@ -533,28 +709,90 @@ class MSD {
 	
 	unsigned long genSeed(); //generates a new seed
 	
+	std::vector<unsigned int> cluster;  // scratch space for MSD::clusterFlip
+	std::vector<bool> inCluster;        // (same as above) uses the same indexing as spins and fluxes
+	unsigned int regionNeighbors(unsigned int a, unsigned int *neighbors, bool *after = NULL) const;  // neighbors of FM atom "a" in its own FM
+	bool hasMol(unsigned int y, unsigned int z) const;  // is there a mol. at this (y,z) position?
+	Vector localField(unsigned int a) const;  // coefficient of the linear part of U in spin "a"; see: MSD::overrelax
+	Vector heatBathSpin(const Vector &h, double S);  // samples a spin of magnitude S from the Boltzmann distribution in field h
+	static Vector aroundAxis(const Vector &k, double u, double phi);  // unit vector with cosine u to unit vector k, and azimuth phi
+	AcceptanceStats acceptanceStats;
+	
+	std::vector<double> siteWeights;  // see: MSD::setSiteWeight; uses the same indexing as spins and fluxes, or empty if all are 1
+	SumTree selection;  // selectionWeight of each atom, in the same order as "indices"; iff !uniformSelection
+	double selectionTotal;  // sum of the selectionWeight of every atom
+	bool uniformSelection;  // every atom has selectionWeight 1, so atoms are picked uniformly from "indices"
+	bool selectionDirty;  // the selection must be rebuilt (e.g. a spin became, or stopped being, 0)
+	bool selectionSkipsZero;  // skipZeroSpins when the selection was last built
+	bool selectionMacrospins;  // (macrospinFreq != 0) when the selection was last built
+	SweepMode selectionSweepMode;  // sweepMode when the selection was last built
+	unsigned int selectionBlockSize;  // blockSize when the selection was last built
+	unsigned long long selectableCount;  // number of atoms with selectionWeight > 0
+	std::vector<unsigned int> order;  // atoms with selectionWeight > 0, in sweepMode order; empty for RANDOM_SITE
+	size_t orderPos;  // (as above) position of the next atom
+	bool fmSelectable;  // (as above) some FM atom has selectionWeight > 0, so clusterFlip can pick a seed
+	double selectionWeight(unsigned int a) const;  // siteWeight of atom "a", or 0 if it's skipped (see: skipZeroSpins)
+	void updateSelection();  // rebuilds the selection, if needed
+	unsigned int pickSite();  // picks an atom with probability selectionWeight / selectionTotal (requires selectionTotal > 0)
+	unsigned int nextSite();  // the next atom of the sweep (see: sweepMode), or pickSite for RANDOM_SITE
+
+	std::vector< std::vector<unsigned int> > layers;  // MSD::macrospinSweep: the atoms of each layer (x) of FM_L and FM_R; built when first needed
+
+	SumTree flipRates;  // MSD::nFoldWay: flip probability of each atom, in the same order as "indices"
+	std::vector<unsigned int> ratePosition;  // (same as above) position in "indices" of each atom; uses the same indexing as spins and fluxes
+	std::vector<unsigned int> neighborScratch;
+	void neighborsOf(unsigned int a, std::vector<unsigned int> &neighbors) const;  // all atoms bonded to "a" (in any region)
+	double flipRate(unsigned int a);  // metropolis acceptance probability for flipping spin "a" (UP_DOWN_MODEL), and zeroing its flux
+	double heatBathFreeEnergy(const Vector &h, double S) const;  // kT * ln(Z(h)) (up to a constant) for heatBathSpin
+	template <typename Accept, typename Visit>
+	void metropolisSteps(unsigned long long N, Accept accept, Visit visit);  // see: MSD::metropolis
+	template <typename Visit>
+	void boltzmannSteps(unsigned long long N, Visit visit);  // metropolisSteps at fixed kT, with clusterFreq, overrelaxRatio, and macrospinFreq
+
 	MSD& operator=(const MSD&); //undefined, do not use!
 	MSD(const MSD &m); //undefined, do not use!
 
-	void init(const MolProtoFactory *molProtoFactory = NULL);
+	static void clampGeometry(unsigned int &width, unsigned int &height, unsigned int &depth,
+			unsigned int &molPosL, unsigned int &molPosR,
+			unsigned int &topL, unsigned int &bottomL, unsigned int &frontR, unsigned int &backR);
+	void init(const MolProtoFactory *molProtoFactory = NULL, SiteOrder order = ROW_MAJOR);
+	static unsigned long long memoryFor(unsigned int width, unsigned int height, unsigned int depth, unsigned long long n,
+			unsigned long long molRows, unsigned long long molLen, SiteOrder order);  // see: MSD::estimateMemory
 	
  public:
 	std::vector<Results> record;
 	FlippingAlgorithm flippingAlgorithm; //algorithm used to "flip" an atom in metropolis
+	unsigned long long clusterFreq;  // do one MSD::clusterFlip every "clusterFreq" steps in metropolis; 0 (default) disables
+	unsigned int overrelaxRatio;  // do "overrelaxRatio" MSD::overrelax sweeps every n (getN) steps in metropolis; 0 (default) disables
+	unsigned long long macrospinFreq;  // iff != 0, FM atoms are only moved by MSD::macrospinSweep, once every "macrospinFreq" steps in metropolis; 0 (default) disables
+	SweepMode sweepMode;  // order in which metropolis picks atoms; RANDOM_SITE by default
+	unsigned int blockSize;  // edge length of the tiles for BLOCKED sweepMode; 4 by default
+	ProposalSteps proposalSteps;  // only used by CONE_MODEL; see: MSD::tuneProposals
+	bool recordCouplings;  // also push couplingEnergies() to couplingRecord whenever Results are pushed to record; false by default
+	std::vector<CouplingEnergies> couplingRecord;  // (see above) cleared along with record by reinitialize and randomize
+	bool skipZeroSpins;  // atoms whose spin, flux, and F are 0 (e.g. vacancies) are never picked (see: MSD::setSiteWeight); true by default
 	
+	// "order" is the memory layout (see: MSD::setSiteOrder), e.g. COMPACT for huge MSDs which are mostly empty space
 	MSD(unsigned int width, unsigned int height, unsigned int depth,
 			const MolProto &molProto, unsigned int molPosL,
-			unsigned int topL, unsigned int bottomL, unsigned int frontR, unsigned int backR);
+			unsigned int topL, unsigned int bottomL, unsigned int frontR, unsigned int backR,
+			SiteOrder order = ROW_MAJOR);
 	MSD(unsigned int width, unsigned int height, unsigned int depth,
 			const MolProtoFactory &molType, unsigned int molPosL, unsigned int molPosR,
-			unsigned int topL, unsigned int bottomL, unsigned int frontR, unsigned int backR);
+			unsigned int topL, unsigned int bottomL, unsigned int frontR, unsigned int backR,
+			SiteOrder order = ROW_MAJOR);
 	MSD(unsigned int width, unsigned int height, unsigned int depth,
 			unsigned int molPosL, unsigned int molPosR,
-			unsigned int topL, unsigned int bottomL, unsigned int frontR, unsigned int backR);
+			unsigned int topL, unsigned int bottomL, unsigned int frontR, unsigned int backR,
+			SiteOrder order = ROW_MAJOR);
 	MSD(unsigned int width, unsigned int height, unsigned int depth,
 			unsigned int heightL, unsigned depthR);
 	MSD(unsigned int width, unsigned int height, unsigned int depth);
-	
+	// Any shape (see: MSD::VoxelMask); throws invalid_argument if the regions of "mask" are out of order, or a mol.
+	// row is incomplete. The mol. is from the first to the last MOL column, and topL, bottomL, frontR, and backR span
+	// the whole bounding box. COMPACT by default, so that only occupied voxels take memory.
+	MSD(const VoxelMask &mask, const MolProtoFactory &molType = LINEAR_MOL, SiteOrder order = COMPACT);
+
 	
 	Parameters getParameters() const;
 	void setParameters(const Parameters &);
@@ -579,7 +817,42 @@ class MSD {
 	void setFlux(unsigned int x, unsigned int y, unsigned int z, const Vector &);
 	void setLocalM(unsigned int a, const Vector &, const Vector &);
 	void setLocalM(unsigned int x, unsigned int y, unsigned int z, const Vector &, const Vector &);
-	
+
+	// Relative probability of picking atom "a" for a metropolis step (1 by default), e.g. to focus the steps on the mol.
+	// and its leads. 0 freezes the atom. See: MSD::metropolis
+	void setSiteWeight(unsigned int a, double weight);
+	void setSiteWeight(unsigned int x, unsigned int y, unsigned int z, double weight);
+	double getSiteWeight(unsigned int a) const;
+	double getSiteWeight(unsigned int x, unsigned int y, unsigned int z) const;
+	void setRegionWeights(double weightL, double weightR, double weight_m);  // the weight of every atom in FM_L, FM_R, and the mol.
+
+	// Renumbers every atom (see: MSD::SiteOrder). Atoms keep their state, weight, and place in the iteration order
+	// (MSD::begin), but indices ("a") from before the call are no longer valid.
+	void setSiteOrder(SiteOrder order);
+	SiteOrder getSiteOrder() const;  // ROW_MAJOR by default
+	unsigned int getCapacity() const;  // slots allocated for the atoms: getN() with HILBERT or COMPACT, more otherwise
+
+	// Bytes an MSD with this geometry and layout will allocate (not counting caches which are built later, e.g.
+	// for site weights or sweeps), so huge MSDs can be checked before constructing them.
+	static unsigned long long estimateMemory(unsigned int width, unsigned int height, unsigned int depth,
+			unsigned int molPosL, unsigned int molPosR,
+			unsigned int topL, unsigned int bottomL, unsigned int frontR, unsigned int backR,
+			SiteOrder order = ROW_MAJOR);
+	static unsigned long long estimateMemory(const VoxelMask &mask, SiteOrder order = COMPACT);
+
+	bool hasAtom(unsigned int x, unsigned int y, unsigned int z) const;  // is (x, y, z) in the MSD (and not empty space)?
+	bool hasVoxelMask() const;  // was the MSD constructed from a VoxelMask?
+
+	// Periodic boundaries (see: MSD::PeriodicAxes) of FM_L and FM_R; both are OPEN by default. Recalculates the
+	// Results. Throws invalid_argument for an unknown axis, or PERIODIC_X when it isn't allowed.
+	void setPeriodic(unsigned int axesL, unsigned int axesR);
+	unsigned int getPeriodicL() const;
+	unsigned int getPeriodicR() const;
+	// Coordinate next to "c" along axis 0, 1, or 2 (x, y, z) in FM_L (left) or FM_R: after it, or before it if !next.
+	// At the edge of the region it's the opposite edge if that axis is periodic, or else UINT_MAX. (Only bounds the
+	// region: the position may still be empty, see: MSD::hasAtom.)
+	unsigned int adjacent(bool left, unsigned int axis, unsigned int c, bool next) const;
+
 	unsigned int getN() const;
 	unsigned int getNL() const;
 	unsigned int getNR() const;
@@ -611,6 +884,26 @@ class MSD {
 	void randomize(bool reseed = true); //similar to reinitialize, but initial state is random
 	void metropolis(unsigned long long N);
 	void metropolis(unsigned long long N, unsigned long long freq);
+	void sweep(unsigned long long sweeps);  // metropolis(sweeps * sweepLength())
+	void sweep(unsigned long long sweeps, unsigned long long freq);  // metropolis(N, freq), with N and freq in sweeps
+	unsigned long long sweepLength();  // metropolis steps per sweep: the number of atoms metropolis can pick
+	double getSweeps();  // results.t in sweeps
+	void metropolis(unsigned long long N, const std::function<double(double)> &lnW, const std::function<void(const Results &)> &visit);  // generalized ensemble
+	void run(const Schedule &schedule);  // kT and B are left at their values after the last step
+	unsigned int clusterFlip();  // one Wolff (embedded reflection) cluster move in FM_L or FM_R. Returns the cluster size, or 0 if rejected.
+	unsigned int overrelax();  // one over-relaxation sweep over every atom. Returns the number of accepted reflections.
+	unsigned int macrospinSweep();  // one rigid rotation of each layer of FM_L and FM_R. Returns the number of accepted rotations.
+	void tuneProposals(unsigned long long N, double targetRate = 0.5);  // metropolis(N), while tuning proposalSteps
+	AcceptanceStats getAcceptanceStats() const;  // since construction, or the last call to resetAcceptanceStats
+	void resetAcceptanceStats();
+	void nFoldWay(unsigned long long N);  // rejection-free equivalent of metropolis(N) with UP_DOWN_MODEL, when all F == 0 and sweepMode == RANDOM_SITE
+	void nFoldWay(unsigned long long N, unsigned long long freq);  // same as metropolis(N, freq), but uses nFoldWay
+	
+	CouplingEnergies couplingEnergies() const;  // calculated from scratch: O(n)
+	// Fluctuation estimators from record and couplingRecord (matching the last entries of each, with equal weights):
+	double meanCoupling(Coupling) const;  // <dU/dc>
+	double dMeanU(Coupling) const;  // d<U>/dc = <dU/dc> - (<U dU/dc> - <U><dU/dc>) / kT
+	Vector dMeanM(Coupling) const;  // d<M>/dc = -(<M dU/dc> - <M><dU/dc>) / kT
 	
 	double specificHeat() const;
 	double specificHeat_L() const;
@@ -1327,7 +1620,7 @@ void Molecule::Instance::setLocalM(unsigned int a, const Vector &spin, const Vec
 		const auto &msdFluxes = msd.fluxes;
 
 		// left lead
-		if (a == prototype.leftLead && msd.FM_L_exists) {
+		if (a == prototype.leftLead && msd.FM_L_exists && msd.inMask(msd.molPosL - 1, y, z)) {
 			unsigned int a1 = msd.index(msd.molPosL - 1, y, z);
 			Vector neighbor_s = msdSpins[a1];
 			Vector neighbor_f = msdFluxes[a1];
@@ -1342,7 +1635,7 @@ void Molecule::Instance::setLocalM(unsigned int a, const Vector &spin, const Vec
 		}
 
 		// right lead
-		if (a == prototype.rightLead && msd.FM_R_exists) {
+		if (a == prototype.rightLead && msd.FM_R_exists && msd.inMask(msd.molPosR + 1, y, z)) {
 			unsigned int a1 = msd.index(msd.molPosR + 1, y, z);
 			Vector neighbor_s = msdSpins[a1];
 			Vector neighbor_f = msdFluxes[a1];
@@ -1388,6 +1681,122 @@ Molecule::Instance Molecule::instantiate(MSD &msd, unsigned int y, unsigned int
 }
 
 
+MSD::ProposalSteps::ProposalSteps() : L(1), R(1), m(1) {
+}
+
+MSD::CouplingEnergies::CouplingEnergies()
+: B(Vector::ZERO), JL(0), JR(0), Jm(0), JmL(0), JmR(0), JLR(0), Je0L(0), Je0R(0), Je0m(0),
+  Je1L(0), Je1R(0), Je1m(0), Je1mL(0), Je1mR(0), Je1LR(0), JeeL(0), JeeR(0), Jeem(0), JeemL(0), JeemR(0), JeeLR(0),
+  bL(0), bR(0), bm(0), bmL(0), bmR(0), bLR(0), AL(Vector::ZERO), AR(Vector::ZERO), Am(Vector::ZERO),
+  DL(Vector::ZERO), DR(Vector::ZERO), Dm(Vector::ZERO), DmL(Vector::ZERO), DmR(Vector::ZERO), DLR(Vector::ZERO) {
+}
+
+MSD::Schedule::Stage::Stage()
+: steps(0), kT(0.25), kT_end(0.25), B(Vector::ZERO), B_end(Vector::ZERO), freq(0), reset(NOOP), clearRecord(false) {
+}
+
+MSD::Schedule & MSD::Schedule::hold(unsigned long long steps, double kT, const Vector &B, unsigned long long freq) {
+	return ramp(steps, kT, kT, B, B, freq);
+}
+
+MSD::Schedule & MSD::Schedule::ramp(unsigned long long steps, double kT, double kT_end, const Vector &B,
+		const Vector &B_end, unsigned long long freq) {
+	Stage s;
+	s.steps = steps;
+	s.kT = kT;
+	s.kT_end = kT_end;
+	s.B = B;
+	s.B_end = B_end;
+	s.freq = freq;
+	stages.push_back(s);
+	return *this;
+}
+
+MSD::Schedule & MSD::Schedule::temperatureSteps(double kT_min, double kT_max, double kT_inc, const Vector &B,
+		unsigned long long t_eq, unsigned long long simCount, unsigned long long freq, Reset reset) {
+	auto add = [&](double kT) {
+		hold(t_eq, kT, B);
+		stages.back().reset = reset;
+		stages.back().clearRecord = true;
+		hold(simCount, kT, B, freq);
+	};
+	if( kT_inc > 0 ) {
+		for( double kT = kT_min; kT <= kT_max; kT += kT_inc )
+			add(kT);
+	} else if( kT_inc < 0 ) {
+		for( double kT = kT_max; kT >= kT_min; kT += kT_inc )
+			add(kT);
+	} else
+		throw invalid_argument("MSD::Schedule::temperatureSteps: kT_inc == 0");
+	return *this;
+}
+
+MSD::Schedule & MSD::Schedule::fieldSteps(double B_min, double B_max, double B_inc, double theta, double phi,
+		double kT, unsigned long long t_eq, unsigned long long simCount, unsigned long long freq, Reset reset) {
+	if( !(B_inc > 0) )
+		throw invalid_argument("MSD::Schedule::fieldSteps: B_inc <= 0");
+	auto add = [&](const Vector &B) {
+		hold(t_eq, kT, B);
+		stages.back().reset = reset;
+		stages.back().clearRecord = true;
+		hold(simCount, kT, B, freq);
+	};
+	Vector dB = Vector::sphericalForm(B_inc, theta, phi);
+	Vector B = Vector::sphericalForm(B_max, theta, phi);
+	for( double rho = B_max; rho > B_min; rho -= B_inc ) {
+		add(B);
+		B -= dB;
+	}
+	double B_max2 = B_max + B_inc / 2;  // to correct for floating point errors
+	B = Vector::sphericalForm(B_min, theta, phi);
+	for( double rho = B_min; rho <= B_max2; rho += B_inc ) {
+		add(B);
+		B += dB;
+	}
+	return *this;
+}
+
+MSD::Schedule & MSD::Schedule::fieldRamp(double B_from, double B_to, double B_rate, double theta, double phi,
+		double kT, unsigned long long freq) {
+	if( !(B_rate > 0) )
+		throw invalid_argument("MSD::Schedule::fieldRamp: B_rate <= 0");
+	unsigned long long steps = llround(abs(B_to - B_from) / B_rate);
+	return ramp(steps, kT, kT, Vector::sphericalForm(B_from, theta, phi), Vector::sphericalForm(B_to, theta, phi), freq);
+}
+
+MSD::Schedule & MSD::Schedule::repeat(unsigned int cycles) {
+	const size_t size = stages.size();
+	if( cycles == 0 )
+		stages.clear();
+	else
+		stages.reserve(size * cycles);  // (so stages[k] isn't invalidated by push_back)
+	for( unsigned int c = 1; c < cycles; c++ )
+		for( size_t k = 0; k < size; k++ )
+			stages.push_back(stages[k]);
+	return *this;
+}
+
+MSD::AcceptanceStats::AcceptanceStats()
+: triedL(0), triedR(0), triedm(0), acceptedL(0), acceptedR(0), acceptedm(0) {
+}
+
+double MSD::AcceptanceStats::rate() const {
+	unsigned long long tried = triedL + triedR + triedm;
+	return tried == 0 ? 0 : static_cast<double>(acceptedL + acceptedR + acceptedm) / tried;
+}
+
+double MSD::AcceptanceStats::rateL() const {
+	return triedL == 0 ? 0 : static_cast<double>(acceptedL) / triedL;
+}
+
+double MSD::AcceptanceStats::rateR() const {
+	return triedR == 0 ? 0 : static_cast<double>(acceptedR) / triedR;
+}
+
+double MSD::AcceptanceStats::rate_m() const {
+	return triedm == 0 ? 0 : static_cast<double>(acceptedm) / triedm;
+}
+
 MSD::Parameters::Parameters()
 : kT(0.25), B(Vector::ZERO),
   SL(1), SR(1), FL(0), FR(0),
@@ -1582,6 +1991,18 @@ const MSD::FlippingAlgorithm MSD::CONTINUOUS_SPIN_MODEL = [](const Vector &spin,
 	return Vector::sphericalForm( spin.norm(), 2 * PI * rand(), asin(2 * rand() - 1) );
 };
 
+// MSD::metropolis recognizes this model, and samples the new spin from its local field instead (see: MSD::heatBathSpin).
+// Called on its own (without a field) it is the same as CONTINUOUS_SPIN_MODEL, i.e. a heat-bath at infinite temperature.
+const MSD::FlippingAlgorithm MSD::HEAT_BATH_MODEL = [](const Vector &spin, function<double()> rand) {
+	return Vector::sphericalForm( spin.norm(), 2 * PI * rand(), asin(2 * rand() - 1) );
+};
+
+// MSD::metropolis recognizes this model, and proposes small (symmetric) moves instead (see: MSD::ProposalSteps).
+// Called on its own (without a step size) it is the same as CONTINUOUS_SPIN_MODEL, i.e. step size 1.
+const MSD::FlippingAlgorithm MSD::CONE_MODEL = [](const Vector &spin, function<double()> rand) {
+	return Vector::sphericalForm( spin.norm(), 2 * PI * rand(), asin(2 * rand() - 1) );
+};
+
 const MSD::MolProtoFactory MSD::LINEAR_MOL = [](unsigned int nodeCount) {
 	MolProto mol(nodeCount);
 	for (unsigned int i = 1; i < nodeCount; i++)
@@ -1606,19 +2027,169 @@ Vector MSD::initFlux = Vector::ZERO;
 
 
 unsigned int MSD::index(unsigned int x, unsigned int y, unsigned int z) const {
-	return (z * height + y) * width + x;
+	if( siteOrder == ROW_MAJOR )
+		return (z * height + y) * width + x;
+	if( siteOrder == MORTON )
+		return spreadX[x] | spreadY[y] | spreadZ[z];
+	if( siteOrder == HILBERT )
+		return siteIndex[(z * height + y) * width + x];
+	return compactIndex(x, y, z);
+}
+
+unsigned int MSD::compactIndex(unsigned int x, unsigned int y, unsigned int z) const {
+	if( !occupancy.empty() )
+		return hasAtom(x, y, z) ? rowStart[z * height + y] + maskRank(y, z, x) : UINT_MAX;
+	const bool left = topL <= y && y <= bottomL;
+	unsigned int offset;
+	if( x < molPosL ) {
+		if( !left )
+			return UINT_MAX;
+		offset = x;
+	} else if( x <= molPosR ) {
+		if( !hasMol(y, z) )
+			return UINT_MAX;
+		offset = (left ? molPosL : 0) + (x - molPosL);
+	} else {
+		if( z < frontR || z > backR )
+			return UINT_MAX;
+		offset = (left ? molPosL : 0) + (hasMol(y, z) ? molPosR - molPosL + 1 : 0) + (x - molPosR - 1);
+	}
+	return rowStart[z * height + y] + offset;
+}
+
+unsigned int MSD::rowAtoms(unsigned int y, unsigned int z) const {
+	if( !occupancy.empty() )
+		return maskRank(y, z, width);
+	return (topL <= y && y <= bottomL ? molPosL : 0)
+	     + (hasMol(y, z) ? molPosR - molPosL + 1 : 0)
+	     + (frontR <= z && z <= backR ? width - molPosR - 1 : 0);
+}
+
+bool MSD::inMask(unsigned int x, unsigned int y, unsigned int z) const {
+	return occupancy.empty()
+	    || ( occupancy[static_cast<size_t>(z * height + y) * rowWords + x / 64] >> (x % 64) & 1 ) != 0;
+}
+
+unsigned int MSD::maskRank(unsigned int y, unsigned int z, unsigned int x) const {
+	const unsigned long long *row = &occupancy[static_cast<size_t>(z * height + y) * rowWords];
+	unsigned int count = 0;
+	for( unsigned int w = 0; w < x / 64; w++ )
+		count += static_cast<unsigned int>( std::bitset<64>(row[w]).count() );
+	if( x % 64 != 0 )
+		count += static_cast<unsigned int>( std::bitset<64>(row[x / 64] & ((1ull << (x % 64)) - 1)).count() );
+	return count;
+}
+
+bool MSD::hasAtom(unsigned int x, unsigned int y, unsigned int z) const {
+	if( x >= width || y >= height || z >= depth )
+		return false;
+	if( x < molPosL )
+		return topL <= y && y <= bottomL && inMask(x, y, z);
+	if( x <= molPosR )
+		return hasMol(y, z);
+	return frontR <= z && z <= backR && inMask(x, y, z);
 }
 
+bool MSD::hasVoxelMask() const {
+	return !occupancy.empty();
+}
+
+void MSD::setPeriodic(unsigned int axesL, unsigned int axesR) {
+	const unsigned int all = PERIODIC_X | PERIODIC_Y | PERIODIC_Z;
+	if( (axesL & ~all) != 0 || (axesR & ~all) != 0 )
+		throw invalid_argument("MSD::setPeriodic: unknown axis");
+	if( (axesR & PERIODIC_X) != 0 || ((axesL & PERIODIC_X) != 0 && (mol_exists || FM_R_exists)) )
+		throw invalid_argument("MSD::setPeriodic: PERIODIC_X is only allowed for FM_L, when it's the whole device");
+	periodicL = axesL;
+	periodicR = axesR;
+	setParameters(parameters);  // (the FM bonds changed)
+}
+
+unsigned int MSD::getPeriodicL() const {
+	return periodicL;
+}
+
+unsigned int MSD::getPeriodicR() const {
+	return periodicR;
+}
+
+unsigned int MSD::adjacent(bool left, unsigned int axis, unsigned int c, bool next) const {
+	unsigned int first, last;
+	if( axis == 0 ) {
+		first = left ? 0 : molPosR + 1;
+		last = left ? molPosL - 1 : width - 1;
+	} else if( axis == 1 ) {
+		first = left ? topL : 0;
+		last = left ? bottomL : height - 1;
+	} else {
+		first = left ? 0 : frontR;
+		last = left ? depth - 1 : backR;
+	}
+	if( c != (next ? last : first) )
+		return next ? c + 1 : c - 1;
+	if( ((left ? periodicL : periodicR) >> axis & 1) == 0 || last - first < 2 )
+		return UINT_MAX;
+	return next ? first : last;
+}
+
+// Note: with a coordinate table, indices past the end give x == width (out of range), like unused indices
 unsigned int MSD::x(unsigned int a) const {
-	return a % width;
+	if( siteCoords.empty() )
+		return a % width;
+	return 3 * static_cast<size_t>(a) < siteCoords.size() ? siteCoords[3 * a] : width;
 }
 
 unsigned int MSD::y(unsigned int a) const {
-	return a % (width * height) / width;
+	if( siteCoords.empty() )
+		return a % (width * height) / width;
+	return 3 * static_cast<size_t>(a) < siteCoords.size() ? siteCoords[3 * a + 1] : 0;
 }
 
 unsigned int MSD::z(unsigned int a) const {
-	return a / (width * height);
+	if( siteCoords.empty() )
+		return a / (width * height);
+	return 3 * static_cast<size_t>(a) < siteCoords.size() ? siteCoords[3 * a + 2] : 0;
+}
+
+// Interleaves the lowest "bits" bits of x, y, and z (z first) for MORTON. For HILBERT, the coordinates are first
+// transformed as in J. Skilling, "Programming the Hilbert curve", AIP Conf. Proc. 707, 381 (2004).
+unsigned int MSD::curveBits(unsigned int width, unsigned int height, unsigned int depth) {
+	const unsigned int maxSize = std::max(width, std::max(height, depth));
+	unsigned int bits = 1;
+	while( (1ull << bits) < maxSize )
+		bits++;
+	return bits;
+}
+
+unsigned long long MSD::curveKey(SiteOrder order, unsigned int x, unsigned int y, unsigned int z, unsigned int bits) {
+	unsigned int X[3] = { z, y, x };
+	if( order == HILBERT ) {
+		const unsigned int M = 1u << (bits - 1);
+		for( unsigned int Q = M; Q > 1; Q >>= 1 ) {  // inverse undo
+			const unsigned int P = Q - 1;
+			for( int i = 0; i < 3; i++ )
+				if( X[i] & Q ) {
+					X[0] ^= P;
+				} else {
+					const unsigned int t = (X[0] ^ X[i]) & P;
+					X[0] ^= t;
+					X[i] ^= t;
+				}
+		}
+		for( int i = 1; i < 3; i++ )  // Gray encode
+			X[i] ^= X[i - 1];
+		unsigned int t = 0;
+		for( unsigned int Q = M; Q > 1; Q >>= 1 )
+			if( X[2] & Q )
+				t ^= Q - 1;
+		for( int i = 0; i < 3; i++ )
+			X[i] ^= t;
+	}
+	unsigned long long key = 0;
+	for( unsigned int b = bits; b-- > 0; )
+		for( int i = 0; i < 3; i++ )
+			key = (key << 1) | ((X[i] >> b) & 1);
+	return key;
 }
 
 
@@ -1628,10 +2199,209 @@ unsigned long MSD::genSeed() {
 	     | ( (static_cast<unsigned long>(seed_count++) & 0xFF) );
 }
 
+// Stores the indices of the (up to 6) nearest-neighbors of FM atom "a" that are in the same FM region as "a"
+// into the given array, and returns how many were found. If "after" isn't NULL, after[k] is set to whether neighbor k
+// comes after "a" along its axis (i.e. the DMI term is D * (m_a x m_k)), which across a periodic boundary (see:
+// MSD::setPeriodic) isn't the same as having the larger index. Used by MSD::clusterFlip and MSD::localField.
+unsigned int MSD::regionNeighbors(unsigned int a, unsigned int *neighbors, bool *after) const {
+	const unsigned int c[3] = { this->x(a), this->y(a), this->z(a) };
+	const bool left = c[0] < molPosL;
+	unsigned int count = 0;
+	for( unsigned int axis = 0; axis < 3; axis++ )
+		for( int next = 0; next < 2; next++ ) {
+			unsigned int n[3] = { c[0], c[1], c[2] };
+			n[axis] = adjacent(left, axis, c[axis], next != 0);
+			if( n[axis] == UINT_MAX || !inMask(n[0], n[1], n[2]) )
+				continue;  // (a VoxelMask may leave the position empty)
+			if( after != NULL )
+				after[count] = next != 0;
+			neighbors[count++] = index(n[0], n[1], n[2]);
+		}
+	return count;
+}
 
-// Note: "molProtoFactory" is a pointer so that it can be NULL
-void MSD::init(const MolProtoFactory *molProtoFactory) {
-	// preconditions:
+bool MSD::hasMol(unsigned int y, unsigned int z) const {
+	if( !occupancy.empty() )
+		return mol_exists && inMask(molPosL, y, z);
+	return mol_exists && (((y == topL || y == bottomL) && (frontR <= z && z <= backR)) || ((z == frontR || z == backR) && (topL <= y && y <= bottomL)));
+}
+
+// Returns h such that U = -h * s_a + (terms independent of, or non-linear in, s_a).
+// h includes B, the local flux (Je0), and all the J, Je1, and D (DMI) terms from the neighbors of "a".
+// The anisotropy (A) and biquadratic (b) terms are not linear in s_a, and aren't included.
+// Note: D * (m_i x m_j) == s_i * (m_j x D) == s_j * (D x m_i)
+Vector MSD::localField(unsigned int a) const {
+	unsigned int x = this->x(a);
+	unsigned int y = this->y(a);
+	unsigned int z = this->z(a);
+	Vector h = parameters.B;
+
+	// ----- mol. -----
+	if( molPosL <= x && x <= molPosR ) {
+		const Mol &mol = *mols[a];
+		const unsigned int n = x - molPosL;
+		const Molecule::Node &node = molProto.nodes[n];
+		h += node.parameters.Je0m * mol.fluxes[n];
+		for (const Molecule::Edge &edge : node.neighbors) {
+			if (edge.nodeIndex == n)
+				continue;  // loops don't contribute to the energy
+			const Molecule::EdgeParameters &edgeParams = molProto.edgeParameters[edge.edgeIndex];
+			Vector neighbor_s = mol.spins[edge.nodeIndex];
+			Vector neighbor_f = mol.fluxes[edge.nodeIndex];
+			h += edgeParams.Jm * neighbor_s + edgeParams.Je1m * neighbor_f
+			   + edge.direction * (neighbor_s + neighbor_f).crossProduct(edgeParams.Dm);
+		}
+		if( n == molProto.leftLead && FM_L_exists && inMask(molPosL - 1, y, z) ) {
+			unsigned int a1 = index(molPosL - 1, y, z);
+			h += parameters.JmL * spins[a1] + parameters.Je1mL * fluxes[a1] + parameters.DmL.crossProduct(spins[a1] + fluxes[a1]);
+		}
+		if( n == molProto.rightLead && FM_R_exists && inMask(molPosR + 1, y, z) ) {
+			unsigned int a1 = index(molPosR + 1, y, z);
+			h += parameters.JmR * spins[a1] + parameters.Je1mR * fluxes[a1] + (spins[a1] + fluxes[a1]).crossProduct(parameters.DmR);
+		}
+		return h;
+	}
+
+	// ----- FM_L or FM_R -----
+	const bool left = x < molPosL;
+	const double J = left ? parameters.JL : parameters.JR;
+	const double Je1 = left ? parameters.Je1L : parameters.Je1R;
+	const Vector &D = left ? parameters.DL : parameters.DR;
+	h += (left ? parameters.Je0L : parameters.Je0R) * fluxes[a];
+
+	unsigned int neighbors[6];
+	bool after[6];
+	const unsigned int count = regionNeighbors(a, neighbors, after);
+	for( unsigned int k = 0; k < count; k++ ) {
+		const unsigned int a1 = neighbors[k];
+		Vector neighbor_m = spins[a1] + fluxes[a1];
+		h += J * spins[a1] + Je1 * fluxes[a1] + (after[k] ? neighbor_m.crossProduct(D) : D.crossProduct(neighbor_m));
+	}
+
+	if( left && x + 1 == molPosL ) {
+		if( hasMol(y, z) ) {
+			const Mol &mol = *mols[index(molPosL, y, z)];
+			Vector neighbor_s = mol.spins[molProto.leftLead];
+			Vector neighbor_f = mol.fluxes[molProto.leftLead];
+			h += parameters.JmL * neighbor_s + parameters.Je1mL * neighbor_f + (neighbor_s + neighbor_f).crossProduct(parameters.DmL);
+		}
+		if( FM_R_exists && frontR <= z && z <= backR && inMask(molPosR + 1, y, z) ) {
+			unsigned int a1 = index(molPosR + 1, y, z);
+			h += parameters.JLR * spins[a1] + parameters.Je1LR * fluxes[a1] + (spins[a1] + fluxes[a1]).crossProduct(parameters.DLR);
+		}
+	} else if( !left && x - 1 == molPosR ) {
+		if( hasMol(y, z) ) {
+			const Mol &mol = *mols[index(molPosL, y, z)];
+			Vector neighbor_s = mol.spins[molProto.rightLead];
+			Vector neighbor_f = mol.fluxes[molProto.rightLead];
+			h += parameters.JmR * neighbor_s + parameters.Je1mR * neighbor_f + parameters.DmR.crossProduct(neighbor_s + neighbor_f);
+		}
+		if( FM_L_exists && topL <= y && y <= bottomL && inMask(molPosL - 1, y, z) ) {
+			unsigned int a1 = index(molPosL - 1, y, z);
+			h += parameters.JLR * spins[a1] + parameters.Je1LR * fluxes[a1] + parameters.DLR.crossProduct(spins[a1] + fluxes[a1]);
+		}
+	}
+	return h;
+}
+
+// Samples a spin, s, with |s| = S from the density exp(h * s / kT) on the sphere.
+// u = cos(angle between s and h) has density proportional to exp(x u) on [-1, 1], where x = S |h| / kT,
+// and is sampled by inverting its CDF; the azimuth is uniform.
+Vector MSD::heatBathSpin(const Vector &h, double S) {
+	double hNorm = h.norm();
+	double x = parameters.kT > 0 ? S * hNorm / parameters.kT : (hNorm > 0 ? INFINITY : 0);
+	double u;
+	if( x < 1e-8 )
+		u = 2 * rand(prng) - 1;  // (almost) no field: uniform
+	else if( x == INFINITY )
+		u = 1;  // kT == 0: align with the field
+	else {
+		u = 1 + log1p(rand(prng) * expm1(-2 * x)) / x;
+		if( u < -1 )
+			u = -1;  // (round-off)
+	}
+
+	return S * aroundAxis(hNorm > 0 ? h * (1 / hNorm) : Vector::J, u, 2 * PI * rand(prng));
+}
+
+Vector MSD::aroundAxis(const Vector &k, double u, double phi) {
+	Vector i = k.crossProduct(k.x * k.x < 0.81 ? Vector::I : Vector::J).normalize();
+	Vector j = k.crossProduct(i);
+	double v = sqrt(1 - u * u);
+	return u * k + (v * cos(phi)) * i + (v * sin(phi)) * j;
+}
+
+// kT * ln( sinh(x) / x ), where x = S |h| / kT. The limit as kT -> 0 is S |h|.
+double MSD::heatBathFreeEnergy(const Vector &h, double S) const {
+	double e = S * h.norm();
+	if( parameters.kT <= 0 )
+		return e;
+	double x = e / parameters.kT;
+	if( x < 1e-6 )
+		return parameters.kT * x * x / 6;
+	return parameters.kT * ( x + log1p(-exp(-2 * x)) - log(2 * x) );
+}
+
+
+// Stores the indices of every atom which shares a bond (in any region, including the leads and LR) with atom "a".
+void MSD::neighborsOf(unsigned int a, std::vector<unsigned int> &neighbors) const {
+	neighbors.clear();
+	unsigned int x = this->x(a);
+	unsigned int y = this->y(a);
+	unsigned int z = this->z(a);
+
+	if( molPosL <= x && x <= molPosR ) {  // mol.
+		const unsigned int n = x - molPosL;
+		for (const Molecule::Edge &edge : molProto.nodes[n].neighbors)
+			if (edge.nodeIndex != n)
+				neighbors.push_back(index(molPosL + edge.nodeIndex, y, z));
+		if( n == molProto.leftLead && FM_L_exists && inMask(molPosL - 1, y, z) )
+			neighbors.push_back(index(molPosL - 1, y, z));
+		if( n == molProto.rightLead && FM_R_exists && inMask(molPosR + 1, y, z) )
+			neighbors.push_back(index(molPosR + 1, y, z));
+		return;
+	}
+
+	unsigned int buf[6];
+	unsigned int count = regionNeighbors(a, buf);
+	neighbors.insert(neighbors.end(), buf, buf + count);
+	if( x + 1 == molPosL ) {  // FM_L, next to the mol.
+		if( hasMol(y, z) )
+			neighbors.push_back(index(molPosL + molProto.leftLead, y, z));
+		if( FM_R_exists && frontR <= z && z <= backR && inMask(molPosR + 1, y, z) )
+			neighbors.push_back(index(molPosR + 1, y, z));
+	} else if( x == molPosR + 1 ) {  // FM_R, next to the mol.
+		if( hasMol(y, z) )
+			neighbors.push_back(index(molPosL + molProto.rightLead, y, z));
+		if( FM_L_exists && topL <= y && y <= bottomL && inMask(molPosL - 1, y, z) )
+			neighbors.push_back(index(molPosL - 1, y, z));
+	}
+}
+
+// Since A and b are even in s_a, only the linear terms change when a spin with no flux is flipped: dU = 2 h * s_a.
+// Otherwise (e.g. after randomize) the trial move is made, and undone.
+double MSD::flipRate(unsigned int a) {
+	Vector s = getSpin(a);
+	Vector f = getFlux(a);
+	double dU;
+	if( f.normSq() == 0 ) {
+		dU = 2 * (localField(a) * s);
+	} else {
+		const Results r = results;
+		setLocalM(a, -s, Vector::ZERO);
+		dU = results.U - r.U;
+		setLocalM(a, s, f);
+		results = r;
+	}
+	if( dU <= 0 )
+		return 1;
+	return parameters.kT > 0 ? pow( E, -dU / parameters.kT ) : 0;
+}
+
+
+void MSD::clampGeometry(unsigned int &width, unsigned int &height, unsigned int &depth,
+		unsigned int &molPosL, unsigned int &molPosR,
+		unsigned int &topL, unsigned int &bottomL, unsigned int &frontR, unsigned int &backR) {
 	if (width == 0)         width = 1;
 	if (height == 0)        height = 1;
 	if (depth == 0)         depth = 1;
@@ -1644,78 +2414,197 @@ void MSD::init(const MolProtoFactory *molProtoFactory) {
 	if (backR >= depth)     backR = depth - 1;
 	if (frontR > depth)     frontR = depth;
 	if (backR < frontR)     backR = frontR - 1;
+}
+
+// Finds the mol. columns, [molPosL, molPosR], of "mask" (or an empty range where FM_L ends, if there are no MOL voxels),
+// and throws invalid_argument unless every FM_L voxel is left of them, every FM_R voxel is right of them, and every
+// row (y, z) is either MOL in all of them, or in none.
+void MSD::checkMask(const VoxelMask &mask, unsigned int &molPosL, unsigned int &molPosR) {
+	if( mask.width == 0 || mask.height == 0 || mask.depth == 0
+	    || mask.labels.size() != static_cast<size_t>(mask.width) * mask.height * mask.depth )
+		throw invalid_argument("MSD::VoxelMask: the mask must have width * height * depth > 0 labels");
+	unsigned int endL = 0, firstM = UINT_MAX, endM = 0, firstR = UINT_MAX;  // x range of each region
+	size_t c = 0;
+	for( unsigned int z = 0; z < mask.depth; z++ )
+		for( unsigned int y = 0; y < mask.height; y++ )
+			for( unsigned int x = 0; x < mask.width; x++ ) {
+				const unsigned char label = mask.labels[c++];
+				if( label == VoxelMask::FM_L ) {
+					endL = std::max(endL, x + 1);
+				} else if( label == VoxelMask::MOL ) {
+					firstM = std::min(firstM, x);
+					endM = std::max(endM, x + 1);
+				} else if( label == VoxelMask::FM_R ) {
+					firstR = std::min(firstR, x);
+				} else if( label != VoxelMask::EMPTY ) {
+					throw invalid_argument("MSD::VoxelMask: invalid label");
+				}
+			}
+	if( endL == 0 && endM == 0 )
+		throw invalid_argument("MSD::VoxelMask: the mask needs FM_L or MOL voxels (label a lone lead FM_L)");
+	molPosL = endM != 0 ? firstM : endL;
+	molPosR = endM != 0 ? endM - 1 : molPosL - 1;
+	if( endL > molPosL || firstR <= molPosR )
+		throw invalid_argument("MSD::VoxelMask: FM_L must be left of the mol., and FM_R right of it");
+	if( endM != 0 )
+		for( unsigned int z = 0; z < mask.depth; z++ )
+			for( unsigned int y = 0; y < mask.height; y++ ) {
+				unsigned int count = 0;
+				for( unsigned int x = molPosL; x <= molPosR; x++ )
+					count += mask.get(x, y, z) == VoxelMask::MOL;
+				if( count != 0 && count != molPosR - molPosL + 1 )
+					throw invalid_argument("MSD::VoxelMask: every mol. must be MOL from the first to the last MOL column");
+			}
+}
 
-	spins.resize(width * height * depth);
-	fluxes.resize(width * height * depth);
+// Note: "molProtoFactory" is a pointer so that it can be NULL
+void MSD::init(const MolProtoFactory *molProtoFactory, SiteOrder order) {
+	// preconditions:
+	clampGeometry(width, height, depth, molPosL, molPosR, topL, bottomL, frontR, backR);
+	if( occupancy.empty() )
+		rowWords = 0;
+	periodicL = periodicR = OPEN;
 
 	FM_L_exists = (molPosL != 0);
 	FM_R_exists = (molPosR + 1 < width);
 	mol_exists = (molPosL <= molPosR);
 
-	if (mol_exists) {
-		mols.resize(width * height * depth);
-		if (molProtoFactory != NULL)
-			molProto = (*molProtoFactory)(molPosR - molPosL + 1);
-	}
+	if (mol_exists && molProtoFactory != NULL)
+		molProto = (*molProtoFactory)(molPosR - molPosL + 1);
 
 	seed = genSeed();
 	prng.seed(seed);
 	
-	n = nL = nR = n_m = n_mL = n_mR = nLR = 0;
-	unsigned int a;
-	for( unsigned int z = 0; z < depth; z++ )
-		for( unsigned int y = 0; y < height; y++ ) {
+	// ----- count the atoms in each row (y, z) -----
+	if( static_cast<unsigned long long>(height) * depth > UINT_MAX )
+		throw length_error("MSD: height * depth must be < 2^32");
+	const unsigned int rows = height * depth;
+	std::vector<unsigned int> first(rows);  // position in "indices" of the first atom of each row
+	unsigned long long count[7] = { 0 };  // n, nL, nR, n_m, n_mL, n_mR, nLR
+	for( unsigned int r = 0; r < rows; r++ ) {
+		const unsigned int y = r % height, z = r / height;
+		first[r] = static_cast<unsigned int>(count[0]);
+		if( !occupancy.empty() ) {  // (the leads' boundaries count the atoms next to the mol. and to the other lead)
+			const unsigned int l = maskRank(y, z, molPosL), all = maskRank(y, z, width);
+			const unsigned int m = hasMol(y, z) ? molPosR - molPosL + 1 : 0;
+			const bool edgeL = FM_L_exists && inMask(molPosL - 1, y, z), edgeR = FM_R_exists && inMask(molPosR + 1, y, z);
+			count[0] += all;
+			count[1] += l;
+			count[2] += all - l - m;
+			count[3] += m;
+			count[4] += (edgeL && mol_exists) + (m != 0 && FM_L_exists);
+			count[5] += (edgeR && mol_exists) + (m != 0 && FM_R_exists);
+			count[6] += (edgeL && FM_R_exists) + (edgeR && FM_L_exists);
+			continue;
+		}
+		if( FM_L_exists && topL <= y && y <= bottomL ) {
+			count[0] += molPosL;
+			count[1] += molPosL;
+			count[4] += mol_exists;
+			count[6] += FM_R_exists;
+		}
+		if( hasMol(y, z) ) {
+			count[0] += molPosR - molPosL + 1;
+			count[3] += molPosR - molPosL + 1;
+			count[4] += FM_L_exists;
+			count[5] += FM_R_exists;
+		}
+		if( FM_R_exists && frontR <= z && z <= backR ) {
+			count[0] += width - molPosR - 1;
+			count[2] += width - molPosR - 1;
+			count[5] += mol_exists;
+			count[6] += FM_L_exists;
+		}
+	}
+	if( count[0] > UINT_MAX )
+		throw length_error("MSD: more than 2^32 - 1 atoms");
+	unsigned int *counts[] = { &n, &nL, &nR, &n_m, &n_mL, &n_mR, &nLR };
+	for( int i = 0; i < 7; i++ )
+		*counts[i] = static_cast<unsigned int>(count[i]);
+
+	// ----- allocate (everything above is cheap, and checked) -----
+	const unsigned long long capacity = layout(order);
+	siteOrder = order;
+	spins.resize(capacity);
+	fluxes.resize(capacity);
+	if (mol_exists)
+		mols.resize(capacity);
+	indices.resize(n);
+
+	// ----- fill the rows; in parallel (by blocks of rows) for large MSDs -----
+	auto fill = [this, &first](unsigned int r0, unsigned int r1) {
+		std::vector<unsigned int> molIndices;
+		for( unsigned int r = r0; r < r1; r++ ) {
+			const unsigned int y = r % height, z = r / height;
+			unsigned int i = first[r];
 			// left
-			for( unsigned int x = 0; x < molPosL; x++ )
-				if (topL <= y && y <= bottomL) {
-					a = index(x, y, z);
-					indices.push_back(a);
+			if (topL <= y && y <= bottomL)
+				for( unsigned int x = 0; x < molPosL; x++ ) {
+					if( !inMask(x, y, z) )
+						continue;
+					const unsigned int a = index(x, y, z);
+					indices[i++] = a;
 					spins[a] = initSpin;
 					fluxes[a] = initFlux;
-					n++;
-					nL++;
-					if (x + 1 == molPosL) {
-						if (mol_exists)
-							n_mL++;
-						if (FM_R_exists)
-							nLR++;
-					}
 				}
 			// mol
-			if( mol_exists && (((y == topL || y == bottomL) && (frontR <= z && z <= backR)) || ((z == frontR || z == backR) && (topL <= y && y <= bottomL))) ) {
+			if( hasMol(y, z) ) {
 				shared_ptr<Mol> mol = shared_ptr<Mol>(new Mol(molProto, *this, y, z, initSpin, initFlux));
-				unique_mol_indices.push_back(index(molPosL, y, z));  // store the indices for all unique Mol (Molecule::Instance) objects
+				molIndices.push_back(index(molPosL, y, z));  // store the indices for all unique Mol (Molecule::Instance) objects
 				for( unsigned int x = molPosL; x <= molPosR; x++ ) {
-					a = index(x, y, z);
-					indices.push_back(a);
+					const unsigned int a = index(x, y, z);
+					indices[i++] = a;
 					mols[a] = mol;
-					n++;
-					n_m++;
-					if (x == molPosL && FM_L_exists)
-						n_mL++;
-					if (x == molPosR && FM_R_exists)
-						n_mR++;
 				}
 			}
 			// right
-			for( unsigned int x = molPosR + 1; x < width; x++ )
-				if (frontR <= z && z <= backR) {
-					a = index(x, y, z);
-					indices.push_back(a);
+			if (frontR <= z && z <= backR)
+				for( unsigned int x = molPosR + 1; x < width; x++ ) {
+					if( !inMask(x, y, z) )
+						continue;
+					const unsigned int a = index(x, y, z);
+					indices[i++] = a;
 					spins[a] = initSpin;
 					fluxes[a] = initFlux;
-					n++;
-					nR++;
-					if (x == molPosR + 1) {
-						if (mol_exists)
-							n_mR++;
-						if (FM_L_exists)
-							nLR++;
-					}
 				}
 		}
+		return molIndices;
+	};
+	const unsigned int T = capacity < (1u << 20) ? 1 : std::max(1u, std::min(std::thread::hardware_concurrency(), rows));
+	if( T == 1 ) {
+		unique_mol_indices = fill(0, rows);
+	} else {
+		std::vector< std::future< std::vector<unsigned int> > > pool;
+		for( unsigned int t = 0; t < T; t++ )
+			pool.push_back( std::async(std::launch::async, fill,
+					static_cast<unsigned int>(static_cast<unsigned long long>(rows) * t / T),
+					static_cast<unsigned int>(static_cast<unsigned long long>(rows) * (t + 1) / T)) );
+		for( auto &p : pool ) {
+			std::vector<unsigned int> molIndices = p.get();
+			unique_mol_indices.insert(unique_mol_indices.end(), molIndices.begin(), molIndices.end());
+		}
+	}
 	
 	flippingAlgorithm = CONTINUOUS_SPIN_MODEL; // set default "flipping" algorithm
+	clusterFreq = 0;  // no cluster moves by default
+	proposalSteps = ProposalSteps();
+	acceptanceStats = AcceptanceStats();
+	overrelaxRatio = 0;  // no over-relaxation by default
+	macrospinFreq = 0;  // every FM atom is simulated by default
+	sweepMode = RANDOM_SITE;
+	blockSize = 4;
+	recordCouplings = false;
+	skipZeroSpins = true;
+	selectionTotal = 0;
+	uniformSelection = true;
+	selectionDirty = true;
+	selectionSkipsZero = true;
+	selectionMacrospins = false;
+	selectionSweepMode = RANDOM_SITE;
+	selectionBlockSize = 4;
+	selectableCount = 0;
+	orderPos = 0;
+	fmSelectable = false;
 
 	setParameters(parameters); // calculate initial state ("Results") for FM sections
 	setMolProto(molProto);     // calculate initial state ("Results") for mol. section
@@ -1723,32 +2612,32 @@ void MSD::init(const MolProtoFactory *molProtoFactory) {
 
 MSD::MSD(unsigned int width, unsigned int height, unsigned int depth,
 		const MolProto &molProto, unsigned int molPosL,
-		unsigned int topL, unsigned int bottomL, unsigned int frontR, unsigned int backR)
+		unsigned int topL, unsigned int bottomL, unsigned int frontR, unsigned int backR, SiteOrder order)
 : width(width), height(height), depth(depth),
 		molPosL(molPosL), molPosR(molPosL + molProto.nodeCount() - 1),
 		topL(topL), bottomL(bottomL), frontR(frontR), backR(backR), molProto(molProto)
 {
-	init();
+	init(NULL, order);
 }
 
 MSD::MSD(unsigned int width, unsigned int height, unsigned int depth,
 			const MolProtoFactory &molType, unsigned int molPosL, unsigned int molPosR,
-			unsigned int topL, unsigned int bottomL, unsigned int frontR, unsigned int backR)
+			unsigned int topL, unsigned int bottomL, unsigned int frontR, unsigned int backR, SiteOrder order)
 : width(width), height(height), depth(depth),
 		molPosL(molPosL), molPosR(molPosR),
 		topL(topL), bottomL(bottomL), frontR(frontR), backR(backR)
 {
-	init(&molType);
+	init(&molType, order);
 }
 
 MSD::MSD(unsigned int width, unsigned int height, unsigned int depth,
 		unsigned int molPosL, unsigned int molPosR,
-		unsigned int topL, unsigned int bottomL, unsigned int frontR, unsigned int backR)
+		unsigned int topL, unsigned int bottomL, unsigned int frontR, unsigned int backR, SiteOrder order)
 : width(width), height(height), depth(depth),
 		molPosL(molPosL), molPosR(molPosR),
 		topL(topL), bottomL(bottomL), frontR(frontR), backR(backR)
 {
-	init(&LINEAR_MOL);
+	init(&LINEAR_MOL, order);
 }
 
 
@@ -1771,6 +2660,94 @@ MSD::MSD(unsigned int width, unsigned int height, unsigned int depth)
 	init(&LINEAR_MOL);
 }
 
+MSD::MSD(const VoxelMask &mask, const MolProtoFactory &molType, SiteOrder order)
+: width(mask.width), height(mask.height), depth(mask.depth), molPosL(0), molPosR(0),
+		topL(0), bottomL(mask.height - 1), frontR(0), backR(mask.depth - 1)
+{
+	checkMask(mask, molPosL, molPosR);
+	if( static_cast<unsigned long long>(height) * depth > UINT_MAX )
+		throw length_error("MSD: height * depth must be < 2^32");
+	const unsigned int rows = height * depth;
+	rowWords = (width - 1) / 64 + 1;
+	occupancy.assign(static_cast<size_t>(rows) * rowWords, 0);
+	size_t c = 0;
+	for( unsigned int r = 0; r < rows; r++ )
+		for( unsigned int x = 0; x < width; x++ )
+			if( mask.labels[c++] != VoxelMask::EMPTY )
+				occupancy[static_cast<size_t>(r) * rowWords + x / 64] |= 1ull << (x % 64);
+	init(&molType, order);
+}
+
+
+MSD::VoxelMask::VoxelMask(unsigned int width, unsigned int height, unsigned int depth)
+: width(width), height(height), depth(depth), labels(static_cast<size_t>(width) * height * depth, EMPTY)
+{
+}
+
+MSD::VoxelMask::Label MSD::VoxelMask::get(unsigned int x, unsigned int y, unsigned int z) const {
+	if( x >= width || y >= height || z >= depth )
+		throw out_of_range("(x,y,z) coordinate not in range");
+	return static_cast<Label>( labels[(static_cast<size_t>(z) * height + y) * width + x] );
+}
+
+void MSD::VoxelMask::set(unsigned int x, unsigned int y, unsigned int z, Label label) {
+	if( x >= width || y >= height || z >= depth )
+		throw out_of_range("(x,y,z) coordinate not in range");
+	labels[(static_cast<size_t>(z) * height + y) * width + x] = label;
+}
+
+MSD::VoxelMask MSD::VoxelMask::read(istream &in) {
+	// split into whitespace separated tokens, without comments
+	std::vector<string> tokens;
+	string line;
+	while( std::getline(in, line) ) {
+		line = line.substr(0, line.find('#'));
+		size_t i = 0;
+		while( (i = line.find_first_not_of(" \t\r", i)) != string::npos ) {
+			size_t j = line.find_first_of(" \t\r", i);
+			tokens.push_back(line.substr(i, j - i));
+			i = j;
+		}
+	}
+
+	unsigned long dims[3];
+	for( int i = 0; i < 3; i++ ) {
+		char *end = NULL;
+		dims[i] = i < static_cast<int>(tokens.size()) ? std::strtoul(tokens[i].c_str(), &end, 10) : 0;
+		if( dims[i] == 0 || dims[i] > UINT_MAX || *end != '\0' )
+			throw invalid_argument("MSD::VoxelMask::read: expected \"width height depth\" (each > 0)");
+	}
+	VoxelMask mask(dims[0], dims[1], dims[2]);
+	if( tokens.size() - 3 != static_cast<size_t>(mask.height) * mask.depth )
+		throw invalid_argument("MSD::VoxelMask::read: expected height * depth rows");
+	size_t c = 0;
+	for( size_t t = 3; t < tokens.size(); t++ ) {
+		if( tokens[t].size() != mask.width )
+			throw invalid_argument("MSD::VoxelMask::read: every row must have \"width\" voxels");
+		for( char ch : tokens[t] ) {
+			const char *label = std::strchr(".LMR", ch);
+			if( ch == '\0' || label == NULL )
+				throw invalid_argument(string("MSD::VoxelMask::read: invalid voxel '") + ch + "' (use . L M R)");
+			mask.labels[c++] = static_cast<unsigned char>(label - ".LMR");
+		}
+	}
+	return mask;
+}
+
+ostream& MSD::VoxelMask::write(ostream &out) const {
+	out << width << ' ' << height << ' ' << depth << '\n';
+	size_t c = 0;
+	for( unsigned int z = 0; z < depth; z++ ) {
+		out << "# z = " << z << '\n';
+		for( unsigned int y = 0; y < height; y++ ) {
+			for( unsigned int x = 0; x < width; x++, c++ )
+				out << (labels[c] <= FM_R ? ".LMR"[labels[c]] : '?');
+			out << '\n';
+		}
+	}
+	return out;
+}
+
 MSD::Parameters MSD::getParameters() const {
 	return parameters;
 }
@@ -1780,6 +2757,7 @@ MSD::Parameters MSD::getParameters() const {
 void MSD::setParameters(const MSD::Parameters &p) {
 	MSD::Parameters p0 = parameters;  // old parameters
 	parameters = p;  // update to new parameters
+	selectionDirty = true;  // (spins are rescaled)
 	
 	// ----- Spin and Spin Flux Magnitudes -----
 	for( auto iter = begin(); iter != end(); ++iter ) {
@@ -1836,12 +2814,16 @@ void MSD::setParameters(const MSD::Parameters &p) {
 	for( unsigned int z = 0; z < depth; z++ )
 		for( unsigned int y = topL; y <= bottomL; y++ )
 			for( unsigned int x = 0; x < molPosL; x++ ) {
+				if( !inMask(x, y, z) )
+					continue;
 				unsigned int a = index(x, y, z);
 				Vector s = getSpin(a);
 				Vector f = getFlux(a);
 				Vector m = s + f;
-				if( x + 1 < molPosL ) {
-					unsigned int neighbor = index(x + 1, y, z);
+				const unsigned int nextX = adjacent(true, 0, x, true), nextY = adjacent(true, 1, y, true),
+				                   nextZ = adjacent(true, 2, z, true);  // (see: MSD::setPeriodic)
+				if( nextX != UINT_MAX && inMask(nextX, y, z) ) {
+					unsigned int neighbor = index(nextX, y, z);
 					Vector spin = getSpin(neighbor);
 					Vector flux = getFlux(neighbor);
 					Vector mag = spin + flux;
@@ -1852,8 +2834,8 @@ void MSD::setParameters(const MSD::Parameters &p) {
 					biquad_L += sq(m * mag);
 					dmi_L += m.crossProduct(mag);
 				}
-				if( y + 1 <= bottomL ) {
-					unsigned int neighbor = index(x, y + 1, z);
+				if( nextY != UINT_MAX && inMask(x, nextY, z) ) {
+					unsigned int neighbor = index(x, nextY, z);
 					Vector spin = getSpin(neighbor);
 					Vector flux = getFlux(neighbor);
 					Vector mag = spin + flux;
@@ -1864,8 +2846,8 @@ void MSD::setParameters(const MSD::Parameters &p) {
 					biquad_L += sq(m * mag);
 					dmi_L += m.crossProduct(mag);
 				}
-				if( z + 1 < depth ) {
-					unsigned int neighbor = index(x, y, z + 1);
+				if( nextZ != UINT_MAX && inMask(x, y, nextZ) ) {
+					unsigned int neighbor = index(x, y, nextZ);
 					Vector spin = getSpin(neighbor);
 					Vector flux = getFlux(neighbor);
 					Vector mag = spin + flux;
@@ -1896,12 +2878,16 @@ void MSD::setParameters(const MSD::Parameters &p) {
 	for( unsigned int z = frontR; z <= backR; z++ )
 		for( unsigned int y = 0; y < height; y++ )
 			for( unsigned int x = molPosR + 1; x < width; x++ ) {
+				if( !inMask(x, y, z) )
+					continue;
 				unsigned int a = index(x, y, z);
 				Vector s = getSpin(a);
 				Vector f = getFlux(a);
 				Vector m = s + f;
-				if( x + 1 < width ) {
-					unsigned int neighbor = index(x + 1, y, z);
+				const unsigned int nextX = adjacent(false, 0, x, true), nextY = adjacent(false, 1, y, true),
+				                   nextZ = adjacent(false, 2, z, true);  // (see: MSD::setPeriodic)
+				if( nextX != UINT_MAX && inMask(nextX, y, z) ) {
+					unsigned int neighbor = index(nextX, y, z);
 					Vector spin = getSpin(neighbor);
 					Vector flux = getFlux(neighbor);
 					Vector mag = spin + flux;
@@ -1912,8 +2898,8 @@ void MSD::setParameters(const MSD::Parameters &p) {
 					biquad_R += sq(m * mag);
 					dmi_R += m.crossProduct(mag);
 				}
-				if( y + 1 < height ) {
-					unsigned int neighbor = index(x, y + 1, z);
+				if( nextY != UINT_MAX && inMask(x, nextY, z) ) {
+					unsigned int neighbor = index(x, nextY, z);
 					Vector spin = getSpin(neighbor);
 					Vector flux = getFlux(neighbor);
 					Vector mag = spin + flux;
@@ -1924,8 +2910,8 @@ void MSD::setParameters(const MSD::Parameters &p) {
 					biquad_R += sq(m * mag);
 					dmi_R += m.crossProduct(mag);
 				}
-				if( z + 1 <= backR ) {
-					unsigned int neighbor = index(x, y, z + 1);
+				if( nextZ != UINT_MAX && inMask(x, y, nextZ) ) {
+					unsigned int neighbor = index(x, y, nextZ);
 					Vector spin = getSpin(neighbor);
 					Vector flux = getFlux(neighbor);
 					Vector mag = spin + flux;
@@ -1959,7 +2945,7 @@ void MSD::setParameters(const MSD::Parameters &p) {
 	if( FM_L_exists && mol_exists )
 		for( unsigned int y = topL; y <= bottomL; y++ )
 			for( unsigned int z = frontR; z <= backR; z++ )
-				if( y == topL || z == frontR || y == bottomL || z == backR ) {
+				if( hasMol(y, z) && inMask(x1, y, z) ) {
 					unsigned int a = index(x1, y, z);
 					Vector s = getSpin(a);
 					Vector f = getFlux(a);
@@ -1992,7 +2978,7 @@ void MSD::setParameters(const MSD::Parameters &p) {
 	if( FM_R_exists && mol_exists )
 		for( unsigned int y = topL; y <= bottomL; y++ )
 			for( unsigned int z = frontR; z <= backR; z++ )
-				if( y == topL || z == frontR || y == bottomL || z == backR ) {
+				if( hasMol(y, z) && inMask(x2, y, z) ) {
 					unsigned int a = index(molPosL + molProto.rightLead, y, z);
 					Vector s = getSpin(a);
 					Vector f = getFlux(a);
@@ -2024,6 +3010,8 @@ void MSD::setParameters(const MSD::Parameters &p) {
 	if( FM_L_exists && FM_R_exists )
 		for( unsigned int z = frontR; z <= backR; z++ )
 			for( unsigned int y = topL; y <= bottomL; y++ ) {
+				if( !inMask(x1, y, z) || !inMask(x2, y, z) )
+					continue;
 				unsigned int a = index(x1, y, z);
 				Vector s = getSpin(a);
 				Vector f = getFlux(a);
@@ -2053,6 +3041,104 @@ MSD::Results MSD::getResults() const {
 	return results;
 }
 
+MSD::CouplingEnergies MSD::couplingEnergies() const {
+	CouplingEnergies c;
+	const unsigned int nodeCount = molProto.nodeCount();
+	
+	// adds the bond between sites i and j to the given components
+	auto bond = [](const Vector &s_i, const Vector &f_i, const Vector &s_j, const Vector &f_j,
+			double &J, double &Je1, double &Jee, double &b, Vector &D) {
+		Vector m_i = s_i + f_i;
+		Vector m_j = s_j + f_j;
+		J -= s_i * s_j;
+		Je1 -= s_i * f_j + f_i * s_j;
+		Jee -= f_i * f_j;
+		b -= sq(m_i * m_j);
+		D -= m_i.crossProduct(m_j);
+	};
+	auto site = [this](unsigned int a, double &Je0, Vector &A) {
+		Vector s = getSpin(a);
+		Vector f = getFlux(a);
+		Vector m = s + f;
+		Je0 -= s * f;
+		A -= Vector(sq(m.x), sq(m.y), sq(m.z));
+	};
+	
+	// ----- FM_L and FM_R -----
+	for( unsigned int z = 0; z < depth; z++ )
+		for( unsigned int y = topL; y <= bottomL; y++ )
+			for( unsigned int x = 0; x < molPosL; x++ ) {
+				if( !inMask(x, y, z) )
+					continue;
+				unsigned int a = index(x, y, z);
+				site(a, c.Je0L, c.AL);
+				c.B -= getSpin(a) + getFlux(a);
+				const unsigned int nextX = adjacent(true, 0, x, true), nextY = adjacent(true, 1, y, true),
+				                   nextZ = adjacent(true, 2, z, true);
+				if( nextX != UINT_MAX && inMask(nextX, y, z) )
+					bond(getSpin(a), getFlux(a), getSpin(index(nextX, y, z)), getFlux(index(nextX, y, z)), c.JL, c.Je1L, c.JeeL, c.bL, c.DL);
+				if( nextY != UINT_MAX && inMask(x, nextY, z) )
+					bond(getSpin(a), getFlux(a), getSpin(index(x, nextY, z)), getFlux(index(x, nextY, z)), c.JL, c.Je1L, c.JeeL, c.bL, c.DL);
+				if( nextZ != UINT_MAX && inMask(x, y, nextZ) )
+					bond(getSpin(a), getFlux(a), getSpin(index(x, y, nextZ)), getFlux(index(x, y, nextZ)), c.JL, c.Je1L, c.JeeL, c.bL, c.DL);
+			}
+	for( unsigned int z = frontR; z <= backR; z++ )
+		for( unsigned int y = 0; y < height; y++ )
+			for( unsigned int x = molPosR + 1; x < width; x++ ) {
+				if( !inMask(x, y, z) )
+					continue;
+				unsigned int a = index(x, y, z);
+				site(a, c.Je0R, c.AR);
+				c.B -= getSpin(a) + getFlux(a);
+				const unsigned int nextX = adjacent(false, 0, x, true), nextY = adjacent(false, 1, y, true),
+				                   nextZ = adjacent(false, 2, z, true);
+				if( nextX != UINT_MAX && inMask(nextX, y, z) )
+					bond(getSpin(a), getFlux(a), getSpin(index(nextX, y, z)), getFlux(index(nextX, y, z)), c.JR, c.Je1R, c.JeeR, c.bR, c.DR);
+				if( nextY != UINT_MAX && inMask(x, nextY, z) )
+					bond(getSpin(a), getFlux(a), getSpin(index(x, nextY, z)), getFlux(index(x, nextY, z)), c.JR, c.Je1R, c.JeeR, c.bR, c.DR);
+				if( nextZ != UINT_MAX && inMask(x, y, nextZ) )
+					bond(getSpin(a), getFlux(a), getSpin(index(x, y, nextZ)), getFlux(index(x, y, nextZ)), c.JR, c.Je1R, c.JeeR, c.bR, c.DR);
+			}
+	
+	// ----- mol., and the leads (mL, mR) -----
+	for( unsigned int a : unique_mol_indices ) {
+		unsigned int y = this->y(a);
+		unsigned int z = this->z(a);
+		const Mol &mol = *mols.at(a);
+		for( unsigned int n = 0; n < nodeCount; n++ ) {
+			site(index(molPosL + n, y, z), c.Je0m, c.Am);
+			c.B -= mol.spins[n] + mol.fluxes[n];
+			for( auto &edge : molProto.nodes[n].neighbors ) {
+				if( edge.selfIndex >= edge.nodeIndex )
+					continue;  // each edge exists twice (and ignore loops), see: MSD::setMolProto
+				Vector dmi = Vector::ZERO;
+				bond(mol.spins[n], mol.fluxes[n], mol.spins[edge.nodeIndex], mol.fluxes[edge.nodeIndex], c.Jm, c.Je1m, c.Jeem, c.bm, dmi);
+				c.Dm += edge.direction * dmi;
+			}
+		}
+		if( FM_L_exists && inMask(molPosL - 1, y, z) ) {
+			unsigned int i = index(molPosL - 1, y, z), j = index(molPosL + molProto.leftLead, y, z);
+			bond(getSpin(i), getFlux(i), getSpin(j), getFlux(j), c.JmL, c.Je1mL, c.JeemL, c.bmL, c.DmL);
+		}
+		if( FM_R_exists && inMask(molPosR + 1, y, z) ) {
+			unsigned int i = index(molPosL + molProto.rightLead, y, z), j = index(molPosR + 1, y, z);
+			bond(getSpin(i), getFlux(i), getSpin(j), getFlux(j), c.JmR, c.Je1mR, c.JeemR, c.bmR, c.DmR);
+		}
+	}
+	
+	// ----- LR -----
+	if( FM_L_exists && FM_R_exists )
+		for( unsigned int z = frontR; z <= backR; z++ )
+			for( unsigned int y = topL; y <= bottomL; y++ ) {
+				if( !inMask(molPosL - 1, y, z) || !inMask(molPosR + 1, y, z) )
+					continue;
+				unsigned int i = index(molPosL - 1, y, z), j = index(molPosR + 1, y, z);
+				bond(getSpin(i), getFlux(i), getSpin(j), getFlux(j), c.JLR, c.Je1LR, c.JeeLR, c.bLR, c.DLR);
+			}
+	
+	return c;
+}
+
 
 void MSD::set_kT(double kT) {
 	// kT doesn't effect energy (U)
@@ -2080,6 +3166,7 @@ void MSD::setMolProto(const MolProto &molProto) {
 	const unsigned int nodeCount = this->molProto.nodeCount();
 	if (molProto.nodeCount() != nodeCount)
 		throw MSD::MoleculeException("Can not change the number of nodes in the molecule after MSD creation. Must create a new MSD.");
+	selectionDirty = true;  // (Sm may have changed)
 
 	// ----- remove energy caused by previous mol. and leads from aggregate: U -----
 	results.U -= results.Um + results.UmL + results.UmR;
@@ -2167,7 +3254,7 @@ void MSD::setMolProto(const MolProto &molProto) {
 		unsigned int y = this->y(a);
 		unsigned int z = this->z(a);
 
-		if (FM_L_exists) {
+		if (FM_L_exists && inMask(molPosL - 1, y, z)) {
 			unsigned int FML_idx = index(molPosL - 1, y, z);
 			unsigned int mol_idx = index(molPosL + molProto.leftLead, y, z);
 			Vector s_i = getSpin(FML_idx);
@@ -2184,7 +3271,7 @@ void MSD::setMolProto(const MolProto &molProto) {
 			results.UmL -= parameters.DmL * m_i.crossProduct(m_j);
 		}
 
-		if (FM_R_exists) {
+		if (FM_R_exists && inMask(molPosR + 1, y, z)) {
 			unsigned int FMR_idx = index(molPosR + 1, y, z);
 			unsigned int mol_idx = index(molPosL + molProto.rightLead, y, z);
 			Vector s_i = getSpin(mol_idx);
@@ -2279,6 +3366,10 @@ void MSD::setLocalM(unsigned int a, const Vector &spin, const Vector &flux) {
 	unsigned int y = this->y(a);
 	unsigned int z = this->z(a);
 
+	// (metropolis proposals keep the magnitude of the spin, so they can't make an atom skipped, see: MSD::skipZeroSpins)
+	if( (spin.normSq() == 0 && flux.normSq() == 0) != (getSpin(a).normSq() == 0 && getFlux(a).normSq() == 0) )
+		selectionDirty = true;
+
 	// if position "a" is within the mol., bybass this function and call Mol::setLocalM instead. 
 	if (molPosL <= x && x <= molPosR) {
 		mols.at(a)->setLocalM(x - molPosL, spin, flux);
@@ -2317,9 +3408,14 @@ void MSD::setLocalM(unsigned int a, const Vector &spin, const Vector &flux) {
 			results.UL -= deltaU;
 		}
 		
+		// neighbors within FM_L, including across its periodic boundaries (UINT_MAX if none, see: MSD::adjacent)
+		const unsigned int prevX = adjacent(true, 0, x, false), nextX = adjacent(true, 0, x, true);
+		const unsigned int prevY = adjacent(true, 1, y, false), nextY = adjacent(true, 1, y, true);
+		const unsigned int prevZ = adjacent(true, 2, z, false), nextZ = adjacent(true, 2, z, true);
+
 		// [5 neighbors stay only within FM_L: left, above, below, front, back]
-		if( x != 0 ) {
-			unsigned int a1 = index(x - 1, y, z);  // left neighbor
+		if( prevX != UINT_MAX && inMask(prevX, y, z) ) {
+			unsigned int a1 = index(prevX, y, z);  // left neighbor
 			Vector neighbor_s = getSpin(a1);
 			Vector neighbor_f = getFlux(a1);
 			Vector neighbor_m = neighbor_s + neighbor_f;
@@ -2331,8 +3427,8 @@ void MSD::setLocalM(unsigned int a, const Vector &spin, const Vector &flux) {
 			results.U -= deltaU;
 			results.UL -= deltaU;
 		} // else, x - 1 neighbor doesn't exist
-		if( y != topL ) {
-			unsigned int a1 = index(x, y - 1, z);  // above neighbor
+		if( prevY != UINT_MAX && inMask(x, prevY, z) ) {
+			unsigned int a1 = index(x, prevY, z);  // above neighbor
 			Vector neighbor_s = getSpin(a1);
 			Vector neighbor_f = getFlux(a1);
 			Vector neighbor_m = neighbor_s + neighbor_f;
@@ -2344,8 +3440,8 @@ void MSD::setLocalM(unsigned int a, const Vector &spin, const Vector &flux) {
 			results.U -= deltaU;
 			results.UL -= deltaU;
 		} // else, y - 1 neighbor doesn't exist
-		if( y != bottomL ) {
-			unsigned int a1 = index(x, y + 1, z);  // below neighbor
+		if( nextY != UINT_MAX && inMask(x, nextY, z) ) {
+			unsigned int a1 = index(x, nextY, z);  // below neighbor
 			Vector neighbor_s = getSpin(a1);
 			Vector neighbor_f = getFlux(a1);
 			Vector neighbor_m = neighbor_s + neighbor_f;
@@ -2357,8 +3453,8 @@ void MSD::setLocalM(unsigned int a, const Vector &spin, const Vector &flux) {
 			results.U -= deltaU;
 			results.UL -= deltaU;
 		} // else, y + 1 neighbor doesn't exist
-		if( z != 0 ) {
-			unsigned int a1 = index(x, y, z - 1);  // front neighbor
+		if( prevZ != UINT_MAX && inMask(x, y, prevZ) ) {
+			unsigned int a1 = index(x, y, prevZ);  // front neighbor
 			Vector neighbor_s = getSpin(a1);
 			Vector neighbor_f = getFlux(a1);
 			Vector neighbor_m = neighbor_s + neighbor_f;
@@ -2370,8 +3466,8 @@ void MSD::setLocalM(unsigned int a, const Vector &spin, const Vector &flux) {
 			results.U -= deltaU;
 			results.UL -= deltaU;
 		} // else, z - 1 neighbor doesn't exist
-		if( z + 1 != depth ) {
-			unsigned int a1 = index(x, y, z + 1);  // back neighbor
+		if( nextZ != UINT_MAX && inMask(x, y, nextZ) ) {
+			unsigned int a1 = index(x, y, nextZ);  // back neighbor
 			Vector neighbor_s = getSpin(a1);
 			Vector neighbor_f = getFlux(a1);
 			Vector neighbor_m = neighbor_s + neighbor_f;
@@ -2385,52 +3481,50 @@ void MSD::setLocalM(unsigned int a, const Vector &spin, const Vector &flux) {
 		} // else, z + 1 neighbor doesn't exist
 		
 		// [2 neighbors may leave FM_L: right, LR (direct coupling)]
-		if( x + 1 != width )  // do these neighbors exist?
-			if( x + 1 == molPosL ) {  // are we next to the mol.?
-				if( mol_exists )
-					try {
-						unsigned int a1 = index(molPosL + molProto.leftLead, y, z);  // right neighbor (in mol.)
-						Vector neighbor_s = getSpin(a1);
-						Vector neighbor_f = getFlux(a1);
-						Vector neighbor_m = neighbor_s + neighbor_f;
-						double deltaU = parameters.JmL * ( neighbor_s * deltaS )
-						              + parameters.Je1mL * ( neighbor_f * deltaS + neighbor_s * deltaF )
-						              + parameters.JeemL * ( neighbor_f * deltaF )
-						              + parameters.bmL * ( sq(neighbor_m * mag) - sq(neighbor_m * m) )
-									  + parameters.DmL * deltaM.crossProduct(neighbor_m);  // (a < a1): left vector changed
-						results.U -= deltaU;
-						results.UmL -= deltaU;
-					} catch(const out_of_range &e) {} // x + 1 neighbor doesn't exist because it's in the buffer zone
-				
-				if( FM_R_exists )
-					try {
-						unsigned int a1 = index(molPosR + 1, y, z);  // LR (direct coupling) neighbor
-						Vector neighbor_s = getSpin(a1);
-						Vector neighbor_f = getFlux(a1);
-						Vector neighbor_m = neighbor_s + neighbor_f;
-						double deltaU = parameters.JLR * ( neighbor_s * deltaS )
-						              + parameters.Je1LR * ( neighbor_f * deltaS + neighbor_s * deltaF )
-						              + parameters.JeeLR * ( neighbor_f * deltaF )
-						              + parameters.bLR * ( sq(neighbor_m * mag) - sq(neighbor_m * m) )
-									  + parameters.DLR * deltaM.crossProduct(neighbor_m);  // (a < a1): left vector changed
-						results.U -= deltaU;
-						results.ULR -= deltaU;
-					} catch(const out_of_range &e) {} // molPosR + 1 atom doesn't exist because we're not in the center
-				
-			} else {  // we are not next to the mol.
-				unsigned int a1 = index(x + 1, y, z);  // right neighbor (also in FM_L)
-				Vector neighbor_s = getSpin(a1);
-				Vector neighbor_f = getFlux(a1);
-				Vector neighbor_m = neighbor_s + neighbor_f;
-				double deltaU = parameters.JL * ( neighbor_s * deltaS )
-				              + parameters.Je1L * ( neighbor_f * deltaS + neighbor_s * deltaF )
-				              + parameters.JeeL * ( neighbor_f * deltaF )
-				              + parameters.bL * ( sq(neighbor_m * mag) - sq(neighbor_m * m) )
-							  + parameters.DL * deltaM.crossProduct(neighbor_m);  // (a < a1): left vector changed
-				results.U -= deltaU;
-				results.UL -= deltaU;
-			}
-		// else, x + 1 neighbor doesn't exist (because molPosL == width)
+		if( x + 1 == molPosL && x + 1 != width ) {  // are we next to the mol.?
+			if( mol_exists )
+				try {
+					unsigned int a1 = index(molPosL + molProto.leftLead, y, z);  // right neighbor (in mol.)
+					Vector neighbor_s = getSpin(a1);
+					Vector neighbor_f = getFlux(a1);
+					Vector neighbor_m = neighbor_s + neighbor_f;
+					double deltaU = parameters.JmL * ( neighbor_s * deltaS )
+					              + parameters.Je1mL * ( neighbor_f * deltaS + neighbor_s * deltaF )
+					              + parameters.JeemL * ( neighbor_f * deltaF )
+					              + parameters.bmL * ( sq(neighbor_m * mag) - sq(neighbor_m * m) )
+								  + parameters.DmL * deltaM.crossProduct(neighbor_m);  // (a < a1): left vector changed
+					results.U -= deltaU;
+					results.UmL -= deltaU;
+				} catch(const out_of_range &e) {} // x + 1 neighbor doesn't exist because it's in the buffer zone
+			
+			if( FM_R_exists )
+				try {
+					unsigned int a1 = index(molPosR + 1, y, z);  // LR (direct coupling) neighbor
+					Vector neighbor_s = getSpin(a1);
+					Vector neighbor_f = getFlux(a1);
+					Vector neighbor_m = neighbor_s + neighbor_f;
+					double deltaU = parameters.JLR * ( neighbor_s * deltaS )
+					              + parameters.Je1LR * ( neighbor_f * deltaS + neighbor_s * deltaF )
+					              + parameters.JeeLR * ( neighbor_f * deltaF )
+					              + parameters.bLR * ( sq(neighbor_m * mag) - sq(neighbor_m * m) )
+								  + parameters.DLR * deltaM.crossProduct(neighbor_m);  // (a < a1): left vector changed
+					results.U -= deltaU;
+					results.ULR -= deltaU;
+				} catch(const out_of_range &e) {} // molPosR + 1 atom doesn't exist because we're not in the center
+			
+		} else if( nextX != UINT_MAX && inMask(nextX, y, z) ) {  // we are not next to the mol.
+			unsigned int a1 = index(nextX, y, z);  // right neighbor (also in FM_L)
+			Vector neighbor_s = getSpin(a1);
+			Vector neighbor_f = getFlux(a1);
+			Vector neighbor_m = neighbor_s + neighbor_f;
+			double deltaU = parameters.JL * ( neighbor_s * deltaS )
+			              + parameters.Je1L * ( neighbor_f * deltaS + neighbor_s * deltaF )
+			              + parameters.JeeL * ( neighbor_f * deltaF )
+			              + parameters.bL * ( sq(neighbor_m * mag) - sq(neighbor_m * m) )
+						  + parameters.DL * deltaM.crossProduct(neighbor_m);  // (a < a1): left vector changed
+			results.U -= deltaU;
+			results.UL -= deltaU;
+		}
 	
 	// ----- right section (FM_R) -----
 	} else {  // x > molPosR
@@ -2446,9 +3540,15 @@ void MSD::setLocalM(unsigned int a, const Vector &spin, const Vector &flux) {
 			results.UR -= deltaU;
 		}
 		
+		// neighbors within FM_R, including across its periodic boundaries (UINT_MAX if none, see: MSD::adjacent)
+		// (FM_R is never periodic in x, so its left neighbor is found below)
+		const unsigned int nextX = adjacent(false, 0, x, true);
+		const unsigned int prevY = adjacent(false, 1, y, false), nextY = adjacent(false, 1, y, true);
+		const unsigned int prevZ = adjacent(false, 2, z, false), nextZ = adjacent(false, 2, z, true);
+
 		// [5 neighbors stay only within FM_R: right, above, below, front, back]
-		if( x + 1 != width ) {
-			unsigned int a1 = index(x + 1, y, z);  // right neighbor
+		if( nextX != UINT_MAX && inMask(nextX, y, z) ) {
+			unsigned int a1 = index(nextX, y, z);  // right neighbor
 			Vector neighbor_s = getSpin(a1);
 			Vector neighbor_f = getFlux(a1);
 			Vector neighbor_m = neighbor_s + neighbor_f;
@@ -2460,8 +3560,8 @@ void MSD::setLocalM(unsigned int a, const Vector &spin, const Vector &flux) {
 			results.U -= deltaU;
 			results.UR -= deltaU;
 		} // else, x + 1 neighbor doesn't exist
-		if( y != 0 ) {
-			unsigned int a1 = index(x, y - 1, z);  // above neighbor
+		if( prevY != UINT_MAX && inMask(x, prevY, z) ) {
+			unsigned int a1 = index(x, prevY, z);  // above neighbor
 			Vector neighbor_s = getSpin(a1);
 			Vector neighbor_f = getFlux(a1);
 			Vector neighbor_m = neighbor_s + neighbor_f;
@@ -2473,8 +3573,8 @@ void MSD::setLocalM(unsigned int a, const Vector &spin, const Vector &flux) {
 			results.U -= deltaU;
 			results.UR -= deltaU;
 		} // else, y - 1 neighbor doesn't exist
-		if( y + 1 != height ) {
-			unsigned int a1 = index(x, y + 1, z);  // below neighbor
+		if( nextY != UINT_MAX && inMask(x, nextY, z) ) {
+			unsigned int a1 = index(x, nextY, z);  // below neighbor
 			Vector neighbor_s = getSpin(a1);
 			Vector neighbor_f = getFlux(a1);
 			Vector neighbor_m = neighbor_s + neighbor_f;
@@ -2486,8 +3586,8 @@ void MSD::setLocalM(unsigned int a, const Vector &spin, const Vector &flux) {
 			results.U -= deltaU;
 			results.UR -= deltaU;
 		} // else, y + 1 neighbor doesn't exist
-		if( z != frontR ) {
-			unsigned int a1 = index(x, y, z - 1);  // front neighbor
+		if( prevZ != UINT_MAX && inMask(x, y, prevZ) ) {
+			unsigned int a1 = index(x, y, prevZ);  // front neighbor
 			Vector neighbor_s = getSpin(a1);
 			Vector neighbor_f = getFlux(a1);
 			Vector neighbor_m = neighbor_s + neighbor_f;
@@ -2499,8 +3599,8 @@ void MSD::setLocalM(unsigned int a, const Vector &spin, const Vector &flux) {
 			results.U -= deltaU;
 			results.UR -= deltaU;
 		} // else, z - 1 neighbor doesn't exist
-		if( z != backR ) {
-			unsigned int a1 = index(x, y, z + 1);  // back neighbor
+		if( nextZ != UINT_MAX && inMask(x, y, nextZ) ) {
+			unsigned int a1 = index(x, y, nextZ);  // back neighbor
 			Vector neighbor_s = getSpin(a1);
 			Vector neighbor_f = getFlux(a1);
 			Vector neighbor_m = neighbor_s + neighbor_f;
@@ -2546,7 +3646,7 @@ void MSD::setLocalM(unsigned int a, const Vector &spin, const Vector &flux) {
 					results.ULR -= deltaU;
 				} catch(const out_of_range &e) {} // molPos - 1 atom doesn't exist because we're not in the center
 
-		} else {  // we are not next to the mol.
+		} else if( inMask(x - 1, y, z) ) {  // we are not next to the mol.
 			unsigned int a1 = index(x - 1, y, z);  // left neighbor (also in FM_R)
 			Vector neighbor_s = getSpin(a1);
 			Vector neighbor_f = getFlux(a1);
@@ -2585,6 +3685,340 @@ void MSD::setLocalM(unsigned int x, unsigned int y, unsigned int z, const Vector
 	setLocalM( index(x, y, z), spin, flux );
 }
 
+void MSD::setSiteWeight(unsigned int a, double weight) {
+	if( !(weight >= 0) || std::isinf(weight) )
+		throw invalid_argument("MSD::setSiteWeight: weight must be finite, and >= 0");
+	getSpin(a);  // throws out_of_range if there's no atom at "a"
+	if( siteWeights.empty() ) {
+		if( weight == 1 )
+			return;
+		siteWeights.assign(spins.capacity(), 1.0);
+	}
+	siteWeights.at(a) = weight;
+	selectionDirty = true;
+}
+
+void MSD::setSiteWeight(unsigned int x, unsigned int y, unsigned int z, double weight) {
+	if( x >= width || y >= height || z >= depth )
+		throw out_of_range("(x,y,z) coordinate not in range");
+	setSiteWeight( index(x, y, z), weight );
+}
+
+double MSD::getSiteWeight(unsigned int a) const {
+	getSpin(a);  // throws out_of_range if there's no atom at "a"
+	return siteWeights.empty() ? 1 : siteWeights.at(a);
+}
+
+double MSD::getSiteWeight(unsigned int x, unsigned int y, unsigned int z) const {
+	if( x >= width || y >= height || z >= depth )
+		throw out_of_range("(x,y,z) coordinate not in range");
+	return getSiteWeight( index(x, y, z) );
+}
+
+void MSD::setRegionWeights(double weightL, double weightR, double weight_m) {
+	for( unsigned int a : indices ) {
+		unsigned int x = this->x(a);
+		setSiteWeight( a, x < molPosL ? weightL : x > molPosR ? weightR : weight_m );
+	}
+}
+
+// Builds the index and coordinate tables for "order" (throwing, without changing anything, if it's impossible),
+// and returns the capacity the arrays of atoms need. Doesn't move any atoms; see: MSD::setSiteOrder
+unsigned long long MSD::layout(SiteOrder order) {
+	if( order < ROW_MAJOR || order > COMPACT )
+		throw invalid_argument("MSD: invalid site order");
+	const unsigned long long cells = static_cast<unsigned long long>(width) * height * depth;
+	const unsigned int bits = curveBits(width, height, depth);
+	if( (order == MORTON || order == HILBERT) && bits > 21 )
+		throw invalid_argument("MSD: the MSD is too large for MORTON or HILBERT order");
+	unsigned long long capacity = n;
+	if( order == ROW_MAJOR )
+		capacity = cells;
+	else if( order == MORTON )
+		capacity = curveKey(MORTON, width - 1, height - 1, depth - 1, bits) + 1;
+	if( capacity > UINT_MAX || (order == HILBERT && cells > UINT_MAX) )
+		throw length_error("MSD: too many positions for the site order; COMPACT only needs < 2^32 atoms");
+
+	std::vector<unsigned int>().swap(spreadX);
+	std::vector<unsigned int>().swap(spreadY);
+	std::vector<unsigned int>().swap(spreadZ);
+	std::vector<unsigned int>().swap(siteIndex);
+	std::vector<unsigned int>().swap(rowStart);
+	std::vector<unsigned int>().swap(siteCoords);
+	if( order == ROW_MAJOR )
+		return capacity;
+	siteCoords.assign(3 * capacity, width);  // (unused indices are out of range)
+	auto place = [this](unsigned int a, unsigned int x, unsigned int y, unsigned int z) {
+		siteCoords[3 * a] = x;
+		siteCoords[3 * a + 1] = y;
+		siteCoords[3 * a + 2] = z;
+	};
+
+	if( order == MORTON ) {
+		for( unsigned int x = 0; x < width; x++ )
+			spreadX.push_back( static_cast<unsigned int>(curveKey(MORTON, x, 0, 0, bits)) );
+		for( unsigned int y = 0; y < height; y++ )
+			spreadY.push_back( static_cast<unsigned int>(curveKey(MORTON, 0, y, 0, bits)) );
+		for( unsigned int z = 0; z < depth; z++ )
+			spreadZ.push_back( static_cast<unsigned int>(curveKey(MORTON, 0, 0, z, bits)) );
+		for( unsigned int z = 0; z < depth; z++ )
+			for( unsigned int y = 0; y < height; y++ )
+				for( unsigned int x = 0; x < width; x++ )
+					place(spreadX[x] | spreadY[y] | spreadZ[z], x, y, z);
+
+	} else if( order == HILBERT ) {
+		std::vector< std::pair<unsigned long long, unsigned int> > keys;  // of the atoms, with their position
+		keys.reserve(n);
+		for( unsigned int c = 0; c < cells; c++ ) {
+			const unsigned int x = c % width, y = c / width % height, z = c / width / height;
+			if( hasAtom(x, y, z) )
+				keys.push_back( std::make_pair(curveKey(HILBERT, x, y, z, bits), c) );
+		}
+		std::sort(keys.begin(), keys.end());
+		siteIndex.assign(cells, UINT_MAX);
+		for( unsigned int a = 0; a < keys.size(); a++ ) {
+			const unsigned int c = keys[a].second;
+			siteIndex[c] = a;
+			place(a, c % width, c / width % height, c / width / height);
+		}
+
+	} else {  // COMPACT
+		unsigned int a = 0;
+		rowStart.resize(height * depth);
+		for( unsigned int z = 0; z < depth; z++ )
+			for( unsigned int y = 0; y < height; y++ ) {
+				rowStart[z * height + y] = a;
+				for( unsigned int x = 0; x < width; x++ )
+					if( hasAtom(x, y, z) )
+						place(a++, x, y, z);
+			}
+	}
+	return capacity;
+}
+
+/**
+ * Lays the atoms out in memory in the given order. Since only the indices change, Results, the iteration order, and
+ * (for the same seed) metropolis with RANDOM_SITE are unaffected; the sweepModes follow the new memory order.
+ *
+ * MORTON indices are the interleaved bits, so index(x, y, z) is just 3 (small) table lookups, but unless the
+ * dimensions are powers of 2 there are unused indices in between (e.g. 192^3 atoms need about 2 * 192^3 slots).
+ * HILBERT numbers the atoms consecutively, and looks every index up in a table of all width * height * depth positions.
+ * Both need every dimension to be at most 2^21.
+ * COMPACT only stores the atoms, and computes indices from the index of the first atom of each row (y, z), so it's
+ * the only order in which width * height * depth can be 2^32 or more (see: MSD::MSD and MSD::estimateMemory).
+ */
+void MSD::setSiteOrder(SiteOrder order) {
+	// ----- save every atom (in the iteration order) -----
+	const size_t N = indices.size();
+	std::vector<unsigned int> coords(3 * N), molCoords;
+	std::vector<Vector> s(N), f(N);
+	std::vector< shared_ptr<Mol> > m(N);
+	std::vector<double> w(siteWeights.empty() ? 0 : N);
+	for( size_t i = 0; i < N; i++ ) {
+		const unsigned int a = indices[i], x = this->x(a);
+		coords[3 * i] = x;
+		coords[3 * i + 1] = y(a);
+		coords[3 * i + 2] = z(a);
+		if( x < molPosL || x > molPosR ) {
+			s[i] = spins[a];
+			f[i] = fluxes[a];
+		} else {
+			m[i] = mols[a];
+		}
+		if( !w.empty() )
+			w[i] = siteWeights[a];
+	}
+	for( unsigned int a : unique_mol_indices ) {
+		molCoords.push_back(y(a));
+		molCoords.push_back(z(a));
+	}
+
+	// ----- move them to their new indices -----
+	const unsigned long long capacity = layout(order);
+	siteOrder = order;
+	spins.resize(capacity);
+	fluxes.resize(capacity);
+	if( mol_exists )
+		mols.resize(capacity);
+	for( size_t i = 0; i < N; i++ ) {
+		const unsigned int a = indices[i] = index(coords[3 * i], coords[3 * i + 1], coords[3 * i + 2]);
+		if( m[i] ) {
+			mols[a] = m[i];
+		} else {
+			spins[a] = s[i];
+			fluxes[a] = f[i];
+		}
+	}
+	for( size_t k = 0; k < unique_mol_indices.size(); k++ )
+		unique_mol_indices[k] = index(molPosL, molCoords[2 * k], molCoords[2 * k + 1]);
+	if( !w.empty() ) {
+		siteWeights.assign(capacity, 1.0);
+		for( size_t i = 0; i < N; i++ )
+			siteWeights[indices[i]] = w[i];
+	}
+
+	// ----- caches that use indices -----
+	layers.clear();
+	inCluster.clear();
+	ratePosition.clear();
+	selectionDirty = true;
+}
+
+MSD::SiteOrder MSD::getSiteOrder() const {
+	return siteOrder;
+}
+
+unsigned int MSD::getCapacity() const {
+	return spins.capacity();
+}
+
+unsigned long long MSD::estimateMemory(unsigned int width, unsigned int height, unsigned int depth,
+		unsigned int molPosL, unsigned int molPosR,
+		unsigned int topL, unsigned int bottomL, unsigned int frontR, unsigned int backR, SiteOrder order) {
+	clampGeometry(width, height, depth, molPosL, molPosR, topL, bottomL, frontR, backR);
+	const unsigned long long H = height, D = depth;
+	const unsigned long long h = bottomL >= topL ? bottomL - topL + 1 : 0;  // rows of FM_L in each z
+	const unsigned long long d = backR >= frontR ? backR - frontR + 1 : 0;  // rows of FM_R in each y
+	const bool molExists = molPosL <= molPosR;
+
+	// mols are on the edges of the rectangle [topL, bottomL] x [frontR, backR] (see: MSD::hasMol)
+	unsigned long long molRows = 0, molLen = 0;
+	if( molExists ) {
+		const unsigned long long ye = (topL < height) + (bottomL < height && bottomL != topL);
+		const unsigned long long ze = (frontR < depth) + (backR < depth && backR != frontR);
+		molRows = ye * d + h * ze - (h > 0 && d > 0 ? ye * ze : 0);
+		molLen = molPosR - molPosL + 1;
+	}
+	const unsigned long long n = molPosL * h * D + (width - molPosR - 1) * d * H + molRows * molLen;
+	return memoryFor(width, height, depth, n, molRows, molLen, order);
+}
+
+unsigned long long MSD::estimateMemory(const VoxelMask &mask, SiteOrder order) {
+	unsigned int molPosL, molPosR;
+	checkMask(mask, molPosL, molPosR);
+	unsigned long long n = 0, molAtoms = 0;
+	for( unsigned char label : mask.labels ) {
+		n += label != VoxelMask::EMPTY;
+		molAtoms += label == VoxelMask::MOL;
+	}
+	const unsigned long long molLen = molPosL <= molPosR ? molPosR - molPosL + 1 : 0;
+	const unsigned long long rows = static_cast<unsigned long long>(mask.height) * mask.depth;
+	return memoryFor(mask.width, mask.height, mask.depth, n, molLen != 0 ? molAtoms / molLen : 0, molLen, order)
+	     + sizeof(unsigned long long) * ((mask.width - 1) / 64 + 1) * rows;  // (occupancy)
+}
+
+// Bytes for n atoms, in molRows mols. of molLen atoms each, in a bounding box of width * height * depth
+unsigned long long MSD::memoryFor(unsigned int width, unsigned int height, unsigned int depth, unsigned long long n,
+		unsigned long long molRows, unsigned long long molLen, SiteOrder order) {
+	if( order < ROW_MAJOR || order > COMPACT )
+		throw invalid_argument("MSD::estimateMemory: invalid site order");
+	const unsigned long long H = height, D = depth, cells = width * H * D;
+	unsigned long long slots = n, tables = 3 * sizeof(unsigned int) * n;  // (coordinate table)
+	if( order == ROW_MAJOR ) {
+		slots = cells;
+		tables = 0;
+	} else if( order == MORTON ) {
+		const unsigned int bits = curveBits(width, height, depth);
+		if( bits > 21 )
+			throw invalid_argument("MSD::estimateMemory: the MSD is too large for MORTON order");
+		slots = curveKey(MORTON, width - 1, height - 1, depth - 1, bits) + 1;
+		tables = 3 * sizeof(unsigned int) * slots + sizeof(unsigned int) * (width + H + D);
+	} else if( order == HILBERT ) {
+		tables += sizeof(unsigned int) * cells;
+	} else {
+		tables += sizeof(unsigned int) * H * D;
+	}
+	if( slots > UINT_MAX || n > UINT_MAX || H * D > UINT_MAX || (order == HILBERT && cells > UINT_MAX) )
+		throw length_error("MSD::estimateMemory: too many positions for the site order; COMPACT only needs < 2^32 atoms");
+	const unsigned long long perSlot = 2 * sizeof(SparseArrayValue<Vector>)
+			+ (molLen != 0 ? sizeof(SparseArrayValue< shared_ptr<Mol> >) : 0);
+	const unsigned long long perMol = sizeof(Mol) + 2 * molLen * sizeof(Vector) + 4 * sizeof(void *);  // (and shared_ptr's control block)
+	return slots * perSlot + tables + sizeof(unsigned int) * (n + molRows) + molRows * perMol;
+}
+
+double MSD::selectionWeight(unsigned int a) const {
+	if( macrospinFreq != 0 && (x(a) < molPosL || x(a) > molPosR) )
+		return 0;  // only moved by macrospinSweep
+	if( skipZeroSpins && getSpin(a).normSq() == 0 && getFlux(a).normSq() == 0 ) {
+		unsigned int x = this->x(a);
+		double F = x < molPosL ? parameters.FL : x > molPosR ? parameters.FR : molProto.getNodeParameters(x - molPosL).Fm;
+		if( F == 0 )
+			return 0;  // no proposal can change this atom
+	}
+	return siteWeights.empty() ? 1 : siteWeights[a];
+}
+
+void MSD::updateSelection() {
+	if( !selectionDirty && selectionSkipsZero == skipZeroSpins && selectionMacrospins == (macrospinFreq != 0)
+			&& selectionSweepMode == sweepMode && selectionBlockSize == blockSize )
+		return;
+	if( sweepMode < RANDOM_SITE || sweepMode > BLOCKED )
+		throw invalid_argument("MSD: invalid sweepMode");
+	if( sweepMode == BLOCKED && blockSize == 0 )
+		throw invalid_argument("MSD: blockSize must be > 0");
+	std::vector<double> w(indices.size());
+	selectionTotal = 0;
+	selectableCount = 0;
+	uniformSelection = true;
+	fmSelectable = false;
+	order.clear();
+	for( unsigned int i = 0; i < indices.size(); i++ ) {
+		const unsigned int a = indices[i];
+		w[i] = selectionWeight(a);
+		selectionTotal += w[i];
+		if( w[i] > 0 ) {
+			selectableCount++;
+			if( sweepMode != RANDOM_SITE )
+				order.push_back(a);
+		}
+		uniformSelection = uniformSelection && w[i] == 1;
+		const unsigned int x = this->x(a);
+		fmSelectable = fmSelectable || (w[i] > 0 && (x < molPosL || x > molPosR));
+	}
+	if( uniformSelection )
+		selection = SumTree();
+	else
+		selection.assign(w);
+
+	// sort the sweep (by a key, then memory order)
+	auto sortBy = [this](auto key) {
+		std::sort(order.begin(), order.end(), [&key](unsigned int a0, unsigned int a1) {
+			return key(a0) < key(a1) || (key(a0) == key(a1) && a0 < a1);
+		});
+	};
+	if( sweepMode == TYPEWRITER || sweepMode == RANDOM_PERMUTATION )  // (RANDOM_PERMUTATION is shuffled by nextSite)
+		std::sort(order.begin(), order.end());
+	else if( sweepMode == CHECKERBOARD )
+		sortBy([this](unsigned int a) { return (x(a) + y(a) + z(a)) % 2; });
+	else if( sweepMode == BLOCKED ) {
+		const unsigned int b = blockSize, bw = (width + b - 1) / b, bh = (height + b - 1) / b;
+		sortBy([this, b, bw, bh](unsigned int a) { return ((z(a) / b) * bh + y(a) / b) * bw + x(a) / b; });
+	}
+	orderPos = 0;
+
+	selectionDirty = false;
+	selectionSkipsZero = skipZeroSpins;
+	selectionMacrospins = macrospinFreq != 0;
+	selectionSweepMode = sweepMode;
+	selectionBlockSize = blockSize;
+}
+
+unsigned int MSD::pickSite() {
+	if( uniformSelection )
+		return indices[static_cast<unsigned int>( rand(prng) * indices.size() )];
+	return indices[ selection.find(rand(prng) * selection.total()) ];
+}
+
+unsigned int MSD::nextSite() {
+	if( sweepMode == RANDOM_SITE )
+		return pickSite();
+	if( orderPos == order.size() )
+		orderPos = 0;
+	if( orderPos == 0 && sweepMode == RANDOM_PERMUTATION )
+		std::shuffle(order.begin(), order.end(), prng);
+	return order[orderPos++];
+}
+
 
 unsigned int MSD::getN() const {
 	return n;
@@ -2704,6 +4138,7 @@ void MSD::reinitialize(bool reseed) {
 	for( auto i = begin(); i != end(); i++ )
 		setLocalM( i, initSpin, initFlux );
 	record.clear();
+	couplingRecord.clear();
 	setParameters(parameters);  // TODO: do we need this? Yes, but I think only because we
 	setMolProto(molProto);  // need to rescale Spin and Flux vectors to match S and F params
 	results.t = 0;
@@ -2718,17 +4153,41 @@ void MSD::randomize(bool reseed) {
 				Vector::sphericalForm(1, 2 * PI * rand(prng), asin(2 * rand(prng) - 1)),
 				Vector::sphericalForm(rand(prng), 2 * PI * rand(prng), asin(2 * rand(prng) - 1)) );
 	record.clear();
+	couplingRecord.clear();
 	setParameters(parameters);  // TODO: do we still need this? Yes. (See comment in MSD::reinitialize())
 	setMolProto(molProto);
 	results.t = 0;
 }
 
-void MSD::metropolis(unsigned long long N) {
+/**
+ * The metropolis loop shared by both versions of MSD::metropolis. For each step, a new local state is proposed (see:
+ * MSD::flippingAlgorithm), then kept iff accept(U, U', dU_correction, lnQ) returns true, where:
+ *   dU_correction is added to U' - U in the Boltzmann (fixed kT) acceptance test, and
+ *   lnQ is the log of the ratio of proposal densities, q(new -> old) / q(old -> new), or NaN for HEAT_BATH_MODEL.
+ * After every step, visit(i) is called, and must return true iff it changed the state of the MSD.
+ *
+ * Atoms are picked with probability siteWeight / (sum of siteWeights) (see: MSD::setSiteWeight). Since that never
+ * depends on the state, q(new -> old) / q(old -> new) is unchanged and detailed balance still holds; atoms with weight
+ * 0 are just frozen. Skipped atoms (0 spin, flux, and F) would never change anyway, since proposals keep |s|.
+ * With any other sweepMode, atoms are visited in a fixed (or per sweep random) order instead, and only weight 0 matters.
+ * Each step still satisfies detailed balance, so the sweep as a whole leaves the Boltzmann distribution unchanged
+ * (global balance), and ordered sweeps are more cache friendly on large lattices.
+ */
+template <typename Accept, typename Visit>
+void MSD::metropolisSteps(unsigned long long N, Accept accept, Visit visit) {
 	function<double()> random = bind( rand, ref(prng) );
+	const bool heatBath = flippingAlgorithm.target_type() == HEAT_BATH_MODEL.target_type();
+	const bool cone = flippingAlgorithm.target_type() == CONE_MODEL.target_type();
 	Results r = getResults(); //get the energy of the system
+	updateSelection();
 	//start loop (will iterate N times)
 	for( unsigned long long i = 0; i < N; i++ ) {
-		unsigned int a = indices[static_cast<unsigned int>( random() * indices.size() )]; //pick an atom (pseudo) randomly
+		if( selectionTotal <= 0 ) {  // every atom is frozen
+			if( visit(i) )
+				r = getResults();
+			continue;
+		}
+		unsigned int a = nextSite(); //pick an atom (pseudo) randomly, see: MSD::setSiteWeight and MSD::sweepMode
 		Vector s = getSpin(a);  // TODO: do we need the bounds checking?
 		Vector f = getFlux(a);  // TODO: do we need the bounds checking?
 		
@@ -2738,26 +4197,72 @@ void MSD::metropolis(unsigned long long N) {
 
 		// pick the correct F coeficient to determine new flux magnitude
 		unsigned int x = this->x(a);
-		double F;
+		double F, Je0, step;
+		unsigned long long *accepted;
 		if (x < molPosL) {
 			F = parameters.FL;
+			Je0 = parameters.Je0L;
+			step = proposalSteps.L;
+			acceptanceStats.triedL++;
+			accepted = &acceptanceStats.acceptedL;
 		} else if (x > molPosR) {
 			F = parameters.FR;
+			Je0 = parameters.Je0R;
+			step = proposalSteps.R;
+			acceptanceStats.triedR++;
+			accepted = &acceptanceStats.acceptedR;
 		} else {
 			n = x - molPosL;
 			F = molProto.getNodeParameters(n).Fm;  // TODO: do we need the bounds checking?
+			Je0 = molProto.nodes[n].parameters.Je0m;
+			step = proposalSteps.m;
+			acceptanceStats.triedm++;
+			accepted = &acceptanceStats.acceptedm;
 			inMol = true;
 		}
 
 		//"flip" that atom
-		setLocalM( a, flippingAlgorithm(s, random),
-				Vector::sphericalForm(F * random(), 2 * PI * random(), asin(2 * random() - 1)) );
+		double dU_correction = 0, lnQ = 0;
+		if( heatBath ) {
+			// Gibbs sample the spin in the local field (using the new flux), then correct with metropolis for the rest:
+			// dU + h1 * s' - h0 * s is the change in the terms not sampled exactly (A, b, and all flux-only terms), and
+			// the ratio of the normalizations, Z(h1) / Z(h0), makes up for the (now non-symmetric) proposal.
+			Vector flux = Vector::sphericalForm(F * random(), 2 * PI * random(), asin(2 * random() - 1));
+			Vector h0 = localField(a);
+			Vector h1 = h0 + Je0 * (flux - f);
+			double S = s.norm();
+			Vector spin = heatBathSpin(h1, S);
+			setLocalM(a, spin, flux);
+			dU_correction = h1 * spin - h0 * s - (heatBathFreeEnergy(h1, S) - heatBathFreeEnergy(h0, S));
+			lnQ = NAN;
+		} else if( cone ) {
+			// Symmetric (random walk) proposals. Since fluxes are otherwise picked with a uniform magnitude,
+			// i.e. density proportional to 1/|f|^2, the ratio |f|^2 / |f'|^2 is included to keep the same distribution.
+			Vector spin = s;
+			double S = s.norm();
+			if( S != 0 )
+				spin = S * aroundAxis( s * (1 / S), 1 - random() * (1 - cos(step * PI)), 2 * PI * random() );
+			Vector flux = f;
+			if( F != 0 )
+				flux += Vector::sphericalForm(step * 2 * F * cbrt(random()), 2 * PI * random(), asin(2 * random() - 1));
+			if( flux.normSq() >= F * F && F != 0 ) {
+				dU_correction = INFINITY;  // outside of the allowed ball: reject
+				lnQ = -INFINITY;
+			} else {
+				setLocalM(a, spin, flux);
+				if( f.normSq() != 0 && flux.normSq() != 0 ) {
+					lnQ = log(f.normSq() / flux.normSq());
+					dU_correction = -parameters.kT * lnQ;
+				}
+			}
+		} else
+			setLocalM( a, flippingAlgorithm(s, random),
+					Vector::sphericalForm(F * random(), 2 * PI * random(), asin(2 * random() - 1)) );
 		
 		Results r2 = getResults(); //get the energy of the system (for the new state)
-		double dU = r2.U - r.U;  // delta-U (change in energy)
-		if( dU <= 0 || random() < pow( E, -dU / parameters.kT ) ) {
-			//either the new system requires less energy or external energy (kT) is disrupting it
-			r = r2; //in either case we keep the new system
+		if( accept(r.U, r2.U, dU_correction, lnQ) ) {
+			r = r2; //keep the new system
+			++*accepted;
 		} else {
 			//neither thing (above) happened so we revert the system
 			if (inMol) {
@@ -2770,10 +4275,71 @@ void MSD::metropolis(unsigned long long N) {
 			}
 			results = r;
 		}
+
+		if( visit(i) )
+			r = getResults();
 	}
 	results.t += N;
 }
 
+// visit(i) is called after the hooks of every step, and must return true iff it changed the state (or kT, or B)
+template <typename Visit>
+void MSD::boltzmannSteps(unsigned long long N, Visit visit) {
+	function<double()> random = bind( rand, ref(prng) );
+	auto boltzmann = [&](double U, double U2, double dU_correction, double) {
+		double dU = U2 - U + dU_correction;  // delta-U (change in energy)
+		//either the new system requires less energy or external energy (kT) is disrupting it
+		return dU <= 0 || random() < pow( E, -dU / parameters.kT );
+	};
+	auto hooks = [&](unsigned long long i) {
+		bool changed = false;
+		if( clusterFreq != 0 && (results.t + i + 1) % clusterFreq == 0 ) {
+			clusterFlip();
+			changed = true;
+		}
+		if( overrelaxRatio != 0 && (results.t + i + 1) % n == 0 ) {
+			for( unsigned int k = 0; k < overrelaxRatio; k++ )
+				overrelax();
+			changed = true;
+		}
+		if( macrospinFreq != 0 && (results.t + i + 1) % macrospinFreq == 0 ) {
+			macrospinSweep();
+			changed = true;
+		}
+		if( visit(i) )
+			changed = true;
+		return changed;
+	};
+	metropolisSteps(N, boltzmann, hooks);
+}
+
+void MSD::metropolis(unsigned long long N) {
+	boltzmannSteps(N, [](unsigned long long) { return false; });
+}
+
+/**
+ * Metropolis sampling of a generalized ensemble: the state is weighted by exp(lnW(U)) instead of exp(-U / kT), e.g.
+ * lnW(U) = -ln(g(U)) for Wang-Landau (see: WangLandau.h). A state with lnW(U) == -INFINITY is never entered.
+ * visit(getResults()) is called after every step (accepted or not), and must not change the state of the MSD.
+ * clusterFreq, overrelaxRatio, and macrospinFreq are ignored since those moves are only valid for the Boltzmann
+ * distribution (so with macrospinFreq != 0, the FMs are frozen).
+ * Throws invalid_argument for HEAT_BATH_MODEL, since its proposals depend on kT.
+ */
+void MSD::metropolis(unsigned long long N, const function<double(double)> &lnW, const function<void(const Results &)> &visit) {
+	if( flippingAlgorithm.target_type() == HEAT_BATH_MODEL.target_type() )
+		throw invalid_argument("MSD::metropolis(N, lnW, visit) doesn't support HEAT_BATH_MODEL");
+	function<double()> random = bind( rand, ref(prng) );
+	auto generalized = [&](double U, double U2, double, double lnQ) {
+		double lnA = lnW(U2) - lnW(U) + lnQ;  // log of the acceptance ratio
+		return lnA >= 0 || random() < exp(lnA);
+	};
+	auto noHooks = [&](unsigned long long) {
+		visit(results);
+		return false;
+	};
+	metropolisSteps(N, generalized, noHooks);
+}
+
 void MSD::metropolis(unsigned long long N, unsigned long long freq) {
 	if( freq == 0 ) {
 		metropolis(N);
@@ -2781,6 +4347,8 @@ void MSD::metropolis(unsigned long long N, unsigned long long freq) {
 	}
 	while(true) {
 		record.push_back( getResults() );
+		if( recordCouplings )
+			couplingRecord.push_back( couplingEnergies() );
 		if( N >= freq ) {
 			metropolis(freq);
 			N -= freq;
@@ -2792,6 +4360,469 @@ void MSD::metropolis(unsigned long long N, unsigned long long freq) {
 	}
 }
 
+void MSD::sweep(unsigned long long sweeps) {
+	metropolis( sweeps * sweepLength() );
+}
+
+void MSD::sweep(unsigned long long sweeps, unsigned long long freq) {
+	const unsigned long long L = sweepLength();
+	metropolis( sweeps * L, freq * L );
+}
+
+unsigned long long MSD::sweepLength() {
+	updateSelection();
+	return selectableCount;
+}
+
+double MSD::getSweeps() {
+	const unsigned long long L = sweepLength();
+	return L == 0 ? 0 : static_cast<double>(results.t) / L;
+}
+
+/**
+ * Runs every stage of the schedule (see: MSD::Schedule) in one metropolis loop per stage, changing kT and B between
+ * steps and recording from inside the loop. Throws invalid_argument if any stage has kT < 0 (or NaN).
+ */
+void MSD::run(const Schedule &schedule) {
+	for( const Schedule::Stage &stage : schedule.stages )
+		if( !(stage.kT >= 0 && stage.kT_end >= 0) )
+			throw invalid_argument("MSD::run: requires kT >= 0");
+
+	for( size_t k = 0; k < schedule.stages.size(); k++ ) {
+		const Schedule::Stage &stage = schedule.stages[k];
+		if( stage.reset == Schedule::REINITIALIZE )
+			reinitialize();
+		else if( stage.reset == Schedule::RANDOMIZE )
+			randomize();
+		if( stage.clearRecord ) {
+			record.clear();
+			couplingRecord.clear();
+		}
+		set_kT(stage.kT);
+		if( stage.B != parameters.B )
+			setB(stage.B);  // (only if needed, since it rounds U differently than metropolis)
+
+		const unsigned long long N = stage.steps, freq = stage.freq;
+		const bool ramp = N != 0 && (stage.kT_end != stage.kT || stage.B_end != stage.B);
+		const double dkT = ramp ? (stage.kT_end - stage.kT) / N : 0;
+		const Vector dB = ramp ? (1.0 / N) * (stage.B_end - stage.B) : Vector::ZERO;
+		auto push = [&](unsigned long long i) {  // after i steps (results.t is only updated at the end of the loop)
+			Results r = getResults();
+			r.t += i;
+			record.push_back(r);
+			if( recordCouplings )
+				couplingRecord.push_back( couplingEnergies() );
+			if( schedule.onRecord )
+				schedule.onRecord(k, r);
+		};
+
+		if( freq != 0 )
+			push(0);
+		boltzmannSteps(N, [&](unsigned long long i) {
+			if( ramp && i + 1 == N ) {
+				parameters.kT = stage.kT_end;
+				setB(stage.B_end);
+			} else if( ramp ) {
+				parameters.kT = stage.kT + dkT * (i + 1);
+				setB(stage.B + static_cast<double>(i + 1) * dB);
+			}
+			if( freq != 0 && (i + 1) % freq == 0 )
+				push(i + 1);
+			return ramp;
+		});
+		if( schedule.onStageEnd )
+			schedule.onStageEnd(k);
+	}
+}
+
+/**
+ * Wolff cluster move for the Heisenberg (JL, JR) part of the FM regions: a cluster is grown from a random FM atom
+ * through bonds of its own FM, then every spin in it is reflected about a random plane (normal vector, r).
+ * Bonds are added with probability 1 - exp(min(0, -2 J (r.s_i)(r.s_j) / kT)), which satisfies detailed balance
+ * for the intra-FM spin-spin energy exactly. Every other term (B, anisotropy, flux couplings, biquadratic, DMI,
+ * and bonds leaving the FM) is "embedded" by accepting the whole move with probability exp(-dU' / kT), where dU'
+ * is the change in energy not already accounted for by the cluster construction.
+ *
+ * With UP_DOWN_MODEL, the seed's own axis is used as r, and bonds are only added to spins collinear with it, so the
+ * reflection is exactly s -> -s for every spin in the cluster (the move UP_DOWN_MODEL itself makes) and no spin ever
+ * leaves its axis. A non-collinear neighbor (e.g. after randomize, which gives every spin its own axis) is never
+ * added, in either direction of the move, so its bond is left to the acceptance step like the embedded terms.
+ * Fluxes and mol. atoms are never changed by this move. Does not advance results.t.
+ */
+unsigned int MSD::clusterFlip() {
+	updateSelection();
+	if( nL + nR == 0 || !fmSelectable )
+		return 0;  // no FM atoms to grow a cluster from
+
+	// pick a seed atom (pseudo) randomly from either FM
+	unsigned int a0;
+	do {
+		a0 = pickSite();
+	} while( molPosL <= x(a0) && x(a0) <= molPosR );
+	const double J = x(a0) < molPosL ? parameters.JL : parameters.JR;
+
+	// pick the reflection axis
+	Vector r;
+	if( flippingAlgorithm.target_type() == UP_DOWN_MODEL.target_type() ) {
+		r = spins[a0];
+		if( r.normSq() == 0 )
+			return 0;
+		r.normalize();
+	} else {
+		r = Vector::sphericalForm(1, 2 * PI * rand(prng), asin(2 * rand(prng) - 1));
+	}
+	// can a1 join the cluster? (with UP_DOWN_MODEL, only if its spin is on the axis r)
+	const bool collinearOnly = flippingAlgorithm.target_type() == UP_DOWN_MODEL.target_type();
+	auto bondable = [&](unsigned int a1) {
+		return !collinearOnly || r.crossProduct(spins[a1]).normSq() <= 1e-20 * spins[a1].normSq();
+	};
+
+	// grow the cluster (breadth first)
+	if( inCluster.size() != spins.capacity() )
+		inCluster.assign(spins.capacity(), false);
+	unsigned int neighbors[6];
+	cluster.clear();
+	cluster.push_back(a0);
+	inCluster[a0] = true;
+	bool frozen = false;  // does the cluster include a frozen atom? (then the move is rejected)
+	for( size_t i = 0; i < cluster.size(); i++ ) {
+		const unsigned int a = cluster[i];
+		const double rs = r * spins[a];
+		const unsigned int count = regionNeighbors(a, neighbors);
+		for( unsigned int k = 0; k < count; k++ ) {
+			const unsigned int a1 = neighbors[k];
+			if( inCluster[a1] || !bondable(a1) )
+				continue;
+			double e = 2 * J * rs * (r * spins[a1]);  // increase in bond energy if only "a" were reflected
+			if( e > 0 && rand(prng) < 1 - pow( E, -e / parameters.kT ) ) {
+				cluster.push_back(a1);
+				inCluster[a1] = true;
+				frozen = frozen || (!siteWeights.empty() && siteWeights[a1] == 0);
+			}
+		}
+	}
+	if( frozen ) {
+		for( unsigned int a : cluster )
+			inCluster[a] = false;
+		return 0;
+	}
+
+	// change in spin-spin energy of the cluster's boundary that the construction accounts for (the bonds inside the
+	// cluster don't change, and bonds that could never be added are left to the acceptance step)
+	double deltaU_J = 0;
+	for( unsigned int a : cluster ) {
+		const double rs = r * spins[a];
+		const unsigned int count = regionNeighbors(a, neighbors);
+		for( unsigned int k = 0; k < count; k++ )
+			if( !inCluster[neighbors[k]] && bondable(neighbors[k]) )
+				deltaU_J += 2 * J * rs * (r * spins[neighbors[k]]);
+	}
+
+	// reflect the cluster
+	const Results prev = getResults();
+	std::vector<Vector> prevSpins;
+	prevSpins.reserve(cluster.size());
+	for( unsigned int a : cluster ) {
+		Vector s = spins[a];
+		prevSpins.push_back(s);
+		setLocalM( a, collinearOnly ? -s : s - (2 * (r * s)) * r, fluxes[a] );  // (exactly s -> -s on the axis)
+	}
+
+	// accept or reject based on the remaining (non-Heisenberg) change in energy
+	double dU = (results.U - prev.U) - deltaU_J;
+	bool accepted = dU <= 0 || rand(prng) < pow( E, -dU / parameters.kT );
+	if( !accepted ) {
+		for( size_t i = 0; i < cluster.size(); i++ )
+			spins[cluster[i]] = prevSpins[i];
+		results = prev;
+	}
+	for( unsigned int a : cluster )
+		inCluster[a] = false;
+	return accepted ? cluster.size() : 0;
+}
+
+/**
+ * Over-relaxation sweep: each atom's spin, in order, is reflected about its local field h (see: MSD::localField),
+ *   s' = 2 (s.h / h.h) h - s,
+ * which leaves the linear part of the energy (B, J, Je0, Je1, DMI) unchanged. Any remaining change in energy
+ * (anisotropy and biquadratic terms only) is accepted or rejected the same way as in metropolis, so the reflection
+ * is exact for any set of parameters, and free (always accepted, microcanonical) when A and b are zero.
+ * Magnitudes and fluxes are never changed.
+ *
+ * Meant to be interleaved with metropolis (see: MSD::overrelaxRatio) to speed up decorrelation of the continuous
+ * spin model; it does nothing with UP_DOWN_MODEL since the reflected spin would leave its axis. Does not advance results.t.
+ */
+unsigned int MSD::overrelax() {
+	if( flippingAlgorithm.target_type() == UP_DOWN_MODEL.target_type() )
+		return 0;
+
+	unsigned int accepted = 0;
+	for( unsigned int a : indices ) {
+		if( selectionWeight(a) == 0 )
+			continue;  // frozen, skipped, or a macrospin
+		Vector h = localField(a);
+		double hh = h.normSq();
+		if( hh == 0 )
+			continue;  // no preferred axis
+
+		Vector s = getSpin(a);
+		Vector f = getFlux(a);
+		const Results r = getResults();
+		setLocalM( a, (2 * (s * h) / hh) * h - s, f );
+
+		double dU = results.U - r.U;
+		if( dU <= 0 || rand(prng) < pow( E, -dU / parameters.kT ) ) {
+			accepted++;
+		} else {
+			unsigned int x = this->x(a);
+			if (molPosL <= x && x <= molPosR)
+				mols[a]->spins[x - molPosL] = s;
+			else
+				spins[a] = s;
+			results = r;
+		}
+	}
+	return accepted;
+}
+
+/**
+ * Coarse-grained ("macrospin") model of the FMs, for when only the mol. and its interfaces are of interest: each layer
+ * (x) of FM_L and FM_R is treated as one rigid macrospin. A new direction, d', is proposed for each layer in turn, and
+ * every spin of the layer is set to |s| d'. The change in energy is exact (including the JmL, JmR, Je1mL, ... bonds to
+ * the mol., and the J bonds between layers), and the rotation is accepted or rejected the same way as in metropolis.
+ *   UP_DOWN_MODEL: d' = -d (the layer flips).
+ *   CONE_MODEL: d' is within proposalSteps.L (or R) of the current direction, d.
+ *   otherwise: d' is uniformly random.
+ * Each proposal is symmetric, so detailed balance holds once a layer is aligned, i.e. after its first accepted rotation.
+ *
+ * With macrospinFreq != 0, metropolis only picks mol. atoms (see: MSD::setSiteWeight), and calls this every
+ * macrospinFreq steps. So the FMs cost O(nL + nR) per macrospinFreq steps instead of most of the steps, and every
+ * Results field keeps its meaning. FM fluxes are never changed. Does not advance results.t.
+ */
+unsigned int MSD::macrospinSweep() {
+	if( layers.empty() && nL + nR != 0 ) {
+		std::vector< std::vector<unsigned int> > byX(width);
+		for( unsigned int a : indices ) {
+			unsigned int x = this->x(a);
+			if( x < molPosL || x > molPosR )
+				byX[x].push_back(a);
+		}
+		for( auto &layer : byX )
+			if( !layer.empty() )
+				layers.push_back(std::move(layer));
+	}
+
+	const bool upDown = flippingAlgorithm.target_type() == UP_DOWN_MODEL.target_type();
+	const bool cone = flippingAlgorithm.target_type() == CONE_MODEL.target_type();
+	unsigned int accepted = 0;
+	std::vector<Vector> old;
+	for( const auto &layer : layers ) {
+		// current direction of the layer (of its first non-zero spin)
+		Vector d = Vector::ZERO;
+		for( unsigned int a : layer )
+			if( spins[a].normSq() != 0 ) {
+				d = spins[a] * (1 / spins[a].norm());
+				break;
+			}
+		if( d.normSq() == 0 )
+			continue;  // every spin is 0
+
+		Vector d2;
+		if( upDown )
+			d2 = -d;
+		else if( cone ) {
+			double step = x(layer[0]) < molPosL ? proposalSteps.L : proposalSteps.R;
+			d2 = aroundAxis( d, 1 - rand(prng) * (1 - cos(step * PI)), 2 * PI * rand(prng) );
+		} else
+			d2 = Vector::sphericalForm(1, 2 * PI * rand(prng), asin(2 * rand(prng) - 1));
+
+		const Results r = getResults();
+		old.clear();
+		for( unsigned int a : layer ) {
+			old.push_back(spins[a]);
+			setLocalM( a, spins[a].norm() * d2, fluxes[a] );
+		}
+
+		double dU = results.U - r.U;
+		if( dU <= 0 || rand(prng) < pow( E, -dU / parameters.kT ) ) {
+			accepted++;
+		} else {
+			for( size_t i = 0; i < layer.size(); i++ )
+				spins[layer[i]] = old[i];
+			results = r;
+		}
+	}
+	return accepted;
+}
+
+/**
+ * Same as metropolis(N), but every 10 sweeps (10 n steps, at least 1000) the step size of each region is scaled by
+ * (acceptance rate / targetRate), limited to a factor of 2 either way, to approach the target acceptance rate.
+ * Meant to be used for equilibration with CONE_MODEL; the proposal steps have no effect on the other models.
+ * The acceptance stats are reset afterwards.
+ */
+void MSD::tuneProposals(unsigned long long N, double targetRate) {
+	auto tune = [targetRate](double &step, unsigned long long tried, unsigned long long accepted) {
+		if( tried == 0 )
+			return;
+		double factor = (static_cast<double>(accepted) / tried) / targetRate;
+		step *= factor < 0.5 ? 0.5 : (factor > 2 ? 2 : factor);
+		if( step > 1 )
+			step = 1;
+		else if( step < 1e-6 )
+			step = 1e-6;
+	};
+
+	const unsigned long long block = 10ull * n > 1000 ? 10ull * n : 1000;
+	while( N != 0 ) {
+		unsigned long long steps = N < block ? N : block;
+		resetAcceptanceStats();
+		metropolis(steps);
+		N -= steps;
+		tune(proposalSteps.L, acceptanceStats.triedL, acceptanceStats.acceptedL);
+		tune(proposalSteps.R, acceptanceStats.triedR, acceptanceStats.acceptedR);
+		tune(proposalSteps.m, acceptanceStats.triedm, acceptanceStats.acceptedm);
+	}
+	resetAcceptanceStats();
+}
+
+/**
+ * N-fold way (Bortz, Kalos, Lebowitz): a rejection-free version of metropolis(N) for UP_DOWN_MODEL.
+ * The acceptance probability, w_a, of flipping each atom is kept in a sum tree. Each metropolis step would
+ * flip some atom with probability W = (sum of w_a) / n, so the number of steps until the next flip is sampled
+ * from a geometric distribution, and atom "a" is then picked with probability w_a / (sum of w_a).
+ * After a flip, only the rates of "a" and its neighbors are updated.
+ *
+ * results.t advances by exactly N steps, with the same meaning (and distribution of states) as metropolis(N),
+ * so it remains a physical time axis at low kT, where metropolis would waste nearly every step.
+ * The rates are rebuilt at the start of each call, so parameters may be changed between calls.
+ *
+ * Requires FL == FR == 0 and Fm == 0 (for every node), since flux proposals are continuous;
+ * throws invalid_argument otherwise. (Fluxes which are already non-zero are set to 0 as atoms flip.)
+ * Cluster moves and over-relaxation are not used, and neither are macrospins (throws invalid_argument if
+ * macrospinFreq != 0). Atoms are always picked at random, so it also throws invalid_argument if sweepMode isn't
+ * RANDOM_SITE (the ordered sweeps have no rejection-free equivalent).
+ */
+void MSD::nFoldWay(unsigned long long N) {
+	if( macrospinFreq != 0 )
+		throw invalid_argument("MSD::nFoldWay doesn't support macrospinFreq != 0");
+	if( sweepMode != RANDOM_SITE )
+		throw invalid_argument("MSD::nFoldWay requires sweepMode == RANDOM_SITE");
+	if( (FM_L_exists && parameters.FL != 0) || (FM_R_exists && parameters.FR != 0) )
+		throw invalid_argument("MSD::nFoldWay requires FL == FR == 0");
+	if( mol_exists )
+		for (const Molecule::Node &node : molProto.nodes)
+			if (node.parameters.Fm != 0)
+				throw invalid_argument("MSD::nFoldWay requires Fm == 0");
+
+	// (re)build the rates
+	if( ratePosition.size() != spins.capacity() )
+		ratePosition.assign(spins.capacity(), 0);
+	updateSelection();
+	std::vector<double> w(indices.size());
+	for( unsigned int i = 0; i < indices.size(); i++ ) {
+		ratePosition[indices[i]] = i;
+		w[i] = selectionWeight(indices[i]) * flipRate(indices[i]);
+	}
+	flipRates.assign(w);
+
+	unsigned long long remaining = N;
+	while( remaining != 0 && selectionTotal > 0 ) {
+		double W = flipRates.total() / selectionTotal;  // probability that a metropolis step would flip an atom
+		if( W <= 0 )
+			break;  // frozen: every remaining step would be rejected
+		double k = W >= 1 ? 1 : 1 + floor( log(1 - rand(prng)) / log1p(-W) );  // steps until (and including) the next flip
+		if( k > remaining )
+			break;  // the next flip happens after N steps
+		remaining -= static_cast<unsigned long long>(k);
+		results.t += static_cast<unsigned long long>(k);
+
+		const unsigned int a = indices[ flipRates.find(rand(prng) * flipRates.total()) ];
+		setLocalM( a, -getSpin(a), Vector::ZERO );
+		flipRates.set( ratePosition[a], selectionWeight(a) * flipRate(a) );
+		neighborsOf(a, neighborScratch);
+		for( unsigned int a1 : neighborScratch )
+			flipRates.set( ratePosition[a1], selectionWeight(a1) * flipRate(a1) );
+	}
+	results.t += remaining;
+}
+
+void MSD::nFoldWay(unsigned long long N, unsigned long long freq) {
+	if( freq == 0 ) {
+		nFoldWay(N);
+		return;
+	}
+	while(true) {
+		record.push_back( getResults() );
+		if( recordCouplings )
+			couplingRecord.push_back( couplingEnergies() );
+		if( N >= freq ) {
+			nFoldWay(freq);
+			N -= freq;
+		} else {
+			if( N != 0 )
+				nFoldWay(N);
+			break;
+		}
+	}
+}
+
+MSD::AcceptanceStats MSD::getAcceptanceStats() const {
+	return acceptanceStats;
+}
+
+void MSD::resetAcceptanceStats() {
+	acceptanceStats = AcceptanceStats();
+}
+
+
+// ----- fluctuation estimators (see: MSD::recordCouplings) -----
+// Pairs the last entries of record with the last entries of couplingRecord (both are pushed together), each
+// sample having the same weight. Vector components (e.g. &CouplingEnergies::B) aren't supported since Coupling
+// only points to doubles; for those use couplingRecord directly.
+double MSD::meanCoupling(Coupling c) const {
+	if( couplingRecord.empty() )
+		throw std::logic_error("MSD: couplingRecord is empty (was recordCouplings set?)");
+	double sum = 0;
+	for( const CouplingEnergies &e : couplingRecord )
+		sum += e.*c;
+	return sum / couplingRecord.size();
+}
+
+double MSD::dMeanU(Coupling c) const {
+	size_t len = std::min(record.size(), couplingRecord.size());
+	if( len == 0 )
+		throw std::logic_error("MSD: couplingRecord is empty (was recordCouplings set?)");
+	auto r = record.end() - len;
+	auto e = couplingRecord.end() - len;
+	double sumU = 0, sumE = 0, sumUE = 0;
+	for( size_t i = 0; i < len; i++ ) {
+		double dU = (*e++).*c;
+		sumU += r->U;
+		sumE += dU;
+		sumUE += (r++)->U * dU;
+	}
+	double meanU = sumU / len, meanE = sumE / len;
+	return meanE - (sumUE / len - meanU * meanE) / parameters.kT;
+}
+
+Vector MSD::dMeanM(Coupling c) const {
+	size_t len = std::min(record.size(), couplingRecord.size());
+	if( len == 0 )
+		throw std::logic_error("MSD: couplingRecord is empty (was recordCouplings set?)");
+	auto r = record.end() - len;
+	auto e = couplingRecord.end() - len;
+	Vector sumM = Vector::ZERO, sumME = Vector::ZERO;
+	double sumE = 0;
+	for( size_t i = 0; i < len; i++ ) {
+		double dU = (*e++).*c;
+		sumM += r->M;
+		sumE += dU;
+		sumME += dU * (r++)->M;
+	}
+	double meanE = sumE / len;
+	return (-1 / parameters.kT) * ((1.0 / len) * sumME - meanE * ((1.0 / len) * sumM));
+}
 
 double MSD::specificHeat() const {
 	if (record.size() <= 1) {
@@ -2806,7 +4837,7 @@ double MSD::specificHeat() const {
 		double dU = r1->U - r0->U;
 		double dt = r1->t - r0->t;
 		s += (r0->U + r1->U) * dt;  // trapizoidal rule (1/2 factored out)
-		s2 += ((dt/3 * dU + r0->U) * dU + sq(r0->U)) * dt;  // square of trapizoidal rule (linear interpolation)
+		s2 += ((dU / 3 + r0->U) * dU + sq(r0->U)) * dt;  // square of trapizoidal rule (linear interpolation)
 
 		r0 = r1;
 	}
@@ -2831,7 +4862,7 @@ double MSD::specificHeat_L() const {
 		double dU = r1->UL - r0->UL;
 		double dt = r1->t - r0->t;
 		s += (r0->UL + r1->UL) * dt;  // trapizoidal rule (1/2 factored out)
-		s2 += ((dt/3 * dU + r0->UL) * dU + sq(r0->UL)) * dt;  // square of trapizoidal rule (linear interpolation)
+		s2 += ((dU / 3 + r0->UL) * dU + sq(r0->UL)) * dt;  // square of trapizoidal rule (linear interpolation)
 
 		r0 = r1;
 	}
@@ -2856,7 +4887,7 @@ double MSD::specificHeat_R() const {
 		double dU = r1->UR - r0->UR;
 		double dt = r1->t - r0->t;
 		s += (r0->UR + r1->UR) * dt;  // trapizoidal rule (1/2 factored out)
-		s2 += ((dt/3 * dU + r0->UR) * dU + sq(r0->UR)) * dt;  // square of trapizoidal rule (linear interpolation)
+		s2 += ((dU / 3 + r0->UR) * dU + sq(r0->UR)) * dt;  // square of trapizoidal rule (linear interpolation)
 
 		r0 = r1;
 	}
@@ -2881,7 +4912,7 @@ double MSD::specificHeat_m() const {
 		double dU = r1->Um - r0->Um;
 		double dt = r1->t - r0->t;
 		s += (r0->Um + r1->Um) * dt;  // trapizoidal rule (1/2 factored out)
-		s2 += ((dt/3 * dU + r0->Um) * dU + sq(r0->Um)) * dt;  // square of trapizoidal rule (linear interpolation)
+		s2 += ((dU / 3 + r0->Um) * dU + sq(r0->Um)) * dt;  // square of trapizoidal rule (linear interpolation)
 
 		r0 = r1;
 	}
@@ -2906,7 +4937,7 @@ double MSD::specificHeat_mL() const {
 		double dU = r1->UmL - r0->UmL;
 		double dt = r1->t - r0->t;
 		s += (r0->UmL + r1->UmL) * dt;  // trapizoidal rule (1/2 factored out)
-		s2 += ((dt/3 * dU + r0->UmL) * dU + sq(r0->UmL)) * dt;  // square of trapizoidal rule (linear interpolation)
+		s2 += ((dU / 3 + r0->UmL) * dU + sq(r0->UmL)) * dt;  // square of trapizoidal rule (linear interpolation)
 
 		r0 = r1;
 	}
@@ -2931,7 +4962,7 @@ double MSD::specificHeat_mR() const {
 		double dU = r1->UmR - r0->UmR;
 		double dt = r1->t - r0->t;
 		s += (r0->UmR + r1->UmR) * dt;  // trapizoidal rule (1/2 factored out)
-		s2 += ((dt/3 * dU + r0->UmR) * dU + sq(r0->UmR)) * dt;  // square of trapizoidal rule (linear interpolation)
+		s2 += ((dU / 3 + r0->UmR) * dU + sq(r0->UmR)) * dt;  // square of trapizoidal rule (linear interpolation)
 
 		r0 = r1;
 	}
@@ -2956,7 +4987,7 @@ double MSD::specificHeat_LR() const {
 		double dU = r1->ULR - r0->ULR;
 		double dt = r1->t - r0->t;
 		s += (r0->ULR + r1->ULR) * dt;  // trapizoidal rule (1/2 factored out)
-		s2 += ((dt/3 * dU + r0->ULR) * dU + sq(r0->ULR)) * dt;  // square of trapizoidal rule (linear interpolation)
+		s2 += ((dU / 3 + r0->ULR) * dU + sq(r0->ULR)) * dt;  // square of trapizoidal rule (linear interpolation)
 
 		r0 = r1;
 	}
@@ -2982,7 +5013,7 @@ double MSD::magneticSusceptibility() const {
 		Vector dM = r1->M - r0->M;
 		double dt = r1->t - r0->t;
 		s += (r0->M + r1->M) * dt;  // trapizoidal rule (1/2 factored out)
-		s2 += ((dt/3 * dM + r0->M) * dM + r0->M * r0->M) * dt;  // square of trapizoidal rule (linear interpolation)
+		s2 += ((dM * (1.0 / 3) + r0->M) * dM + r0->M * r0->M) * dt;  // square of trapizoidal rule (linear interpolation)
 
 		r0 = r1;
 	}
@@ -3008,7 +5039,7 @@ double MSD::magneticSusceptibility_L() const {
 		Vector dM = r1->ML - r0->ML;
 		double dt = r1->t - r0->t;
 		s += (r0->ML + r1->ML) * dt;  // trapizoidal rule (1/2 factored out)
-		s2 += ((dt/3 * dM + r0->ML) * dM + r0->ML * r0->ML) * dt;  // square of trapizoidal rule (linear interpolation)
+		s2 += ((dM * (1.0 / 3) + r0->ML) * dM + r0->ML * r0->ML) * dt;  // square of trapizoidal rule (linear interpolation)
 
 		r0 = r1;
 	}
@@ -3034,7 +5065,7 @@ double MSD::magneticSusceptibility_R() const {
 		Vector dM = r1->MR - r0->MR;
 		double dt = r1->t - r0->t;
 		s += (r0->MR + r1->MR) * dt;  // trapizoidal rule (1/2 factored out)
-		s2 += ((dt/3 * dM + r0->MR) * dM + r0->MR * r0->MR) * dt;  // square of trapizoidal rule (linear interpolation)
+		s2 += ((dM * (1.0 / 3) + r0->MR) * dM + r0->MR * r0->MR) * dt;  // square of trapizoidal rule (linear interpolation)
 
 		r0 = r1;
 	}
@@ -3060,7 +5091,7 @@ double MSD::magneticSusceptibility_m() const {
 		Vector dM = r1->Mm - r0->Mm;
 		double dt = r1->t - r0->t;
 		s += (r0->Mm + r1->Mm) * dt;  // trapizoidal rule (1/2 factored out)
-		s2 += ((dt/3 * dM + r0->Mm) * dM + r0->Mm * r0->Mm) * dt;  // square of trapizoidal rule (linear interpolation)
+		s2 += ((dM * (1.0 / 3) + r0->Mm) * dM + r0->Mm * r0->Mm) * dt;  // square of trapizoidal rule (linear interpolation)
 
 		r0 = r1;
 	}
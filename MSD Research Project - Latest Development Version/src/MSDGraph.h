@@ -0,0 +1,155 @@
+#ifndef UDC_MSD_GRAPH
+#define UDC_MSD_GRAPH
+
+#include <vector>
+#include "MSD.h"
+
+namespace udc {
+
+/*
+ * An MSD flattened into a list of sites (atoms) and a (CSR) list of bonds, with the parameters of each, so that
+ * engines which store their own spin states (e.g. BatchMSD, IsingMSD) can share the geometry. The bonds are the same
+ * as the ones MSD::setParameters and MSD::setMolProto sum over, and each is listed once for both of its sites.
+ */
+struct MSDGraph {
+	enum Region { L, R, M, ML, MR, LR };  // sites are only L, R, or M
+
+	struct Bond {
+		unsigned int site;  // the other site
+		Region region;
+		double J, Je1, Jee, b;
+		Vector D;  // oriented so that the energy is -D * (m_this x m_site)
+	};
+
+	unsigned int width, height, depth;
+	std::vector<unsigned int> indices;  // MSD index of each site
+	std::vector<int> slot;  // site of each MSD index, or -1
+	std::vector<int> cell;  // site at each (z * height + y) * width + x, or -1 (see: MSD::setSiteOrder)
+	std::vector<Region> regions;
+	std::vector<double> F, Je0;
+	std::vector<Vector> A;
+	std::vector<size_t> bondStart;  // bonds of site a are [bondStart[a], bondStart[a + 1])
+	std::vector<Bond> bonds;
+
+	explicit MSDGraph(const MSD &msd);
+
+	unsigned int size() const;  // number of sites
+	int site(unsigned int x, unsigned int y, unsigned int z) const;  // or -1
+	int site(unsigned int a) const;  // from an MSD index, or -1
+};
+
+
+MSDGraph::MSDGraph(const MSD &msd)
+	: width(msd.getWidth()), height(msd.getHeight()), depth(msd.getDepth()), slot(msd.getCapacity(), -1),
+	  cell(width * height * depth, -1)
+{
+	const MSD::Parameters p = msd.getParameters();
+	const MSD::MolProto &mol = msd.getMolProto();
+	const unsigned int molPosL = msd.getMolPosL(), molPosR = msd.getMolPosR();
+
+	// ----- sites -----
+	for( auto iter = msd.begin(); iter != msd.end(); ++iter ) {
+		unsigned int x = iter.getX();
+		slot[iter.getIndex()] = static_cast<int>(indices.size());
+		cell[(iter.getZ() * height + iter.getY()) * width + x] = static_cast<int>(indices.size());
+		indices.push_back(iter.getIndex());
+		if( x < molPosL ) {
+			regions.push_back(L);
+			F.push_back(p.FL);
+			Je0.push_back(p.Je0L);
+			A.push_back(p.AL);
+		} else if( x > molPosR ) {
+			regions.push_back(R);
+			F.push_back(p.FR);
+			Je0.push_back(p.Je0R);
+			A.push_back(p.AR);
+		} else {
+			Molecule::NodeParameters node = mol.getNodeParameters(x - molPosL);
+			regions.push_back(M);
+			F.push_back(node.Fm);
+			Je0.push_back(node.Je0m);
+			A.push_back(node.Am);
+		}
+	}
+	const unsigned int n = size();
+
+	// ----- bonds -----
+	std::vector< std::vector<Bond> > adj(n);
+	auto add = [&](int a, int b, Region region, double J, double Je1, double Jee, double bq, const Vector &D) {
+		if( a < 0 || b < 0 )
+			return;
+		Bond bond;
+		bond.region = region;
+		bond.J = J;
+		bond.Je1 = Je1;
+		bond.Jee = Jee;
+		bond.b = bq;
+		bond.site = b;
+		bond.D = D;
+		adj[a].push_back(bond);
+		bond.site = a;
+		bond.D = -D;  // m_b x m_a == -(m_a x m_b)
+		adj[b].push_back(bond);
+	};
+	for( unsigned int z = 0; z < depth; z++ )
+		for( unsigned int y = 0; y < height; y++ )
+			for( unsigned int x = 0; x < width; x++ ) {
+				int a = site(x, y, z);
+				if( a < 0 || regions[a] == M )
+					continue;
+				bool left = regions[a] == L;
+				double J = left ? p.JL : p.JR, Je1 = left ? p.Je1L : p.Je1R, Jee = left ? p.JeeL : p.JeeR;
+				double bq = left ? p.bL : p.bR;
+				Vector D = left ? p.DL : p.DR;
+				// (the next position may be across a periodic boundary, see: MSD::setPeriodic)
+				const unsigned int nextX = msd.adjacent(left, 0, x, true), nextY = msd.adjacent(left, 1, y, true),
+				                   nextZ = msd.adjacent(left, 2, z, true);
+				for( int b : { site(nextX, y, z), site(x, nextY, z), site(x, y, nextZ) } )
+					if( b >= 0 && regions[b] == regions[a] )
+						add(a, b, regions[a], J, Je1, Jee, bq, D);
+			}
+	for( unsigned int z = 0; z < depth; z++ )
+		for( unsigned int y = 0; y < height; y++ ) {
+			if( molPosL <= molPosR && site(molPosL, y, z) >= 0 ) {  // a mol. at (y, z)
+				auto edges = mol.getEdges();
+				for( auto edge = edges.begin(); edge != edges.end(); ++edge ) {
+					if( edge.src() >= edge.dest() )
+						continue;  // each edge is listed in both directions, and loops are ignored (see: MSD::setMolProto)
+					Molecule::EdgeParameters e = edge.getParameters();
+					add(site(molPosL + edge.src(), y, z), site(molPosL + edge.dest(), y, z), M,
+							e.Jm, e.Je1m, e.Jeem, e.bm, edge.getDirection() * e.Dm);
+				}
+				if( molPosL != 0 )
+					add(site(molPosL - 1, y, z), site(molPosL + mol.getLeftLead(), y, z), ML,
+							p.JmL, p.Je1mL, p.JeemL, p.bmL, p.DmL);
+				if( molPosR + 1 < width )
+					add(site(molPosL + mol.getRightLead(), y, z), site(molPosR + 1, y, z), MR,
+							p.JmR, p.Je1mR, p.JeemR, p.bmR, p.DmR);
+			}
+			if( molPosL != 0 && molPosR + 1 < width )
+				add(site(molPosL - 1, y, z), site(molPosR + 1, y, z), LR, p.JLR, p.Je1LR, p.JeeLR, p.bLR, p.DLR);
+		}
+	bondStart.push_back(0);
+	for( unsigned int a = 0; a < n; a++ ) {
+		bonds.insert(bonds.end(), adj[a].begin(), adj[a].end());
+		bondStart.push_back(bonds.size());
+	}
+}
+
+unsigned int MSDGraph::size() const {
+	return static_cast<unsigned int>(indices.size());
+}
+
+int MSDGraph::site(unsigned int x, unsigned int y, unsigned int z) const {
+	if( x >= width || y >= height || z >= depth )
+		return -1;
+	return cell[(z * height + y) * width + x];
+}
+
+int MSDGraph::site(unsigned int a) const {
+	return a < slot.size() ? slot[a] : -1;
+}
+
+}  // end of namespace udc
+
+#endif
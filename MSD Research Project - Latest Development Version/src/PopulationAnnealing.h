@@ -0,0 +1,228 @@
+#ifndef UDC_POPULATION_ANNEALING
+#define UDC_POPULATION_ANNEALING
+
+#include <algorithm>
+#include <cmath>
+#include <functional>
+#include <future>
+#include <memory>
+#include <random>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+#include "MSD.h"
+
+namespace udc {
+
+/*
+ * Population annealing (Hukushima and Iba; Machta) of many replicas of the same MSD through a kT schedule.
+ *
+ * At each kT, every replica does "sweeps" * n metropolis steps (the replicas are split between "threads" threads).
+ * Then, before moving from kT to kT', the population is resampled: replica i is copied in proportion to its weight,
+ * w_i = exp(-(1/kT' - 1/kT) U_i), using systematic resampling so the population size stays constant. The mean
+ * weight, Q = <w>, is the ratio of the partition functions, Z(kT') / Z(kT), so the free energy is known (up to
+ * a constant) at every kT of the schedule.
+ *
+ * The estimates at each kT are population averages (like MSD::meanU, MSD::specificHeat, etc. but over replicas
+ * instead of time). They are only reliable when the population is still diverse: see Step::effectiveFamilies.
+ */
+class PopulationAnnealing {
+ public:
+	typedef std::function<std::shared_ptr<MSD>()> Factory;  // makes a new replica, with all of its parameters set
+
+	struct Step {
+		double kT;
+		double meanU;
+		Vector meanM;
+		double specificHeat;            // same definition as MSD::specificHeat, but using the population variance
+		double magneticSusceptibility;  // same definition as MSD::magneticSusceptibility (see above)
+		double lnZ;    // ln(Z(kT) / Z(kT_0)), where kT_0 is the first kT of the schedule
+		double betaF;  // F(kT) / kT - F(kT_0) / kT_0 == -lnZ
+		double effectiveFamilies;  // 1 / sum(p_f^2), where p_f is the fraction of replicas descended from initial replica f
+	};
+
+	unsigned long long sweeps;  // metropolis sweeps (n steps each) done by every replica at each kT (default: 10)
+	unsigned int threads;  // (default: std::thread::hardware_concurrency())
+
+	PopulationAnnealing(const Factory &factory, unsigned int replicas);
+
+	void run(const std::vector<double> &schedule);  // starting from the state given by the factory (or the last run)
+
+	unsigned int getReplicas() const;
+	const MSD & getReplica(unsigned int i) const;
+	const std::vector<Step> & getSteps() const;
+
+ private:
+	std::vector< std::shared_ptr<MSD> > replicas;
+	std::vector<unsigned int> families;  // the initial replica each replica is descended from
+	std::vector<Step> steps;
+	unsigned int n;  // atoms per replica
+	std::mt19937_64 prng;
+	std::uniform_real_distribution<double> rand;
+
+	void parallel(const std::function<void(unsigned int)> &f);  // calls f(i) for every replica, i
+	void resample(double kT0, double kT1, double &lnQ);
+	Step measure(double kT, double lnZ) const;
+	static void copyState(const MSD &from, MSD &to);
+};
+
+
+PopulationAnnealing::PopulationAnnealing(const Factory &factory, unsigned int replicas)
+	: sweeps(10), threads(std::thread::hardware_concurrency()), replicas(replicas), families(replicas), rand(0, 1)
+{
+	if( replicas == 0 )
+		throw std::invalid_argument("PopulationAnnealing: requires at least 1 replica");
+	if( threads == 0 )
+		threads = 1;
+	for( unsigned int i = 0; i < replicas; i++ ) {
+		this->replicas[i] = factory();
+		families[i] = i;
+	}
+	// replicas made at the same time get the same seed
+	unsigned long seed = this->replicas[0]->getSeed();
+	for( unsigned int i = 0; i < replicas; i++ )
+		this->replicas[i]->setSeed(seed + i);
+	prng.seed(seed + replicas);
+	n = this->replicas[0]->getN();
+}
+
+// copies the spins and fluxes of every atom (Results are updated by setLocalM)
+void PopulationAnnealing::copyState(const MSD &from, MSD &to) {
+	for( auto iter = from.begin(); iter != from.end(); ++iter )
+		to.setLocalM(iter.getIndex(), iter.getSpin(), iter.getFlux());
+}
+
+void PopulationAnnealing::parallel(const std::function<void(unsigned int)> &f) {
+	const unsigned int R = static_cast<unsigned int>(replicas.size());
+	const unsigned int T = std::min(threads, R);
+	std::vector< std::future<void> > pool;
+	for( unsigned int t = 0; t < T; t++ )
+		pool.push_back( std::async(std::launch::async, [&f, t, T, R]() {
+			for( unsigned int i = t; i < R; i += T )
+				f(i);
+		}) );
+	for( auto &p : pool )
+		p.get();
+}
+
+// Systematic resampling from kT0 to kT1. Sets lnQ = ln(Z(kT1) / Z(kT0)).
+void PopulationAnnealing::resample(double kT0, double kT1, double &lnQ) {
+	const unsigned int R = static_cast<unsigned int>(replicas.size());
+	const double dBeta = 1 / kT1 - 1 / kT0;
+	std::vector<double> lnw(R);
+	double max = -INFINITY;
+	for( unsigned int i = 0; i < R; i++ ) {
+		lnw[i] = -dBeta * replicas[i]->getResults().U;
+		max = std::max(max, lnw[i]);
+	}
+	double sum = 0;
+	std::vector<double> w(R);
+	for( unsigned int i = 0; i < R; i++ )
+		sum += w[i] = std::exp(lnw[i] - max);
+	lnQ = max + std::log(sum / R);
+
+	// number of copies of each replica
+	std::vector<unsigned int> copies(R, 0);
+	double u = rand(prng) / R, cumulative = 0;
+	for( unsigned int i = 0; i < R; i++ ) {
+		cumulative += w[i] / sum;
+		while( u < cumulative && u < 1 ) {
+			copies[i]++;
+			u += 1.0 / R;
+		}
+	}
+	{	unsigned int total = 0;  // round-off error may leave the last copy unassigned
+		for( unsigned int c : copies )
+			total += c;
+		for( ; total < R; total++ )
+			copies[std::max_element(w.begin(), w.end()) - w.begin()]++;
+	}
+
+	// replicas with no copies are overwritten by the extra copies of the others
+	std::vector<unsigned int> free, source;
+	for( unsigned int i = 0; i < R; i++ )
+		if( copies[i] == 0 )
+			free.push_back(i);
+	for( unsigned int i = 0; i < R; i++ )
+		for( unsigned int c = 1; c < copies[i]; c++ )
+			source.push_back(i);
+	const unsigned int T = std::min(threads, static_cast<unsigned int>(free.size()));
+	std::vector< std::future<void> > pool;
+	for( unsigned int t = 0; t < T; t++ )
+		pool.push_back( std::async(std::launch::async, [&, t, T]() {
+			for( size_t k = t; k < free.size(); k += T )
+				copyState(*replicas[source[k]], *replicas[free[k]]);
+		}) );
+	for( auto &p : pool )
+		p.get();
+	for( size_t k = 0; k < free.size(); k++ )
+		families[free[k]] = families[source[k]];
+}
+
+PopulationAnnealing::Step PopulationAnnealing::measure(double kT, double lnZ) const {
+	const unsigned int R = static_cast<unsigned int>(replicas.size());
+	Step s;
+	s.kT = kT;
+	s.lnZ = lnZ;
+	s.betaF = 0 - lnZ;  // (not -lnZ, which prints as -0 at the first kT)
+	double sumU = 0, sumU2 = 0, sumM2 = 0;
+	Vector sumM = Vector::ZERO;
+	for( const auto &msd : replicas ) {
+		const MSD::Results &r = msd->getResults();
+		sumU += r.U;
+		sumU2 += r.U * r.U;
+		sumM += r.M;
+		sumM2 += r.M * r.M;
+	}
+	s.meanU = sumU / R;
+	s.meanM = (1.0 / R) * sumM;
+	s.specificHeat = (sumU2 / R - s.meanU * s.meanU) / (n * kT * kT);
+	s.magneticSusceptibility = (sumM2 / R - s.meanM * s.meanM) / (n * kT * kT);
+
+	std::vector<unsigned int> count(R, 0);
+	for( unsigned int f : families )
+		count[f]++;
+	double sumP2 = 0;
+	for( unsigned int c : count )
+		sumP2 += static_cast<double>(c) * c / (static_cast<double>(R) * R);
+	s.effectiveFamilies = 1 / sumP2;
+	return s;
+}
+
+void PopulationAnnealing::run(const std::vector<double> &schedule) {
+	for( double kT : schedule )
+		if( !(kT > 0) )
+			throw std::invalid_argument("PopulationAnnealing: requires kT > 0");
+	steps.clear();
+	double lnZ = 0;
+	for( size_t k = 0; k < schedule.size(); k++ ) {
+		if( k != 0 ) {
+			double lnQ;
+			resample(schedule[k - 1], schedule[k], lnQ);
+			lnZ += lnQ;
+		}
+		const double kT = schedule[k];
+		const unsigned long long N = sweeps * n;
+		parallel([&](unsigned int i) {
+			replicas[i]->set_kT(kT);
+			replicas[i]->metropolis(N);
+		});
+		steps.push_back( measure(kT, lnZ) );
+	}
+}
+
+unsigned int PopulationAnnealing::getReplicas() const {
+	return static_cast<unsigned int>(replicas.size());
+}
+
+const MSD & PopulationAnnealing::getReplica(unsigned int i) const {
+	return *replicas.at(i);
+}
+
+const std::vector<PopulationAnnealing::Step> & PopulationAnnealing::getSteps() const {
+	return steps;
+}
+
+}  // end of namespace udc
+
+#endif
@@ -0,0 +1,299 @@
+#ifndef UDC_REPLICAS
+#define UDC_REPLICAS
+
+#include <algorithm>
+#include <cmath>
+#include <functional>
+#include <future>
+#include <iostream>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+#include "MSD.h"
+
+namespace udc {
+
+/*
+ * Independent replicas of one MSD, run concurrently through the same MSD::Schedule, e.g. to average many hysteresis
+ * loops at once instead of rerunning the same loop with different seeds.
+ *
+ * Each replica turns its state into a Row (the numbers of one line of an app's CSV output) after every stage and/or
+ * at every record. Since every replica follows the same schedule they make the same sequence of rows, and run()
+ * summarizes each row by the mean and standard error (of the mean) of every value over the replicas.
+ *
+ * Replica i uses seed (s + i), where s is the seed of the first replica made by the factory. Stage resets
+ * (MSD::Schedule::Reset) also use distinct seeds for every replica and reset, instead of MSD::genSeed (which is
+ * based on the time, so replicas reset at the same moment could get the same seed).
+ */
+class Replicas {
+ public:
+	typedef std::function<std::shared_ptr<MSD>()> Factory;  // makes a new replica, with all of its parameters set
+	typedef std::vector< std::vector<double> > Row;  // groups of values (written with an empty column between groups)
+
+	struct Summary {
+		Row mean, stdError;
+	};
+
+	unsigned int threads;  // (default: std::thread::hardware_concurrency())
+	std::function<Row(size_t stage, const MSD &)> stageRow;  // optional: made after every stage; an empty Row is skipped
+	std::function<Row(size_t stage, const MSD &, const MSD::Results &)> recordRow;  // optional: made at every record
+
+	Replicas(const Factory &factory, unsigned int count);
+
+	void fork(const MSD &from);  // copies the state (spins and fluxes) of "from" into every replica
+	void randomize();  // randomizes every replica independently (see: MSD::randomize)
+	void run(const MSD::Schedule &schedule);  // the schedule's own callbacks are ignored (use stageRow and recordRow)
+
+	unsigned int size() const;
+	MSD & getReplica(unsigned int i);
+	const std::vector<Summary> & getRows() const;  // of the last run, in the order they were made
+	const std::vector<Row> & getRows(unsigned int i) const;  // made by replica i in the last run
+	// The HysteresisFeatures (see below) of each replica's rows, where h and m are the dot products of "axis" with
+	// the first 3 values of groups hGroup and mGroup of each row. The Summary has one group:
+	// { coerciveDown, coerciveUp, remanenceDown, remanenceUp }, each over the replicas where it isn't NaN.
+	Summary hysteresis(const Vector &axis, size_t hGroup, size_t mGroup) const;
+
+	static void write(std::ostream &out, const Row &row);  // the values of one CSV line (without the '\n')
+	static std::string errorColumns(const std::string &columns);  // CSV headings for stdError, e.g. "U,,M_x" -> "U_se,,M_x_se"
+
+ private:
+	std::vector< std::shared_ptr<MSD> > replicas;
+	std::vector< std::vector<Row> > rows;  // [replica]
+	std::vector<Summary> summaries;
+	unsigned long seed;
+	unsigned long long resets;  // number of resets done by each replica so far
+
+	void parallel(const std::function<void(unsigned int)> &f);  // calls f(i) for every replica, i
+	unsigned long resetSeed(unsigned int i, unsigned long long reset) const;
+};
+
+
+/*
+ * Features of a hysteresis loop, given the field (h) and magnetization (m) along the field's axis at each point
+ * of the loop, in order. The "down" branch is made of the points where h is decreasing, and "up" where h is
+ * increasing. Each value is interpolated between the first pair of points in that branch where m (or h) changes
+ * sign, or is NaN if there is no such pair.
+ */
+struct HysteresisFeatures {
+	double coerciveDown, coerciveUp;    // h where m == 0
+	double remanenceDown, remanenceUp;  // m where h == 0
+
+	HysteresisFeatures(const std::vector<double> &h, const std::vector<double> &m);
+};
+
+
+Replicas::Replicas(const Factory &factory, unsigned int count)
+	: threads(std::thread::hardware_concurrency()), replicas(count), rows(count), resets(0)
+{
+	if( count == 0 )
+		throw std::invalid_argument("Replicas: requires at least 1 replica");
+	if( threads == 0 )
+		threads = 1;
+	for( unsigned int i = 0; i < count; i++ )
+		replicas[i] = factory();
+	// replicas made at the same time get the same seed
+	seed = replicas[0]->getSeed();
+	for( unsigned int i = 0; i < count; i++ )
+		replicas[i]->setSeed(seed + i);
+}
+
+unsigned long Replicas::resetSeed(unsigned int i, unsigned long long reset) const {
+	return seed + static_cast<unsigned long>((reset + 1) * replicas.size() + i);
+}
+
+void Replicas::parallel(const std::function<void(unsigned int)> &f) {
+	const unsigned int R = static_cast<unsigned int>(replicas.size());
+	const unsigned int T = std::min(threads, R);
+	std::vector< std::future<void> > pool;
+	for( unsigned int t = 0; t < T; t++ )
+		pool.push_back( std::async(std::launch::async, [&f, t, T, R]() {
+			for( unsigned int i = t; i < R; i += T )
+				f(i);
+		}) );
+	for( auto &p : pool )
+		p.get();
+}
+
+void Replicas::fork(const MSD &from) {
+	parallel([&](unsigned int i) {
+		if( replicas[i].get() == &from )
+			return;
+		for( auto iter = from.begin(); iter != from.end(); ++iter )
+			replicas[i]->setLocalM(iter.getIndex(), iter.getSpin(), iter.getFlux());
+	});
+}
+
+void Replicas::randomize() {
+	parallel([&](unsigned int i) {
+		replicas[i]->setSeed(resetSeed(i, resets));
+		replicas[i]->randomize(false);
+	});
+	resets++;
+}
+
+void Replicas::run(const MSD::Schedule &schedule) {
+	unsigned long long count = 0;  // resets in this schedule
+	for( const MSD::Schedule::Stage &stage : schedule.stages )
+		if( stage.reset != MSD::Schedule::NOOP )
+			count++;
+
+	parallel([&](unsigned int i) {
+		MSD &msd = *replicas[i];
+		std::vector<Row> &out = rows[i];
+		out.clear();
+		unsigned long long reset = resets;
+		for( size_t k = 0; k < schedule.stages.size(); k++ ) {
+			MSD::Schedule one;
+			one.stages.push_back(schedule.stages[k]);
+			MSD::Schedule::Stage &stage = one.stages.back();
+			if( stage.reset != MSD::Schedule::NOOP ) {
+				msd.setSeed(resetSeed(i, reset++));
+				if( stage.reset == MSD::Schedule::REINITIALIZE )
+					msd.reinitialize(false);
+				else
+					msd.randomize(false);
+				stage.reset = MSD::Schedule::NOOP;
+			}
+			if( recordRow )
+				one.onRecord = [&](size_t, const MSD::Results &r) {
+					Row row = recordRow(k, msd, r);
+					if( !row.empty() )
+						out.push_back(row);
+				};
+			msd.run(one);
+			if( stageRow ) {
+				Row row = stageRow(k, msd);
+				if( !row.empty() )
+					out.push_back(row);
+			}
+		}
+	});
+	resets += count;
+
+	// ----- mean and standard error of every value -----
+	const size_t R = replicas.size();
+	summaries.clear();
+	for( size_t j = 0; j < rows[0].size(); j++ ) {
+		Summary s;
+		s.mean = s.stdError = rows[0][j];
+		for( size_t g = 0; g < s.mean.size(); g++ )
+			for( size_t v = 0; v < s.mean[g].size(); v++ ) {
+				double sum = 0, sum2 = 0;
+				for( size_t i = 0; i < R; i++ )
+					sum += rows[i].at(j).at(g).at(v);
+				double mean = sum / R;
+				for( size_t i = 0; i < R; i++ )
+					sum2 += (rows[i][j][g][v] - mean) * (rows[i][j][g][v] - mean);
+				double var = R > 1 ? sum2 / (R - 1) : 0;
+				s.mean[g][v] = mean;
+				s.stdError[g][v] = std::sqrt(var / R);
+			}
+		summaries.push_back(s);
+	}
+}
+
+unsigned int Replicas::size() const {
+	return static_cast<unsigned int>(replicas.size());
+}
+
+MSD & Replicas::getReplica(unsigned int i) {
+	return *replicas.at(i);
+}
+
+const std::vector<Replicas::Summary> & Replicas::getRows() const {
+	return summaries;
+}
+
+const std::vector<Replicas::Row> & Replicas::getRows(unsigned int i) const {
+	return rows.at(i);
+}
+
+Replicas::Summary Replicas::hysteresis(const Vector &axis, size_t hGroup, size_t mGroup) const {
+	std::vector< std::vector<double> > values(4);
+	for( const std::vector<Row> &rs : rows ) {
+		std::vector<double> h, m;
+		for( const Row &row : rs ) {
+			const std::vector<double> &hs = row.at(hGroup), &ms = row.at(mGroup);
+			h.push_back( Vector(hs.at(0), hs.at(1), hs.at(2)) * axis );
+			m.push_back( Vector(ms.at(0), ms.at(1), ms.at(2)) * axis );
+		}
+		HysteresisFeatures f(h, m);
+		double fs[] = { f.coerciveDown, f.coerciveUp, f.remanenceDown, f.remanenceUp };
+		for( int k = 0; k < 4; k++ )
+			if( !std::isnan(fs[k]) )
+				values[k].push_back(fs[k]);
+	}
+	Summary s;
+	s.mean.assign(1, std::vector<double>(4, NAN));
+	s.stdError = s.mean;
+	for( int k = 0; k < 4; k++ ) {
+		double n = static_cast<double>(values[k].size()), sum = 0, sum2 = 0;
+		if( n == 0 )
+			continue;
+		for( double x : values[k] )
+			sum += x;
+		double mean = sum / n;
+		for( double x : values[k] )
+			sum2 += (x - mean) * (x - mean);
+		s.mean[0][k] = mean;
+		s.stdError[0][k] = n > 1 ? std::sqrt(sum2 / (n - 1) / n) : 0;
+	}
+	return s;
+}
+
+void Replicas::write(std::ostream &out, const Row &row) {
+	for( size_t g = 0; g < row.size(); g++ ) {
+		if( g != 0 )
+			out << ",,";
+		for( size_t v = 0; v < row[g].size(); v++ ) {
+			if( v != 0 )
+				out << ',';
+			out << row[g][v];
+		}
+	}
+}
+
+
+std::string Replicas::errorColumns(const std::string &columns) {
+	std::string out;
+	size_t start = 0;
+	while( true ) {
+		size_t end = columns.find(',', start);
+		std::string name = columns.substr(start, end == std::string::npos ? std::string::npos : end - start);
+		if( !name.empty() )
+			out += name + "_se";
+		if( end == std::string::npos )
+			break;
+		out += ',';
+		start = end + 1;
+	}
+	return out;
+}
+
+HysteresisFeatures::HysteresisFeatures(const std::vector<double> &h, const std::vector<double> &m)
+	: coerciveDown(NAN), coerciveUp(NAN), remanenceDown(NAN), remanenceUp(NAN)
+{
+	if( h.size() != m.size() )
+		throw std::invalid_argument("HysteresisFeatures: h and m must be the same size");
+	// value of y where x crosses 0, between points i and i + 1
+	auto cross = [](double x0, double x1, double y0, double y1) {
+		return x0 == x1 ? y0 : y0 + (y1 - y0) * (0 - x0) / (x1 - x0);
+	};
+	for( size_t i = 0; i + 1 < h.size(); i++ ) {
+		if( h[i + 1] == h[i] )
+			continue;
+		bool down = h[i + 1] < h[i];
+		double &coercive = down ? coerciveDown : coerciveUp;
+		double &remanence = down ? remanenceDown : remanenceUp;
+		if( std::isnan(coercive) && (m[i] == 0 || (m[i] < 0) != (m[i + 1] < 0)) )
+			coercive = cross(m[i], m[i + 1], h[i], h[i + 1]);
+		if( std::isnan(remanence) && (h[i] == 0 || (h[i] < 0) != (h[i + 1] < 0)) )
+			remanence = cross(h[i], h[i + 1], m[i], m[i + 1]);
+	}
+}
+
+}  // end of namespace udc
+
+#endif
@@ -0,0 +1,466 @@
+#ifndef UDC_RESULT_CACHE
+#define UDC_RESULT_CACHE
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <map>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <type_traits>
+#include <typeinfo>
+#include <vector>
+#include "MSD.h"
+
+namespace udc {
+
+/*
+ * A persistent, on-disk cache of simulation results, so that a run which was already done (e.g. the same point of a
+ * sweep in an earlier study) is loaded instead of simulated again.
+ *
+ * Each result is an opaque payload (bytes) under a 64-bit key: a hash (FNV-1a) of the canonical form of everything
+ * that determines the run (see: ResultCache::key). The file is a log of [key, size, payload] records after a short
+ * header, indexed in memory when the cache is opened; new results are appended to it right away. If a key is
+ * stored twice, the last record wins.
+ *
+ * With a size limit (maxBytes > 0), the least recently used results (stored or loaded) are evicted once the records
+ * would take more than maxBytes. The file is only rewritten (compacted, without evicted or replaced records, and in
+ * order of use) by flush(), or when it grows to twice the limit. The destructor flushes.
+ *
+ * All methods are thread safe, but the file shouldn't be shared by processes running at the same time.
+ */
+class ResultCache {
+ public:
+	typedef std::uint64_t Key;
+
+	// FNV-1a (64-bit) over a sequence of values
+	class Hasher {
+	 public:
+		Hasher();
+		Hasher & add(const void *bytes, size_t size);
+		Hasher & operator<<(double x);  // (0 and -0 hash the same)
+		Hasher & operator<<(unsigned long long x);
+		Hasher & operator<<(const Vector &v);
+		Hasher & operator<<(const std::string &str);  // (with its length, so consecutive strings can't run together)
+		Key get() const;
+
+	 private:
+		Key h;
+	};
+
+	// The hash of every parameter of msd (geometry, MSD::Parameters, the serialized MolProto, the flipping algorithm,
+	// clusterFreq, overrelaxRatio, proposalSteps, recordCouplings), its state (every spin and flux), and "run": a
+	// description of what will be done with it (e.g. the app, t_eq, simCount, freq). The seed is only included if
+	// withSeed is true, since most runs use a new seed every time (see: MSD::genSeed).
+	static Key key(const MSD &msd, const std::string &run, bool withSeed = false);
+
+	// Opens (or creates) the cache file at "path". Throws std::runtime_error if it isn't a cache file, or can't be
+	// created. An incomplete record at the end (e.g. from a crash while writing) is ignored.
+	ResultCache(const std::string &path, unsigned long long maxBytes = 0);
+	~ResultCache();
+
+	bool get(Key key, std::string &payload);  // loads the payload of "key"; returns false (a miss) if it isn't cached
+	void put(Key key, const std::string &payload);
+	void flush();  // rewrites the file with only the cached results (if anything was evicted, replaced, or used)
+
+	unsigned long long getHits() const;  // calls to get that found a result (since the cache was opened)
+	unsigned long long getMisses() const;
+	size_t size() const;  // number of cached results
+	unsigned long long bytes() const;  // total size of their records
+	const std::string & getPath() const;
+
+	// Helpers for building payloads out of trivially copyable values. extract returns false if there isn't enough
+	// data left at "pos" (which is advanced past the value).
+	template <typename T> static void append(std::string &payload, const T &value);
+	template <typename T> static bool extract(const std::string &payload, size_t &pos, T &value);
+	static void append(std::string &payload, const std::string &value);
+	static bool extract(const std::string &payload, size_t &pos, std::string &value);
+
+	// The payload of a finished run of msd: its state, and the Results it added to record (from index "from" on), as
+	// well as the last as many CouplingEnergies of couplingRecord. load restores it (e.g. to an MSD with the same key,
+	// before its run), appending to record and couplingRecord, and returns false if the payload doesn't match msd.
+	// (Other side effects of a run, e.g. on the acceptance stats and the prng, aren't restored.)
+	static std::string save(const MSD &msd, size_t from = 0);
+	static bool load(MSD &msd, const std::string &payload);
+
+ private:
+	static const char MAGIC[16];
+	static const unsigned long long RECORD_HEADER = sizeof(Key) + sizeof(std::uint64_t);
+
+	struct Entry {
+		unsigned long long offset;  // of the payload in the file
+		unsigned long long size;
+		unsigned long long used;  // when it was last stored or loaded (a counter)
+	};
+
+	std::string path;
+	unsigned long long maxBytes;
+	std::map<Key, Entry> index;
+	unsigned long long fileBytes, liveBytes;  // size of the file, and of the records in the index
+	unsigned long long clock;
+	unsigned long long hits, misses;
+	bool reordered;  // has a result been loaded since the file was last written in order of use?
+	mutable std::mutex mutex;
+
+	ResultCache(const ResultCache &);  // undefined, do not use!
+	ResultCache & operator=(const ResultCache &);  // undefined, do not use!
+
+	void evict();
+	void compact();
+};
+
+
+const char ResultCache::MAGIC[16] = { 'U', 'D', 'C', '-', 'M', 'S', 'D', '-', 'C', 'A', 'C', 'H', 'E', '-', '1', '\n' };
+
+ResultCache::Hasher::Hasher() : h(14695981039346656037ull) {
+}
+
+ResultCache::Hasher & ResultCache::Hasher::add(const void *bytes, size_t size) {
+	const unsigned char *b = static_cast<const unsigned char *>(bytes);
+	for( size_t i = 0; i < size; i++ ) {
+		h ^= b[i];
+		h *= 1099511628211ull;
+	}
+	return *this;
+}
+
+ResultCache::Hasher & ResultCache::Hasher::operator<<(double x) {
+	if( x == 0 )
+		x = 0;
+	return add(&x, sizeof(x));
+}
+
+ResultCache::Hasher & ResultCache::Hasher::operator<<(unsigned long long x) {
+	std::uint64_t y = x;
+	return add(&y, sizeof(y));
+}
+
+ResultCache::Hasher & ResultCache::Hasher::operator<<(const Vector &v) {
+	return *this << v.x << v.y << v.z;
+}
+
+ResultCache::Hasher & ResultCache::Hasher::operator<<(const std::string &str) {
+	*this << static_cast<unsigned long long>(str.size());
+	return add(str.data(), str.size());
+}
+
+ResultCache::Key ResultCache::Hasher::get() const {
+	return h;
+}
+
+ResultCache::Key ResultCache::key(const MSD &msd, const std::string &run, bool withSeed) {
+	Hasher h;
+	h << std::string(UDC_MSD_VERSION) << run;
+
+	unsigned long long geometry[] = { msd.getWidth(), msd.getHeight(), msd.getDepth(), msd.getMolPosL(),
+			msd.getMolPosR(), msd.getTopL(), msd.getBottomL(), msd.getFrontR(), msd.getBackR() };
+	for( unsigned long long g : geometry )
+		h << g;
+	if( msd.hasVoxelMask() )  // (the shape isn't just the box above)
+		for( auto iter = msd.begin(); iter != msd.end(); ++iter )
+			h << static_cast<unsigned long long>(iter.getX()) << static_cast<unsigned long long>(iter.getY())
+			  << static_cast<unsigned long long>(iter.getZ());
+	if( msd.getPeriodicL() != MSD::OPEN || msd.getPeriodicR() != MSD::OPEN )  // (keeps the keys of open MSDs)
+		h << static_cast<unsigned long long>(msd.getPeriodicL()) << static_cast<unsigned long long>(msd.getPeriodicR());
+
+	MSD::Parameters p = msd.getParameters();
+	h << p.kT << p.B << p.SL << p.SR << p.FL << p.FR
+	  << p.JL << p.JR << p.JmL << p.JmR << p.JLR << p.Je0L << p.Je0R
+	  << p.Je1L << p.Je1R << p.Je1mL << p.Je1mR << p.Je1LR
+	  << p.JeeL << p.JeeR << p.JeemL << p.JeemR << p.JeeLR
+	  << p.bL << p.bR << p.bmL << p.bmR << p.bLR
+	  << p.AL << p.AR << p.DL << p.DR << p.DmL << p.DmR << p.DLR;
+
+	const MSD::MolProto &proto = msd.getMolProto();
+	std::vector<unsigned char> buffer(proto.serializationSize());
+	proto.serialize(buffer.data());
+	h << static_cast<unsigned long long>(buffer.size());
+	h.add(buffer.data(), buffer.size());
+
+	const std::type_info &algo = msd.flippingAlgorithm.target_type();
+	h << std::string(
+			algo == MSD::UP_DOWN_MODEL.target_type() ? "UP_DOWN_MODEL" :
+			algo == MSD::CONTINUOUS_SPIN_MODEL.target_type() ? "CONTINUOUS_SPIN_MODEL" :
+			algo == MSD::HEAT_BATH_MODEL.target_type() ? "HEAT_BATH_MODEL" :
+			algo == MSD::CONE_MODEL.target_type() ? "CONE_MODEL" : algo.name() );
+	h << msd.clusterFreq << static_cast<unsigned long long>(msd.overrelaxRatio) << msd.macrospinFreq
+	  << static_cast<unsigned long long>(msd.sweepMode) << static_cast<unsigned long long>(msd.blockSize)
+	  << msd.proposalSteps.L << msd.proposalSteps.R << msd.proposalSteps.m
+	  << static_cast<unsigned long long>(msd.recordCouplings) << static_cast<unsigned long long>(msd.skipZeroSpins);
+	if( withSeed )
+		h << static_cast<unsigned long long>(msd.getSeed());
+
+	for( auto iter = msd.begin(); iter != msd.end(); ++iter )
+		h << static_cast<unsigned long long>(iter.getIndex()) << iter.getSpin() << iter.getFlux()
+		  << msd.getSiteWeight(iter.getIndex());
+	return h.get();
+}
+
+
+ResultCache::ResultCache(const std::string &path, unsigned long long maxBytes)
+	: path(path), maxBytes(maxBytes), fileBytes(0), liveBytes(0), clock(0), hits(0), misses(0), reordered(false)
+{
+	std::ifstream in(path, std::ios::binary);
+	if( in ) {
+		in.seekg(0, std::ios::end);
+		const unsigned long long length = static_cast<unsigned long long>(in.tellg());
+		in.seekg(0);
+		char magic[sizeof(MAGIC)];
+		if( length != 0 ) {
+			if( length < sizeof(MAGIC) || !in.read(magic, sizeof(MAGIC)) || std::memcmp(magic, MAGIC, sizeof(MAGIC)) != 0 )
+				throw std::runtime_error("ResultCache: not a result cache file: " + path);
+			fileBytes = sizeof(MAGIC);
+			while( fileBytes + RECORD_HEADER <= length ) {
+				Key key;
+				std::uint64_t size;
+				in.read(reinterpret_cast<char *>(&key), sizeof(key));
+				in.read(reinterpret_cast<char *>(&size), sizeof(size));
+				if( !in || size > length - fileBytes - RECORD_HEADER )
+					break;  // incomplete record
+				auto old = index.find(key);
+				if( old != index.end() )
+					liveBytes -= RECORD_HEADER + old->second.size;  // replaced
+				Entry &e = index[key];
+				e.offset = fileBytes + RECORD_HEADER;
+				e.size = size;
+				e.used = ++clock;
+				liveBytes += RECORD_HEADER + size;
+				fileBytes += RECORD_HEADER + size;
+				in.seekg(static_cast<std::streamoff>(fileBytes));
+			}
+		}
+		in.close();
+		if( fileBytes != length ) {
+			if( fileBytes == 0 )
+				fileBytes = sizeof(MAGIC);
+			compact();  // drop the incomplete record (or write the header of an empty file)
+		}
+	} else {
+		std::ofstream out(path, std::ios::binary | std::ios::trunc);
+		if( !out.write(MAGIC, sizeof(MAGIC)) )
+			throw std::runtime_error("ResultCache: can't create the cache file: " + path);
+		fileBytes = sizeof(MAGIC);
+	}
+	evict();
+}
+
+ResultCache::~ResultCache() {
+	try {
+		flush();
+	} catch(std::exception &) {
+		// the appended records are still in the file
+	}
+}
+
+bool ResultCache::get(Key key, std::string &payload) {
+	std::lock_guard<std::mutex> lock(mutex);
+	auto e = index.find(key);
+	if( e != index.end() ) {
+		std::ifstream in(path, std::ios::binary);
+		payload.resize(static_cast<size_t>(e->second.size));
+		in.seekg(static_cast<std::streamoff>(e->second.offset));
+		if( in && (payload.empty() || in.read(&payload[0], payload.size())) ) {
+			e->second.used = ++clock;
+			reordered = true;
+			hits++;
+			return true;
+		}
+		liveBytes -= RECORD_HEADER + e->second.size;  // unreadable: forget it
+		index.erase(e);
+	}
+	misses++;
+	return false;
+}
+
+void ResultCache::put(Key key, const std::string &payload) {
+	std::lock_guard<std::mutex> lock(mutex);
+	std::ofstream out(path, std::ios::binary | std::ios::app);
+	const std::uint64_t size = payload.size();
+	out.write(reinterpret_cast<const char *>(&key), sizeof(key));
+	out.write(reinterpret_cast<const char *>(&size), sizeof(size));
+	out.write(payload.data(), payload.size());
+	out.close();
+	if( !out )
+		throw std::runtime_error("ResultCache: can't write to the cache file: " + path);
+
+	auto e = index.find(key);
+	if( e != index.end() )
+		liveBytes -= RECORD_HEADER + e->second.size;
+	Entry &entry = index[key];
+	entry.offset = fileBytes + RECORD_HEADER;
+	entry.size = size;
+	entry.used = ++clock;
+	liveBytes += RECORD_HEADER + size;
+	fileBytes += RECORD_HEADER + size;
+	evict();
+	if( maxBytes != 0 && fileBytes - sizeof(MAGIC) > 2 * maxBytes )
+		compact();
+}
+
+void ResultCache::flush() {
+	std::lock_guard<std::mutex> lock(mutex);
+	if( reordered || fileBytes != sizeof(MAGIC) + liveBytes )
+		compact();
+}
+
+void ResultCache::evict() {
+	if( maxBytes == 0 || liveBytes <= maxBytes )
+		return;
+	std::vector< std::pair<unsigned long long, Key> > order;  // (used, key)
+	for( const auto &e : index )
+		order.push_back(std::make_pair(e.second.used, e.first));
+	std::sort(order.begin(), order.end());
+	for( size_t i = 0; i < order.size() && liveBytes > maxBytes; i++ ) {
+		auto e = index.find(order[i].second);
+		liveBytes -= RECORD_HEADER + e->second.size;
+		index.erase(e);
+	}
+}
+
+void ResultCache::compact() {
+	std::vector< std::pair<unsigned long long, Key> > order;  // (used, key): least recently used first
+	for( const auto &e : index )
+		order.push_back(std::make_pair(e.second.used, e.first));
+	std::sort(order.begin(), order.end());
+
+	const std::string temp = path + ".tmp";
+	std::ifstream in(path, std::ios::binary);
+	std::ofstream out(temp, std::ios::binary | std::ios::trunc);
+	out.write(MAGIC, sizeof(MAGIC));
+	unsigned long long offset = sizeof(MAGIC);
+	std::string payload;
+	for( const auto &o : order ) {
+		Entry &e = index[o.second];
+		const std::uint64_t size = e.size;
+		payload.resize(static_cast<size_t>(size));
+		in.seekg(static_cast<std::streamoff>(e.offset));
+		if( size != 0 )
+			in.read(&payload[0], payload.size());
+		out.write(reinterpret_cast<const char *>(&o.second), sizeof(o.second));
+		out.write(reinterpret_cast<const char *>(&size), sizeof(size));
+		out.write(payload.data(), payload.size());
+		e.offset = offset + RECORD_HEADER;
+		offset += RECORD_HEADER + size;
+	}
+	in.close();
+	out.close();
+	if( !in.good() && !order.empty() )
+		throw std::runtime_error("ResultCache: can't read the cache file: " + path);
+	if( !out )
+		throw std::runtime_error("ResultCache: can't write to the cache file: " + temp);
+	std::remove(path.c_str());
+	if( std::rename(temp.c_str(), path.c_str()) != 0 )
+		throw std::runtime_error("ResultCache: can't replace the cache file: " + path);
+	fileBytes = offset;
+	reordered = false;
+}
+
+unsigned long long ResultCache::getHits() const {
+	std::lock_guard<std::mutex> lock(mutex);
+	return hits;
+}
+
+unsigned long long ResultCache::getMisses() const {
+	std::lock_guard<std::mutex> lock(mutex);
+	return misses;
+}
+
+size_t ResultCache::size() const {
+	std::lock_guard<std::mutex> lock(mutex);
+	return index.size();
+}
+
+unsigned long long ResultCache::bytes() const {
+	std::lock_guard<std::mutex> lock(mutex);
+	return liveBytes;
+}
+
+const std::string & ResultCache::getPath() const {
+	return path;
+}
+
+
+template <typename T> void ResultCache::append(std::string &payload, const T &value) {
+	static_assert(std::is_trivially_copyable<T>::value, "ResultCache::append: T must be trivially copyable");
+	payload.append(reinterpret_cast<const char *>(&value), sizeof(value));
+}
+
+template <typename T> bool ResultCache::extract(const std::string &payload, size_t &pos, T &value) {
+	static_assert(std::is_trivially_copyable<T>::value, "ResultCache::extract: T must be trivially copyable");
+	if( pos > payload.size() || payload.size() - pos < sizeof(value) )
+		return false;
+	std::memcpy(&value, payload.data() + pos, sizeof(value));
+	pos += sizeof(value);
+	return true;
+}
+
+void ResultCache::append(std::string &payload, const std::string &value) {
+	append(payload, static_cast<std::uint64_t>(value.size()));
+	payload += value;
+}
+
+bool ResultCache::extract(const std::string &payload, size_t &pos, std::string &value) {
+	std::uint64_t size;
+	if( !extract(payload, pos, size) || payload.size() - pos < size )
+		return false;
+	value = payload.substr(pos, static_cast<size_t>(size));
+	pos += static_cast<size_t>(size);
+	return true;
+}
+
+std::string ResultCache::save(const MSD &msd, size_t from) {
+	std::string payload;
+	from = std::min(from, msd.record.size());
+	const size_t count = msd.record.size() - from;
+	append(payload, static_cast<std::uint64_t>(count));
+	for( size_t i = from; i < msd.record.size(); i++ )
+		append(payload, msd.record[i]);
+	const size_t couplings = std::min(count, msd.couplingRecord.size());
+	append(payload, static_cast<std::uint64_t>(couplings));
+	for( size_t i = msd.couplingRecord.size() - couplings; i < msd.couplingRecord.size(); i++ )
+		append(payload, msd.couplingRecord[i]);
+	append(payload, static_cast<std::uint64_t>(msd.getN()));
+	for( auto iter = msd.begin(); iter != msd.end(); ++iter ) {
+		append(payload, iter.getSpin());
+		append(payload, iter.getFlux());
+	}
+	return payload;
+}
+
+bool ResultCache::load(MSD &msd, const std::string &payload) {
+	size_t pos = 0;
+	std::uint64_t count;
+	std::vector<MSD::Results> record;
+	if( !extract(payload, pos, count) || count > payload.size() / sizeof(MSD::Results) )
+		return false;
+	record.resize(static_cast<size_t>(count));
+	for( MSD::Results &r : record )
+		if( !extract(payload, pos, r) )
+			return false;
+	std::vector<MSD::CouplingEnergies> couplingRecord;
+	if( !extract(payload, pos, count) || count > payload.size() / sizeof(MSD::CouplingEnergies) )
+		return false;
+	couplingRecord.resize(static_cast<size_t>(count));
+	for( MSD::CouplingEnergies &c : couplingRecord )
+		if( !extract(payload, pos, c) )
+			return false;
+	if( !extract(payload, pos, count) || count != msd.getN() || payload.size() - pos != count * 2 * sizeof(Vector) )
+		return false;
+
+	for( auto iter = msd.begin(); iter != msd.end(); ++iter ) {
+		Vector spin, flux;
+		extract(payload, pos, spin);
+		extract(payload, pos, flux);
+		msd.setLocalM(iter.getIndex(), spin, flux);
+	}
+	msd.record.insert(msd.record.end(), record.begin(), record.end());
+	msd.couplingRecord.insert(msd.couplingRecord.end(), couplingRecord.begin(), couplingRecord.end());
+	return true;
+}
+
+}  // end of namespace udc
+
+#endif
@@ -0,0 +1,233 @@
+#ifndef UDC_REWEIGHTING
+#define UDC_REWEIGHTING
+
+#include <cmath>
+#include <functional>
+#include <stdexcept>
+#include <vector>
+#include "MSD.h"
+
+namespace udc {
+
+/*
+ * Histogram reweighting of MSD::record's from one or more runs to other (nearby) values of kT and B.
+ *
+ * Each sample, x, in the record of a run done at (kT_k, B_k) has energy U(x) = E(x) - B_k * M(x), where E doesn't
+ * depend on B. So the (unnormalized) Boltzmann weight of x at any (kT, B) is known: exp(-(E(x) - B * M(x)) / kT).
+ * With one run this is single-histogram reweighting (Ferrenberg and Swendsen). With several runs, the samples are
+ * combined with the multiple-histogram (WHAM) weights:
+ *     w(x) = exp(-u(x)) / sum_k( N_k exp(f_k - u_k(x)) ),
+ * where u is the reduced energy, (E - B * M) / kT, and the free energies, f_k, are solved for self-consistently.
+ *
+ * Every sample in a record is given the same weight (i.e. records made with a constant freq, like
+ * MSD::metropolis(N, freq)). The estimates are only reliable near the simulated (kT, B): see Estimate::valid.
+ */
+class Reweighting {
+ public:
+	struct Estimate {
+		double kT;
+		Vector B;
+		double meanU;
+		Vector meanM;
+		double specificHeat;            // same definition as MSD::specificHeat
+		double magneticSusceptibility;  // same definition as MSD::magneticSusceptibility
+		double effectiveSamples;  // Kish's effective sample size, (sum w)^2 / sum(w^2). Ignores autocorrelation.
+		double maxWeight;  // largest (normalized) weight of a single sample
+		bool valid;  // effectiveSamples >= minEffectiveSamples
+	};
+
+	double minEffectiveSamples;  // (default: 100)
+
+	Reweighting();
+
+	void addRun(const MSD &msd);  // uses msd.record, and msd's current kT, B, and N
+	void addRun(const std::vector<MSD::Results> &record, double kT, const Vector &B, unsigned int n);
+
+	unsigned int getRuns() const;
+	unsigned long long getSamples() const;
+	const std::vector<double> & getFreeEnergies() const;  // f_k (with f_0 == 0). Solves the WHAM equations if needed.
+
+	Estimate at(double kT, const Vector &B) const;
+	double mean(const std::function<double(const MSD::Results &)> &f, double kT, const Vector &B) const;  // <f> at (kT, B). Note: Results::U is still at the simulated B.
+
+ private:
+	struct Sample {
+		MSD::Results r;
+		double E;  // U without the Zeeman energy
+	};
+	struct Run {
+		double kT;
+		Vector B;
+		size_t begin, end;  // range in samples
+	};
+
+	std::vector<Sample> samples;
+	std::vector<Run> runs;
+	unsigned int n;
+	mutable std::vector<double> f;  // free energies (of each run), or empty if they need to be solved for
+	double tolerance;
+	unsigned int maxIterations;
+
+	void solve() const;
+	void logWeights(double kT, const Vector &B, std::vector<double> &lnw) const;
+	static double logSumExp(const std::vector<double> &a);
+};
+
+
+Reweighting::Reweighting() : minEffectiveSamples(100), n(0), tolerance(1e-10), maxIterations(100000) {
+}
+
+void Reweighting::addRun(const MSD &msd) {
+	MSD::Parameters p = msd.getParameters();
+	addRun(msd.record, p.kT, p.B, msd.getN());
+}
+
+void Reweighting::addRun(const std::vector<MSD::Results> &record, double kT, const Vector &B, unsigned int n) {
+	if( record.empty() )
+		throw std::invalid_argument("Reweighting::addRun: empty record");
+	if( !(kT > 0) )
+		throw std::invalid_argument("Reweighting::addRun: requires kT > 0");
+	if( this->n != 0 && this->n != n )
+		throw std::invalid_argument("Reweighting::addRun: all runs must have the same number of atoms");
+	this->n = n;
+	Run run;
+	run.kT = kT;
+	run.B = B;
+	run.begin = samples.size();
+	for( const MSD::Results &r : record ) {
+		Sample s;
+		s.r = r;
+		s.E = r.U + B * r.M;
+		samples.push_back(s);
+	}
+	run.end = samples.size();
+	runs.push_back(run);
+	f.clear();
+}
+
+unsigned int Reweighting::getRuns() const {
+	return static_cast<unsigned int>(runs.size());
+}
+
+unsigned long long Reweighting::getSamples() const {
+	return samples.size();
+}
+
+const std::vector<double> & Reweighting::getFreeEnergies() const {
+	if( f.empty() )
+		solve();
+	return f;
+}
+
+double Reweighting::logSumExp(const std::vector<double> &a) {
+	double max = -INFINITY;
+	for( double x : a )
+		if( x > max )
+			max = x;
+	if( max == -INFINITY )
+		return -INFINITY;
+	double s = 0;
+	for( double x : a )
+		s += std::exp(x - max);
+	return max + std::log(s);
+}
+
+// Self-consistent iteration of the WHAM equations:
+//     f_k = -ln sum_x( exp(-u_k(x)) / sum_l( N_l exp(f_l - u_l(x)) ) )
+void Reweighting::solve() const {
+	const size_t K = runs.size();
+	f.assign(K, 0.0);
+	if( K <= 1 )
+		return;
+	std::vector< std::vector<double> > u(K, std::vector<double>(samples.size()));  // u[k][x]
+	for( size_t k = 0; k < K; k++ )
+		for( size_t x = 0; x < samples.size(); x++ )
+			u[k][x] = (samples[x].E - runs[k].B * samples[x].r.M) / runs[k].kT;
+
+	std::vector<double> lnDenom(samples.size()), terms(K), next(K);
+	for( unsigned int iter = 0; iter < maxIterations; iter++ ) {
+		for( size_t x = 0; x < samples.size(); x++ ) {
+			for( size_t l = 0; l < K; l++ )
+				terms[l] = std::log(static_cast<double>(runs[l].end - runs[l].begin)) + f[l] - u[l][x];
+			lnDenom[x] = logSumExp(terms);
+		}
+		std::vector<double> a(samples.size());
+		for( size_t k = 0; k < K; k++ ) {
+			for( size_t x = 0; x < samples.size(); x++ )
+				a[x] = -u[k][x] - lnDenom[x];
+			next[k] = -logSumExp(a);
+		}
+		double change = 0;
+		for( size_t k = 0; k < K; k++ ) {
+			double fk = next[k] - next[0];
+			change = std::fmax(change, std::fabs(fk - f[k]));
+			f[k] = fk;
+		}
+		if( change < tolerance )
+			return;
+	}
+	throw std::runtime_error("Reweighting: the WHAM equations didn't converge (do the runs overlap?)");
+}
+
+// ln(w(x)) (unnormalized) of every sample at (kT, B)
+void Reweighting::logWeights(double kT, const Vector &B, std::vector<double> &lnw) const {
+	if( samples.empty() )
+		throw std::logic_error("Reweighting: no runs were added");
+	if( f.empty() )
+		solve();
+	const size_t K = runs.size();
+	std::vector<double> terms(K);
+	lnw.resize(samples.size());
+	for( size_t x = 0; x < samples.size(); x++ ) {
+		const Sample &s = samples[x];
+		for( size_t l = 0; l < K; l++ )
+			terms[l] = std::log(static_cast<double>(runs[l].end - runs[l].begin)) + f[l]
+					- (s.E - runs[l].B * s.r.M) / runs[l].kT;
+		lnw[x] = -(s.E - B * s.r.M) / kT - logSumExp(terms);
+	}
+}
+
+Reweighting::Estimate Reweighting::at(double kT, const Vector &B) const {
+	std::vector<double> lnw;
+	logWeights(kT, B, lnw);
+	double lnZ = logSumExp(lnw);
+
+	Estimate est;
+	est.kT = kT;
+	est.B = B;
+	est.meanU = 0;
+	est.meanM = Vector::ZERO;
+	est.maxWeight = 0;
+	double sumU2 = 0, sumM2 = 0, sumW2 = 0;
+	for( size_t x = 0; x < samples.size(); x++ ) {
+		double w = std::exp(lnw[x] - lnZ);
+		const MSD::Results &r = samples[x].r;
+		double U = samples[x].E - B * r.M;  // energy at the new B
+		est.meanU += w * U;
+		est.meanM += w * r.M;
+		sumU2 += w * U * U;
+		sumM2 += w * (r.M * r.M);
+		sumW2 += w * w;
+		if( w > est.maxWeight )
+			est.maxWeight = w;
+	}
+	est.specificHeat = (sumU2 - est.meanU * est.meanU) / (n * kT * kT);
+	est.magneticSusceptibility = (sumM2 - est.meanM * est.meanM) / (n * kT * kT);
+	est.effectiveSamples = 1 / sumW2;
+	est.valid = est.effectiveSamples >= minEffectiveSamples;
+	return est;
+}
+
+double Reweighting::mean(const std::function<double(const MSD::Results &)> &func, double kT, const Vector &B) const {
+	std::vector<double> lnw;
+	logWeights(kT, B, lnw);
+	double lnZ = logSumExp(lnw);
+	double s = 0;
+	for( size_t x = 0; x < samples.size(); x++ )
+		s += std::exp(lnw[x] - lnZ) * func(samples[x].r);
+	return s;
+}
+
+}  // end of namespace udc
+
+#endif
@@ -0,0 +1,391 @@
+#ifndef UDC_STATE_LIBRARY
+#define UDC_STATE_LIBRARY
+
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <limits>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include "MSD.h"
+#include "ResultCache.h"
+
+namespace udc {
+
+/*
+ * A persistent, on-disk library of equilibrated states, so that a new run can start from the stored state nearest to
+ * its parameters (e.g. the neighboring point of a sweep done in an earlier study) instead of from the reinitialized
+ * or randomized state, and equilibrate in fewer steps.
+ *
+ * States are grouped by "shape" (see: StateLibrary::shape), which must match exactly, and within a shape the nearest
+ * state is the one with the least Euclidean distance between the features (see: StateLibrary::features) of the MSD
+ * it was stored from and the one being started. Each state is stored as the direction of every spin and the
+ * magnitude of every flux relative to its F, so that a warm start keeps the current magnitude of every spin (e.g. a
+ * custom one set with MSD::setSpin) and scales every flux to the new F.
+ *
+ * The file is a log of [shape, features, state] records after a short header, indexed in memory (without the states)
+ * when the library is opened; new states are appended to it right away. A state stored with the same shape and
+ * features as an earlier one replaces it. The file is only rewritten (without the replaced records) by flush(), which
+ * the destructor calls.
+ *
+ * All methods are thread safe, but the file shouldn't be shared by processes running at the same time.
+ */
+class StateLibrary {
+ public:
+	typedef ResultCache::Key Key;
+
+	static const char *const OPTION;  // command line option of the apps: "--warm-start-from-library"
+
+	// The hash of everything a stored state must match exactly: the geometry, the molecule's topology (nodes, edges,
+	// and leads), and the flipping algorithm.
+	static Key shape(const MSD &msd);
+	// Every MSD::Parameter, then every node's, and every edge's, MolProto parameters (vectors by component).
+	static std::vector<double> features(const MSD &msd);
+	// Removes OPTION and its file (either "OPTION file" or "OPTION=file") from the command line, and returns the
+	// file, or "" if the option isn't there. Throws std::invalid_argument if the file is missing.
+	static std::string takeOption(int &argc, char *argv[]);
+
+	// Opens (or creates) the library file at "path". Throws std::runtime_error if it isn't a library file, or can't
+	// be created. An incomplete record at the end (e.g. from a crash while writing) is ignored.
+	StateLibrary(const std::string &path);
+	~StateLibrary();
+
+	void store(const MSD &msd);  // stores the current state of msd, e.g. right after it was equilibrated
+	// Sets the state of msd to the nearest stored state of the same shape (keeping the magnitude of every spin), and
+	// clears its record (and couplingRecord), like MSD::reinitialize. Returns false, and doesn't change msd, if there's no such state. If "distance" isn't
+	// NULL, it's set to the distance between the features of msd and the state (or infinity).
+	bool warmStart(MSD &msd, double *distance = NULL);
+	void flush();  // rewrites the file with only the current states (if any were replaced)
+
+	size_t size() const;  // number of stored states
+	const std::string & getPath() const;
+
+ private:
+	static const char MAGIC[16];
+
+	struct Entry {
+		Key shape;
+		std::vector<double> features;
+		unsigned long long offset;  // of the state in the file
+		std::uint64_t atoms;
+	};
+
+	std::string path;
+	std::vector<Entry> index;
+	unsigned long long fileBytes, liveBytes;  // size of the file, and of the records in the index
+	mutable std::mutex mutex;
+
+	StateLibrary(const StateLibrary &);  // undefined, do not use!
+	StateLibrary & operator=(const StateLibrary &);  // undefined, do not use!
+
+	static unsigned long long recordBytes(size_t features, std::uint64_t atoms);
+	static double maxFlux(const MSD &msd, const MSD::Iterator &iter);  // F of the atom at iter
+	void add(const Entry &e);  // to the index, replacing an entry with the same shape and features
+	void compact();
+};
+
+
+const char *const StateLibrary::OPTION = "--warm-start-from-library";
+
+const char StateLibrary::MAGIC[16] = { 'U', 'D', 'C', '-', 'M', 'S', 'D', '-', 'S', 'T', 'A', 'T', 'E', '-', '1', '\n' };
+
+StateLibrary::Key StateLibrary::shape(const MSD &msd) {
+	ResultCache::Hasher h;
+	h << std::string(UDC_MSD_VERSION) << std::string("StateLibrary");
+	unsigned long long geometry[] = { msd.getWidth(), msd.getHeight(), msd.getDepth(), msd.getMolPosL(),
+			msd.getMolPosR(), msd.getTopL(), msd.getBottomL(), msd.getFrontR(), msd.getBackR() };
+	for( unsigned long long g : geometry )
+		h << g;
+	if( msd.hasVoxelMask() )  // (the shape isn't just the box above)
+		for( auto iter = msd.begin(); iter != msd.end(); ++iter )
+			h << static_cast<unsigned long long>(iter.getX()) << static_cast<unsigned long long>(iter.getY())
+			  << static_cast<unsigned long long>(iter.getZ());
+	if( msd.getPeriodicL() != MSD::OPEN || msd.getPeriodicR() != MSD::OPEN )  // (keeps the keys of open MSDs)
+		h << static_cast<unsigned long long>(msd.getPeriodicL()) << static_cast<unsigned long long>(msd.getPeriodicR());
+
+	const MSD::MolProto &proto = msd.getMolProto();
+	h << static_cast<unsigned long long>(proto.nodeCount())
+	  << static_cast<unsigned long long>(proto.getLeftLead()) << static_cast<unsigned long long>(proto.getRightLead());
+	auto edges = proto.getEdges();
+	for( auto edge = edges.begin(); edge != edges.end(); ++edge )
+		h << static_cast<unsigned long long>(edge.src()) << static_cast<unsigned long long>(edge.dest());
+
+	const std::type_info &algo = msd.flippingAlgorithm.target_type();
+	h << std::string(
+			algo == MSD::UP_DOWN_MODEL.target_type() ? "UP_DOWN_MODEL" :
+			algo == MSD::CONTINUOUS_SPIN_MODEL.target_type() ? "CONTINUOUS_SPIN_MODEL" :
+			algo == MSD::HEAT_BATH_MODEL.target_type() ? "HEAT_BATH_MODEL" :
+			algo == MSD::CONE_MODEL.target_type() ? "CONE_MODEL" : algo.name() );
+	return h.get();
+}
+
+std::vector<double> StateLibrary::features(const MSD &msd) {
+	std::vector<double> f;
+	auto add = [&f](const Vector &v) {
+		f.push_back(v.x);
+		f.push_back(v.y);
+		f.push_back(v.z);
+	};
+	MSD::Parameters p = msd.getParameters();
+	f.push_back(p.kT);
+	add(p.B);
+	f.insert(f.end(), { p.SL, p.SR, p.FL, p.FR, p.JL, p.JR, p.JmL, p.JmR, p.JLR, p.Je0L, p.Je0R,
+			p.Je1L, p.Je1R, p.Je1mL, p.Je1mR, p.Je1LR, p.JeeL, p.JeeR, p.JeemL, p.JeemR, p.JeeLR,
+			p.bL, p.bR, p.bmL, p.bmR, p.bLR });
+	add(p.AL);
+	add(p.AR);
+	add(p.DL);
+	add(p.DR);
+	add(p.DmL);
+	add(p.DmR);
+	add(p.DLR);
+
+	const MSD::MolProto &proto = msd.getMolProto();
+	auto nodes = proto.getNodes();
+	for( auto node = nodes.begin(); node != nodes.end(); ++node ) {
+		MSD::MolProto::NodeParameters n = node.getParameters();
+		f.insert(f.end(), { n.Sm, n.Fm, n.Je0m });
+		add(n.Am);
+	}
+	auto edges = proto.getEdges();
+	for( auto edge = edges.begin(); edge != edges.end(); ++edge ) {
+		MSD::MolProto::EdgeParameters e = edge.getParameters();
+		f.insert(f.end(), { e.Jm, e.Je1m, e.Jeem, e.bm });
+		add(e.Dm);
+	}
+	return f;
+}
+
+std::string StateLibrary::takeOption(int &argc, char *argv[]) {
+	const size_t len = std::strlen(OPTION);
+	std::string file;
+	for( int i = 1; i < argc; i++ ) {
+		int count;  // of arguments taken
+		if( std::strcmp(argv[i], OPTION) == 0 ) {
+			if( i + 1 >= argc )
+				throw std::invalid_argument(std::string(OPTION) + " needs a file");
+			file = argv[i + 1];
+			count = 2;
+		} else if( std::strncmp(argv[i], OPTION, len) == 0 && argv[i][len] == '=' ) {
+			file = argv[i] + len + 1;
+			count = 1;
+		} else
+			continue;
+		if( file.empty() )
+			throw std::invalid_argument(std::string(OPTION) + " needs a file");
+		for( int j = i; j + count <= argc; j++ )
+			argv[j] = argv[j + count];  // (including the NULL at argv[argc])
+		argc -= count;
+		i--;
+	}
+	return file;
+}
+
+
+StateLibrary::StateLibrary(const std::string &path) : path(path), fileBytes(0), liveBytes(0) {
+	std::ifstream in(path, std::ios::binary);
+	if( in ) {
+		in.seekg(0, std::ios::end);
+		const unsigned long long length = static_cast<unsigned long long>(in.tellg());
+		in.seekg(0);
+		char magic[sizeof(MAGIC)];
+		if( length != 0 ) {
+			if( length < sizeof(MAGIC) || !in.read(magic, sizeof(MAGIC)) || std::memcmp(magic, MAGIC, sizeof(MAGIC)) != 0 )
+				throw std::runtime_error("StateLibrary: not a state library file: " + path);
+			fileBytes = sizeof(MAGIC);
+			while( true ) {
+				Entry e;
+				std::uint64_t count;
+				if( !in.read(reinterpret_cast<char *>(&e.shape), sizeof(e.shape))
+						|| !in.read(reinterpret_cast<char *>(&count), sizeof(count))
+						|| count > (length - fileBytes) / sizeof(double) )
+					break;  // incomplete record
+				e.features.resize(static_cast<size_t>(count));
+				if( (count != 0 && !in.read(reinterpret_cast<char *>(e.features.data()), count * sizeof(double)))
+						|| !in.read(reinterpret_cast<char *>(&e.atoms), sizeof(e.atoms)) )
+					break;
+				const unsigned long long bytes = recordBytes(e.features.size(), e.atoms);
+				if( e.atoms > length / (2 * sizeof(Vector)) || bytes > length - fileBytes )
+					break;
+				e.offset = fileBytes + bytes - e.atoms * 2 * sizeof(Vector);
+				add(e);
+				fileBytes += bytes;
+				in.seekg(static_cast<std::streamoff>(fileBytes));
+			}
+		}
+		in.close();
+		if( fileBytes != length ) {
+			if( fileBytes == 0 )
+				fileBytes = sizeof(MAGIC);
+			compact();  // drop the incomplete record (or write the header of an empty file)
+		}
+	} else {
+		std::ofstream out(path, std::ios::binary | std::ios::trunc);
+		if( !out.write(MAGIC, sizeof(MAGIC)) )
+			throw std::runtime_error("StateLibrary: can't create the library file: " + path);
+		fileBytes = sizeof(MAGIC);
+	}
+}
+
+StateLibrary::~StateLibrary() {
+	try {
+		flush();
+	} catch(std::exception &) {
+		// the appended records are still in the file
+	}
+}
+
+unsigned long long StateLibrary::recordBytes(size_t features, std::uint64_t atoms) {
+	return sizeof(Key) + 2 * sizeof(std::uint64_t) + features * sizeof(double) + atoms * 2 * sizeof(Vector);
+}
+
+double StateLibrary::maxFlux(const MSD &msd, const MSD::Iterator &iter) {
+	const unsigned int x = iter.getX();
+	if( x < msd.getMolPosL() )
+		return msd.getParameters().FL;
+	else if( x > msd.getMolPosR() )
+		return msd.getParameters().FR;
+	else
+		return msd.getMolProto().getNodeParameters(x - msd.getMolPosL()).Fm;
+}
+
+void StateLibrary::add(const Entry &e) {
+	for( Entry &old : index )
+		if( old.shape == e.shape && old.features == e.features ) {
+			liveBytes -= recordBytes(old.features.size(), old.atoms);
+			old = e;
+			liveBytes += recordBytes(e.features.size(), e.atoms);
+			return;
+		}
+	index.push_back(e);
+	liveBytes += recordBytes(e.features.size(), e.atoms);
+}
+
+void StateLibrary::store(const MSD &msd) {
+	Entry e;
+	e.shape = shape(msd);
+	e.features = features(msd);
+	e.atoms = msd.getN();
+	std::string record;
+	ResultCache::append(record, e.shape);
+	ResultCache::append(record, static_cast<std::uint64_t>(e.features.size()));
+	for( double f : e.features )
+		ResultCache::append(record, f);
+	ResultCache::append(record, e.atoms);
+	for( auto iter = msd.begin(); iter != msd.end(); ++iter ) {
+		const double F = maxFlux(msd, iter);
+		const Vector spin = iter.getSpin(), flux = iter.getFlux();
+		const double s = spin.norm();
+		ResultCache::append(record, s != 0 ? (1 / s) * spin : Vector::ZERO);  // direction
+		ResultCache::append(record, F != 0 ? (1 / F) * flux : Vector::ZERO);  // relative to F
+	}
+
+	std::lock_guard<std::mutex> lock(mutex);
+	std::ofstream out(path, std::ios::binary | std::ios::app);
+	out.write(record.data(), record.size());
+	out.close();
+	if( !out )
+		throw std::runtime_error("StateLibrary: can't write to the library file: " + path);
+	e.offset = fileBytes + record.size() - e.atoms * 2 * sizeof(Vector);
+	add(e);
+	fileBytes += record.size();
+}
+
+bool StateLibrary::warmStart(MSD &msd, double *distance) {
+	const Key s = shape(msd);
+	const std::vector<double> f = features(msd);
+	std::string state;
+	{	std::lock_guard<std::mutex> lock(mutex);
+		const Entry *nearest = NULL;
+		double d2 = std::numeric_limits<double>::infinity();
+		for( const Entry &e : index ) {
+			if( e.shape != s || e.features.size() != f.size() || e.atoms != msd.getN() )
+				continue;
+			double sum = 0;
+			for( size_t i = 0; i < f.size(); i++ )
+				sum += (e.features[i] - f[i]) * (e.features[i] - f[i]);
+			if( sum < d2 || nearest == NULL ) {
+				d2 = sum;
+				nearest = &e;
+			}
+		}
+		if( distance != NULL )
+			*distance = std::sqrt(d2);
+		if( nearest == NULL )
+			return false;
+		state.resize(static_cast<size_t>(nearest->atoms * 2 * sizeof(Vector)));
+		std::ifstream in(path, std::ios::binary);
+		in.seekg(static_cast<std::streamoff>(nearest->offset));
+		if( !in || (!state.empty() && !in.read(&state[0], state.size())) )
+			throw std::runtime_error("StateLibrary: can't read the library file: " + path);
+	}
+
+	size_t pos = 0;
+	for( auto iter = msd.begin(); iter != msd.end(); ++iter ) {
+		const Vector spin = iter.getSpin();
+		Vector dir, flux;
+		ResultCache::extract(state, pos, dir);
+		ResultCache::extract(state, pos, flux);
+		msd.setLocalM(iter.getIndex(), dir == Vector::ZERO ? spin : spin.norm() * dir, maxFlux(msd, iter) * flux);
+	}
+	msd.record.clear();
+	msd.couplingRecord.clear();
+	return true;
+}
+
+void StateLibrary::flush() {
+	std::lock_guard<std::mutex> lock(mutex);
+	if( fileBytes != sizeof(MAGIC) + liveBytes )
+		compact();
+}
+
+void StateLibrary::compact() {
+	const std::string temp = path + ".tmp";
+	std::ifstream in(path, std::ios::binary);
+	std::ofstream out(temp, std::ios::binary | std::ios::trunc);
+	out.write(MAGIC, sizeof(MAGIC));
+	unsigned long long offset = sizeof(MAGIC);
+	std::string state;
+	for( Entry &e : index ) {
+		const std::uint64_t count = e.features.size();
+		state.resize(static_cast<size_t>(e.atoms * 2 * sizeof(Vector)));
+		in.seekg(static_cast<std::streamoff>(e.offset));
+		if( !state.empty() )
+			in.read(&state[0], state.size());
+		out.write(reinterpret_cast<const char *>(&e.shape), sizeof(e.shape));
+		out.write(reinterpret_cast<const char *>(&count), sizeof(count));
+		out.write(reinterpret_cast<const char *>(e.features.data()), count * sizeof(double));
+		out.write(reinterpret_cast<const char *>(&e.atoms), sizeof(e.atoms));
+		out.write(state.data(), state.size());
+		const unsigned long long bytes = recordBytes(e.features.size(), e.atoms);
+		e.offset = offset + bytes - state.size();
+		offset += bytes;
+	}
+	in.close();
+	out.close();
+	if( !in.good() && !index.empty() )
+		throw std::runtime_error("StateLibrary: can't read the library file: " + path);
+	if( !out )
+		throw std::runtime_error("StateLibrary: can't write to the library file: " + temp);
+	std::remove(path.c_str());
+	if( std::rename(temp.c_str(), path.c_str()) != 0 )
+		throw std::runtime_error("StateLibrary: can't replace the library file: " + path);
+	fileBytes = offset;
+}
+
+size_t StateLibrary::size() const {
+	std::lock_guard<std::mutex> lock(mutex);
+	return index.size();
+}
+
+const std::string & StateLibrary::getPath() const {
+	return path;
+}
+
+}  // end of namespace udc
+
+#endif
@@ -0,0 +1,80 @@
+#ifndef UDC_SUMTREE
+#define UDC_SUMTREE
+
+#include <stdexcept>
+#include <vector>
+
+namespace udc {
+
+using std::out_of_range;
+
+/*
+ * A fixed-sized array of non-negative weights, stored as a complete binary tree of partial sums,
+ * so that changing a weight and picking an index with probability (weight / total) are both O(log n).
+ * Parents are always recalculated from their children, so round-off error doesn't accumulate.
+ */
+class SumTree {
+ private:
+	unsigned int _size;
+	unsigned int leaves;  // (power of 2) >= size. Weight i is stored at tree[leaves + i]
+	std::vector<double> tree;  // tree[1] is the root (total)
+
+ public:
+	SumTree() : _size(0), leaves(1), tree(2, 0.0) { /* empty */ }
+	SumTree(unsigned int size) { resize(size); }
+
+	unsigned int size() const { return _size; }
+	void resize(unsigned int size);  // will set all weights to 0
+	void assign(const std::vector<double> &weights);  // resize to weights.size(), and set all weights in O(n)
+
+	double total() const { return tree[1]; }
+
+	// does NO bounds checking
+	double operator[](unsigned int i) const { return tree[leaves + i]; }
+	void set(unsigned int i, double weight);
+
+	// Returns the index, i, such that (w[0] + ... + w[i-1]) <= x < (w[0] + ... + w[i]).
+	// Indices with 0 weight are never returned. Throws out_of_range if total() == 0.
+	unsigned int find(double x) const;
+};
+
+void SumTree::resize(unsigned int size) {
+	_size = size;
+	leaves = 1;
+	while (leaves < size)
+		leaves *= 2;
+	tree.assign(2 * leaves, 0.0);
+}
+
+void SumTree::assign(const std::vector<double> &weights) {
+	resize(static_cast<unsigned int>(weights.size()));
+	for (unsigned int i = 0; i < _size; i++)
+		tree[leaves + i] = weights[i];
+	for (unsigned int node = leaves - 1; node >= 1; node--)
+		tree[node] = tree[2 * node] + tree[2 * node + 1];
+}
+
+void SumTree::set(unsigned int i, double weight) {
+	unsigned int node = leaves + i;
+	tree[node] = weight;
+	for (node /= 2; node >= 1; node /= 2)
+		tree[node] = tree[2 * node] + tree[2 * node + 1];
+}
+
+unsigned int SumTree::find(double x) const {
+	if (tree[1] <= 0)
+		throw out_of_range("SumTree::find(double): total weight is 0");
+	unsigned int node = 1;
+	while (node < leaves) {
+		node *= 2;  // left child
+		if (tree[node + 1] > 0 && (x >= tree[node] || tree[node] <= 0)) {
+			x -= tree[node];
+			node++;  // right child
+		}
+	}
+	return node - leaves;
+}
+
+}  // end of namespace udc
+
+#endif
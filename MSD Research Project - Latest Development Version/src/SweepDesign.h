@@ -0,0 +1,191 @@
+#ifndef UDC_SWEEP_DESIGN
+#define UDC_SWEEP_DESIGN
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <map>
+#include <random>
+#include <stdexcept>
+#include <vector>
+
+namespace udc {
+
+/*
+ * Space-filling designs for parameter sweeps (see: metropolis.cpp) over many parameters at once, where a full grid
+ * would need too many simulations. Each design is a list of "points" points in the unit hypercube, [0, 1)^dims,
+ * which the caller maps onto the parameter ranges.
+ */
+class SweepDesign {
+ public:
+	static const size_t SOBOL_DIMS = 16;  // max. dims of sobol
+
+	// One random point in each of the "points" equal slices of every axis (McKay, Beckman, and Conover).
+	static std::vector< std::vector<double> > latinHypercube(size_t points, size_t dims, unsigned long seed);
+	// The first "points" points of the Sobol sequence (with the direction numbers of Joe and Kuo), starting at 0.
+	static std::vector< std::vector<double> > sobol(size_t points, size_t dims);
+};
+
+
+/*
+ * Adaptive refinement of a sweep along one parameter: the sweep is made of lines (e.g. one for each combination of
+ * the other parameters of a grid), each a list of points along a coordinate, u, with the value of some observable.
+ *
+ * Every interval between neighboring points of a line has a loss: its length in normalized coordinates (u scaled
+ * to [0, 1] in its line, and the value scaled to [0, 1] over all lines), which is large where the value changes
+ * quickly, plus sqrt of the area of the triangles its ends make with their neighbors, which is large around peaks
+ * (where the curvature is large). next() splits the intervals with the largest losses at their midpoints.
+ *
+ * The level of a point is 0 for the initial (coarse) points, or 1 + the larger level of the interval it split.
+ */
+class LineRefiner {
+ public:
+	struct Task {
+		size_t line;
+		double u;
+		unsigned int level;
+	};
+
+	unsigned int maxLevel;  // intervals aren't split into points beyond this level (default: 10)
+
+	LineRefiner();
+
+	void add(size_t line, double u, double value, unsigned int level = 0);
+	// up to "count" new points to simulate (and then add), from the intervals with the largest losses
+	std::vector<Task> next(size_t count) const;
+
+ private:
+	struct Point {
+		double u, value;
+		unsigned int level;
+	};
+
+	std::map< size_t, std::vector<Point> > lines;  // (each sorted by u)
+};
+
+
+std::vector< std::vector<double> > SweepDesign::latinHypercube(size_t points, size_t dims, unsigned long seed) {
+	std::mt19937_64 prng(seed);
+	std::uniform_real_distribution<double> rand(0, 1);
+	std::vector< std::vector<double> > design(points, std::vector<double>(dims));
+	std::vector<size_t> slice(points);
+	for( size_t d = 0; d < dims; d++ ) {
+		for( size_t i = 0; i < points; i++ )
+			slice[i] = i;
+		std::shuffle(slice.begin(), slice.end(), prng);
+		for( size_t i = 0; i < points; i++ )
+			design[i][d] = (slice[i] + rand(prng)) / points;
+	}
+	return design;
+}
+
+std::vector< std::vector<double> > SweepDesign::sobol(size_t points, size_t dims) {
+	if( dims > SOBOL_DIMS )
+		throw std::invalid_argument("SweepDesign::sobol: too many dimensions");
+	if( points > (1ull << 32) )
+		throw std::invalid_argument("SweepDesign::sobol: too many points");
+	// s, a, and m_1 ... m_s for dims 2 to SOBOL_DIMS (new-joe-kuo-6.21201)
+	static const unsigned int s[] = { 1, 2, 3, 3, 4, 4, 5, 5, 5, 5, 5, 5, 6, 6, 6 };
+	static const unsigned int a[] = { 0, 1, 1, 2, 1, 4, 2, 4, 7, 11, 13, 14, 1, 13, 16 };
+	static const unsigned int m[][6] = {
+		{ 1 }, { 1, 3 }, { 1, 3, 1 }, { 1, 1, 1 }, { 1, 1, 3, 3 }, { 1, 3, 5, 13 }, { 1, 1, 5, 5, 17 },
+		{ 1, 1, 5, 5, 5 }, { 1, 1, 7, 11, 19 }, { 1, 1, 5, 1, 1 }, { 1, 1, 1, 3, 11 }, { 1, 3, 5, 5, 31 },
+		{ 1, 3, 3, 9, 7, 49 }, { 1, 1, 1, 15, 21, 21 }, { 1, 3, 1, 13, 27, 49 } };
+	const unsigned int BITS = 32;
+
+	std::vector< std::vector<double> > design(points, std::vector<double>(dims));
+	for( size_t d = 0; d < dims; d++ ) {
+		std::uint32_t V[BITS + 1];  // direction numbers, V[1] ... V[BITS]
+		if( d == 0 )
+			for( unsigned int k = 1; k <= BITS; k++ )
+				V[k] = std::uint32_t(1) << (BITS - k);
+		else {
+			const unsigned int sd = s[d - 1], ad = a[d - 1];
+			for( unsigned int k = 1; k <= BITS; k++ )
+				if( k <= sd )
+					V[k] = m[d - 1][k - 1] << (BITS - k);
+				else {
+					V[k] = V[k - sd] ^ (V[k - sd] >> sd);
+					for( unsigned int i = 1; i < sd; i++ )
+						if( (ad >> (sd - 1 - i)) & 1 )
+							V[k] ^= V[k - i];
+				}
+		}
+		// Gray code order (Antonov and Saleev)
+		std::uint32_t x = 0;
+		for( size_t i = 0; i < points; i++ ) {
+			design[i][d] = x / 4294967296.0;  // 2^32
+			unsigned int c = 1;  // index of the lowest 0 bit of i
+			for( size_t j = i; j & 1; j >>= 1 )
+				c++;
+			if( c <= BITS )
+				x ^= V[c];
+		}
+	}
+	return design;
+}
+
+
+LineRefiner::LineRefiner() : maxLevel(10) {
+}
+
+void LineRefiner::add(size_t line, double u, double value, unsigned int level) {
+	std::vector<Point> &pts = lines[line];
+	Point pt = { u, value, level };
+	auto iter = std::lower_bound(pts.begin(), pts.end(), pt, [](const Point &p0, const Point &p1) { return p0.u < p1.u; });
+	pts.insert(iter, pt);
+}
+
+std::vector<LineRefiner::Task> LineRefiner::next(size_t count) const {
+	// range of values over every line
+	double vMin = INFINITY, vMax = -INFINITY;
+	for( const auto &line : lines )
+		for( const Point &pt : line.second )
+			if( std::isfinite(pt.value) ) {
+				vMin = std::min(vMin, pt.value);
+				vMax = std::max(vMax, pt.value);
+			}
+	const double vRange = vMax > vMin ? vMax - vMin : 1;
+
+	struct Candidate {
+		double loss;
+		Task task;
+	};
+	std::vector<Candidate> candidates;
+	for( const auto &line : lines ) {
+		const std::vector<Point> &pts = line.second;
+		const size_t N = pts.size();
+		if( N < 2 )
+			continue;
+		const double uRange = pts.back().u - pts.front().u;
+		std::vector<double> X(N), Y(N), area(N, 0);
+		for( size_t i = 0; i < N; i++ ) {
+			X[i] = (pts[i].u - pts.front().u) / uRange;
+			Y[i] = std::isfinite(pts[i].value) ? (pts[i].value - vMin) / vRange : 0;
+		}
+		for( size_t i = 1; i + 1 < N; i++ )
+			area[i] = 0.5 * std::abs((X[i] - X[i - 1]) * (Y[i + 1] - Y[i - 1]) - (X[i + 1] - X[i - 1]) * (Y[i] - Y[i - 1]));
+		for( size_t i = 0; i + 1 < N; i++ ) {
+			unsigned int level = std::max(pts[i].level, pts[i + 1].level) + 1;
+			if( level > maxLevel )
+				continue;
+			Candidate c;
+			c.loss = std::hypot(X[i + 1] - X[i], Y[i + 1] - Y[i]) + std::sqrt(area[i] + area[i + 1]);
+			c.task.line = line.first;
+			c.task.u = (pts[i].u + pts[i + 1].u) / 2;
+			c.task.level = level;
+			candidates.push_back(c);
+		}
+	}
+	count = std::min(count, candidates.size());
+	std::partial_sort(candidates.begin(), candidates.begin() + count, candidates.end(),
+			[](const Candidate &c0, const Candidate &c1) { return c0.loss > c1.loss; });
+	std::vector<Task> tasks;
+	for( size_t i = 0; i < count; i++ )
+		tasks.push_back(candidates[i].task);
+	return tasks;
+}
+
+}  // end of namespace udc
+
+#endif
@@ -0,0 +1,364 @@
+#ifndef UDC_WANG_LANDAU
+#define UDC_WANG_LANDAU
+
+#include <algorithm>
+#include <cmath>
+#include <functional>
+#include <future>
+#include <memory>
+#include <random>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include "MSD.h"
+
+namespace udc {
+
+/*
+ * Wang-Landau estimate of the density of states, g(U), of an MSD, so that <U> and the specific heat can be
+ * calculated for any kT afterwards (instead of running a separate simulation for each kT).
+ *
+ * The energy range [Umin, Umax) is split into bins, which are covered by overlapping windows. Each window has its
+ * own walker (MSD) and its own estimate of ln(g), and all windows are run in parallel (one thread each) using
+ * MSD::metropolis(N, lnW, visit) with lnW = -ln(g). Between rounds, the walkers of neighboring windows are swapped
+ * (replica exchange) when both energies are in the overlap, so that no walker gets stuck in one part of its window.
+ * When (almost) every bin of a window has been visited again, its ln(f) is halved, until ln(f) < 1/t, after which
+ * ln(f) = 1/t (Belardinelli and Pereyra) to avoid the saturation error of plain Wang-Landau. A window is done once
+ * ln(f) < lnfFinal, and run() returns when every window is done, after stitching the windows together.
+ *
+ * Each walker starts in the state given by the factory, and is first moved into its window (see: enterWindow).
+ * Umin and Umax should cover all the energies of interest (for kT > 0, the range from the ground state up to the
+ * mean energy of a randomized MSD). Bins that are never visited (e.g. below the ground state) are ignored.
+ */
+class WangLandau {
+ public:
+	typedef std::function<std::shared_ptr<MSD>()> Factory;  // makes a new walker, with all of its parameters set
+
+	double coverage;  // ln(f) is halved once this fraction of the bins seen so far were visited again (default: 0.95)
+	double lnfFinal;  // (default: 1e-6)
+	unsigned long long roundSteps;  // metropolis steps done by each window between replica exchanges (default: 100 n)
+
+	WangLandau(const Factory &factory, double Umin, double Umax, unsigned int bins,
+			unsigned int windows = 1, double overlap = 0.75);
+
+	void run();
+
+	unsigned int getBins() const;
+	unsigned int getWindows() const;
+	double getUmin() const;
+	double getUmax() const;
+	unsigned long long getRounds() const;
+	double exchangeRate() const;  // fraction of the attempted replica exchanges that were accepted
+
+	double energy(unsigned int bin) const;  // mean energy of the visits to this bin (or its center, if never visited)
+	const std::vector<double> & lnG() const;  // -INFINITY for bins never visited. Only valid after run().
+
+	double meanU(double kT) const;
+	double specificHeat(double kT) const;  // per atom, like MSD::specificHeat
+
+ private:
+	struct Window {
+		unsigned int first, last;  // covers bins [first, last)
+		std::shared_ptr<MSD> msd;
+		std::vector<double> lnG;
+		std::vector<unsigned long long> H;
+		std::vector<unsigned long long> visits;  // never reset
+		std::vector<double> sumU;  // never reset
+		double lnf;
+		unsigned long long steps;
+		bool oneOverT;  // using ln(f) = 1/t
+
+		bool done(double lnfFinal) const { return lnf < lnfFinal; }
+		unsigned int visited() const;  // number of bins visited at least once
+	};
+
+	unsigned int bins;
+	double Umin, Umax, binWidth;
+	unsigned int n;  // atoms per walker
+	std::vector<Window> windows;
+	std::vector<double> _lnG;
+	unsigned long long rounds;
+	unsigned long long exchangesTried, exchangesAccepted;
+	std::mt19937_64 prng;
+	std::uniform_real_distribution<double> rand;
+
+	unsigned int bin(double U) const;
+	void enterWindow(Window &w);
+	void sample(Window &w);
+	void updateF(Window &w) const;
+	void exchange(Window &w0, Window &w1);
+	void stitch();
+	void moments(double kT, double &avgU, double &avgU2) const;
+};
+
+
+WangLandau::WangLandau(const Factory &factory, double Umin, double Umax, unsigned int bins,
+		unsigned int windows, double overlap)
+	: coverage(0.95), lnfFinal(1e-6), bins(bins), Umin(Umin), Umax(Umax), binWidth((Umax - Umin) / bins),
+	  windows(windows), _lnG(bins, -INFINITY), rounds(0), exchangesTried(0), exchangesAccepted(0), rand(0, 1)
+{
+	if( !(Umax > Umin) )
+		throw std::invalid_argument("WangLandau: requires Umin < Umax");
+	if( windows == 0 || bins < 2 * windows )
+		throw std::invalid_argument("WangLandau: requires 0 < windows <= bins / 2");
+	if( !(overlap >= 0 && overlap < 1) )
+		throw std::invalid_argument("WangLandau: requires 0 <= overlap < 1");
+
+	double perWindow = bins / (1 + (windows - 1) * (1 - overlap));
+	for( unsigned int i = 0; i < windows; i++ ) {
+		Window &w = this->windows[i];
+		w.first = static_cast<unsigned int>( std::floor(i * perWindow * (1 - overlap)) );
+		w.last = i + 1 == windows ? bins : static_cast<unsigned int>( std::ceil(w.first + perWindow) );
+		if( w.last > bins )
+			w.last = bins;
+		if( i != 0 && w.first >= this->windows[i - 1].last )
+			w.first = this->windows[i - 1].last - 1;  // at least one bin of overlap
+		unsigned int count = w.last - w.first;
+		w.lnG.assign(count, 0.0);
+		w.H.assign(count, 0);
+		w.visits.assign(count, 0);
+		w.sumU.assign(count, 0.0);
+		w.lnf = 1;
+		w.steps = 0;
+		w.oneOverT = false;
+		w.msd = factory();
+		if( w.msd->flippingAlgorithm.target_type() == MSD::HEAT_BATH_MODEL.target_type() )
+			throw std::invalid_argument("WangLandau: HEAT_BATH_MODEL isn't supported");
+	}
+	// walkers made at the same time get the same seed
+	unsigned long seed = this->windows[0].msd->getSeed();
+	for( unsigned int i = 0; i < windows; i++ )
+		this->windows[i].msd->setSeed(seed + i);
+	prng.seed(seed + windows);
+	n = this->windows[0].msd->getN();
+	roundSteps = 100ull * n;
+}
+
+unsigned int WangLandau::Window::visited() const {
+	unsigned int count = 0;
+	for( unsigned long long v : visits )
+		if( v != 0 )
+			count++;
+	return count;
+}
+
+unsigned int WangLandau::bin(double U) const {
+	if( U < Umin )
+		return 0;
+	unsigned int b = static_cast<unsigned int>( (U - Umin) / binWidth );
+	return b < bins ? b : bins - 1;
+}
+
+// Moves the walker of window "w" into its energy range, by sampling exp(-distance / binWidth) outside of it.
+void WangLandau::enterWindow(Window &w) {
+	const double lo = Umin + w.first * binWidth, hi = Umin + w.last * binWidth;
+	auto lnW = [&](double U) -> double {
+		return U < lo ? (U - lo) / binWidth : U >= hi ? (hi - U) / binWidth : 0;
+	};
+	auto inside = [&]() {
+		double U = w.msd->getResults().U;
+		return U >= lo && U < hi;
+	};
+	for( unsigned int k = 0; k < 10000 && !inside(); k++ )
+		w.msd->metropolis(10ull * n, lnW, [](const MSD::Results &) {});
+	if( !inside() )
+		throw std::runtime_error("WangLandau: couldn't reach the energy window starting at U = " + std::to_string(lo));
+}
+
+void WangLandau::sample(Window &w) {
+	if( w.done(lnfFinal) )
+		return;
+	auto lnW = [&](double U) -> double {
+		if( !(U >= Umin && U < Umax) )
+			return -INFINITY;
+		unsigned int b = bin(U);
+		return b < w.first || b >= w.last ? -INFINITY : -w.lnG[b - w.first];
+	};
+	auto visit = [&](const MSD::Results &r) {
+		unsigned int b = bin(r.U) - w.first;
+		w.lnG[b] += w.lnf;
+		w.H[b]++;
+		w.visits[b]++;
+		w.sumU[b] += r.U;
+	};
+	w.msd->metropolis(roundSteps, lnW, visit);
+	w.steps += roundSteps;
+}
+
+void WangLandau::updateF(Window &w) const {
+	if( w.done(lnfFinal) )
+		return;
+	double t = static_cast<double>(w.steps) / w.visited();  // steps per visited bin
+	if( w.oneOverT ) {
+		w.lnf = 1 / t;
+		return;
+	}
+	// Belardinelli and Pereyra only require every bin to be visited again (instead of a flat histogram), since the 1/t
+	// stage corrects the rest. Only a fraction (coverage) is required here, since (with round-off error in U) an energy
+	// level on the edge of two bins may never return to one of them.
+	unsigned int count = 0;
+	for( unsigned long long h : w.H )
+		if( h != 0 )
+			count++;
+	if( count < coverage * w.visited() )
+		return;
+	w.lnf /= 2;
+	w.H.assign(w.H.size(), 0);
+	if( w.lnf < 1 / t ) {
+		w.oneOverT = true;
+		w.lnf = 1 / t;
+	}
+}
+
+// Replica exchange between neighboring windows: accepted with probability
+// min(1, g0(U0) g1(U1) / (g0(U1) g1(U0))), if both energies are in the overlap of the windows.
+void WangLandau::exchange(Window &w0, Window &w1) {
+	if( w0.done(lnfFinal) || w1.done(lnfFinal) )
+		return;
+	unsigned int b0 = bin(w0.msd->getResults().U);
+	unsigned int b1 = bin(w1.msd->getResults().U);
+	if( b0 < w1.first || b1 >= w0.last )
+		return;  // not in the overlap
+	exchangesTried++;
+	double lnA = w0.lnG[b0 - w0.first] + w1.lnG[b1 - w1.first] - w0.lnG[b1 - w0.first] - w1.lnG[b0 - w1.first];
+	if( lnA >= 0 || rand(prng) < std::exp(lnA) ) {
+		std::swap(w0.msd, w1.msd);
+		exchangesAccepted++;
+	}
+}
+
+// Joins the windows into one ln(g), by shifting each window to match the previous one in their overlap (using the
+// median difference, since a bin on the edge of an energy level may have stopped being visited, see: updateF),
+// and switching from one to the next in the middle of the overlap.
+void WangLandau::stitch() {
+	_lnG.assign(bins, -INFINITY);
+	for( size_t i = 0; i < windows.size(); i++ ) {
+		const Window &w = windows[i];
+		double shift = 0;
+		unsigned int from = w.first;
+		if( i != 0 ) {
+			const Window &prev = windows[i - 1];
+			std::vector<double> diff;
+			for( unsigned int b = w.first; b < prev.last; b++ )
+				if( w.visits[b - w.first] != 0 && prev.visits[b - prev.first] != 0 )
+					diff.push_back(_lnG[b] - w.lnG[b - w.first]);
+			if( diff.empty() )
+				throw std::runtime_error("WangLandau: no common energies in the overlap of two windows");
+			std::nth_element(diff.begin(), diff.begin() + diff.size() / 2, diff.end());
+			shift = diff[diff.size() / 2];
+			from = (w.first + prev.last) / 2;
+		}
+		for( unsigned int b = from; b < w.last; b++ )
+			if( w.visits[b - w.first] != 0 )
+				_lnG[b] = w.lnG[b - w.first] + shift;
+	}
+	double min = INFINITY;  // normalize so that the smallest ln(g) is 0
+	for( double lng : _lnG )
+		if( lng != -INFINITY && lng < min )
+			min = lng;
+	for( double &lng : _lnG )
+		lng -= min;
+}
+
+void WangLandau::run() {
+	{	std::vector< std::future<void> > threads;
+		for( Window &w : windows )
+			threads.push_back( std::async(std::launch::async, &WangLandau::enterWindow, this, std::ref(w)) );
+		for( auto &t : threads )
+			t.get();
+	}
+	while(true) {
+		bool done = true;
+		for( const Window &w : windows )
+			done = done && w.done(lnfFinal);
+		if( done )
+			break;
+
+		std::vector< std::future<void> > threads;
+		for( Window &w : windows )
+			threads.push_back( std::async(std::launch::async, &WangLandau::sample, this, std::ref(w)) );
+		for( auto &t : threads )
+			t.get();
+		rounds++;
+
+		for( Window &w : windows )
+			updateF(w);
+		for( size_t i = rounds % 2; i + 1 < windows.size(); i += 2 )  // alternate between even and odd pairs
+			exchange(windows[i], windows[i + 1]);
+	}
+	stitch();
+}
+
+unsigned int WangLandau::getBins() const {
+	return bins;
+}
+
+unsigned int WangLandau::getWindows() const {
+	return static_cast<unsigned int>(windows.size());
+}
+
+double WangLandau::getUmin() const {
+	return Umin;
+}
+
+double WangLandau::getUmax() const {
+	return Umax;
+}
+
+unsigned long long WangLandau::getRounds() const {
+	return rounds;
+}
+
+double WangLandau::exchangeRate() const {
+	return exchangesTried == 0 ? 0 : static_cast<double>(exchangesAccepted) / exchangesTried;
+}
+
+double WangLandau::energy(unsigned int b) const {
+	unsigned long long visits = 0;
+	double sumU = 0;
+	for( const Window &w : windows )
+		if( b >= w.first && b < w.last ) {
+			visits += w.visits[b - w.first];
+			sumU += w.sumU[b - w.first];
+		}
+	return visits != 0 ? sumU / visits : Umin + (b + 0.5) * binWidth;
+}
+
+const std::vector<double> & WangLandau::lnG() const {
+	return _lnG;
+}
+
+// <U> and <U^2> in the canonical ensemble, using log-sum-exp to avoid overflow
+void WangLandau::moments(double kT, double &avgU, double &avgU2) const {
+	double max = -INFINITY;
+	for( unsigned int b = 0; b < bins; b++ )
+		if( _lnG[b] != -INFINITY && _lnG[b] - energy(b) / kT > max )
+			max = _lnG[b] - energy(b) / kT;
+	double Z = 0, sumU = 0, sumU2 = 0;
+	for( unsigned int b = 0; b < bins; b++ )
+		if( _lnG[b] != -INFINITY ) {
+			double U = energy(b);
+			double p = std::exp(_lnG[b] - U / kT - max);
+			Z += p;
+			sumU += p * U;
+			sumU2 += p * U * U;
+		}
+	avgU = sumU / Z;
+	avgU2 = sumU2 / Z;
+}
+
+double WangLandau::meanU(double kT) const {
+	double avgU, avgU2;
+	moments(kT, avgU, avgU2);
+	return avgU;
+}
+
+double WangLandau::specificHeat(double kT) const {
+	double avgU, avgU2;
+	moments(kT, avgU, avgU2);
+	return (avgU2 - avgU * avgU) / (n * kT * kT);
+}
+
+}  // end of namespace udc
+
+#endif
@@ -0,0 +1,48 @@
+#include <cstdlib>
+#include <ctime>
+#include <chrono>
+#include <iostream>
+#include <thread>
+#include "../MSD.h"
+#include "../DomainMSD.h"
+
+using namespace std;
+using namespace std::chrono;
+using namespace udc;
+
+
+// Times sweeps of a large cubic MSD with MSD::metropolis (RANDOM_SITE) and with DomainMSD on 1, 2, 4, ... threads
+// (up to the number of hardware threads), with and without pinned threads. Wall clock time, since DomainMSD's
+// threads add their CPU time together.
+int main(int argc, char *argv[]) {
+	const int N = (argc > 1 ? atoi(argv[1]) : 10);  // sweeps
+	const unsigned int W = (argc > 2 ? atoi(argv[2]) : 128);
+	const unsigned int cpus = std::max(1u, std::thread::hardware_concurrency());
+
+	MSD msd(W, W, W, W / 2, W / 2, 0, W - 1, 0, W - 1);
+	MSD::Parameters p;
+	p.kT = 0.5;
+	p.JL = p.JR = 1;
+	p.FL = p.FR = 0.1;
+	msd.setParameters(p);
+	msd.randomize();
+
+	cout << "(N=" << N << ", " << W << "x" << W << "x" << W << ", " << cpus << " hardware threads) Running...\n";
+	auto start = steady_clock::now();
+	msd.metropolis((unsigned long long) N * msd.getN());
+	cout << "MSD::metropolis:        " << duration<double>(steady_clock::now() - start).count() << " seconds\n";
+
+	for (unsigned int T = 1; T <= 2 * cpus; T *= 2)
+		for (int pin = 0; pin < 2; pin++) {
+			start = steady_clock::now();
+			DomainMSD domain(msd, T, pin != 0);
+			double init = duration<double>(steady_clock::now() - start).count();
+			start = steady_clock::now();
+			domain.sweep(N);
+			double run = duration<double>(steady_clock::now() - start).count();
+			cout << "DomainMSD (" << domain.getSlabs() << " slabs" << (pin ? ", pinned): " : "):         ")
+			     << run << " seconds (construction: " << init << " seconds)\n";
+		}
+
+	return 0;
+}
@@ -0,0 +1,60 @@
+#include <cstdlib>
+#include <ctime>
+#include <iostream>
+#include "../MSD.h"
+
+using namespace std;
+using namespace udc;
+
+
+// Times metropolis on large cubic MSDs in each MSD::SiteOrder, with both random (RANDOM_SITE) and memory order
+// (TYPEWRITER) sweeps, and a full energy recalculation (setParameters).
+int main(int argc, char *argv[]) {
+	const int N = (argc > 1 ? atoi(argv[1]) : 10);  // sweeps
+	const unsigned int sizes[] = { 64, 128, 192 };
+	const MSD::SiteOrder orders[] = { MSD::ROW_MAJOR, MSD::MORTON, MSD::HILBERT };
+	const char *names[] = { "ROW_MAJOR", "MORTON", "HILBERT" };
+
+	MSD::Parameters p;
+	p.kT = 0.5;
+	p.JL = p.JR = 1;
+	p.FL = p.FR = 0.1;
+
+	cout << "(N=" << N << ") Running...\n";
+	for (unsigned int W : sizes) {
+		cout << "---------- " << W << "x" << W << "x" << W << " ----------\n";
+		for (int k = 0; k < 3; k++) {
+			MSD msd(W, W, W, W / 2, W / 2, 0, W - 1, 0, W - 1);
+			msd.setParameters(p);
+			clock_t start = clock();
+			msd.setSiteOrder(orders[k]);
+			double layout = (double) (clock() - start) / CLOCKS_PER_SEC;
+			msd.randomize();
+			const unsigned long long steps = (unsigned long long) N * msd.getN();
+
+			msd.sweepMode = MSD::RANDOM_SITE;
+			start = clock();
+			msd.metropolis(steps);
+			double random = (double) (clock() - start) / CLOCKS_PER_SEC;
+
+			msd.sweepMode = MSD::TYPEWRITER;
+			start = clock();
+			msd.metropolis(steps);
+			double typewriter = (double) (clock() - start) / CLOCKS_PER_SEC;
+
+			start = clock();
+			for (int i = 0; i < N; i++)
+				msd.setParameters(p);
+			double recalc = (double) (clock() - start) / CLOCKS_PER_SEC;
+
+			cout << names[k] << ":\n";
+			cout << "Clock time (setSiteOrder): " << layout << " seconds\n";
+			cout << "Clock time (RANDOM_SITE):  " << random << " seconds\n";
+			cout << "Clock time (TYPEWRITER):   " << typewriter << " seconds\n";
+			cout << "Clock time (setParameters): " << recalc << " seconds\n";
+		}
+		cout << "\n";
+	}
+
+	return 0;
+}
@@ -9,9 +9,14 @@
  */
 
 #include <fstream>
+#include <iomanip>
 #include <iostream>
+#include <memory>
+#include <sstream>
 #include <string>
 #include "MSD.h"
+#include "ResultCache.h"
+#include "StateLibrary.h"
 
 using namespace std;
 using namespace udc;
@@ -34,6 +39,16 @@ enum ARG3 {
 
 int main(int argc, char *argv[]) {
 	//get command line argument(s)
+	unique_ptr<StateLibrary> library;  // optional: each kT starts from the nearest equilibrated state in it
+	try {
+		string libraryFile = StateLibrary::takeOption(argc, argv);
+		if (!libraryFile.empty())
+			library.reset(new StateLibrary(libraryFile));
+	} catch(exception &ex) {
+		cerr << ex.what() << '\n';
+		return 5;
+	}
+
 	if( argc > 1 ) {
 		ifstream test(argv[1]);
 		if( test.good() ) {
@@ -58,6 +73,10 @@ int main(int argc, char *argv[]) {
 			arg2 = MSD::CONTINUOUS_SPIN_MODEL;
 		else if( s == string("UP_DOWN_MODEL") )
 			arg2 = MSD::UP_DOWN_MODEL;
+		else if( s == string("HEAT_BATH_MODEL") )
+			arg2 = MSD::HEAT_BATH_MODEL;
+		else if( s == string("CONE_MODEL") )
+			arg2 = MSD::CONE_MODEL;
 		else
 			cout << "Unrecognized third argument! Defaulting to 'CONTINUOUS_SPIN_MODEL'.\n";
 	} else
@@ -98,6 +117,23 @@ int main(int argc, char *argv[]) {
 	} else
 		cout << "Defaulting to 'LINEAR'.\n";
 
+	// the whole run is cached, by every parameter (and the initial state), but not with a library: the warm starts
+	// depend on the states stored in it during the run, so the initial state doesn't identify the results
+	unique_ptr<ResultCache> cache;
+	if (argc > 5 && string(argv[5]) != "none" && library)
+		cerr << "Warning: the results of a run with a state library aren't cached.\n";
+	else if (argc > 5 && string(argv[5]) != "none") {
+		double maxMB = 0;
+		if (argc > 6)
+			istringstream(argv[6]) >> maxMB;
+		try {
+			cache.reset(new ResultCache(argv[5], static_cast<unsigned long long>(maxMB * 1024 * 1024)));
+		} catch(runtime_error &ex) {
+			cerr << ex.what() << '\n';
+			return 4;
+		}
+	}
+
 	ofstream file(argv[1]);
 	file.exceptions( ios::badbit | ios::failbit );
 	
@@ -294,19 +330,35 @@ int main(int argc, char *argv[]) {
 			 << ",,msd_version = " << UDC_MSD_VERSION
 			 << '\n';
 	
+		if (kT_inc == 0) {
+			cerr << "kT_inc == 0: infinite loop!\n";
+			return 8;
+		}
+		
+		ResultCache::Key key = 0;
+		string rows;  // the CSV lines of the results (for the cache)
+		if (cache) {
+			ostringstream run;
+			run << setprecision(17) << "heat," << argv[3] << ",kT=" << kT_min << ':' << kT_max << ':' << kT_inc
+			    << ",t_eq=" << t_eq << ",simCount=" << simCount << ",freq=" << freq;
+			key = ResultCache::key(msd, run.str());
+			if (cache->get(key, rows)) {
+				cout << "Loaded the results from the cache: " << argv[5] << '\n';
+				file << rows;
+				return 0;
+			}
+		}
+
 		//run simulations
 		cout << "Starting simulation...\n";
-		auto sim = [&]() {
-			if( arg3 == REINITIALIZE )
-				msd.reinitialize();
-			else if( arg3 == RANDOMIZE )
-				msd.randomize();
-			msd.record.clear();
-			
-			cout << "kT = " << p.kT << '\n';
-			msd.set_kT(p.kT);
-			msd.metropolis(t_eq);
-			msd.metropolis(simCount, freq);
+		MSD::Schedule schedule;
+		schedule.temperatureSteps(kT_min, kT_max, kT_inc, p.B, t_eq, simCount, freq,
+				arg3 == REINITIALIZE ? MSD::Schedule::REINITIALIZE : arg3 == RANDOMIZE ? MSD::Schedule::RANDOMIZE : MSD::Schedule::NOOP);
+		schedule.onStageEnd = [&](size_t stage) {
+			if( stage % 2 == 0 ) {  // equilibrated
+				cout << "kT = " << msd.getParameters().kT << '\n';
+				return;
+			}
 			
 			cout << "Saving data...\n";
 			MSD::Results r = msd.getResults();
@@ -329,7 +381,8 @@ int main(int argc, char *argv[]) {
 			double avgUmL = msd.meanUmL();
 			double avgUmR = msd.meanUmR();
 			double avgULR = msd.meanULR();
-			file << p.kT << ",,"
+			ostringstream row;
+			row << msd.getParameters().kT << ",,"
 				 << avgM.x  << ',' << avgM.y  << ',' << avgM.z  << ',' << avgM.norm()  << ',' << avgM.theta()  << ',' << avgM.phi()  << ",,"
 				 << avgML.x << ',' << avgML.y << ',' << avgML.z << ',' << avgML.norm() << ',' << avgML.theta() << ',' << avgML.phi() << ",,"
 				 << avgMR.x << ',' << avgMR.y << ',' << avgMR.z << ',' << avgMR.norm() << ',' << avgMR.theta() << ',' << avgMR.phi() << ",,"
@@ -360,17 +413,38 @@ int main(int argc, char *argv[]) {
 				 << r.MFR.x << ',' << r.MFR.y << ',' << r.MFR.z << ',' << r.MFR.norm() << ',' << r.MFR.theta() << ',' << r.MFR.phi() << ",,"
 				 << r.MFm.x << ',' << r.MFm.y << ',' << r.MFm.z << ',' << r.MFm.norm() << ',' << r.MFm.theta() << ',' << r.MFm.phi() << ",,"
 				 << r.U << ',' << r.UL << ',' << r.UR << ',' << r.Um << ',' << r.UmL << ',' << r.UmR << ',' << r.ULR << '\n';
+			file << row.str();
+			rows += row.str();
 		};
-		if (kT_inc > 0) {
-			for (p.kT = kT_min; p.kT <= kT_max; p.kT += kT_inc)
-				sim();
-		} else if (kT_inc < 0) {
-			for (p.kT = kT_max; p.kT >= kT_min; p.kT += kT_inc)
-				sim();
-		} else {
-			cerr << "kT_inc == 0: infinite loop!\n";
-			return 8;
-		}
+		if (!library)
+			msd.run(schedule);
+		else
+			// one stage at a time: the first kT (and, with a reset, every kT) starts from the nearest state in the
+			// library instead, and every equilibrated state is stored in it
+			for (size_t k = 0; k < schedule.stages.size(); k++) {
+				MSD::Schedule one;
+				one.stages.push_back(schedule.stages[k]);
+				MSD::Schedule::Stage &stage = one.stages.back();
+				if (k % 2 == 0 && (k == 0 || stage.reset != MSD::Schedule::NOOP)) {
+					msd.set_kT(stage.kT);
+					if (library->warmStart(msd))
+						stage.reset = MSD::Schedule::NOOP;
+				}
+				one.onStageEnd = [&](size_t) { schedule.onStageEnd(k); };
+				msd.run(one);
+				if (k % 2 == 0)
+					try {
+						library->store(msd);
+					} catch(runtime_error &ex) {
+						cerr << "Warning: " << ex.what() << '\n';
+					}
+			}
+		if (cache)
+			try {
+				cache->put(key, rows);
+			} catch(runtime_error &ex) {
+				cerr << "Warning: " << ex.what() << '\n';
+			}
 	} catch(ios::failure &e) {
 		cerr << "Couldn't write to output file \"" << argv[1] << "\": " << e.what() << '\n';
 		return 3;
@@ -9,12 +9,16 @@
  */
 
 #include <fstream>
+#include <iomanip>
 #include <iostream>
+#include <memory>
 #include <sstream>
 #include <string>
 #include <map>
 #include <limits>
 #include "MSD.h"
+#include "ResultCache.h"
+#include "StateLibrary.h"
 
 using namespace std;
 using namespace udc;
@@ -73,7 +77,9 @@ const int
 	INVALID_PARAM_ERR = 2,
 	OUT_FILE_ERR = 4,
 	INPUT_FILE_ERR = 5,
-	INVALID_SEED_ERR = 6;
+	INVALID_SEED_ERR = 6,
+	CACHE_ERR = 7,
+	LIBRARY_ERR = 8;
 
 int main(int argc, char *argv[]) {
 	//get command line argument
@@ -83,7 +89,20 @@ int main(int argc, char *argv[]) {
 		MOL_TYPE = 3,
 		RANDOMIZE = 4,
 		SEED = 5,
-		INPUT_FILE = 6;
+		INPUT_FILE = 6,
+		CACHE_FILE = 7,
+		CACHE_SIZE = 8;
+
+	// optional: start from the nearest equilibrated state in this library (instead of randomizing), and store the last state
+	unique_ptr<StateLibrary> library;
+	try {
+		string libraryFile = StateLibrary::takeOption(argc, argv);
+		if (!libraryFile.empty())
+			library.reset(new StateLibrary(libraryFile));
+	} catch(exception &e) {
+		cerr << e.what() << '\n';
+		return LIBRARY_ERR;
+	}
 
 	if( argc > OUT_FILE ) {
 		ifstream file(argv[OUT_FILE]);
@@ -109,6 +128,10 @@ int main(int argc, char *argv[]) {
 			arg2 = MSD::CONTINUOUS_SPIN_MODEL;
 		else if( s == string("UP_DOWN_MODEL") )
 			arg2 = MSD::UP_DOWN_MODEL;
+		else if( s == string("HEAT_BATH_MODEL") )
+			arg2 = MSD::HEAT_BATH_MODEL;
+		else if( s == string("CONE_MODEL") )
+			arg2 = MSD::CONE_MODEL;
 		else
 			cout << "Unrecognized third argument! Defaulting to 'CONTINUOUS_SPIN_MODEL'.\n";
 	} else
@@ -317,7 +340,36 @@ int main(int argc, char *argv[]) {
 		msd.setSeed(seed);
 	}
 
-	if( argc > RANDOMIZE && string(argv[RANDOMIZE]) != string("0") )
+	// start from the nearest equilibrated state in the library (if any), before the cache key hashes the initial state
+	bool warm = library && library->warmStart(msd);
+
+	// the whole run is cached, by every parameter and the initial state (and the seed, iff customSeed)
+	unique_ptr<ResultCache> cache;
+	ResultCache::Key key = 0;
+	string rows;  // the CSV lines after the headings (for the cache)
+	bool cached = false;
+	if (argc > CACHE_FILE && string(argv[CACHE_FILE]) != "none") {
+		double maxMB = 0;
+		if (argc > CACHE_SIZE)
+			istringstream(argv[CACHE_SIZE]) >> maxMB;
+		try {
+			cache.reset(new ResultCache(argv[CACHE_FILE], static_cast<unsigned long long>(maxMB * 1024 * 1024)));
+		} catch(runtime_error &e) {
+			cerr << e.what() << '\n';
+			return CACHE_ERR;
+		}
+		ostringstream run;
+		run << setprecision(17) << "iterate,randomize=" << (argc > RANDOMIZE ? argv[RANDOMIZE] : "0")
+		    << ",simCount=" << simCount << ",freq=" << freq << (warm ? ",warmStart" : "");
+		for (auto const &s : spins)
+			run << ",[" << s.x << ' ' << s.y << ' ' << s.z << "]=" << s.norm;
+		key = ResultCache::key(msd, run.str(), customSeed);
+		cached = cache->get(key, rows);
+	}
+
+	if (warm)
+		cout << "Starting from the nearest state in the library: " << library->getPath() << '\n';
+	else if( argc > RANDOMIZE && string(argv[RANDOMIZE]) != string("0") )
 		msd.randomize(!customSeed);  // TODO: arg should just be false always, right?
 
 	try {
@@ -391,6 +443,12 @@ int main(int argc, char *argv[]) {
 			 << ",,msd_version = " << UDC_MSD_VERSION
 			 << '\n';
 	
+		if (cached) {
+			cout << "Loaded the results from the cache: " << argv[CACHE_FILE] << '\n';
+			file << rows;
+			return 0;
+		}
+
 		//run simulations
 		cout << "Starting simulation...\n";
 		for (auto const &s : spins) {
@@ -405,9 +463,16 @@ int main(int argc, char *argv[]) {
 			}
 		}
 		msd.metropolis(simCount, freq);
+		if (library)
+			try {
+				library->store(msd);
+			} catch(runtime_error &e) {
+				cerr << "Warning: " << e.what() << '\n';
+			}
 	
 		//print stability info
 		cout << "Saving data...\n";
+		ostringstream out;
 		
 		MSD::Iterator msdIter = msd.begin();
 		
@@ -429,17 +494,17 @@ int main(int argc, char *argv[]) {
 		auto printMMT = [&](size_t padding) {
 			if (mmtLine >= 0) {
 				while (padding-- > 0)
-					file << ",,,,,,,,,,,";  // padding for missing MSD snapshot or data section(s)
-				file << ",,,";
+					out << ",,,,,,,,,,,";  // padding for missing MSD snapshot or data section(s)
+				out << ",,,";
 
 				if (mmtLine == 0) {
 					// Node-count header
-					file << "Nodes:," << nodes.size();
+					out << "Nodes:," << nodes.size();
 				
 				} else if (mmtLine - 1 < nodesSize) {
 					// Node parameters
 					auto nP = nodeIter.getParameters();
-					file << ",Sm=" << nP.Sm << ",Fm=" << nP.Fm << ",Je0m=" << nP.Je0m
+					out << ",Sm=" << nP.Sm << ",Fm=" << nP.Fm << ",Je0m=" << nP.Je0m
 					     << ",\"Am=" << nP.Am.x << ',' << nP.Am.y << ',' << nP.Am.z << '"';
 					++nodeIter;
 				
@@ -448,12 +513,12 @@ int main(int argc, char *argv[]) {
 					
 				} else if (mmtLine == 1 + nodesSize + 1) {
 					// Egde-count header
-					file << "Edges:," << uniqueEdges.size();
+					out << "Edges:," << uniqueEdges.size();
 				
 				} else if (mmtLine - 1 - nodesSize - 1 < uniqueEdgesSize) {
 					// Edge info
 					auto eP = edgeIter->getParameters();
-					file << ",Jm=" << eP.Jm << ",Je1m=" << eP.Je1m << ",Jeem=" << eP.Jeem << ",bm=" << eP.bm
+					out << ",Jm=" << eP.Jm << ",Je1m=" << eP.Je1m << ",Jeem=" << eP.Jeem << ",bm=" << eP.bm
 						<< ",\"Dm=" << eP.Dm.x << ',' << eP.Dm.y << ',' << eP.Dm.z << '"'
 						<< ",srcNode=" << edgeIter->src() << ",destNode=" << edgeIter->dest();
 					++edgeIter;
@@ -463,11 +528,11 @@ int main(int argc, char *argv[]) {
 					
 				} else if (mmtLine == 1 + nodesSize + 1 + 1 + uniqueEdgesSize + 1) {
 					// Left lead
-					file << "Left Lead:," << molProto.getLeftLead();
+					out << "Left Lead:," << molProto.getLeftLead();
 				
 				} else if (mmtLine == 1 + nodesSize + 1 + 1 + uniqueEdgesSize + 2) {
 					// Right lead
-					file << "Right Lead:," << molProto.getRightLead();
+					out << "Right Lead:," << molProto.getRightLead();
 				
 				}
 			}
@@ -476,7 +541,7 @@ int main(int argc, char *argv[]) {
 		};
 
 		for( auto iter = msd.record.begin(); iter != msd.record.end(); iter++ ) {
-			file << iter->t << ",,"
+			out << iter->t << ",,"
 			     << iter->M.x  << ',' << iter->M.y  << ',' << iter->M.z  << ',' << iter->M.norm()  << ',' << iter->M.theta()  << ',' << iter->M.phi()  << ",,"
 				 << iter->ML.x << ',' << iter->ML.y << ',' << iter->ML.z << ',' << iter->ML.norm() << ',' << iter->ML.theta() << ',' << iter->ML.phi() << ",,"
 				 << iter->MR.x << ',' << iter->MR.y << ',' << iter->MR.z << ',' << iter->MR.norm() << ',' << iter->MR.theta() << ',' << iter->MR.phi() << ",,"
@@ -492,7 +557,7 @@ int main(int argc, char *argv[]) {
 			     << iter->U << ',' << iter->UL << ',' << iter->UR << ',' << iter->Um << ',' << iter->UmL << ',' << iter->UmR << ',' << iter->ULR << ",,,";
 			if( msdIter != msd.end() ) {
 				Vector m = msdIter.getLocalM(), s = msdIter.getSpin(), f = msdIter.getFlux();
-				file << msdIter.getX() << ',' << msdIter.getY() << ',' << msdIter.getZ() << ','
+				out << msdIter.getX() << ',' << msdIter.getY() << ',' << msdIter.getZ() << ','
 				     << m.x << ',' << m.y << ',' << m.z << ','
 					 << s.x << ',' << s.y << ',' << s.z << ','
 					 << f.x << ',' << f.y << ',' << f.z;
@@ -501,23 +566,30 @@ int main(int argc, char *argv[]) {
 			if (notDonePrintingMMT())
 				printMMT(msdIter == msd.end() ? 11 : 0);
 
-			file << '\n';
+			out << '\n';
 		}
 		for( ; msdIter != msd.end(); ++msdIter ) {
 			Vector m = msdIter.getLocalM(), s = msdIter.getSpin(), f = msdIter.getFlux();
-			file << ",, ,,,,,,, ,,,,,,, ,,,,,,, ,,,,,,, ,,,,,,, ,,,,,,, ,,,,,,, ,,,,,,, ,,,,,,, ,,,,,,, ,,,,,,, ,,,,,,, ,,,,,,,,,"
+			out << ",, ,,,,,,, ,,,,,,, ,,,,,,, ,,,,,,, ,,,,,,, ,,,,,,, ,,,,,,, ,,,,,,, ,,,,,,, ,,,,,,, ,,,,,,, ,,,,,,, ,,,,,,,,,"
 			     << msdIter.getX() << ',' << msdIter.getY() << ',' << msdIter.getZ() << ','
 			     << m.x << ',' << m.y << ',' << m.z << ','
 			     << s.x << ',' << s.y << ',' << s.z << ','
 			     << f.x << ',' << f.y << ',' << f.z;
 			if (notDonePrintingMMT())
 				printMMT(0);
-			file << '\n';
+			out << '\n';
 		}
 		while(notDonePrintingMMT()) {
 			printMMT(95 + 11);
-			file << '\n';
+			out << '\n';
 		}
+		file << out.str();
+		if (cache)
+			try {
+				cache->put(key, out.str());
+			} catch(runtime_error &e) {
+				cerr << "Warning: " << e.what() << '\n';
+			}
 			
 	} catch(const ios::failure &e) {
 		cerr << "Couldn't write to output file \"" << argv[1] << "\": " << e.what() << '\n';
@@ -11,7 +11,9 @@
 #include <fstream>
 #include <iostream>
 #include <string>
+#include "AdaptiveField.h"
 #include "MSD.h"
+#include "Replicas.h"
 
 using namespace std;
 using namespace udc;
@@ -58,6 +60,10 @@ int main(int argc, char *argv[]) {
 			arg2 = MSD::CONTINUOUS_SPIN_MODEL;
 		else if( s == string("UP_DOWN_MODEL") )
 			arg2 = MSD::UP_DOWN_MODEL;
+		else if( s == string("HEAT_BATH_MODEL") )
+			arg2 = MSD::HEAT_BATH_MODEL;
+		else if( s == string("CONE_MODEL") )
+			arg2 = MSD::CONE_MODEL;
 		else
 			cout << "Unrecognized third argument! Defaulting to 'CONTINUOUS_SPIN_MODEL'.\n";
 	} else
@@ -98,6 +104,36 @@ int main(int argc, char *argv[]) {
 	} else
 		cout << "Defaulting to 'LINEAR'.\n";
 	
+	unsigned int replicas = 1;  // run this many replicas of the loop at once, and write their means and standard errors
+	bool forkStart = true;  // start the replicas from one equilibrated state, or initialize each one independently
+	if (argc > 5) {
+		replicas = static_cast<unsigned int>(atoi(argv[5]));
+		if (replicas == 0) {
+			cerr << "REPLICAS must be at least 1!\n";
+			return 2;
+		}
+	}
+	if (argc > 6) {
+		string s(argv[6]);
+		if (s == "independent")
+			forkStart = false;
+		else if (s != "fork")
+			cout << "Unrecognized seventh argument! Defaulting to 'fork'.\n";
+	}
+	
+	bool adaptive = false;  // adapt the step in B to the loop (see: AdaptiveFieldSweep), instead of always using B_inc
+	if (argc > 7) {
+		string s(argv[7]);
+		if (s == "adaptive")
+			adaptive = true;
+		else if (s != "uniform")
+			cout << "Unrecognized eighth argument! Defaulting to 'uniform'.\n";
+	}
+	if (adaptive && replicas > 1) {
+		cerr << "Adaptive steps can only be used with 1 replica!\n";
+		return 2;
+	}
+	
 	ofstream file(argv[1]);
 	file.exceptions( ios::badbit | ios::failbit );
 	
@@ -105,6 +141,8 @@ int main(int argc, char *argv[]) {
 	unsigned int width, height, depth, molPosL, molPosR, topL, bottomL, frontR, backR;
 	unsigned long long t_eq, simCount, freq;
 	double B_min, B_max, B_inc, B_theta, B_phi;
+	double B_inc_min = 0, B_inc_max = 0, dm = 0;  // iff adaptive
+	unsigned long long budget = 0;  // iff adaptive
 	MSD::Parameters p;
 	Molecule::NodeParameters p_node;
 	Molecule::EdgeParameters p_edge;
@@ -139,6 +177,12 @@ int main(int argc, char *argv[]) {
 		ask("> B_inc = ", B_inc);
 		ask("> B_theta = ", B_theta);
 		ask("> B_phi = ", B_phi);
+		if (adaptive) {
+			ask("> B_inc_min = ", B_inc_min);
+			ask("> B_inc_max = ", B_inc_max);
+			ask("> dm = ", dm);
+			ask("> budget = ", budget);
+		}
 		cout << '\n';
 		ask("> SL = ", p.SL);
 		ask("> SR = ", p.SR);
@@ -206,7 +250,7 @@ int main(int argc, char *argv[]) {
 	
 	try {
 		//print info/headings
-		file << "B_x,B_y,B_z,B_norm,,"
+		const string columns = "B_x,B_y,B_z,B_norm,,"
 		        "<M>_x,<M>_y,<M>_z,<M>_norm,<M>_theta,<M>_phi,,"
 				"<ML>_x,<ML>_y,<ML>_z,<ML>_norm,<ML>_theta,<ML>_phi,,"
 				"<MR>_x,<MR>_y,<MR>_z,<MR>_norm,<MR>_theta,<MR>_phi,,"
@@ -234,8 +278,11 @@ int main(int argc, char *argv[]) {
 				"MFL_x,MFL_y,MFL_z,MFL_norm,MFL_theta,MFL_phi,,"
 				"MFR_x,MFR_y,MFR_z,MFR_norm,MFR_theta,MFR_phi,,"
 				"MFm_x,MFm_y,MFm_z,MFm_norm,MFm_theta,MFm_phi,,"
-				"U,UL,UR,Um,UmL,UmR,ULR,"
-			    ",width = " << msd.getWidth()
+				"U,UL,UR,Um,UmL,UmR,ULR,";
+		file << columns;
+		if (replicas > 1)
+			file << ',' << Replicas::errorColumns(columns);
+		file << ",width = " << msd.getWidth()
 			 << ",height = " << msd.getHeight()
 			 << ",depth = " << msd.getDepth()
 			 << ",molPosL = " << msd.getMolPosL()
@@ -252,8 +299,13 @@ int main(int argc, char *argv[]) {
 			 << ",B_max = " << B_max
 			 << ",B_inc = " << B_inc
 			 << ",B_theta = " << B_theta
-			 << ",B_phi = " << B_phi
-			 << ",SL = " << p.SL
+			 << ",B_phi = " << B_phi;
+		if (adaptive)
+			file << ",B_inc_min = " << B_inc_min
+				 << ",B_inc_max = " << B_inc_max
+				 << ",dm = " << dm
+				 << ",budget = " << budget;
+		file << ",SL = " << p.SL
 			 << ",SR = " << p.SR;
 		if (!usingMMB)  file << ",Sm = " << p_node.Sm;
 		file << ",FL = " << p.FL
@@ -297,100 +349,119 @@ int main(int argc, char *argv[]) {
 			 << ",\"DLR = " << p.DLR << '"'
 			 << ",molType = " << argv[4]
 			 << ",reset = " << argv[3]
+			 << ",replicas = " << replicas
+			 << ",start = " << (forkStart ? "fork" : "independent")
+			 << ",steps = " << (adaptive ? "adaptive" : "uniform")
 			 << ",seed = " << msd.getSeed()
 			 << ",,msd_version = " << UDC_MSD_VERSION
 			 << '\n';
 
+		if (B_inc <= 0) {
+			cerr << "B_inc <= 0: infinite loop!\n";
+			return 8;
+		}
+		if (adaptive && !(0 < B_inc_min && B_inc_min <= B_inc_max && B_min < B_max)) {
+			cerr << "Adaptive steps require 0 < B_inc_min <= B_inc_max, and B_min < B_max!\n";
+			return 8;
+		}
+		
 		// convert from degrees to radians
 		B_theta *= PI / 180.0;
 		B_phi *= PI / 180.0;
-		Vector dB = Vector::sphericalForm(B_inc, B_theta, B_phi);
+
+		// the values of one line of output (see: columns)
+		auto row = [](const MSD &msd) {
+			auto polar = [](const Vector &v) { return vector<double>{ v.x, v.y, v.z, v.norm(), v.theta(), v.phi() }; };
+			MSD::Results r = msd.getResults();
+			Vector B = msd.getParameters().B;
+			return Replicas::Row{
+				{ B.x, B.y, B.z, B.norm() },
+				polar(msd.meanM()), polar(msd.meanML()), polar(msd.meanMR()), polar(msd.meanMm()),
+				polar(msd.meanMS()), polar(msd.meanMSL()), polar(msd.meanMSR()), polar(msd.meanMSm()),
+				polar(msd.meanMF()), polar(msd.meanMFL()), polar(msd.meanMFR()), polar(msd.meanMFm()),
+				{ msd.meanU(), msd.meanUL(), msd.meanUR(), msd.meanUm(), msd.meanUmL(), msd.meanUmR(), msd.meanULR() },
+				{ msd.specificHeat(), msd.specificHeat_L(), msd.specificHeat_R(), msd.specificHeat_m(),
+				  msd.specificHeat_mL(), msd.specificHeat_mR(), msd.specificHeat_LR() },
+				{ msd.magneticSusceptibility(), msd.magneticSusceptibility_L(),
+				  msd.magneticSusceptibility_R(), msd.magneticSusceptibility_m() },
+				polar(r.M), polar(r.ML), polar(r.MR), polar(r.Mm),
+				polar(r.MS), polar(r.MSL), polar(r.MSR), polar(r.MSm),
+				polar(r.MF), polar(r.MFL), polar(r.MFR), polar(r.MFm),
+				{ r.U, r.UL, r.UR, r.Um, r.UmL, r.UmR, r.ULR } };
+		};
 
 		//run simulations
 		cout << "Starting simulation...\n";
-		
-		auto sim = [&]() {
-			if( arg3 == REINITIALIZE )
-				msd.reinitialize();
-			else if( arg3 == RANDOMIZE )
-				msd.randomize();
-			msd.record.clear();
-			
-			cout << "B = " << p.B << '\n';
-			msd.setB(p.B);
-			msd.metropolis(t_eq);
-			msd.metropolis(simCount, freq);
+		MSD::Schedule schedule;
+		schedule.fieldSteps(B_min, B_max, B_inc, B_theta, B_phi, p.kT, t_eq, simCount, freq,
+				arg3 == REINITIALIZE ? MSD::Schedule::REINITIALIZE : arg3 == RANDOMIZE ? MSD::Schedule::RANDOMIZE : MSD::Schedule::NOOP);
+		if (adaptive) {
+			AdaptiveFieldSweep sweep(B_min, B_max, B_inc, B_theta, B_phi, p.kT, t_eq, simCount, freq,
+					arg3 == REINITIALIZE ? MSD::Schedule::REINITIALIZE : arg3 == RANDOMIZE ? MSD::Schedule::RANDOMIZE : MSD::Schedule::NOOP);
+			sweep.stepMin = B_inc_min;
+			sweep.stepMax = B_inc_max;
+			sweep.dm = dm;
+			if (budget != 0)
+				sweep.budget = budget;
+			sweep.onPoint = [&](const MSD &m, const AdaptiveFieldSweep::Point &pt) {
+				cout << "B = " << m.getParameters().B << " (" << pt.rejected << " rejected)\n";
+				Replicas::write(file, row(m));
+				file << '\n';
+			};
+			sweep.run(msd);
+			cout << sweep.getPoints().size() << " fields (" << sweep.getRejected() << " rejected) in "
+			     << sweep.getSteps() << " steps\n";
+			if (!sweep.isComplete())
+				cout << "Out of budget: the loop stopped at B = " << msd.getParameters().B << "\n";
+		} else if (replicas == 1) {
+			schedule.onStageEnd = [&](size_t stage) {
+				if( stage % 2 == 0 ) {  // equilibrated
+					cout << "B = " << msd.getParameters().B << '\n';
+					return;
+				}
+				cout << "Saving data...\n";
+				Replicas::write(file, row(msd));
+				file << '\n';
+			};
+			msd.run(schedule);
+		} else {
+			Replicas reps([&]() {
+				shared_ptr<MSD> m = make_shared<MSD>(width, height, depth, molType, molPosL, molPosR, topL, bottomL, frontR, backR);
+				m->flippingAlgorithm = arg2;
+				m->setParameters(p);
+				if (usingMMB)
+					m->setMolProto(molProto);
+				else
+					m->setMolParameters(p_node, p_edge);
+				m->setSeed(msd.getSeed());  // replica i uses seed + i
+				return m;
+			}, replicas);
+			reps.stageRow = [&](size_t stage, const MSD &m) { return stage % 2 == 0 ? Replicas::Row() : row(m); };
+			if (forkStart) {
+				// equilibrate one replica at the first B, then copy it into the others
+				MSD::Schedule first;
+				first.stages.push_back(schedule.stages[0]);
+				reps.getReplica(0).run(first);
+				reps.fork(reps.getReplica(0));
+				schedule.stages[0].steps = 0;
+				schedule.stages[0].reset = MSD::Schedule::NOOP;
+			} else
+				reps.randomize();
+			cout << "Running " << replicas << " replicas...\n";
+			reps.run(schedule);
 			
 			cout << "Saving data...\n";
-			MSD::Results r = msd.getResults();
-			Vector avgM   = msd.meanM();
-			Vector avgML  = msd.meanML();
-			Vector avgMR  = msd.meanMR();
-			Vector avgMm  = msd.meanMm();
-			Vector avgMS   = msd.meanMS();
-			Vector avgMSL  = msd.meanMSL();
-			Vector avgMSR  = msd.meanMSR();
-			Vector avgMSm  = msd.meanMSm();
-			Vector avgMF   = msd.meanMF();
-			Vector avgMFL  = msd.meanMFL();
-			Vector avgMFR  = msd.meanMFR();
-			Vector avgMFm  = msd.meanMFm();
-			double avgU   = msd.meanU();
-			double avgUL  = msd.meanUL();
-			double avgUR  = msd.meanUR();
-			double avgUm  = msd.meanUm();
-			double avgUmL = msd.meanUmL();
-			double avgUmR = msd.meanUmR();
-			double avgULR = msd.meanULR();
-			file << p.B.x  << ',' << p.B.y  << ',' << p.B.z  << ',' << p.B.norm() << ",,"
-				 << avgM.x  << ',' << avgM.y  << ',' << avgM.z  << ',' << avgM.norm()  << ',' << avgM.theta()  << ',' << avgM.phi()  << ",,"
-				 << avgML.x << ',' << avgML.y << ',' << avgML.z << ',' << avgML.norm() << ',' << avgML.theta() << ',' << avgML.phi() << ",,"
-				 << avgMR.x << ',' << avgMR.y << ',' << avgMR.z << ',' << avgMR.norm() << ',' << avgMR.theta() << ',' << avgMR.phi() << ",,"
-				 << avgMm.x << ',' << avgMm.y << ',' << avgMm.z << ',' << avgMm.norm() << ',' << avgMm.theta() << ',' << avgMm.phi() << ",,"
-				 << avgMS.x  << ',' << avgMS.y  << ',' << avgMS.z  << ',' << avgMS.norm()  << ',' << avgMS.theta()  << ',' << avgMS.phi()  << ",,"
-				 << avgMSL.x << ',' << avgMSL.y << ',' << avgMSL.z << ',' << avgMSL.norm() << ',' << avgMSL.theta() << ',' << avgMSL.phi() << ",,"
-				 << avgMSR.x << ',' << avgMSR.y << ',' << avgMSR.z << ',' << avgMSR.norm() << ',' << avgMSR.theta() << ',' << avgMSR.phi() << ",,"
-				 << avgMSm.x << ',' << avgMSm.y << ',' << avgMSm.z << ',' << avgMSm.norm() << ',' << avgMSm.theta() << ',' << avgMSm.phi() << ",,"
-				 << avgMF.x  << ',' << avgMF.y  << ',' << avgMF.z  << ',' << avgMF.norm()  << ',' << avgMF.theta()  << ',' << avgMF.phi()  << ",,"
-				 << avgMFL.x << ',' << avgMFL.y << ',' << avgMFL.z << ',' << avgMFL.norm() << ',' << avgMFL.theta() << ',' << avgMFL.phi() << ",,"
-				 << avgMFR.x << ',' << avgMFR.y << ',' << avgMFR.z << ',' << avgMFR.norm() << ',' << avgMFR.theta() << ',' << avgMFR.phi() << ",,"
-				 << avgMFm.x << ',' << avgMFm.y << ',' << avgMFm.z << ',' << avgMFm.norm() << ',' << avgMFm.theta() << ',' << avgMFm.phi() << ",,"
-				 << avgU << ',' << avgUL << ',' << avgUR << ',' << avgUm << ',' << avgUmL << ',' << avgUmR << ',' << avgULR << ",,"
-				 << msd.specificHeat()    << ',' << msd.specificHeat_L()  << ',' << msd.specificHeat_R()  << ',' << msd.specificHeat_m() << ','
-				 << msd.specificHeat_mL() << ',' << msd.specificHeat_mR() << ',' << msd.specificHeat_LR() << ",,"
-				 << msd.magneticSusceptibility()   << ',' << msd.magneticSusceptibility_L() << ','
-				 << msd.magneticSusceptibility_R() << ',' << msd.magneticSusceptibility_m() << ",,"
-				 << r.M.x  << ',' << r.M.y  << ',' << r.M.z  << ',' << r.M.norm()  << ',' << r.M.theta()  << ',' << r.M.phi()  << ",,"
-				 << r.ML.x << ',' << r.ML.y << ',' << r.ML.z << ',' << r.ML.norm() << ',' << r.ML.theta() << ',' << r.ML.phi() << ",,"
-				 << r.MR.x << ',' << r.MR.y << ',' << r.MR.z << ',' << r.MR.norm() << ',' << r.MR.theta() << ',' << r.MR.phi() << ",,"
-				 << r.Mm.x << ',' << r.Mm.y << ',' << r.Mm.z << ',' << r.Mm.norm() << ',' << r.Mm.theta() << ',' << r.Mm.phi() << ",,"
-				 << r.MS.x  << ',' << r.MS.y  << ',' << r.MS.z  << ',' << r.MS.norm()  << ',' << r.MS.theta()  << ',' << r.MS.phi()  << ",,"
-				 << r.MSL.x << ',' << r.MSL.y << ',' << r.MSL.z << ',' << r.MSL.norm() << ',' << r.MSL.theta() << ',' << r.MSL.phi() << ",,"
-				 << r.MSR.x << ',' << r.MSR.y << ',' << r.MSR.z << ',' << r.MSR.norm() << ',' << r.MSR.theta() << ',' << r.MSR.phi() << ",,"
-				 << r.MSm.x << ',' << r.MSm.y << ',' << r.MSm.z << ',' << r.MSm.norm() << ',' << r.MSm.theta() << ',' << r.MSm.phi() << ",,"
-				 << r.MF.x  << ',' << r.MF.y  << ',' << r.MF.z  << ',' << r.MF.norm()  << ',' << r.MF.theta()  << ',' << r.MF.phi()  << ",,"
-				 << r.MFL.x << ',' << r.MFL.y << ',' << r.MFL.z << ',' << r.MFL.norm() << ',' << r.MFL.theta() << ',' << r.MFL.phi() << ",,"
-				 << r.MFR.x << ',' << r.MFR.y << ',' << r.MFR.z << ',' << r.MFR.norm() << ',' << r.MFR.theta() << ',' << r.MFR.phi() << ",,"
-				 << r.MFm.x << ',' << r.MFm.y << ',' << r.MFm.z << ',' << r.MFm.norm() << ',' << r.MFm.theta() << ',' << r.MFm.phi() << ",,"
-				 << r.U << ',' << r.UL << ',' << r.UR << ',' << r.Um << ',' << r.UmL << ',' << r.UmR << ',' << r.ULR << '\n';
-		};
-
-		if (B_inc <= 0) {
-			cerr << "B_inc <= 0: infinite loop!\n";
-			return 8;
-		}
-		
-		p.B = Vector::sphericalForm(B_max, B_theta, B_phi);
-		for( double rho = B_max; rho > B_min; rho -= B_inc ) {
-			sim();
-			p.B -= dB;
-		}
-		
-		double B_max2 = B_max + B_inc / 2;  // to correct for floating point errors
-		p.B = Vector::sphericalForm(B_min, B_theta, B_phi);
-		for( double rho = B_min; rho <= B_max2; rho += B_inc ) {
-			sim();
-			p.B += dB;
+			for (const Replicas::Summary &s : reps.getRows()) {
+				Replicas::write(file, s.mean);
+				file << ",,";
+				Replicas::write(file, s.stdError);
+				file << '\n';
+			}
+			Replicas::Summary loop = reps.hysteresis(Vector::sphericalForm(1, B_theta, B_phi), 0, 1);  // B and <M>
+			cout << "Coercive field (B decreasing) = " << loop.mean[0][0] << " +/- " << loop.stdError[0][0] << '\n'
+			     << "Coercive field (B increasing) = " << loop.mean[0][1] << " +/- " << loop.stdError[0][1] << '\n'
+			     << "Remanence (B decreasing) = " << loop.mean[0][2] << " +/- " << loop.stdError[0][2] << '\n'
+			     << "Remanence (B increasing) = " << loop.mean[0][3] << " +/- " << loop.stdError[0][3] << '\n';
 		}
 		
 	} catch(ios::failure &e) {
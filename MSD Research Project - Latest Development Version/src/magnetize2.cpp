@@ -11,6 +11,7 @@
 #include <iostream>
 #include <string>
 #include "MSD.h"
+#include "Replicas.h"
 
 using namespace std;
 using namespace udc;
@@ -53,6 +54,10 @@ int main(int argc, char *argv[]) {
 			arg2 = MSD::CONTINUOUS_SPIN_MODEL;
 		else if( s == string("UP_DOWN_MODEL") )
 			arg2 = MSD::UP_DOWN_MODEL;
+		else if( s == string("HEAT_BATH_MODEL") )
+			arg2 = MSD::HEAT_BATH_MODEL;
+		else if( s == string("CONE_MODEL") )
+			arg2 = MSD::CONE_MODEL;
 		else
 			cout << "Unrecognized third argument! Defaulting to 'CONTINUOUS_SPIN_MODEL'.\n";
 	} else
@@ -79,6 +84,23 @@ int main(int argc, char *argv[]) {
 	} else
 		cout << "Defaulting to 'LINEAR'.\n";
 	
+	unsigned int replicas = 1;  // run this many replicas of the loop at once, and write their means and standard errors
+	bool forkStart = true;  // start the replicas from one equilibrated state, or initialize each one independently
+	if (argc > 6) {
+		replicas = static_cast<unsigned int>(atoi(argv[6]));
+		if (replicas == 0) {
+			cerr << "REPLICAS must be at least 1!\n";
+			return 2;
+		}
+	}
+	if (argc > 7) {
+		string s(argv[7]);
+		if (s == "independent")
+			forkStart = false;
+		else if (s != "fork")
+			cout << "Unrecognized eighth argument! Defaulting to 'fork'.\n";
+	}
+	
 	ofstream file(argv[1]);
 	file.exceptions( ios::badbit | ios::failbit );
 	
@@ -186,7 +208,7 @@ int main(int argc, char *argv[]) {
 	
 	try {
 		//print info/headings
-		file << "B_x,B_y,B_z,B_norm,,"
+		const string columns = "B_x,B_y,B_z,B_norm,,"
 				"M_x,M_y,M_z,M_norm,M_theta,M_phi,,"
 				"ML_x,ML_y,ML_z,ML_norm,ML_theta,ML_phi,,"
 				"MR_x,MR_y,MR_z,MR_norm,MR_theta,MR_phi,,"
@@ -199,8 +221,11 @@ int main(int argc, char *argv[]) {
 				"MFL_x,MFL_y,MFL_z,MFL_norm,MFL_theta,MFL_phi,,"
 				"MFR_x,MFR_y,MFR_z,MFR_norm,MFR_theta,MFR_phi,,"
 				"MFm_x,MFm_y,MFm_z,MFm_norm,MFm_theta,MFm_phi,,"
-				"U,UL,UR,Um,UmL,UmR,ULR,"
-			    ",width = " << msd.getWidth()
+				"U,UL,UR,Um,UmL,UmR,ULR,";
+		file << columns;
+		if (replicas > 1)
+			file << ',' << Replicas::errorColumns(columns);
+		file << ",width = " << msd.getWidth()
 			 << ",height = " << msd.getHeight()
 			 << ",depth = " << msd.getDepth()
 			 << ",molPosL = " << msd.getMolPosL()
@@ -262,86 +287,93 @@ int main(int argc, char *argv[]) {
 			 << ",molType = " << argv[5]
 			 << ",randomize = " << argv[3]
 			 << ",startWithMaxB = " << argv[4]
+			 << ",replicas = " << replicas
+			 << ",start = " << (forkStart ? "fork" : "independent")
 			 << ",seed = " << msd.getSeed()
 			 << ",,msd_version = " << UDC_MSD_VERSION
 			 << '\n';
 		
+		if (B_rate <= 0) {
+			cerr << "B_rate <= 0: infinite loop!\n";
+			return 8;
+		}
+		
 		// convert from degrees to radians
 		B_theta *= PI / 180.0;
 		B_phi *= PI / 180.0;
-		Vector dB = Vector::sphericalForm(B_rate, B_theta, B_phi);
 
-		// define some lambda functions
-		auto recordResults = [&]() {
-			cout << "B = " << p.B << "; |B| = " << p.B.norm() << '\n';
-			cout << "Saving data...\n";
-			
-			MSD::Results r = msd.getResults();
-			file << p.B.x  << ',' << p.B.y  << ',' << p.B.z  << ',' << p.B.norm()  << ",,"
-				 << r.M.x  << ',' << r.M.y  << ',' << r.M.z  << ',' << r.M.norm()  << ',' << r.M.theta()  << ',' << r.M.phi()  << ",,"
-				 << r.ML.x << ',' << r.ML.y << ',' << r.ML.z << ',' << r.ML.norm() << ',' << r.ML.theta() << ',' << r.ML.phi() << ",,"
-				 << r.MR.x << ',' << r.MR.y << ',' << r.MR.z << ',' << r.MR.norm() << ',' << r.MR.theta() << ',' << r.MR.phi() << ",,"
-				 << r.Mm.x << ',' << r.Mm.y << ',' << r.Mm.z << ',' << r.Mm.norm() << ',' << r.Mm.theta() << ',' << r.Mm.phi() << ",,"
-				 << r.MS.x  << ',' << r.MS.y  << ',' << r.MS.z  << ',' << r.MS.norm()  << ',' << r.MS.theta()  << ',' << r.MS.phi()  << ",,"
-				 << r.MSL.x << ',' << r.MSL.y << ',' << r.MSL.z << ',' << r.MSL.norm() << ',' << r.MSL.theta() << ',' << r.MSL.phi() << ",,"
-				 << r.MSR.x << ',' << r.MSR.y << ',' << r.MSR.z << ',' << r.MSR.norm() << ',' << r.MSR.theta() << ',' << r.MSR.phi() << ",,"
-				 << r.MSm.x << ',' << r.MSm.y << ',' << r.MSm.z << ',' << r.MSm.norm() << ',' << r.MSm.theta() << ',' << r.MSm.phi() << ",,"
-				 << r.MF.x  << ',' << r.MF.y  << ',' << r.MF.z  << ',' << r.MF.norm()  << ',' << r.MF.theta()  << ',' << r.MF.phi()  << ",,"
-				 << r.MFL.x << ',' << r.MFL.y << ',' << r.MFL.z << ',' << r.MFL.norm() << ',' << r.MFL.theta() << ',' << r.MFL.phi() << ",,"
-				 << r.MFR.x << ',' << r.MFR.y << ',' << r.MFR.z << ',' << r.MFR.norm() << ',' << r.MFR.theta() << ',' << r.MFR.phi() << ",,"
-				 << r.MFm.x << ',' << r.MFm.y << ',' << r.MFm.z << ',' << r.MFm.norm() << ',' << r.MFm.theta() << ',' << r.MFm.phi() << ",,"
-				 << r.U << ',' << r.UL << ',' << r.UR << ',' << r.Um << ',' << r.UmL << ',' << r.UmR << ',' << r.ULR << '\n';
-		};
-		
-		unsigned long long simCount = 0L;
-		auto sim = [&]() {
-			msd.setB(p.B);
-			msd.metropolis(1);
-			
-			if( ++simCount == freq ) {
-				recordResults();
-				simCount = 0;
-			}
+		MSD::Schedule schedule;
+		schedule.hold(t_eq, p.kT, p.B);  // running to equilibrium
+		if( !(argc > 4 && string(argv[4]) != string("0")) )
+			schedule.fieldRamp(0, B_max, B_rate, B_theta, B_phi, p.kT, freq);  // running B from 0 to B_max
+		schedule.fieldRamp(B_max, B_min, B_rate, B_theta, B_phi, p.kT, freq);  // running B from B_max to B_min
+		schedule.fieldRamp(B_min, B_max, B_rate, B_theta, B_phi, p.kT, freq);  // running B from B_min to B_max
+		bool randomize = argc > 3 && string(argv[3]) != string("0");
+
+		// the values of one line of output (see: columns)
+		auto row = [](const MSD &msd, const MSD::Results &r) {
+			auto polar = [](const Vector &v) { return vector<double>{ v.x, v.y, v.z, v.norm(), v.theta(), v.phi() }; };
+			Vector B = msd.getParameters().B;
+			return Replicas::Row{
+				{ B.x, B.y, B.z, B.norm() },
+				polar(r.M), polar(r.ML), polar(r.MR), polar(r.Mm),
+				polar(r.MS), polar(r.MSL), polar(r.MSR), polar(r.MSm),
+				polar(r.MF), polar(r.MFL), polar(r.MFR), polar(r.MFm),
+				{ r.U, r.UL, r.UR, r.Um, r.UmL, r.UmR, r.ULR } };
 		};
 
 		//run simulations
 		cout << "Starting simulation...\n";
-		if( argc > 3 && string(argv[3]) != string("0") )
-			msd.randomize();
-		
-		if (B_rate <= 0) {
-			cerr << "B_rate <= 0: infinite loop!\n";
-			return 8;
-		}
-		
-		// running to equilibrium
-		msd.metropolis(t_eq);
-		simCount = freq - 1; // record after next sim
-		
-		if( !(argc > 4 && string(argv[4]) != string("0")) ) {
-			// running B from 0 to B_max
-			p.B = Vector::ZERO;
-			for( double rho = 0; rho < B_max; rho += B_rate ) {
-				sim();
-				p.B += dB;
+		if (replicas == 1) {
+			schedule.onRecord = [&](size_t, const MSD::Results &r) {
+				Vector B = msd.getParameters().B;
+				cout << "B = " << B << "; |B| = " << B.norm() << '\n';
+				cout << "Saving data...\n";
+				Replicas::write(file, row(msd, r));
+				file << '\n';
+			};
+			if (randomize)
+				msd.randomize();
+			msd.run(schedule);
+		} else {
+			Replicas reps([&]() {
+				shared_ptr<MSD> m = make_shared<MSD>(width, height, depth, molType, molPosL, molPosR, topL, bottomL, frontR, backR);
+				m->flippingAlgorithm = arg2;
+				m->setParameters(p);
+				if (usingMMB)
+					m->setMolProto(molProto);
+				else
+					m->setMolParameters(p_node, p_edge);
+				m->setSeed(msd.getSeed());  // replica i uses seed + i
+				return m;
+			}, replicas);
+			reps.recordRow = [&](size_t, const MSD &m, const MSD::Results &r) { return row(m, r); };
+			if (forkStart) {
+				// equilibrate one replica, then copy it into the others
+				MSD::Schedule first;
+				first.stages.push_back(schedule.stages[0]);
+				if (randomize)
+					reps.getReplica(0).randomize();
+				reps.getReplica(0).run(first);
+				reps.fork(reps.getReplica(0));
+				schedule.stages[0].steps = 0;
+			} else if (randomize)
+				reps.randomize();
+			cout << "Running " << replicas << " replicas...\n";
+			reps.run(schedule);
+			
+			cout << "Saving data...\n";
+			for (const Replicas::Summary &s : reps.getRows()) {
+				Replicas::write(file, s.mean);
+				file << ",,";
+				Replicas::write(file, s.stdError);
+				file << '\n';
 			}
-			simCount = freq - 1;
-		}
-		
-		// running B from B_max to B_min
-		p.B = Vector::sphericalForm(B_max, B_theta, B_phi);
-		for( double rho = B_max; rho > B_min; rho -= B_rate ) {
-			sim();
-			p.B -= dB;
-		}
-		simCount = freq - 1;
-		
-		// running B from B_min to B_max
-		double B_max2 = B_max + B_rate / 2;  // to correct for floating point errors
-		p.B = Vector::sphericalForm(B_min, B_theta, B_phi);
-		for( double rho = B_min; rho <= B_max2; rho += B_rate ) {
-			sim();
-			p.B += dB;
+			Replicas::Summary loop = reps.hysteresis(Vector::sphericalForm(1, B_theta, B_phi), 0, 1);  // B and M
+			cout << "Coercive field (B decreasing) = " << loop.mean[0][0] << " +/- " << loop.stdError[0][0] << '\n'
+			     << "Coercive field (B increasing) = " << loop.mean[0][1] << " +/- " << loop.stdError[0][1] << '\n'
+			     << "Remanence (B decreasing) = " << loop.mean[0][2] << " +/- " << loop.stdError[0][2] << '\n'
+			     << "Remanence (B increasing) = " << loop.mean[0][3] << " +/- " << loop.stdError[0][3] << '\n';
 		}
 		
 	} catch(ios::failure &e) {
@@ -7,6 +7,8 @@
  * @copyright Copyright (c) 2023
  */
 
+#include <algorithm>
+#include <cmath>
 #include <cstdlib>
 #include <ctime>
 #include <fstream>
@@ -14,6 +16,7 @@
 #include <iomanip>
 #include <iostream>
 #include <map>
+#include <memory>
 #include <set>
 #include <sstream>
 #include <stdexcept>
@@ -23,6 +26,9 @@
 #include "rapidxml.hpp"
 #include "rapidxml_print.hpp"
 #include "MSD.h"
+#include "ResultCache.h"
+#include "StateLibrary.h"
+#include "SweepDesign.h"
 
 
 using namespace std;
@@ -72,6 +78,13 @@ struct Atom {
 	Vector spin, flux, mag;
 };
 
+// couplings reported by the optional "couplingDerivatives" parameter
+const char * const COUPLING_NAMES[] = { "JL", "JR", "Jm", "JmL", "JmR", "JLR" };
+const MSD::Coupling COUPLINGS[] = {
+	&MSD::CouplingEnergies::JL, &MSD::CouplingEnergies::JR, &MSD::CouplingEnergies::Jm,
+	&MSD::CouplingEnergies::JmL, &MSD::CouplingEnergies::JmR, &MSD::CouplingEnergies::JLR };
+const unsigned int COUPLING_COUNT = sizeof(COUPLINGS) / sizeof(COUPLINGS[0]);
+
 struct Spin {
 	unsigned int x, y, z;
 	double norm;
@@ -83,6 +96,17 @@ struct Info {
 	unsigned int topL, bottomL, frontR, backR;
 	vector<Spin> spins;
 	unsigned long long t_eq, simCount, freq;
+	unsigned long long clusterFreq;  // optional: 0 (no cluster moves) if not given
+	unsigned int overrelaxRatio;  // optional: 0 (no over-relaxation) if not given
+	double weightL, weightR, weight_m;  // optional: 1 if not given. See: MSD::setRegionWeights
+	unsigned long long macrospinFreq;  // optional: 0 (every FM atom is simulated) if not given
+	MSD::SweepMode sweepMode;  // optional: RANDOM_SITE if not given
+	unsigned int blockSize;  // optional: 4 if not given. Only used with BLOCKED sweepMode
+	MSD::SiteOrder siteOrder;  // optional: ROW_MAJOR if not given
+	unsigned int periodicL, periodicR;  // optional: OPEN if not given. See: MSD::setPeriodic
+	double targetAcceptance;  // optional: 0.5 if not given. Only used with CONE_MODEL
+	bool nFoldWay;  // optional: false if not given. Only used with UP_DOWN_MODEL and RANDOM_SITE sweepMode
+	bool couplingDerivatives;  // optional: false if not given
 	MSD::FlippingAlgorithm flippingAlgorithm;
 	ARG4 initMode;
 	MSD::Parameters parameters;
@@ -96,13 +120,183 @@ struct Info {
 	MSD::Results results;
 	double c, cL, cR, cm, cmL, cmR, cLR;
 	double x, xL, xR, xm;
+	double acceptL, acceptR, acceptm;  // acceptance rates after t_eq
+	MSD::ProposalSteps proposalSteps;
+	double dU[COUPLING_COUNT];  // d<U>/dJ for each of COUPLINGS; iff couplingDerivatives
+	Vector dM[COUPLING_COUNT];  // d<M>/dJ (see above)
 	vector<Atom> atoms;
+
+	int level;  // -1 for grid sweeps; otherwise 0 for coarse grid or design points, or the refinement level (see: LineRefiner)
+	ResultCache *cache;  // optional: NULL if the parameters file has no "cache"
+	bool cached;  // were the results loaded from the cache (instead of simulated)?
+	StateLibrary *library;  // optional: NULL without --warm-start-from-library
+	double warmDistance;  // distance to the library state it started from, or infinity if there was none (iff library)
 };
 
+// observables which adaptive refinement can follow ("refine" in the parameters file); returns false if there's no such name
+bool observable(const Info &info, const string &name, double &value) {
+	const map<string, double> scalars = {
+		{ "U", info.results.U }, { "UL", info.results.UL }, { "UR", info.results.UR }, { "Um", info.results.Um },
+		{ "UmL", info.results.UmL }, { "UmR", info.results.UmR }, { "ULR", info.results.ULR },
+		{ "c", info.c }, { "cL", info.cL }, { "cR", info.cR }, { "cm", info.cm },
+		{ "cmL", info.cmL }, { "cmR", info.cmR }, { "cLR", info.cLR },
+		{ "x", info.x }, { "xL", info.xL }, { "xR", info.xR }, { "xm", info.xm } };
+	const map<string, Vector> vectors = {
+		{ "M", info.results.M }, { "ML", info.results.ML }, { "MR", info.results.MR }, { "Mm", info.results.Mm },
+		{ "MS", info.results.MS }, { "MSL", info.results.MSL }, { "MSR", info.results.MSR }, { "MSm", info.results.MSm },
+		{ "MF", info.results.MF }, { "MFL", info.results.MFL }, { "MFR", info.results.MFR }, { "MFm", info.results.MFm } };
+	auto s = scalars.find(name);
+	if (s != scalars.end()) {
+		value = s->second;
+		return true;
+	}
+	// vectors, e.g. "M" (norm), "M_x", "M_y", or "M_z"
+	size_t under = name.find('_');
+	auto v = vectors.find(name.substr(0, under));
+	if (v == vectors.end())
+		return false;
+	string component = under == string::npos ? "" : name.substr(under + 1);
+	if (component == "")
+		value = v->second.norm();
+	else if (component == "x")
+		value = v->second.x;
+	else if (component == "y")
+		value = v->second.y;
+	else if (component == "z")
+		value = v->second.z;
+	else
+		return false;
+	return true;
+}
+
+// maps parameter names to pointers to the Info::parameters (or node/edge parameters) fields of "info"
+map<string, double*> fieldMap(Info &info) {
+	map<string, double*> fields;  // map of parameter names to pointers to Info::parameters fields
+	
+	fields["kT"] = &info.parameters.kT;
+	
+	fields["B_x"] = &info.parameters.B.x;
+	fields["B_y"] = &info.parameters.B.y;
+	fields["B_z"] = &info.parameters.B.z;
+	
+	fields["SL"] = &info.parameters.SL;
+	fields["SR"] = &info.parameters.SR;
+	fields["Sm"] = &info.nodeParameters.Sm ;
+	fields["FL"] = &info.parameters.FL;
+	fields["FR"] = &info.parameters.FR;
+	fields["Fm"] = &info.nodeParameters.Fm;
+	
+	fields["JL"] = &info.parameters.JL;
+	fields["JR"] = &info.parameters.JR;
+	fields["Jm"] = &info.edgeParameters.Jm;
+	fields["JmL"] = &info.parameters.JmL;
+	fields["JmR"] = &info.parameters.JmR;
+	fields["JLR"] = &info.parameters.JLR;
+
+	fields["Je0L"] = &info.parameters.Je0L;
+	fields["Je0R"] = &info.parameters.Je0R;
+	fields["Je0m"] = &info.nodeParameters.Je0m;
+
+	fields["Je1L"] = &info.parameters.Je1L;
+	fields["Je1R"] = &info.parameters.Je1R;
+	fields["Je1m"] = &info.edgeParameters.Je1m ;
+	fields["Je1mL"] = &info.parameters.Je1mL;
+	fields["Je1mR"] = &info.parameters.Je1mR;
+	fields["Je1LR"] = &info.parameters.Je1LR;
+
+	fields["JeeL"] = &info.parameters.JeeL;
+	fields["JeeR"] = &info.parameters.JeeR;
+	fields["Jeem"] = &info.edgeParameters.Jeem;
+	fields["JeemL"] = &info.parameters.JeemL;
+	fields["JeemR"] = &info.parameters.JeemR;
+	fields["JeeLR"] = &info.parameters.JeeLR;
+	
+	fields["bL"] = &info.parameters.bL;
+	fields["bR"] = &info.parameters.bR;
+	fields["bm"] = &info.edgeParameters.bm;
+	fields["bmL"] = &info.parameters.bmL;
+	fields["bmR"] = &info.parameters.bmR;
+	fields["bLR"] = &info.parameters.bLR;
+	
+	fields["AL_x"] = &info.parameters.AL.x;
+	fields["AL_y"] = &info.parameters.AL.y;
+	fields["AL_z"] = &info.parameters.AL.z;
+	
+	fields["AR_x"] = &info.parameters.AR.x;
+	fields["AR_y"] = &info.parameters.AR.y;
+	fields["AR_z"] = &info.parameters.AR.z;
+	
+	fields["Am_x"] = &info.nodeParameters.Am.x;
+	fields["Am_y"] = &info.nodeParameters.Am.y;
+	fields["Am_z"] = &info.nodeParameters.Am.z;
+
+	fields["DL_x"] = &info.parameters.DL.x;
+	fields["DL_y"] = &info.parameters.DL.y;
+	fields["DL_z"] = &info.parameters.DL.z;
+
+	fields["DR_x"] = &info.parameters.DR.x;
+	fields["DR_y"] = &info.parameters.DR.y;
+	fields["DR_z"] = &info.parameters.DR.z;
+
+	fields["Dm_x"] = &info.edgeParameters.Dm.x;
+	fields["Dm_y"] = &info.edgeParameters.Dm.y;
+	fields["Dm_z"] = &info.edgeParameters.Dm.z;
+
+	fields["DmL_x"] = &info.parameters.DmL.x;
+	fields["DmL_y"] = &info.parameters.DmL.y;
+	fields["DmL_z"] = &info.parameters.DmL.z;
+
+	fields["DmR_x"] = &info.parameters.DmR.x;
+	fields["DmR_y"] = &info.parameters.DmR.y;
+	fields["DmR_z"] = &info.parameters.DmR.z;
+
+	fields["DLR_x"] = &info.parameters.DLR.x;
+	fields["DLR_y"] = &info.parameters.DLR.y;
+	fields["DLR_z"] = &info.parameters.DLR.z;
+	
+	return fields;
+}
+
+// the results of an Info, as a ResultCache payload
+string saveResults(const Info &info) {
+	string payload;
+	ResultCache::append(payload, info.results);
+	double values[] = { info.c, info.cL, info.cR, info.cm, info.cmL, info.cmR, info.cLR,
+	                    info.x, info.xL, info.xR, info.xm, info.acceptL, info.acceptR, info.acceptm };
+	ResultCache::append(payload, values);
+	ResultCache::append(payload, info.proposalSteps);
+	ResultCache::append(payload, info.dU);
+	ResultCache::append(payload, info.dM);
+	ResultCache::append(payload, static_cast<uint64_t>(info.atoms.size()));
+	for (const Atom &atom : info.atoms)
+		ResultCache::append(payload, atom);
+	return payload;
+}
+
+// (see above) returns false if the payload is corrupted
+bool loadResults(Info &info, const string &payload) {
+	size_t pos = 0;
+	double values[14];
+	uint64_t atomCount;
+	if (!ResultCache::extract(payload, pos, info.results) || !ResultCache::extract(payload, pos, values)
+			|| !ResultCache::extract(payload, pos, info.proposalSteps) || !ResultCache::extract(payload, pos, info.dU)
+			|| !ResultCache::extract(payload, pos, info.dM) || !ResultCache::extract(payload, pos, atomCount)
+			|| atomCount != (payload.size() - pos) / sizeof(Atom))
+		return false;
+	double *fields[] = { &info.c, &info.cL, &info.cR, &info.cm, &info.cmL, &info.cmR, &info.cLR,
+	                     &info.x, &info.xL, &info.xR, &info.xm, &info.acceptL, &info.acceptR, &info.acceptm };
+	for (unsigned int i = 0; i < 14; i++)
+		*fields[i] = values[i];
+	info.atoms.resize(static_cast<size_t>(atomCount));
+	for (Atom &atom : info.atoms)
+		ResultCache::extract(payload, pos, atom);
+	return true;
+}
+
 Info algorithm(Info info) {
 	MSD msd( info.width, info.height, info.depth,
 			info.molType, info.molPosL, info.molPosR,
-			info.topL, info.bottomL, info.frontR, info.backR );
+			info.topL, info.bottomL, info.frontR, info.backR, info.siteOrder );
 	
 	msd.setParameters(info.parameters);
 	if (info.usingMMB) {
@@ -118,6 +312,19 @@ Info algorithm(Info info) {
 	else
 		msd.setMolParameters(info.nodeParameters, info.edgeParameters);
 	msd.flippingAlgorithm = info.flippingAlgorithm;
+	msd.clusterFreq = info.clusterFreq;
+	msd.overrelaxRatio = info.overrelaxRatio;
+	msd.macrospinFreq = info.macrospinFreq;
+	msd.sweepMode = info.sweepMode;
+	msd.blockSize = info.blockSize;
+	msd.setRegionWeights(info.weightL, info.weightR, info.weight_m);
+	try {
+		msd.setPeriodic(info.periodicL, info.periodicR);
+	} catch(invalid_argument &ex) {
+		cerr << ex.what() << " (periodicL = " << info.periodicL << ", periodicR = " << info.periodicR << ")\n";
+		exit(-11);
+	}
+	msd.recordCouplings = info.couplingDerivatives;
 	
 	for (const Spin &s : info.spins) {  // custom spins
 		try {
@@ -130,10 +337,65 @@ Info algorithm(Info info) {
 		}
 	}
 
-	if (info.initMode == RANDOMIZE)
+	// start from the nearest equilibrated state in the library (if any)
+	info.warmDistance = INFINITY;
+	bool warm = info.library != NULL && info.library->warmStart(msd, &info.warmDistance);
+
+	// look for the results in the cache, by the initial state (after any warm start, but before randomizing) and the
+	// rest of this run
+	ResultCache::Key key = 0;
+	info.cached = false;
+	if (info.cache != NULL) {
+		ostringstream run;
+		run << setprecision(17) << "metropolis," << (info.initMode == RANDOMIZE ? "RANDOMIZE" : "REINITIALIZE")
+		    << ",t_eq=" << info.t_eq << ",simCount=" << info.simCount << ",freq=" << info.freq
+		    << ",targetAcceptance=" << info.targetAcceptance << ",nFoldWay=" << info.nFoldWay
+		    << ",couplingDerivatives=" << info.couplingDerivatives << (warm ? ",warmStart" : "");
+		key = ResultCache::key(msd, run.str());
+		string payload;
+		if (info.cache->get(key, payload) && loadResults(info, payload)) {
+			info.cached = true;
+			return info;
+		}
+	}
+
+	if (!warm && info.initMode == RANDOMIZE)
 		msd.randomize();
-	msd.metropolis( info.t_eq, 0 );
-	msd.metropolis( info.simCount, info.freq );
+	// store this state in the library (if any) after t_eq
+	auto equilibrated = [&]() {
+		if (info.library != NULL)
+			try {
+				info.library->store(msd);
+			} catch(runtime_error &ex) {
+				cerr << "Warning: " << ex.what() << '\n';
+			}
+	};
+	bool nFoldWay = info.nFoldWay && info.flippingAlgorithm.target_type() == MSD::UP_DOWN_MODEL.target_type();
+	if (nFoldWay)
+		try {
+			msd.nFoldWay( info.t_eq, 0 );
+			equilibrated();
+			msd.resetAcceptanceStats();
+			msd.nFoldWay( info.simCount, info.freq );
+		} catch(invalid_argument &ex) {
+			cerr << "Warning: " << ex.what() << ". Using metropolis instead.\n";
+			nFoldWay = false;
+		}
+	if (!nFoldWay) {
+		if (info.flippingAlgorithm.target_type() == MSD::CONE_MODEL.target_type())
+			msd.tuneProposals( info.t_eq, info.targetAcceptance );
+		else
+			msd.metropolis( info.t_eq, 0 );
+		equilibrated();
+		msd.resetAcceptanceStats();
+		msd.metropolis( info.simCount, info.freq );
+	}
+	
+	MSD::AcceptanceStats stats = msd.getAcceptanceStats();
+	info.acceptL = stats.rateL();
+	info.acceptR = stats.rateR();
+	info.acceptm = stats.rate_m();
+	info.proposalSteps = msd.proposalSteps;
 	
 	info.results.M = msd.meanM();
 	info.results.ML = msd.meanML();
@@ -171,6 +433,12 @@ Info algorithm(Info info) {
 	info.xR = msd.magneticSusceptibility_R();
 	info.xm = msd.magneticSusceptibility_m();
 
+	if (info.couplingDerivatives)
+		for (unsigned int i = 0; i < COUPLING_COUNT; i++) {
+			info.dU[i] = msd.dMeanU(COUPLINGS[i]);
+			info.dM[i] = msd.dMeanM(COUPLINGS[i]);
+		}
+
 	info.atoms.clear();
 	Atom atom;
 	for (atom.x = 0; atom.x < msd.getWidth(); atom.x++)
@@ -184,6 +452,13 @@ Info algorithm(Info info) {
 				} catch(out_of_range &ex) {
 					// skip this location: no atom
 				}
+
+	if (info.cache != NULL)
+		try {
+			info.cache->put(key, saveResults(info));
+		} catch(runtime_error &ex) {
+			cerr << "Warning: " << ex.what() << '\n';
+		}
 	
 	return info;
 }
@@ -193,6 +468,14 @@ int main(int argc, char *argv[]) {
 	unsigned threadCount = thread::hardware_concurrency();
 	threadCount = threadCount > 1 ? threadCount : 1;
 
+	string libraryFile;  // optional: runs start from (and store) equilibrated states in this StateLibrary file
+	try {
+		libraryFile = StateLibrary::takeOption(argc, argv);
+	} catch(invalid_argument &ex) {
+		cout << ex.what() << '\n';
+		return -11;
+	}
+
 	if( argc <= 1 ) {
 		cout << "Need a parameters file.\n";
 		return -1;
@@ -226,6 +509,10 @@ int main(int argc, char *argv[]) {
 		flippingAlgorithm = MSD::CONTINUOUS_SPIN_MODEL;
 	else if( s == string("UP_DOWN_MODEL") )
 		flippingAlgorithm = MSD::UP_DOWN_MODEL;
+	else if( s == string("HEAT_BATH_MODEL") )
+		flippingAlgorithm = MSD::HEAT_BATH_MODEL;
+	else if( s == string("CONE_MODEL") )
+		flippingAlgorithm = MSD::CONE_MODEL;
 	else {
 		cout << "Invalid model type: " << argv[3] << '\n';
 		return -3;
@@ -285,6 +572,12 @@ int main(int argc, char *argv[]) {
 	map<string, int> iters;  // maps labels to iterators
 	map<string, int> iterLengths;  // maps labels to length (i.e. exclusive max value) of each iterator
 	vector<Spin> spins;  // list of custom spin magnitudes (and their positions)
+	string refineLabel, refineObservable;  // iff refineBudget != 0: refine the sweep along this label (see: LineRefiner)
+	size_t refineBudget = 0;  // total number of simulations (including the coarse grid), or 0 to run only the grid
+	string designType;  // iff designPoints != 0: "lhs" (latin hypercube) or "sobol"
+	size_t designPoints = 0;  // number of simulations in a space-filling design (instead of a grid), or 0
+	string cacheFile;  // optional: results are loaded from (and stored in) this ResultCache file
+	double cacheMB = 0;  // size limit of the cache file in MB, or 0 for no limit
 	{	//initialize parameters from file
 		stringstream ss;
 		ss << argv[1];
@@ -336,6 +629,37 @@ int main(int argc, char *argv[]) {
 					continue;  // move on to the next parameter
 				}
 
+				// adaptive refinement: refine [label] = observable budget
+				if (key == "refine") {
+					fin >> str;
+					if (str != "=") {
+						refineLabel = str;
+						fin >> str;
+					}
+					if (str != "=" || !(fin >> refineObservable >> refineBudget))
+						throw 22;
+					continue;
+				}
+
+				// result cache: cache = file [maxMB]
+				if (key == "cache") {
+					getline(fin, str);
+					istringstream line(str);
+					if (!(line >> str >> cacheFile) || str != "=")
+						throw 24;
+					if (!(line >> cacheMB))
+						cacheMB = 0;
+					continue;
+				}
+
+				// space-filling design: design = lhs|sobol points
+				if (key == "design") {
+					fin >> str;
+					if (str != "=" || !(fin >> designType >> designPoints) || (designType != "lhs" && designType != "sobol"))
+						throw 23;
+					continue;
+				}
+
 				vector<double> vec;
 				string lbl = "";
 				do {
@@ -402,6 +726,75 @@ int main(int argc, char *argv[]) {
 		}
 	}
 
+	const unsigned long designSeed = static_cast<unsigned long>(time(NULL));  // iff designType == "lhs"
+	{	//check adaptive refinement and design parameters
+		Info info = Info();
+		double value;
+		if (refineBudget != 0 && designPoints != 0) {
+			cerr << "Can't use both \"refine\" and \"design\"!\n";
+			return 0x19;
+		}
+		if (refineBudget != 0) {
+			if (!observable(info, refineObservable, value)) {
+				cerr << "Unknown observable to refine: " << refineObservable << '\n';
+				return 0x1A;
+			}
+			if (refineLabel.empty())  // default: the first label with more than one value
+				for (const string &label : labelNames)
+					if (iterLengths.at(label) > 1) {
+						refineLabel = label;
+						break;
+					}
+			if (iterLengths.find(refineLabel) == iterLengths.end() || iterLengths.at(refineLabel) < 2) {
+				cerr << "Can only refine along a label with at least 2 values: " << refineLabel << '\n';
+				return 0x1B;
+			}
+		}
+		if (designPoints != 0) {
+			size_t dims = 0;
+			for (const string &label : labelNames)
+				dims += iterLengths.at(label) > 1;
+			if (dims == 0 || (designType == "sobol" && dims > SweepDesign::SOBOL_DIMS)) {
+				cerr << "A design needs 1 to " << SweepDesign::SOBOL_DIMS << " labels with more than one value (has " << dims << ")\n";
+				return 0x1C;
+			}
+		}
+	}
+
+	unique_ptr<ResultCache> cache;  // iff !cacheFile.empty()
+	if (!cacheFile.empty())
+		try {
+			cache.reset( new ResultCache(cacheFile, static_cast<unsigned long long>(cacheMB * 1024 * 1024)) );
+			cout << "Using result cache: " << cacheFile << " (" << cache->size() << " results)\n";
+		} catch(runtime_error &ex) {
+			cerr << ex.what() << '\n';
+			return 0x1D;
+		}
+	unique_ptr<StateLibrary> library;  // iff !libraryFile.empty()
+	if (!libraryFile.empty())
+		try {
+			library.reset( new StateLibrary(libraryFile) );
+			cout << "Using state library: " << libraryFile << " (" << library->size() << " states)\n";
+		} catch(runtime_error &ex) {
+			cerr << ex.what() << '\n';
+			return 0x1E;
+		}
+	try {
+		MSD::SiteOrder order = static_cast<MSD::SiteOrder>( p.find("siteOrder") != p.end() ? int(p.at("siteOrder")[0]) : 0 );
+		unsigned long long bytes = MSD::estimateMemory( p.at("width")[0], p.at("height")[0], p.at("depth")[0],
+				p.at("molPosL")[0], p.at("molPosR")[0], p.at("topL")[0], p.at("bottomL")[0], p.at("frontR")[0], p.at("backR")[0],
+				order );
+		cout << "Estimated memory per simulation: " << bytes / 1048576.0 << " MB\n";
+	} catch(logic_error &ex) {
+		cerr << ex.what() << '\n';
+		return 0x1F;
+	}
+	unsigned long long cacheHits = 0;
+	auto reportCache = [&]() {
+		if (cache)
+			cout << "Loaded " << cacheHits << " results from the cache, and simulated " << cache->getMisses() << ".\n";
+	};
+
 	//run simulations
 	try {
 		
@@ -472,6 +865,59 @@ int main(int argc, char *argv[]) {
 			recordVar( doc, *global, "param", "t_eq", p.at("t_eq")[0] );
 			recordVar( doc, *global, "param", "simCount", p.at("simCount")[0] );
 			recordVar( doc, *global, "param", "freq", p.at("freq")[0] );
+			if (p.find("clusterFreq") != p.end())
+				recordVar( doc, *global, "param", "clusterFreq", p.at("clusterFreq")[0] );
+			if (p.find("overrelaxRatio") != p.end())
+				recordVar( doc, *global, "param", "overrelaxRatio", p.at("overrelaxRatio")[0] );
+			if (p.find("macrospinFreq") != p.end())
+				recordVar( doc, *global, "param", "macrospinFreq", p.at("macrospinFreq")[0] );
+			if (p.find("sweepMode") != p.end())
+				recordVar( doc, *global, "param", "sweepMode", p.at("sweepMode")[0] );
+			if (p.find("blockSize") != p.end())
+				recordVar( doc, *global, "param", "blockSize", p.at("blockSize")[0] );
+			if (p.find("siteOrder") != p.end())
+				recordVar( doc, *global, "param", "siteOrder", p.at("siteOrder")[0] );
+			if (p.find("periodicL") != p.end())
+				recordVar( doc, *global, "param", "periodicL", p.at("periodicL")[0] );
+			if (p.find("periodicR") != p.end())
+				recordVar( doc, *global, "param", "periodicR", p.at("periodicR")[0] );
+			for (const char *w : { "weightL", "weightR", "weight_m" })
+				if (p.find(w) != p.end())
+					recordVar( doc, *global, "param", w, p.at(w)[0] );
+			if (p.find("targetAcceptance") != p.end())
+				recordVar( doc, *global, "param", "targetAcceptance", p.at("targetAcceptance")[0] );
+			if (p.find("nFoldWay") != p.end())
+				recordVar( doc, *global, "param", "nFoldWay", p.at("nFoldWay")[0] );
+			if (p.find("couplingDerivatives") != p.end())
+				recordVar( doc, *global, "param", "couplingDerivatives", p.at("couplingDerivatives")[0] );
+			if (refineBudget != 0) {
+				xml_node<> *refine = doc.allocate_node( node_element, "refine", "" );
+				refine->append_attribute( doc.allocate_attribute("label", doc.allocate_string( refineLabel.c_str() )) );
+				refine->append_attribute( doc.allocate_attribute("observable", doc.allocate_string( refineObservable.c_str() )) );
+				refine->append_attribute( doc.allocate_attribute("budget", doc.allocate_string( to_string(refineBudget).c_str() )) );
+				global->append_node(refine);
+			}
+			if (designPoints != 0) {
+				xml_node<> *design = doc.allocate_node( node_element, "design", "" );
+				design->append_attribute( doc.allocate_attribute("type", doc.allocate_string( designType.c_str() )) );
+				design->append_attribute( doc.allocate_attribute("points", doc.allocate_string( to_string(designPoints).c_str() )) );
+				if (designType == "lhs")
+					design->append_attribute( doc.allocate_attribute("seed", doc.allocate_string( to_string(designSeed).c_str() )) );
+				global->append_node(design);
+			}
+			if (cache) {
+				xml_node<> *cache_node = doc.allocate_node( node_element, "cache", "" );
+				cache_node->append_attribute( doc.allocate_attribute("file", doc.allocate_string( cacheFile.c_str() )) );
+				ostringstream mb;
+				mb << cacheMB;
+				cache_node->append_attribute( doc.allocate_attribute("maxMB", doc.allocate_string( mb.str().c_str() )) );
+				global->append_node(cache_node);
+			}
+			if (library) {
+				xml_node<> *library_node = doc.allocate_node( node_element, "library", "" );
+				library_node->append_attribute( doc.allocate_attribute("file", doc.allocate_string( libraryFile.c_str() )) );
+				global->append_node(library_node);
+			}
 			const unsigned int SIZE = 64;
 			string inds[SIZE] = { "kT", "B_x", "B_y", "B_z",  // + 4 (sum: 4)
 			                      "SL", "SR", "Sm", "FL", "FR", "Fm",  // + 6 (sum: 10)
@@ -701,6 +1147,12 @@ int main(int argc, char *argv[]) {
 			recordVar( doc, *data, "param", "DLR_x", info.parameters.DLR.x );
 			recordVar( doc, *data, "param", "DLR_y", info.parameters.DLR.y );
 			recordVar( doc, *data, "param", "DLR_z", info.parameters.DLR.z );
+			if (info.level >= 0)
+				recordVar( doc, *data, "design", "level", info.level );
+			if (info.cache != NULL)
+				recordVar( doc, *data, "cache", "hit", info.cached );
+			if (info.library != NULL && !info.cached)
+				recordVar( doc, *data, "library", "distance", info.warmDistance );
 
 			//record results
 			recordVar( doc, *data, "result", "M_x", info.results.M.x );
@@ -772,6 +1224,27 @@ int main(int argc, char *argv[]) {
 			recordVar( doc, *data, "result", "xR", info.xR );
 			recordVar( doc, *data, "result", "xm", info.xm );
 			
+			// acceptance rates only when they're being tuned (or asked for)
+			const bool cone = info.flippingAlgorithm.target_type() == MSD::CONE_MODEL.target_type();
+			if (cone || p.find("targetAcceptance") != p.end()) {
+				recordVar( doc, *data, "result", "acceptL", info.acceptL );
+				recordVar( doc, *data, "result", "acceptR", info.acceptR );
+				recordVar( doc, *data, "result", "acceptm", info.acceptm );
+			}
+			if (cone) {
+				recordVar( doc, *data, "result", "stepL", info.proposalSteps.L );
+				recordVar( doc, *data, "result", "stepR", info.proposalSteps.R );
+				recordVar( doc, *data, "result", "stepm", info.proposalSteps.m );
+			}
+			if (info.couplingDerivatives)
+				for (unsigned int i = 0; i < COUPLING_COUNT; i++) {
+					string name = COUPLING_NAMES[i];
+					recordVar( doc, *data, "result", doc.allocate_string( ("dU_d" + name).c_str() ), info.dU[i] );
+					recordVar( doc, *data, "result", doc.allocate_string( ("dM_d" + name + "_x").c_str() ), info.dM[i].x );
+					recordVar( doc, *data, "result", doc.allocate_string( ("dM_d" + name + "_y").c_str() ), info.dM[i].y );
+					recordVar( doc, *data, "result", doc.allocate_string( ("dM_d" + name + "_z").c_str() ), info.dM[i].z );
+				}
+			
 			// record atoms
 			xml_node<> *snapshot = doc.allocate_node( node_element, "snapshot", "" );
 			for (const Atom &atom : info.atoms) {
@@ -801,6 +1274,10 @@ int main(int argc, char *argv[]) {
 			//report status
 			cout << (completion += step) << "% ";
 			reportTime( time(NULL) - beginning );
+			if (info.cached) {
+				cout << " (cached)";
+				cacheHits++;
+			}
 			if( fout.fail() ) {
 				cout << "\n\t- Unusual Error... Couldn't write to designated output file: " << filename;
 				fout.clear();
@@ -814,95 +1291,12 @@ int main(int argc, char *argv[]) {
 		bool hasNextIter = true;
 		auto nextIter = [&]() {
 			static Info preInfo;
-			static map<string, double*> fields = [](Info &preInfo) {
-				// initialize fields map in a static block because it only needs to run once, then it can be kept in memory
-				map<string, double*> fields;  // map of parameter names to pointers to Info::parameters fields
-				
-				fields["kT"] = &preInfo.parameters.kT;
-				
-				fields["B_x"] = &preInfo.parameters.B.x;
-				fields["B_y"] = &preInfo.parameters.B.y;
-				fields["B_z"] = &preInfo.parameters.B.z;
-				
-				fields["SL"] = &preInfo.parameters.SL;
-				fields["SR"] = &preInfo.parameters.SR;
-				fields["Sm"] = &preInfo.nodeParameters.Sm ;
-				fields["FL"] = &preInfo.parameters.FL;
-				fields["FR"] = &preInfo.parameters.FR;
-				fields["Fm"] = &preInfo.nodeParameters.Fm;
-				
-				fields["JL"] = &preInfo.parameters.JL;
-				fields["JR"] = &preInfo.parameters.JR;
-				fields["Jm"] = &preInfo.edgeParameters.Jm;
-				fields["JmL"] = &preInfo.parameters.JmL;
-				fields["JmR"] = &preInfo.parameters.JmR;
-				fields["JLR"] = &preInfo.parameters.JLR;
-
-				fields["Je0L"] = &preInfo.parameters.Je0L;
-				fields["Je0R"] = &preInfo.parameters.Je0R;
-				fields["Je0m"] = &preInfo.nodeParameters.Je0m;
-
-				fields["Je1L"] = &preInfo.parameters.Je1L;
-				fields["Je1R"] = &preInfo.parameters.Je1R;
-				fields["Je1m"] = &preInfo.edgeParameters.Je1m ;
-				fields["Je1mL"] = &preInfo.parameters.Je1mL;
-				fields["Je1mR"] = &preInfo.parameters.Je1mR;
-				fields["Je1LR"] = &preInfo.parameters.Je1LR;
-
-				fields["JeeL"] = &preInfo.parameters.JeeL;
-				fields["JeeR"] = &preInfo.parameters.JeeR;
-				fields["Jeem"] = &preInfo.edgeParameters.Jeem;
-				fields["JeemL"] = &preInfo.parameters.JeemL;
-				fields["JeemR"] = &preInfo.parameters.JeemR;
-				fields["JeeLR"] = &preInfo.parameters.JeeLR;
-				
-				fields["bL"] = &preInfo.parameters.bL;
-				fields["bR"] = &preInfo.parameters.bR;
-				fields["bm"] = &preInfo.edgeParameters.bm;
-				fields["bmL"] = &preInfo.parameters.bmL;
-				fields["bmR"] = &preInfo.parameters.bmR;
-				fields["bLR"] = &preInfo.parameters.bLR;
-				
-				fields["AL_x"] = &preInfo.parameters.AL.x;
-				fields["AL_y"] = &preInfo.parameters.AL.y;
-				fields["AL_z"] = &preInfo.parameters.AL.z;
-				
-				fields["AR_x"] = &preInfo.parameters.AR.x;
-				fields["AR_y"] = &preInfo.parameters.AR.y;
-				fields["AR_z"] = &preInfo.parameters.AR.z;
-				
-				fields["Am_x"] = &preInfo.nodeParameters.Am.x;
-				fields["Am_y"] = &preInfo.nodeParameters.Am.y;
-				fields["Am_z"] = &preInfo.nodeParameters.Am.z;
-
-				fields["DL_x"] = &preInfo.parameters.DL.x;
-				fields["DL_y"] = &preInfo.parameters.DL.y;
-				fields["DL_z"] = &preInfo.parameters.DL.z;
-
-				fields["DR_x"] = &preInfo.parameters.DR.x;
-				fields["DR_y"] = &preInfo.parameters.DR.y;
-				fields["DR_z"] = &preInfo.parameters.DR.z;
-
-				fields["Dm_x"] = &preInfo.edgeParameters.Dm.x;
-				fields["Dm_y"] = &preInfo.edgeParameters.Dm.y;
-				fields["Dm_z"] = &preInfo.edgeParameters.Dm.z;
-
-				fields["DmL_x"] = &preInfo.parameters.DmL.x;
-				fields["DmL_y"] = &preInfo.parameters.DmL.y;
-				fields["DmL_z"] = &preInfo.parameters.DmL.z;
-
-				fields["DmR_x"] = &preInfo.parameters.DmR.x;
-				fields["DmR_y"] = &preInfo.parameters.DmR.y;
-				fields["DmR_z"] = &preInfo.parameters.DmR.z;
-
-				fields["DLR_x"] = &preInfo.parameters.DLR.x;
-				fields["DLR_y"] = &preInfo.parameters.DLR.y;
-				fields["DLR_z"] = &preInfo.parameters.DLR.z;
-				
-				return fields;
-			}(preInfo);
+			static map<string, double*> fields = fieldMap(preInfo);
 
 			// set constant Info fields
+			preInfo.level = -1;
+			preInfo.cache = cache.get();
+			preInfo.library = library.get();
 			preInfo.flippingAlgorithm = flippingAlgorithm;
 			preInfo.initMode = initMode;
 			preInfo.molType = molType;
@@ -921,6 +1315,20 @@ int main(int argc, char *argv[]) {
 			preInfo.t_eq = p.at("t_eq")[0];
 			preInfo.simCount = p.at("simCount")[0];
 			preInfo.freq = p.at("freq")[0];
+			preInfo.clusterFreq = p.find("clusterFreq") != p.end() ? p.at("clusterFreq")[0] : 0;
+			preInfo.overrelaxRatio = p.find("overrelaxRatio") != p.end() ? p.at("overrelaxRatio")[0] : 0;
+			preInfo.weightL = p.find("weightL") != p.end() ? p.at("weightL")[0] : 1;
+			preInfo.weightR = p.find("weightR") != p.end() ? p.at("weightR")[0] : 1;
+			preInfo.weight_m = p.find("weight_m") != p.end() ? p.at("weight_m")[0] : 1;
+			preInfo.macrospinFreq = p.find("macrospinFreq") != p.end() ? p.at("macrospinFreq")[0] : 0;
+			preInfo.sweepMode = static_cast<MSD::SweepMode>( p.find("sweepMode") != p.end() ? int(p.at("sweepMode")[0]) : 0 );
+			preInfo.blockSize = p.find("blockSize") != p.end() ? p.at("blockSize")[0] : 4;
+			preInfo.siteOrder = static_cast<MSD::SiteOrder>( p.find("siteOrder") != p.end() ? int(p.at("siteOrder")[0]) : 0 );
+			preInfo.periodicL = p.find("periodicL") != p.end() ? p.at("periodicL")[0] : 0;
+			preInfo.periodicR = p.find("periodicR") != p.end() ? p.at("periodicR")[0] : 0;
+			preInfo.targetAcceptance = p.find("targetAcceptance") != p.end() ? p.at("targetAcceptance")[0] : 0.5;
+			preInfo.nFoldWay = p.find("nFoldWay") != p.end() && p.at("nFoldWay")[0] != 0;
+			preInfo.couplingDerivatives = p.find("couplingDerivatives") != p.end() && p.at("couplingDerivatives")[0] != 0;
 
 			preInfo.spins = spins;
 
@@ -948,6 +1356,115 @@ int main(int argc, char *argv[]) {
 			return preInfo;
 		};
 
+		if (refineBudget != 0 || designPoints != 0) {
+			// runs every task (up to threadCount at once), recording each one as it finishes; returns them in order
+			auto runAll = [&](const vector<Info> &tasks) {
+				vector<Info> done(tasks.size());
+				if (threadCount <= 1) {
+					for (size_t i = 0; i < tasks.size(); i++)
+						recordData(done[i] = algorithm(tasks[i]));
+					return done;
+				}
+				vector< future<Info> > running(tasks.size());
+				vector<size_t> active;
+				size_t next = 0;
+				while (next < tasks.size() || !active.empty()) {
+					while (active.size() < threadCount && next < tasks.size()) {
+						running[next] = async( launch::async, algorithm, tasks[next] );
+						active.push_back(next++);
+					}
+					for (auto i = active.begin(); i != active.end(); )
+						if (running[*i].wait_for(chrono::milliseconds(10)) == future_status::ready) {
+							recordData(done[*i] = running[*i].get());
+							i = active.erase(i);
+						} else
+							++i;
+				}
+				return done;
+			};
+
+			// sets the parameters with the given label to their values at (fractional) index u of their lists
+			auto setLabel = [&](Info &info, const string &label, double u) {
+				map<string, double*> fields = fieldMap(info);
+				for (const string &name : labelMap.at(label)) {
+					auto f = fields.find(name);
+					if (f == fields.end())
+						continue;  // a constant, e.g. "width"
+					const vector<double> &vec = p.at(name);
+					size_t i = min(static_cast<size_t>(u), vec.size() - 1);
+					*f->second = u == i ? vec[i] : vec[i] + (u - i) * (vec[i + 1] - vec[i]);
+				}
+			};
+
+			if (designPoints != 0) {
+				// every label with more than one value is a dimension of the design, from the first to the last of its values
+				Info base = nextIter();
+				vector<string> dims;
+				for (const string &label : labelNames)
+					if (iterLengths.at(label) > 1)
+						dims.push_back(label);
+				vector< vector<double> > design = designType == "sobol"
+						? SweepDesign::sobol(designPoints, dims.size())
+						: SweepDesign::latinHypercube(designPoints, dims.size(), designSeed);
+				vector<Info> tasks;
+				for (const vector<double> &pt : design) {
+					Info info = base;
+					info.level = 0;
+					for (size_t d = 0; d < dims.size(); d++)
+						setLabel(info, dims[d], pt[d] * (iterLengths.at(dims[d]) - 1));
+					tasks.push_back(info);
+				}
+				step = 100.0 / tasks.size();
+				runAll(tasks);
+				reportCache();
+				return 0;
+			}
+
+			// adaptive refinement: the grid is split into lines along refineLabel (one for each combination of the
+			// other labels), and then the intervals of those lines with the largest losses are split until the budget
+			// is used up (see: LineRefiner)
+			LineRefiner refiner;
+			vector<LineRefiner::Task> next;  // of each task
+			vector<Info> tasks, lines;  // (lines: the first grid point of each line, which new points are copied from)
+			map<vector<int>, size_t> lineIds;
+			while (hasNextIter) {
+				vector<int> key;
+				for (const string &label : labelNames)
+					if (label != refineLabel)
+						key.push_back(iters.at(label));
+				LineRefiner::Task task;
+				task.line = lineIds.insert(make_pair(key, lineIds.size())).first->second;
+				task.u = iters.at(refineLabel);
+				task.level = 0;
+				tasks.push_back(nextIter());
+				tasks.back().level = 0;
+				if (task.line == lines.size())
+					lines.push_back(tasks.back());
+				next.push_back(task);
+			}
+			step = 100.0 / max(refineBudget, tasks.size());
+			size_t count = 0;
+			while (!tasks.empty()) {
+				vector<Info> done = runAll(tasks);
+				for (size_t i = 0; i < done.size(); i++) {
+					double value;
+					observable(done[i], refineObservable, value);
+					refiner.add(next[i].line, next[i].u, value, next[i].level);
+				}
+				count += done.size();
+
+				next = refiner.next(count < refineBudget ? min<size_t>(threadCount, refineBudget - count) : 0);
+				tasks.clear();
+				for (const LineRefiner::Task &task : next) {
+					tasks.push_back(lines[task.line]);
+					tasks.back().level = task.level;
+					setLabel(tasks.back(), refineLabel, task.u);
+				}
+			}
+			reportCache();
+			return 0;
+		}
+
 		while (hasNextIter) {
 			
 			Info preInfo = nextIter();
@@ -1005,5 +1522,6 @@ int main(int argc, char *argv[]) {
 		return 0x18;
 	}
 
+	reportCache();
 	return 0;
 }
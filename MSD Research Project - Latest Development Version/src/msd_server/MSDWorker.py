@@ -20,7 +20,9 @@ def flippingAlgorithm(algo: str) -> c_void_p:
 	''' Convert str to MSD FlippingAlgorithm'''
 	return {
 		"UP_DOWN_MODEL": MSD.UP_DOWN_MODEL,
-		"CONTINUOUS_SPIN_MODEL": MSD.CONTINUOUS_SPIN_MODEL
+		"CONTINUOUS_SPIN_MODEL": MSD.CONTINUOUS_SPIN_MODEL,
+		"HEAT_BATH_MODEL": MSD.HEAT_BATH_MODEL,
+		"CONE_MODEL": MSD.CONE_MODEL
 	}[algo.upper()]
 
 def vec(v: list) -> Vector:
@@ -0,0 +1,123 @@
+/**
+ * @file adaptive-field-test.cpp
+ * @brief Tests AdaptiveFieldSweep on a 4x4x4 Ising (UP_DOWN_MODEL) ferromagnet.
+ *
+ * 1. With a tolerance too large to ever reject a field: the loop must start and end at B_max, turn at B_min, keep
+ *    its steps within stepMax, and use no more than its budget.
+ * 2. With a budget too small for the whole loop at stepMax, the sweep must stop early (and not go over budget).
+ * 3. At low kT the magnetization switches abruptly: on each branch, the largest change in m must be across a step of
+ *    stepMin, while the plateaus are crossed with larger steps.
+ */
+
+#include <cmath>
+#include <cstdlib>
+#include <iostream>
+#include <vector>
+#include "../MSD.h"
+#include "../AdaptiveField.h"
+
+using namespace std;
+using namespace udc;
+
+const double eps = 1e-9;
+
+MSD * makeMSD(double kT) {
+	MSD *msd = new MSD(4, 4, 4, 4, 3, 0, 3, 0, 3);  // FM_L only
+	MSD::Parameters p;
+	p.kT = kT;
+	p.JL = 1;
+	p.B = Vector(0, 6, 0);
+	msd->setParameters(p);
+	msd->flippingAlgorithm = MSD::UP_DOWN_MODEL;
+	return msd;
+}
+
+// checks the order and size of the steps; returns false (and prints why) if it's wrong
+bool checkLoop(const string &test, const AdaptiveFieldSweep &sweep, double B_min, double B_max) {
+	const vector<AdaptiveFieldSweep::Point> &pts = sweep.getPoints();
+	if (pts.empty() || pts.front().rho != B_max || pts.back().rho != B_max) {
+		cout << "(" << test << ") loop doesn't start and end at B_max\n";
+		return false;
+	}
+	bool turned = false;
+	for (size_t i = 1; i < pts.size(); i++) {
+		double step = pts[i].rho - pts[i - 1].rho;
+		turned = turned || pts[i - 1].rho == B_min;
+		if ((turned ? step <= 0 : step >= 0) || abs(step) > sweep.stepMax * (1 + eps)) {
+			cout << "(" << test << ") bad step from " << pts[i - 1].rho << " to " << pts[i].rho << "\n";
+			return false;
+		}
+	}
+	if (!turned) {
+		cout << "(" << test << ") loop didn't reach B_min\n";
+		return false;
+	}
+	if (sweep.getSteps() > sweep.budget) {
+		cout << "(" << test << ") used " << sweep.getSteps() << " steps, budget = " << sweep.budget << "\n";
+		return false;
+	}
+	return true;
+}
+
+int main(int argc, char *argv[]) {
+	const double B_min = -6, B_max = 6, step = 1;
+
+	// ----- 1. structure -----
+	{	MSD *msd = makeMSD(2);
+		AdaptiveFieldSweep sweep(B_min, B_max, step, PI / 2, 0, 2, 1000, 1000, 20);
+		sweep.dm = 1e9;
+		sweep.run(*msd);
+		if (!sweep.isComplete() || sweep.getRejected() != 0) {
+			cout << "(structure) complete = " << sweep.isComplete() << ", rejected = " << sweep.getRejected() << "\n";
+			return 1;
+		}
+		if (!checkLoop("structure", sweep, B_min, B_max))
+			return 1;
+		delete msd;
+	}
+
+	// ----- 2. budget -----
+	{	MSD *msd = makeMSD(2);
+		AdaptiveFieldSweep sweep(B_min, B_max, step, PI / 2, 0, 2, 1000, 1000, 20);
+		sweep.budget = 5 * 2000;  // the loop needs at least 7 fields at stepMax = 4
+		sweep.run(*msd);
+		if (sweep.isComplete() || sweep.getSteps() > sweep.budget) {
+			cout << "(budget) complete = " << sweep.isComplete() << ", used " << sweep.getSteps() << " steps\n";
+			return 1;
+		}
+		delete msd;
+	}
+
+	// ----- 3. switching -----
+	{	MSD *msd = makeMSD(0.5);
+		AdaptiveFieldSweep sweep(B_min, B_max, step, PI / 2, 0, 0.5, 2000, 2000, 20);
+		sweep.budget *= 3;
+		sweep.run(*msd);
+		if (!sweep.isComplete() || !checkLoop("switching", sweep, B_min, B_max))
+			return 1;
+		const vector<AdaptiveFieldSweep::Point> &pts = sweep.getPoints();
+		for (bool down : {true, false}) {
+			size_t jump = 0;  // index of the point after the largest change in m on this branch
+			double largest = -1, longest = 0;
+			for (size_t i = 1; i < pts.size(); i++)
+				if (pts[i].down == down) {
+					double dm = abs(pts[i].m - pts[i - 1].m);
+					if (dm > largest) {
+						largest = dm;
+						jump = i;
+					}
+					longest = max(longest, abs(pts[i].rho - pts[i - 1].rho));
+				}
+			double s = abs(pts[jump].rho - pts[jump - 1].rho);
+			if (largest < 1 || s > sweep.stepMin * (1 + eps) || longest <= step) {
+				cout << "(switching) " << (down ? "down" : "up") << " branch: m changed by " << largest << " from B = "
+				     << pts[jump - 1].rho << " to " << pts[jump].rho << " (longest step = " << longest << ")\n";
+				return 1;
+			}
+		}
+		delete msd;
+	}
+
+	cout << "Done. (Passed)\n";
+	return 0;
+}
@@ -0,0 +1,105 @@
+/**
+ * @file batch-test.cpp
+ * @brief Tests BatchMSD.
+ *
+ * 1. Random MSDs: after metropolis, the incrementally updated Results of every replica (each with its own B) must
+ *    match a full recalculation by an MSD in the same state.
+ * 2. An 8 atom Ising chain (UP_DOWN_MODEL, F == 0): each replica has a different kT, and its <U> must match the exact
+ *    value found by enumerating all 2^8 states.
+ */
+
+#include <cmath>
+#include <cstdlib>
+#include <iostream>
+#include <vector>
+#include "../MSD.h"
+#include "../BatchMSD.h"
+#include "test-util.h"
+
+using namespace std;
+using namespace udc;
+using namespace udc::test;
+
+const unsigned int numIter = 50;
+double maxErr = 1e-9;
+
+int main(int argc, char *argv[]) {
+	if (argc > 1)
+		maxErr = atof(argv[1]);
+
+	Random rng;
+
+	for (unsigned int n = 0; n < numIter; n++) {
+		const unsigned int K = 5;
+		shared_ptr<MSD> msd = rng.randMSD(8);
+		msd->flippingAlgorithm = n % 2 == 0 ? MSD::CONTINUOUS_SPIN_MODEL : MSD::UP_DOWN_MODEL;
+		msd->randomize();
+		BatchMSD batch(*msd, K);
+		vector<Vector> B;
+		for (unsigned int k = 0; k < K; k++) {
+			B.push_back(k == 0 ? msd->getParameters().B : rng.randV());
+			batch.setB(k, B[k]);
+		}
+		batch.metropolis(2000, 100);
+
+		for (unsigned int k = 0; k < K; k++) {
+			if (batch.record[k].size() != 21) {
+				cout << "(random MSD) record[" << k << "].size() = " << batch.record[k].size() << ", expected 21\n";
+				return 1;
+			}
+			msd->setB(B[k]);
+			batch.exportState(k, *msd);
+			msd->setParameters(msd->getParameters());  // force recalculation
+			msd->setMolProto(msd->getMolProto());
+			double d = cmpResults(batch.getResults(k), msd->getResults(), maxErr);
+			if (d > maxErr) {
+				cout << "(random MSD) Max error reached: n = " << n << ", k = " << k << ", d = " << d << "\n";
+				return 1;
+			}
+		}
+	}
+
+	{	const unsigned int N = 8;
+		MSD msd(N, 1, 1, N, N - 1, 0, 0, 0, 0);  // a chain of FM_L atoms
+		MSD::Parameters p;
+		p.JL = 1;
+		p.B = Vector(0, 0.3, 0);  // spins start along the y-axis
+		msd.setParameters(p);
+		msd.flippingAlgorithm = MSD::UP_DOWN_MODEL;
+
+		vector<double> U;  // exact energies
+		for (unsigned int state = 0; state < (1u << N); state++) {
+			for (unsigned int a = 0; a < N; a++)
+				msd.setLocalM(a, Vector(0, (state >> a & 1) ? 1 : -1, 0), Vector::ZERO);
+			U.push_back(msd.getResults().U);
+		}
+		msd.reinitialize();
+
+		const vector<double> kTs = { 0.5, 0.75, 1, 1.5, 2, 3, 4, 8 };
+		BatchMSD batch(msd, static_cast<unsigned int>(kTs.size()));
+		for (unsigned int k = 0; k < kTs.size(); k++)
+			batch.set_kT(k, kTs[k]);
+		batch.metropolis(10000);
+		batch.metropolis(2000000, 16);
+
+		for (unsigned int k = 0; k < kTs.size(); k++) {
+			double Z = 0, sumU = 0;
+			for (double u : U) {
+				double w = exp(-u / kTs[k]);
+				Z += w;
+				sumU += w * u;
+			}
+			double expected = sumU / Z, actual = 0;
+			for (const MSD::Results &r : batch.record[k])
+				actual += r.U;
+			actual /= batch.record[k].size();
+			if (abs(actual - expected) > 0.05) {
+				cout << "(Ising chain) kT = " << kTs[k] << ": <U> = " << actual << ", expected " << expected << "\n";
+				return 1;
+			}
+		}
+	}
+
+	cout << "Done. (Passed)\n";
+	return 0;
+}
@@ -0,0 +1,206 @@
+/**
+ * @file cluster-test.cpp
+ * @brief Tests MSD::clusterFlip (Wolff cluster moves).
+ *
+ * 1. Random MSDs: after many cluster moves (mixed with metropolis) the incrementally updated
+ *    Results must match a full recalculation.
+ * 2. Pure Heisenberg FM (only JL, JR non-zero): the construction accounts for all of the change
+ *    in energy, so every cluster move must be accepted.
+ * 3. Equilibrium: near the ordering kT of a Heisenberg cube, <U> and <|M|> (per atom) with cluster moves must
+ *    match plain metropolis within 4 standard errors (from block means).
+ * 4. Autocorrelation: there, the integrated autocorrelation time of |M| (in sweeps) with cluster moves must be
+ *    less than half of plain metropolis'.
+ * 5. UP_DOWN_MODEL: from randomize (every spin on its own axis), cluster moves must keep every spin on its axis;
+ *    from reinitialize (collinear spins), clusters must grow, and <U> and <|M|> near the ordering kT must match
+ *    plain metropolis within 4 standard errors.
+ */
+
+#include <cmath>
+#include <cstdlib>
+#include <iostream>
+#include <vector>
+#include "../MSD.h"
+#include "test-util.h"
+
+using namespace std;
+using namespace udc;
+using namespace udc::test;
+
+const unsigned int numIter = 50;
+double maxErr = 1e-9;
+
+// mean of x, and its standard error from the spread of 20 block means
+void blocked(const vector<double> &x, double &mean, double &err) {
+	const size_t blocks = 20, len = x.size() / blocks;
+	vector<double> b(blocks, 0);
+	mean = 0;
+	for (size_t k = 0; k < blocks; k++) {
+		for (size_t i = 0; i < len; i++)
+			b[k] += x[k * len + i];
+		b[k] /= len;
+		mean += b[k] / blocks;
+	}
+	double var = 0;
+	for (double m : b)
+		var += (m - mean) * (m - mean);
+	err = sqrt(var / (blocks - 1) / blocks);
+}
+
+// integrated autocorrelation time of x (in samples), summed over a window of at least 6 times itself (Sokal)
+double tauInt(const vector<double> &x) {
+	const size_t n = x.size();
+	double mean = 0, var = 0;
+	for (double v : x)
+		mean += v / n;
+	for (double v : x)
+		var += (v - mean) * (v - mean) / n;
+	double tau = 0.5;
+	for (size_t t = 1; t < n / 2 && t < 6 * tau; t++) {
+		double c = 0;
+		for (size_t i = 0; i + t < n; i++)
+			c += (x[i] - mean) * (x[i + t] - mean);
+		tau += c / (n - t) / var;
+	}
+	return tau;
+}
+
+// U and |M| per atom after each of "sweeps" sweeps, after 1000 sweeps to equilibrate (from a random state, or not)
+void sample(MSD &msd, unsigned int sweeps, vector<double> &U, vector<double> &M, bool randomize = true) {
+	const unsigned int n = msd.getN();
+	if (randomize)
+		msd.randomize(false);  // (keeping the seed)
+	else
+		msd.reinitialize(false);
+	msd.metropolis(1000ull * n);
+	for (unsigned int s = 0; s < sweeps; s++) {
+		msd.metropolis(n);
+		U.push_back(msd.getResults().U / n);
+		M.push_back(msd.getResults().M.norm() / n);
+	}
+}
+
+int main(int argc, char *argv[]) {
+	if (argc > 1)
+		maxErr = atof(argv[1]);
+
+	Random rng;
+
+	// ----- 1. random MSDs -----
+	for (unsigned int n = 0; n < numIter; n++) {
+		shared_ptr<MSD> msd = rng.randMSD(8);
+		msd->randomize();
+		msd->clusterFreq = 7;
+		msd->metropolis(2000);
+		for (unsigned int i = 0; i < 200; i++)
+			msd->clusterFlip();
+
+		MSD::Results r1 = msd->getResults();
+		msd->setParameters(msd->getParameters());  // force recalculation
+		msd->setMolProto(msd->getMolProto());
+		MSD::Results r2 = msd->getResults();
+		double d = cmpResults(r1, r2, maxErr);
+		if (d > maxErr) {
+			cout << "(random MSD) Max error reached: n = " << n << ", d = " << d << "\n";
+			return 1;
+		}
+	}
+
+	// ----- 2. pure Heisenberg -----
+	{	MSD msd(12, 8, 8, 5, 6, 0, 7, 0, 7);
+		MSD::Parameters p;
+		p.kT = 1.5;
+		p.JmL = p.JmR = 0;
+		msd.setParameters(p);
+		Molecule::NodeParameters nodeParams;
+		nodeParams.Sm = 0;
+		msd.setMolParameters(nodeParams, Molecule::EdgeParameters());
+		msd.randomize();
+		for (unsigned int i = 0; i < 1000; i++)
+			if (msd.clusterFlip() == 0) {
+				cout << "(pure Heisenberg) cluster move was rejected: i = " << i << "\n";
+				return 1;
+			}
+	}
+
+	// ----- 3. and 4. against plain metropolis -----
+	{	vector<double> U[2], M[2];  // [0] metropolis, [1] with cluster moves
+		for (unsigned int wolff = 0; wolff < 2; wolff++) {
+			MSD msd(6, 6, 6, 6, 5, 0, 5, 0, 5);  // only FM_L
+			MSD::Parameters p;
+			p.kT = 1.2;
+			msd.setParameters(p);
+			msd.setSeed(10 + wolff);
+			msd.clusterFreq = wolff ? msd.getN() / 4 : 0;
+			sample(msd, 10000, U[wolff], M[wolff]);
+		}
+		double u0, eu0, u1, eu1, m0, em0, m1, em1;
+		blocked(U[0], u0, eu0);
+		blocked(U[1], u1, eu1);
+		blocked(M[0], m0, em0);
+		blocked(M[1], m1, em1);
+		if (abs(u1 - u0) > 4 * sqrt(eu0 * eu0 + eu1 * eu1) || abs(m1 - m0) > 4 * sqrt(em0 * em0 + em1 * em1)) {
+			cout << "(equilibrium) metropolis: <U> = " << u0 << " +- " << eu0 << ", <|M|> = " << m0 << " +- " << em0
+			     << "; with cluster moves: <U> = " << u1 << " +- " << eu1 << ", <|M|> = " << m1 << " +- " << em1 << "\n";
+			return 1;
+		}
+		double tau0 = tauInt(M[0]), tau1 = tauInt(M[1]);
+		if (!(tau1 < tau0 / 2)) {
+			cout << "(autocorrelation) tau of |M| = " << tau0 << " sweeps, but " << tau1 << " with cluster moves\n";
+			return 1;
+		}
+	}
+
+	// ----- 5. UP_DOWN_MODEL -----
+	{	MSD msd(6, 6, 6, 6, 5, 0, 5, 0, 5);
+		MSD::Parameters p;
+		p.kT = 1.2;
+		msd.setParameters(p);
+		msd.flippingAlgorithm = MSD::UP_DOWN_MODEL;
+		msd.randomize();
+		vector<Vector> initial;
+		for (auto iter = msd.begin(); iter != msd.end(); ++iter)
+			initial.push_back(iter.getSpin());
+		msd.clusterFreq = 5;
+		msd.metropolis(20000);
+		for (unsigned int i = 0; i < 2000; i++)
+			msd.clusterFlip();
+		size_t k = 0;
+		for (auto iter = msd.begin(); iter != msd.end(); ++iter, ++k)
+			if ((iter.getSpin() - initial[k]).norm() > maxErr && (iter.getSpin() + initial[k]).norm() > maxErr) {
+				cout << "(UP_DOWN_MODEL) a cluster move took a spin off its axis: " << initial[k] << " -> "
+				     << iter.getSpin() << "\n";
+				return 1;
+			}
+
+		msd.reinitialize();
+		p.kT = 4;
+		msd.setParameters(p);
+		unsigned int largest = 0;
+		for (unsigned int i = 0; i < 200; i++)
+			largest = max(largest, msd.clusterFlip());
+		if (largest < 2) {
+			cout << "(UP_DOWN_MODEL) collinear spins didn't form clusters\n";
+			return 1;
+		}
+
+		vector<double> U[2], M[2];  // [0] metropolis, [1] with cluster moves
+		for (unsigned int wolff = 0; wolff < 2; wolff++) {
+			msd.setSeed(20 + wolff);
+			msd.clusterFreq = wolff ? msd.getN() / 4 : 0;
+			sample(msd, 10000, U[wolff], M[wolff], false);
+		}
+		double u0, eu0, u1, eu1, m0, em0, m1, em1;
+		blocked(U[0], u0, eu0);
+		blocked(U[1], u1, eu1);
+		blocked(M[0], m0, em0);
+		blocked(M[1], m1, em1);
+		if (abs(u1 - u0) > 4 * sqrt(eu0 * eu0 + eu1 * eu1) || abs(m1 - m0) > 4 * sqrt(em0 * em0 + em1 * em1)) {
+			cout << "(UP_DOWN_MODEL) metropolis: <U> = " << u0 << " +- " << eu0 << ", <|M|> = " << m0 << " +- " << em0
+			     << "; with cluster moves: <U> = " << u1 << " +- " << eu1 << ", <|M|> = " << m1 << " +- " << em1 << "\n";
+			return 1;
+		}
+	}
+
+	cout << "Done. (Passed)\n";
+	return 0;
+}
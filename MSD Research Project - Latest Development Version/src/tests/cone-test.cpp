@@ -0,0 +1,90 @@
+/**
+ * @file cone-test.cpp
+ * @brief Tests MSD::CONE_MODEL, MSD::tuneProposals, and the acceptance stats.
+ *
+ * 1. Random MSDs: after tuning and metropolis with the cone model the incrementally updated
+ *    Results must match a full recalculation.
+ * 2. A single spin (S = 1) and flux (F = 0.8) in a magnetic field B: after tuning, the acceptance rate
+ *    must be close to the target, and <M * B / |B|> must match the exact value for the same distribution
+ *    as CONTINUOUS_SPIN_MODEL, i.e. the Langevin function for the spin, plus the flux's mean which is
+ *    integrated numerically over its (uniformly distributed) magnitude.
+ */
+
+#include <cmath>
+#include <cstdlib>
+#include <iostream>
+#include "../MSD.h"
+#include "test-util.h"
+
+using namespace std;
+using namespace udc;
+using namespace udc::test;
+
+const unsigned int numIter = 50;
+double maxErr = 1e-9;
+
+// sinh(x) / x, and (coth(x) - 1/x) sinh(x) / x, the unnormalized partition function and mean of u = cos(angle)
+double Z(double x) { return x == 0 ? 1 : sinh(x) / x; }
+double uZ(double x) { return x == 0 ? 0 : (cosh(x) - sinh(x) / x) / x; }
+
+int main(int argc, char *argv[]) {
+	if (argc > 1)
+		maxErr = atof(argv[1]);
+
+	Random rng;
+
+	for (unsigned int n = 0; n < numIter; n++) {
+		shared_ptr<MSD> msd = rng.randMSD(8);
+		msd->flippingAlgorithm = MSD::CONE_MODEL;
+		msd->randomize();
+		msd->tuneProposals(2000);
+		msd->metropolis(3000);
+
+		MSD::Results r1 = msd->getResults();
+		msd->setParameters(msd->getParameters());  // force recalculation
+		msd->setMolProto(msd->getMolProto());
+		MSD::Results r2 = msd->getResults();
+		double d = cmpResults(r1, r2, maxErr);
+		if (d > maxErr) {
+			cout << "(random MSD) Max error reached: n = " << n << ", d = " << d << "\n";
+			return 1;
+		}
+	}
+
+	{	MSD msd(1, 1, 1, 1, 0, 0, 0, 0, 0);  // a single FM_L atom
+		MSD::Parameters p;
+		p.kT = 0.5;
+		p.B = Vector(0, 0, 2);
+		p.FL = 0.8;
+		msd.setParameters(p);
+		msd.flippingAlgorithm = MSD::CONE_MODEL;
+		msd.randomize();
+		msd.tuneProposals(20000, 0.4);
+		msd.metropolis(400000, 1);
+
+		double rate = msd.getAcceptanceStats().rateL();
+		if (abs(rate - 0.4) > 0.1) {
+			cout << "(single atom) acceptance rate = " << rate << ", proposalSteps.L = " << msd.proposalSteps.L << "\n";
+			return 1;
+		}
+
+		const double b = p.B.norm() / p.kT;
+		const unsigned int K = 1000;  // Simpson's rule for the flux
+		double z = 0, mz = 0;
+		for (unsigned int k = 0; k <= K; k++) {
+			double r = p.FL * k / K;
+			double w = (k == 0 || k == K) ? 1 : (k % 2 == 1 ? 4 : 2);
+			z += w * Z(b * r);
+			mz += w * r * uZ(b * r);
+		}
+		double expected = uZ(b) / Z(b) + mz / z;
+		double actual = msd.meanM().z;
+		if (abs(actual - expected) > 0.01) {
+			cout << "(single atom) <M_z> = " << actual << ", expected " << expected << "\n";
+			return 1;
+		}
+	}
+
+	cout << "Done. (Passed)\n";
+	return 0;
+}
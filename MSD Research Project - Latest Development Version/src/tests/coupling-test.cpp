@@ -0,0 +1,110 @@
+/**
+ * @file coupling-test.cpp
+ * @brief Tests MSD::couplingEnergies, MSD::recordCouplings, and the fluctuation estimators (dMeanU, dMeanM).
+ *
+ * 1. Random MSDs (uniform mol. parameters): U must equal sum(coupling * dU/dcoupling), including after metropolis.
+ * 2. An 8 atom Ising chain (UP_DOWN_MODEL) in a magnetic field: d<U>/dJL and d<M_y>/dJL from a recorded run must
+ *    match the exact values found by enumerating all 2^8 states.
+ */
+
+#include <cmath>
+#include <cstdlib>
+#include <iostream>
+#include <vector>
+#include "../MSD.h"
+#include "test-util.h"
+
+using namespace std;
+using namespace udc;
+using namespace udc::test;
+
+const unsigned int numIter = 50;
+double maxErr = 1e-9;
+
+double energy(const MSD::Parameters &p, const Molecule::NodeParameters &pn, const Molecule::EdgeParameters &pe,
+		const MSD::CouplingEnergies &c) {
+	return p.B * c.B
+	     + p.JL * c.JL + p.JR * c.JR + pe.Jm * c.Jm + p.JmL * c.JmL + p.JmR * c.JmR + p.JLR * c.JLR
+	     + p.Je0L * c.Je0L + p.Je0R * c.Je0R + pn.Je0m * c.Je0m
+	     + p.Je1L * c.Je1L + p.Je1R * c.Je1R + pe.Je1m * c.Je1m + p.Je1mL * c.Je1mL + p.Je1mR * c.Je1mR + p.Je1LR * c.Je1LR
+	     + p.JeeL * c.JeeL + p.JeeR * c.JeeR + pe.Jeem * c.Jeem + p.JeemL * c.JeemL + p.JeemR * c.JeemR + p.JeeLR * c.JeeLR
+	     + p.bL * c.bL + p.bR * c.bR + pe.bm * c.bm + p.bmL * c.bmL + p.bmR * c.bmR + p.bLR * c.bLR
+	     + p.AL * c.AL + p.AR * c.AR + pn.Am * c.Am
+	     + p.DL * c.DL + p.DR * c.DR + pe.Dm * c.Dm + p.DmL * c.DmL + p.DmR * c.DmR + p.DLR * c.DLR;
+}
+
+int main(int argc, char *argv[]) {
+	if (argc > 1)
+		maxErr = atof(argv[1]);
+
+	Random rng;
+
+	for (unsigned int n = 0; n < numIter; n++) {
+		shared_ptr<MSD> msd = rng.randMSD(8);
+		Molecule::NodeParameters pn = rng.randPNode();
+		Molecule::EdgeParameters pe = rng.randPEdge();
+		msd->setMolParameters(pn, pe);
+		msd->randomize();
+		msd->recordCouplings = true;
+		msd->metropolis(1000, 100);
+
+		if (msd->couplingRecord.size() != msd->record.size()) {
+			cout << "(random MSD) couplingRecord.size() = " << msd->couplingRecord.size()
+			     << ", expected " << msd->record.size() << "\n";
+			return 1;
+		}
+		for (size_t i = 0; i < msd->record.size(); i++) {
+			double U = msd->record[i].U;
+			double actual = energy(msd->getParameters(), pn, pe, msd->couplingRecord[i]);
+			if (abs(actual - U) > maxErr * (1 + abs(U))) {
+				cout << "(random MSD) n = " << n << ", i = " << i << ": sum(coupling * component) = " << actual
+				     << ", expected U = " << U << "\n";
+				return 1;
+			}
+		}
+	}
+
+	{	const unsigned int N = 8;
+		MSD msd(N, 1, 1, N, N - 1, 0, 0, 0, 0);  // a chain of FM_L atoms
+		MSD::Parameters p;
+		p.kT = 1.5;
+		p.JL = 0.5;
+		p.B = Vector(0, 0.2, 0);  // spins start along the y-axis
+		msd.setParameters(p);
+		msd.flippingAlgorithm = MSD::UP_DOWN_MODEL;
+
+		// exact: U = -JL * C - B_y * M_y, where C = sum(s_i * s_j)
+		double Z = 0, sumU = 0, sumC = 0, sumUC = 0, sumM = 0, sumMC = 0;
+		for (unsigned int state = 0; state < (1u << N); state++) {
+			for (unsigned int a = 0; a < N; a++)
+				msd.setLocalM(a, Vector(0, (state >> a & 1) ? 1 : -1, 0), Vector::ZERO);
+			MSD::Results r = msd.getResults();
+			double C = msd.couplingEnergies().JL;  // == dU/dJL
+			double w = exp(-r.U / p.kT);
+			Z += w;
+			sumU += w * r.U;
+			sumC += w * C;
+			sumUC += w * r.U * C;
+			sumM += w * r.M.y;
+			sumMC += w * r.M.y * C;
+		}
+		double meanC = sumC / Z;
+		double expectedU = meanC - (sumUC / Z - sumU / Z * meanC) / p.kT;
+		double expectedM = -(sumMC / Z - sumM / Z * meanC) / p.kT;
+
+		msd.reinitialize();
+		msd.metropolis(10000);
+		msd.recordCouplings = true;
+		msd.metropolis(2000000, 16);
+		double actualU = msd.dMeanU(&MSD::CouplingEnergies::JL);
+		double actualM = msd.dMeanM(&MSD::CouplingEnergies::JL).y;
+		if (abs(actualU - expectedU) > 0.05 * abs(expectedU) || abs(actualM - expectedM) > 0.05 * abs(expectedM)) {
+			cout << "(Ising chain) d<U>/dJL = " << actualU << ", d<M_y>/dJL = " << actualM
+			     << ", expected " << expectedU << ", " << expectedM << "\n";
+			return 1;
+		}
+	}
+
+	cout << "Done. (Passed)\n";
+	return 0;
+}
@@ -0,0 +1,126 @@
+/**
+ * @file domain-test.cpp
+ * @brief Tests DomainMSD.
+ *
+ * 1. Random MSDs, with 1 to 4 threads: after sweeps, the Results (summed from every slab) must match a full
+ *    recalculation by an MSD in the same state, and the record and time must count sweeps.
+ * 2. Independent spins (J == 0, UP_DOWN_MODEL) in a magnetic field B, split into 4 slabs: every phase of the sweep
+ *    must give <M * B / |B|> = tanh(|B| / kT) per atom.
+ * 3. An Ising slab (UP_DOWN_MODEL, F == 0) at low kT: 4 slabs (with pinned threads) must give the same <U> as the
+ *    serial MSD::metropolis, so the halo exchange can't have lost any updates.
+ * 4. Slabs must be at least 2 planes thick, and unsupported flipping algorithms must be rejected.
+ */
+
+#include <cmath>
+#include <cstdlib>
+#include <iostream>
+#include <stdexcept>
+#include "../MSD.h"
+#include "../DomainMSD.h"
+#include "test-util.h"
+
+using namespace std;
+using namespace udc;
+using namespace udc::test;
+
+const unsigned int numIter = 40;
+double maxErr = 1e-9;
+
+int main(int argc, char *argv[]) {
+	if (argc > 1)
+		maxErr = atof(argv[1]);
+
+	Random rng;
+
+	// ----- 1. random MSDs -----
+	for (unsigned int n = 0; n < numIter; n++) {
+		shared_ptr<MSD> msd = rng.randMSD(10);
+		msd->setMolParameters(rng.randPNode(), rng.randPEdge());
+		msd->flippingAlgorithm = n % 2 == 0 ? MSD::CONTINUOUS_SPIN_MODEL : MSD::UP_DOWN_MODEL;
+		msd->randomize();
+		DomainMSD domain(*msd, 1 + n % 4);
+		Vector B = rng.randV();
+		domain.setB(B);
+		domain.sweep(20, 5);
+		if (domain.record.size() != 5 || domain.getResults().t != msd->getResults().t + 20 * msd->getN()) {
+			cout << "(random MSD) record.size() = " << domain.record.size() << ", expected 5, or wrong time\n";
+			return 1;
+		}
+		msd->setB(B);
+		domain.exportState(*msd);
+		msd->setParameters(msd->getParameters());  // force recalculation
+		msd->setMolProto(msd->getMolProto());
+		double d = cmpResults(domain.getResults(), msd->getResults(), maxErr);
+		if (d > maxErr) {
+			cout << "(random MSD) Max error reached: n = " << n << ", slabs = " << domain.getSlabs() << ", d = " << d << "\n";
+			return 1;
+		}
+	}
+
+	// ----- 2. distribution -----
+	{	MSD msd(4, 4, 16, 2, 1, 0, 3, 0, 15);  // FM_L and FM_R, no mol.
+		MSD::Parameters p;
+		p.kT = 0.5;
+		p.B = Vector(0, 0.5, 0);  // spins start along the y-axis
+		p.JL = p.JR = p.JLR = 0;
+		p.FL = p.FR = 0;
+		msd.setParameters(p);
+		msd.flippingAlgorithm = MSD::UP_DOWN_MODEL;
+		DomainMSD domain(msd, 4);
+		domain.sweep(20000, 1);
+		double M = 0;
+		for (const MSD::Results &r : domain.record)
+			M += r.M.y;
+		M /= domain.record.size() * domain.getN();
+		double expected = tanh(p.B.norm() / p.kT);
+		if (domain.getSlabs() != 4 || abs(M - expected) > 0.01) {
+			cout << "(distribution) <M_y> per atom = " << M << ", expected " << expected << "\n";
+			return 1;
+		}
+	}
+
+	// ----- 3. same <U> as MSD::metropolis -----
+	{	MSD msd(4, 4, 12, 4, 3, 0, 3, 0, 0);  // FM_L only
+		MSD::Parameters p;
+		p.kT = 2;
+		p.JL = 1;
+		p.FL = 0;
+		msd.setParameters(p);
+		msd.flippingAlgorithm = MSD::UP_DOWN_MODEL;
+		DomainMSD domain(msd, 4, true);
+		domain.sweep(2000);
+		domain.sweep(40000, 1);
+		msd.metropolis(2000 * msd.getN());
+		msd.metropolis(40000ull * msd.getN(), msd.getN());
+		double U = 0, expected = 0;
+		for (const MSD::Results &r : domain.record)
+			U += r.U;
+		for (const MSD::Results &r : msd.record)
+			expected += r.U;
+		U /= domain.record.size() * domain.getN();
+		expected /= msd.record.size() * msd.getN();
+		if (domain.getSlabs() != 4 || abs(U - expected) > 0.01) {
+			cout << "(Ising) <U> per atom = " << U << ", expected " << expected << "\n";
+			return 1;
+		}
+	}
+
+	// ----- 4. slabs and bad algorithms -----
+	{	MSD msd(6, 3, 5, MSD::LINEAR_MOL, 2, 3, 0, 2, 0, 4);
+		bool ok = DomainMSD(msd, 8).getSlabs() == 2 && DomainMSD(msd, 1).getSlabs() == 1;
+		msd.flippingAlgorithm = MSD::CONE_MODEL;
+		try {
+			DomainMSD domain(msd, 2);
+			ok = false;
+		} catch (const invalid_argument &) {
+			// expected
+		}
+		if (!ok) {
+			cout << "(slabs) wrong number of slabs, or CONE_MODEL was accepted\n";
+			return 1;
+		}
+	}
+
+	cout << "Done. (Passed)\n";
+	return 0;
+}
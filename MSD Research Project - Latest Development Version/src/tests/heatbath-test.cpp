@@ -0,0 +1,65 @@
+/**
+ * @file heatbath-test.cpp
+ * @brief Tests MSD::HEAT_BATH_MODEL.
+ *
+ * 1. Random MSDs: after metropolis with the heat-bath model the incrementally updated
+ *    Results must match a full recalculation.
+ * 2. A single spin (S = 1, F = 0) in a magnetic field B: every step is a Gibbs sample,
+ *    so <s * B / |B|> must match the Langevin function, coth(x) - 1/x, where x = |B| / kT.
+ */
+
+#include <cmath>
+#include <cstdlib>
+#include <iostream>
+#include "../MSD.h"
+#include "test-util.h"
+
+using namespace std;
+using namespace udc;
+using namespace udc::test;
+
+const unsigned int numIter = 50;
+double maxErr = 1e-9;
+
+int main(int argc, char *argv[]) {
+	if (argc > 1)
+		maxErr = atof(argv[1]);
+
+	Random rng;
+
+	for (unsigned int n = 0; n < numIter; n++) {
+		shared_ptr<MSD> msd = rng.randMSD(8);
+		msd->flippingAlgorithm = MSD::HEAT_BATH_MODEL;
+		msd->randomize();
+		msd->metropolis(5000);
+
+		MSD::Results r1 = msd->getResults();
+		msd->setParameters(msd->getParameters());  // force recalculation
+		msd->setMolProto(msd->getMolProto());
+		MSD::Results r2 = msd->getResults();
+		double d = cmpResults(r1, r2, maxErr);
+		if (d > maxErr) {
+			cout << "(random MSD) Max error reached: n = " << n << ", d = " << d << "\n";
+			return 1;
+		}
+	}
+
+	{	MSD msd(1, 1, 1, 1, 0, 0, 0, 0, 0);  // a single FM_L atom
+		MSD::Parameters p;
+		p.kT = 1;
+		p.B = Vector(0, 0, 2);
+		msd.setParameters(p);
+		msd.flippingAlgorithm = MSD::HEAT_BATH_MODEL;
+		msd.metropolis(200000, 1);
+		double x = p.B.norm() / p.kT;
+		double expected = 1 / tanh(x) - 1 / x;
+		double actual = msd.meanM().z;
+		if (abs(actual - expected) > 0.01) {
+			cout << "(single spin) <M_z> = " << actual << ", expected " << expected << "\n";
+			return 1;
+		}
+	}
+
+	cout << "Done. (Passed)\n";
+	return 0;
+}
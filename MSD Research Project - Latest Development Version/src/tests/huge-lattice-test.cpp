@@ -0,0 +1,133 @@
+/**
+ * @file huge-lattice-test.cpp
+ * @brief Tests the COMPACT site order, MSD::getCapacity, and MSD::estimateMemory.
+ *
+ * 1. For the same seed, an MSD constructed in COMPACT order must give the same run as ROW_MAJOR, store only its
+ *    atoms (getCapacity() == getN()), and reject positions that aren't atoms.
+ * 2. Random MSDs: in COMPACT and HILBERT order, the Results must still match a full recalculation.
+ * 3. Random geometries: estimateMemory must count the same atoms as the constructor, and COMPACT must need less memory
+ *    than ROW_MAJOR for a sparse MSD.
+ * 4. An MSD whose bounding box has more than 2^32 positions must be rejected in ROW_MAJOR order, but work in
+ *    COMPACT order.
+ */
+
+#include <cstdlib>
+#include <iostream>
+#include <stdexcept>
+#include "../MSD.h"
+#include "test-util.h"
+
+using namespace std;
+using namespace udc;
+using namespace udc::test;
+
+double maxErr = 1e-9;
+
+MSD * makeMSD(MSD::SiteOrder order) {
+	MSD *msd = new MSD(7, 5, 6, MSD::LINEAR_MOL, 2, 4, 1, 3, 0, 4, order);
+	MSD::Parameters p;
+	p.kT = 0.5;
+	p.JL = p.JR = 1;
+	p.JmL = p.JmR = 0.5;
+	p.FL = 0.25;
+	msd->setParameters(p);
+	return msd;
+}
+
+int main(int argc, char *argv[]) {
+	if (argc > 1)
+		maxErr = atof(argv[1]);
+
+	// ----- 1. same run -----
+	{	MSD *ref = makeMSD(MSD::ROW_MAJOR);
+		MSD *msd = makeMSD(MSD::COMPACT);
+		ref->randomize(false);
+		ref->metropolis(20000);
+		msd->setSeed(ref->getSeed());
+		msd->randomize(false);
+		msd->metropolis(20000);
+		bool ok = msd->getSiteOrder() == MSD::COMPACT && msd->getCapacity() == msd->getN()
+		          && ref->getCapacity() == 7 * 5 * 6;
+		for (auto i = ref->begin(), j = msd->begin(); ok && i != ref->end(); ++i, ++j)
+			ok = i.getX() == j.getX() && i.getY() == j.getY() && i.getZ() == j.getZ()
+			     && i.getSpin() == j.getSpin() && i.getFlux() == j.getFlux();
+		try {
+			msd->getSpin(0, 0, 5);  // FM_L is only y = 1 to 3
+			ok = false;
+		} catch (const out_of_range &) {
+			// expected
+		}
+		delete ref;
+		delete msd;
+		if (!ok) {
+			cout << "(same run) COMPACT changed the run, or stored the wrong positions\n";
+			return 1;
+		}
+	}
+
+	// ----- 2. random MSDs -----
+	Random rng;
+	for (unsigned int n = 0; n < 20; n++) {
+		shared_ptr<MSD> msd = rng.randMSD(8);
+		msd->setMolParameters(rng.randPNode(), rng.randPEdge());
+		msd->setSiteOrder(n % 2 == 0 ? MSD::COMPACT : MSD::HILBERT);
+		msd->sweepMode = n % 4 < 2 ? MSD::RANDOM_SITE : MSD::TYPEWRITER;
+		msd->clusterFreq = n % 3 == 0 ? 10 : 0;
+		msd->randomize();
+		msd->metropolis(5000);
+		MSD::Results r1 = msd->getResults();
+		msd->setParameters(msd->getParameters());  // force recalculation
+		msd->setMolProto(msd->getMolProto());
+		double d = cmpResults(r1, msd->getResults(), maxErr);
+		if (msd->getCapacity() != msd->getN() || d > maxErr) {
+			cout << "(random MSD) stored empty positions, or max error reached: n = " << n << ", d = " << d << "\n";
+			return 1;
+		}
+	}
+
+	// ----- 3. memory estimates -----
+	for (unsigned int n = 0; n < 50; n++) {
+		unsigned int W = rng.randI(1, 9), H = rng.randI(1, 9), D = rng.randI(1, 9);
+		unsigned int molPosL, molPosR, topL, bottomL, frontR, backR;
+		rng.randPair(0, W + 1, molPosL, molPosR);
+		rng.randPair(0, H, topL, bottomL);
+		rng.randPair(0, D, frontR, backR);
+		MSD msd(W, H, D, molPosL, molPosR, topL, bottomL, frontR, backR, MSD::COMPACT);
+		long long N = msd.getN(), cells = W * H * D;
+		long long slot = 2 * sizeof(SparseArrayValue<Vector>)
+		                 + (msd.getMolPosL() <= msd.getMolPosR() ? sizeof(SparseArrayValue< shared_ptr<MSD::Mol> >) : 0);
+		long long compact = MSD::estimateMemory(W, H, D, molPosL, molPosR, topL, bottomL, frontR, backR, MSD::COMPACT);
+		long long rowMajor = MSD::estimateMemory(W, H, D, molPosL, molPosR, topL, bottomL, frontR, backR, MSD::ROW_MAJOR);
+		if (compact - rowMajor != (N - cells) * slot + 3 * 4 * N + 4 * H * D) {
+			cout << "(memory) estimateMemory counted the wrong atoms: n = " << n << "\n";
+			return 1;
+		}
+	}
+	if (MSD::estimateMemory(100, 100, 100, 99, 98, 0, 0, 0, 0, MSD::COMPACT) * 10
+	    > MSD::estimateMemory(100, 100, 100, 99, 98, 0, 0, 0, 0, MSD::ROW_MAJOR)) {
+		cout << "(memory) COMPACT isn't smaller for a sparse MSD\n";
+		return 1;
+	}
+
+	// ----- 4. more than 2^32 positions -----
+	{	bool ok = false;
+		try {
+			MSD msd(2000, 2200000, 1, MSD::LINEAR_MOL, 1999, 1999, 0, 0, 0, 0);
+		} catch (const length_error &) {
+			ok = true;
+		}
+		MSD msd(2000, 2200000, 1, MSD::LINEAR_MOL, 1999, 1999, 0, 0, 0, 0, MSD::COMPACT);
+		msd.randomize();
+		msd.metropolis(20000);
+		MSD::Results r1 = msd.getResults();
+		msd.setParameters(msd.getParameters());  // force recalculation
+		ok = ok && msd.getN() == 2000 && msd.getCapacity() == 2000 && cmpResults(r1, msd.getResults(), maxErr) <= maxErr;
+		if (!ok) {
+			cout << "(huge) a ROW_MAJOR index overflowed, or the COMPACT MSD was wrong\n";
+			return 1;
+		}
+	}
+
+	cout << "Done. (Passed)\n";
+	return 0;
+}
@@ -0,0 +1,121 @@
+/**
+ * @file ising-test.cpp
+ * @brief Tests IsingMSD.
+ *
+ * 1. Random MSDs (UP_DOWN_MODEL, F == 0): after metropolis, the Results of every replica (found from its bits) must
+ *    match a full recalculation by an MSD in the same state.
+ * 2. An 8 atom Ising chain: the <U> of every replica must match the exact value found by enumerating all 2^8 states
+ *    (at several kT, and with a field), and the replicas must be independent.
+ */
+
+#include <cmath>
+#include <cstdlib>
+#include <iostream>
+#include <vector>
+#include "../MSD.h"
+#include "../IsingMSD.h"
+#include "test-util.h"
+
+using namespace std;
+using namespace udc;
+using namespace udc::test;
+
+const unsigned int numIter = 50;
+double maxErr = 1e-9;
+
+int main(int argc, char *argv[]) {
+	if (argc > 1)
+		maxErr = atof(argv[1]);
+
+	Random rng;
+
+	for (unsigned int n = 0; n < numIter; n++) {
+		shared_ptr<MSD> msd = rng.randMSD(8);
+		MSD::Parameters p = msd->getParameters();
+		p.FL = p.FR = 0;
+		msd->setParameters(p);
+		Molecule::NodeParameters node = rng.randPNode();
+		node.Fm = 0;
+		msd->setMolParameters(node, rng.randPEdge());
+		msd->reinitialize();
+		msd->flippingAlgorithm = MSD::UP_DOWN_MODEL;
+
+		IsingMSD ising(*msd);
+		ising.randomize();
+		ising.metropolis(2000, 100);
+
+		for (unsigned int k = 0; k < IsingMSD::REPLICAS; k++) {
+			if (ising.record[k].size() != 21) {
+				cout << "(random MSD) record[" << k << "].size() = " << ising.record[k].size() << ", expected 21\n";
+				return 1;
+			}
+			ising.exportState(k, *msd);
+			msd->setParameters(msd->getParameters());  // force recalculation
+			msd->setMolProto(msd->getMolProto());
+			double d = cmpResults(ising.getResults(k), msd->getResults(), maxErr);
+			if (d > maxErr) {
+				cout << "(random MSD) Max error reached: n = " << n << ", k = " << k << ", d = " << d << "\n";
+				return 1;
+			}
+		}
+	}
+
+	{	const unsigned int N = 8;
+		MSD msd(N, 1, 1, N, N - 1, 0, 0, 0, 0);  // a chain of FM_L atoms
+		MSD::Parameters p;
+		p.JL = 1;
+		p.B = Vector(0, 0.3, 0);  // spins start along the y-axis
+		msd.setParameters(p);
+		msd.flippingAlgorithm = MSD::UP_DOWN_MODEL;
+
+		vector<double> U;  // exact energies
+		for (unsigned int state = 0; state < (1u << N); state++) {
+			for (unsigned int a = 0; a < N; a++)
+				msd.setLocalM(a, Vector(0, (state >> a & 1) ? 1 : -1, 0), Vector::ZERO);
+			U.push_back(msd.getResults().U);
+		}
+		msd.reinitialize();
+
+		IsingMSD ising(msd);
+		for (double kT : { 0.5, 1.0, 2.0, 4.0 }) {
+			ising.set_kT(kT);
+			for (auto &r : ising.record)
+				r.clear();
+			ising.metropolis(10000);
+			ising.metropolis(200000, 16);
+
+			double Z = 0, sumU = 0;
+			for (double u : U) {
+				double w = exp(-u / kT);
+				Z += w;
+				sumU += w * u;
+			}
+			double expected = sumU / Z, all = 0;
+			for (unsigned int k = 0; k < IsingMSD::REPLICAS; k++) {
+				double actual = 0;
+				for (const MSD::Results &r : ising.record[k])
+					actual += r.U;
+				actual /= ising.record[k].size();
+				all += actual / IsingMSD::REPLICAS;
+				if (abs(actual - expected) > 0.25) {
+					cout << "(Ising chain) kT = " << kT << ", k = " << k << ": <U> = " << actual << ", expected " << expected << "\n";
+					return 1;
+				}
+			}
+			if (abs(all - expected) > 0.03) {
+				cout << "(Ising chain) kT = " << kT << ": <U> of all replicas = " << all << ", expected " << expected << "\n";
+				return 1;
+			}
+			bool same = true;  // replicas must be independent
+			for (size_t i = 0; i < ising.record[0].size() && same; i++)
+				same = ising.record[0][i].U == ising.record[1][i].U;
+			if (same) {
+				cout << "(Ising chain) kT = " << kT << ": replicas 0 and 1 have the same record\n";
+				return 1;
+			}
+		}
+	}
+
+	cout << "Done. (Passed)\n";
+	return 0;
+}
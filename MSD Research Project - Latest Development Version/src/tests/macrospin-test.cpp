@@ -0,0 +1,130 @@
+/**
+ * @file macrospin-test.cpp
+ * @brief Tests MSD::macrospinSweep and MSD::macrospinFreq (coarse-grained FMs).
+ *
+ * 1. Random MSDs: after metropolis with macrospinFreq != 0, the Results must match a full recalculation, every
+ *    layer of each FM must still be aligned, and the FM fluxes must be unchanged.
+ * 2. Independent spins (J == 0, UP_DOWN_MODEL) in a magnetic field B: a layer of k atoms is one spin of magnitude k,
+ *    so FM_L must have <M * B / |B|> = tanh(k |B| / kT) per atom, while the mol. atoms still have tanh(|B| / kT).
+ * 3. metropolis must never pick an FM atom, clusterFlip must do nothing, and nFoldWay must refuse to run.
+ */
+
+#include <cmath>
+#include <cstdlib>
+#include <iostream>
+#include <map>
+#include <stdexcept>
+#include "../MSD.h"
+#include "test-util.h"
+
+using namespace std;
+using namespace udc;
+using namespace udc::test;
+
+const unsigned int numIter = 20;
+double maxErr = 1e-9;
+
+int main(int argc, char *argv[]) {
+	if (argc > 1)
+		maxErr = atof(argv[1]);
+
+	Random rng;
+
+	// ----- 1. random MSDs -----
+	for (unsigned int n = 0; n < numIter; n++) {
+		shared_ptr<MSD> msd = rng.randMSD(8);
+		msd->setMolParameters(rng.randPNode(), rng.randPEdge());
+		msd->flippingAlgorithm = n % 3 == 0 ? MSD::UP_DOWN_MODEL : n % 3 == 1 ? MSD::CONE_MODEL : MSD::CONTINUOUS_SPIN_MODEL;
+		msd->reinitialize();  // (every layer starts aligned)
+		map<unsigned int, Vector> fluxes;
+		for (auto i = msd->begin(); i != msd->end(); ++i)
+			fluxes[i.getIndex()] = i.getFlux();
+		msd->macrospinFreq = 5;
+		msd->metropolis(5000);
+
+		MSD::Results r1 = msd->getResults();
+		msd->setParameters(msd->getParameters());  // force recalculation
+		msd->setMolProto(msd->getMolProto());
+		double d = cmpResults(r1, msd->getResults(), maxErr);
+		if (d > maxErr) {
+			cout << "(random MSD) Max error reached: n = " << n << ", d = " << d << "\n";
+			return 1;
+		}
+
+		map<unsigned int, Vector> direction;  // of each layer (x)
+		for (auto i = msd->begin(); i != msd->end(); ++i) {
+			unsigned int x = i.getX();
+			if (msd->getMolPosL() <= x && x <= msd->getMolPosR())
+				continue;
+			Vector s = i.getSpin();
+			if (i.getFlux() != fluxes[i.getIndex()]) {
+				cout << "(random MSD) an FM flux changed: n = " << n << "\n";
+				return 1;
+			}
+			if (s.normSq() == 0)
+				continue;
+			s = (1 / s.norm()) * s;
+			if (direction.count(x) == 0)
+				direction[x] = s;
+			else if ((direction[x] - s).norm() > 1e-9) {
+				cout << "(random MSD) layer x = " << x << " isn't aligned: n = " << n << "\n";
+				return 1;
+			}
+		}
+	}
+
+	// ----- 2. distribution -----
+	{	MSD msd(3, 2, 2, 1, 1, 0, 1, 0, 1);
+		MSD::Parameters p;
+		p.kT = 1;
+		p.B = Vector(0, 0.25, 0);  // spins start along the y-axis
+		p.JL = p.JR = p.JmL = p.JmR = p.JLR = 0;
+		msd.setParameters(p);
+		Molecule::NodeParameters node;
+		Molecule::EdgeParameters edge;
+		edge.Jm = 0;
+		msd.setMolParameters(node, edge);
+		msd.flippingAlgorithm = MSD::UP_DOWN_MODEL;
+		msd.macrospinFreq = 1;
+		msd.metropolis(1000000, 10);
+		double L = 0, m = 0;
+		for (const MSD::Results &r : msd.record) {
+			L += r.ML.y;
+			m += r.Mm.y;
+		}
+		L /= msd.record.size() * msd.getNL();
+		m /= msd.record.size() * msd.getNm();
+		double expectedL = tanh(msd.getNL() * p.B.norm() / p.kT), expected_m = tanh(p.B.norm() / p.kT);
+		if (abs(L - expectedL) > 0.02 || abs(m - expected_m) > 0.02) {
+			cout << "(distribution) <M_y> per atom = " << L << ", " << m << ", expected " << expectedL << ", "
+			     << expected_m << "\n";
+			return 1;
+		}
+	}
+
+	// ----- 3. no single FM atom moves -----
+	{	MSD msd(6, 4, 4, MSD::LINEAR_MOL, 2, 3, 0, 3, 0, 3);
+		MSD::Parameters p;
+		p.FL = p.FR = 0;
+		msd.setParameters(p);
+		msd.flippingAlgorithm = MSD::UP_DOWN_MODEL;
+		msd.macrospinFreq = 100;
+		msd.resetAcceptanceStats();
+		msd.metropolis(10000);
+		MSD::AcceptanceStats stats = msd.getAcceptanceStats();
+		bool ok = stats.triedL == 0 && stats.triedR == 0 && stats.triedm == 10000 && msd.clusterFlip() == 0;
+		try {
+			msd.nFoldWay(100);
+			ok = false;
+		} catch (const invalid_argument &) {
+			// expected
+		}
+		if (!ok) {
+			cout << "(FM atoms) an FM atom was picked, or nFoldWay didn't throw\n";
+			return 1;
+		}
+	}
+
+	cout << "Done. (Passed)\n";
+	return 0;
+}
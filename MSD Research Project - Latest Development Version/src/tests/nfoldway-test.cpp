@@ -0,0 +1,105 @@
+/**
+ * @file nfoldway-test.cpp
+ * @brief Tests MSD::nFoldWay (rejection-free UP_DOWN_MODEL).
+ *
+ * 1. Random MSDs (with all F == 0): after nFoldWay the incrementally updated Results must match
+ *    a full recalculation, and exactly N steps of time must have passed.
+ * 2. A single spin (S = 1) in a magnetic field B along the spin's axis:
+ *    <M * B / |B|> must match tanh(|B| / kT).
+ * 3. nFoldWay must refuse to run if any F != 0, or if sweepMode isn't RANDOM_SITE.
+ */
+
+#include <cmath>
+#include <cstdlib>
+#include <iostream>
+#include <stdexcept>
+#include "../MSD.h"
+#include "test-util.h"
+
+using namespace std;
+using namespace udc;
+using namespace udc::test;
+
+const unsigned int numIter = 50;
+double maxErr = 1e-9;
+
+int main(int argc, char *argv[]) {
+	if (argc > 1)
+		maxErr = atof(argv[1]);
+
+	Random rng;
+
+	for (unsigned int n = 0; n < numIter; n++) {
+		shared_ptr<MSD> msd = rng.randMSD(8);
+		MSD::Parameters p = msd->getParameters();
+		p.FL = p.FR = 0;
+		msd->setParameters(p);
+		Molecule::NodeParameters nodeParams = rng.randPNode();
+		nodeParams.Fm = 0;
+		msd->setMolParameters(nodeParams, rng.randPEdge());
+		msd->flippingAlgorithm = MSD::UP_DOWN_MODEL;
+		msd->randomize();
+		msd->metropolis(1000);
+		unsigned long long t = msd->getResults().t;
+		msd->nFoldWay(5000, 250);
+
+		MSD::Results r1 = msd->getResults();
+		if (r1.t != t + 5000) {
+			cout << "(random MSD) wrong time: n = " << n << ", t = " << r1.t << ", expected " << t + 5000 << "\n";
+			return 1;
+		}
+		msd->setParameters(msd->getParameters());  // force recalculation
+		msd->setMolProto(msd->getMolProto());
+		MSD::Results r2 = msd->getResults();
+		double d = cmpResults(r1, r2, maxErr);
+		if (d > maxErr) {
+			cout << "(random MSD) Max error reached: n = " << n << ", d = " << d << "\n";
+			return 1;
+		}
+	}
+
+	{	MSD msd(1, 1, 1, 1, 0, 0, 0, 0, 0);  // a single FM_L atom
+		MSD::Parameters p;
+		p.kT = 0.5;
+		p.B = Vector(0, 0.5, 0);  // spins start along the y-axis
+		msd.setParameters(p);
+		msd.flippingAlgorithm = MSD::UP_DOWN_MODEL;
+		msd.nFoldWay(2000000, 1);
+		double expected = tanh(p.B.norm() / p.kT);
+		double actual = msd.meanM().y;
+		if (abs(actual - expected) > 0.01) {
+			cout << "(single spin) <M_y> = " << actual << ", expected " << expected << "\n";
+			return 1;
+		}
+	}
+
+	{	MSD msd(6, 4, 4, 2, 3, 1, 2, 1, 2);
+		MSD::Parameters p;
+		p.FR = 0.5;
+		msd.setParameters(p);
+		try {
+			msd.nFoldWay(100);
+			cout << "(F != 0) nFoldWay didn't throw\n";
+			return 1;
+		} catch (const invalid_argument &) {
+			// expected
+		}
+
+		p.FR = 0;
+		msd.setParameters(p);
+		msd.setMolParameters(Molecule::NodeParameters(), Molecule::EdgeParameters());
+		msd.sweepMode = MSD::CHECKERBOARD;
+		try {
+			msd.nFoldWay(100);
+			cout << "(sweepMode) nFoldWay didn't throw\n";
+			return 1;
+		} catch (const invalid_argument &) {
+			// expected
+		}
+		msd.sweepMode = MSD::RANDOM_SITE;
+		msd.nFoldWay(100);  // shouldn't throw
+	}
+
+	cout << "Done. (Passed)\n";
+	return 0;
+}
@@ -0,0 +1,78 @@
+/**
+ * @file overrelax-test.cpp
+ * @brief Tests MSD::overrelax (over-relaxation sweeps).
+ *
+ * 1. Random MSDs: after many over-relaxation sweeps (mixed with metropolis) the incrementally updated
+ *    Results must match a full recalculation.
+ * 2. Random MSDs without anisotropy or biquadratic coupling: every reflection must be accepted,
+ *    and the total energy must not change (i.e. MSD::localField includes every linear term).
+ */
+
+#include <cstdlib>
+#include <iostream>
+#include "../MSD.h"
+#include "test-util.h"
+
+using namespace std;
+using namespace udc;
+using namespace udc::test;
+
+const unsigned int numIter = 50;
+double maxErr = 1e-9;
+
+int main(int argc, char *argv[]) {
+	if (argc > 1)
+		maxErr = atof(argv[1]);
+
+	Random rng;
+
+	for (unsigned int n = 0; n < numIter; n++) {
+		shared_ptr<MSD> msd = rng.randMSD(8);
+		msd->randomize();
+		msd->overrelaxRatio = 2;
+		msd->metropolis(5000);
+		for (unsigned int i = 0; i < 20; i++)
+			msd->overrelax();
+
+		MSD::Results r1 = msd->getResults();
+		msd->setParameters(msd->getParameters());  // force recalculation
+		msd->setMolProto(msd->getMolProto());
+		MSD::Results r2 = msd->getResults();
+		double d = cmpResults(r1, r2, maxErr);
+		if (d > maxErr) {
+			cout << "(random MSD) Max error reached: n = " << n << ", d = " << d << "\n";
+			return 1;
+		}
+	}
+
+	for (unsigned int n = 0; n < numIter; n++) {
+		shared_ptr<MSD> msd = rng.randMSD(8);
+		MSD::Parameters p = msd->getParameters();
+		p.AL = p.AR = Vector::ZERO;
+		p.bL = p.bR = p.bmL = p.bmR = p.bLR = 0;
+		msd->setParameters(p);
+		Molecule::NodeParameters nodeParams = rng.randPNode();
+		Molecule::EdgeParameters edgeParams = rng.randPEdge();
+		nodeParams.Am = Vector::ZERO;
+		edgeParams.bm = 0;
+		msd->setMolParameters(nodeParams, edgeParams);
+		msd->randomize();
+
+		double U = msd->getResults().U;
+		for (unsigned int i = 0; i < 20; i++) {
+			unsigned int accepted = msd->overrelax();
+			if (accepted != msd->getN()) {
+				cout << "(linear energy) reflection was rejected: n = " << n << ", accepted = " << accepted << " / " << msd->getN() << "\n";
+				return 1;
+			}
+		}
+		double d = abs(msd->getResults().U - U);
+		if (d > maxErr) {
+			cout << "(linear energy) energy changed: n = " << n << ", d = " << d << "\n";
+			return 1;
+		}
+	}
+
+	cout << "Done. (Passed)\n";
+	return 0;
+}
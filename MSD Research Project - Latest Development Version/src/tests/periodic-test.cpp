@@ -0,0 +1,213 @@
+/**
+ * @file periodic-test.cpp
+ * @brief Tests periodic boundaries in FM_L and FM_R (see: MSD::setPeriodic).
+ *
+ * 1. Random MSDs with random periodic axes (and site orders): after metropolis (with cluster moves, over-relaxation,
+ *    or heat bath), the Results must match a full recalculation.
+ * 2. With only J couplings (all 1) and every spin along y, U and couplingEnergies must be minus the number of bonds,
+ *    counted here with the edges of each periodic axis (at least 3 atoms long) bonded.
+ * 3. Without anisotropy or biquadratic coupling, every over-relaxation must keep U, so MSD::localField must orient
+ *    the DMI of the bonds across a boundary.
+ * 4. DomainMSD on periodic MSDs must match a full recalculation, including when a periodic boundary doesn't join
+ *    the first and last planes (so the slabs must be along the other axis, or there's only one).
+ * 5. A lead-only cube, periodic in x, y, and z, must give every atom 6 neighbors; bad axes must be rejected.
+ */
+
+#include <cstdlib>
+#include <iostream>
+#include <stdexcept>
+#include "../MSD.h"
+#include "../DomainMSD.h"
+#include "test-util.h"
+
+using namespace std;
+using namespace udc;
+using namespace udc::test;
+
+const unsigned int numIter = 40;
+double maxErr = 1e-9;
+
+// random periodic axes for each FM (PERIODIC_X only where it's allowed)
+void randPeriodic(Random &rng, MSD &msd) {
+	unsigned int axesL = 2 * rng.randI(4), axesR = 2 * rng.randI(4);
+	if (!msd.getMol_exists() && !msd.getFM_R_exists() && rng.rand() < 0.5)
+		axesL |= MSD::PERIODIC_X;
+	msd.setPeriodic(axesL, axesR);
+}
+
+// random MSD, which is sometimes only FM_L (so it can be periodic in x)
+shared_ptr<MSD> randDevice(Random &rng, unsigned int n) {
+	if (n % 4 != 3)
+		return rng.randMSD(8);
+	unsigned int width = rng.randI(1, 9), height = rng.randI(1, 9), depth = rng.randI(1, 9);
+	shared_ptr<MSD> msd = make_shared<MSD>(width, height, depth, width, width - 1, 0, height - 1, 0, depth - 1);
+	msd->setParameters(rng.randP());
+	return msd;
+}
+
+// J bonds within FM_L and FM_R (see: MSD::setParameters)
+unsigned int countBonds(const MSD &msd) {
+	const unsigned int molPosL = msd.getMolPosL(), molPosR = msd.getMolPosR();
+	unsigned int bonds = 0;
+	for (auto iter = msd.begin(); iter != msd.end(); ++iter) {
+		const unsigned int c[3] = { iter.getX(), iter.getY(), iter.getZ() };
+		const bool left = c[0] < molPosL;
+		if (!left && c[0] <= molPosR)
+			continue;  // mol.
+		const unsigned int first[3] = { left ? 0 : molPosR + 1, left ? msd.getTopL() : 0, left ? 0 : msd.getFrontR() };
+		const unsigned int last[3] = { left ? molPosL - 1 : msd.getWidth() - 1, left ? msd.getBottomL() : msd.getHeight() - 1,
+		                               left ? msd.getDepth() - 1 : msd.getBackR() };
+		const unsigned int periodic = left ? msd.getPeriodicL() : msd.getPeriodicR();
+		for (unsigned int axis = 0; axis < 3; axis++) {
+			unsigned int n[3] = { c[0], c[1], c[2] };
+			if (c[axis] < last[axis])
+				n[axis]++;
+			else if ((periodic & (1u << axis)) != 0 && last[axis] >= first[axis] + 2)
+				n[axis] = first[axis];
+			else
+				continue;
+			bonds += msd.hasAtom(n[0], n[1], n[2]);
+		}
+	}
+	return bonds;
+}
+
+int main(int argc, char *argv[]) {
+	if (argc > 1)
+		maxErr = atof(argv[1]);
+
+	Random rng;
+	const MSD::SiteOrder orders[] = { MSD::ROW_MAJOR, MSD::MORTON, MSD::HILBERT, MSD::COMPACT };
+
+	// ----- 1. random MSDs -----
+	for (unsigned int n = 0; n < numIter; n++) {
+		shared_ptr<MSD> msd = randDevice(rng, n);
+		msd->setSiteOrder(orders[n % 4]);
+		randPeriodic(rng, *msd);
+		msd->setMolParameters(rng.randPNode(), rng.randPEdge());
+		msd->flippingAlgorithm = n % 3 == 0 ? MSD::HEAT_BATH_MODEL : MSD::CONTINUOUS_SPIN_MODEL;
+		msd->clusterFreq = n % 2 == 0 ? 10 : 0;
+		msd->overrelaxRatio = n % 5 == 0 ? 1 : 0;
+		msd->randomize();
+		msd->metropolis(5000);
+		MSD::Results r1 = msd->getResults();
+		msd->setParameters(msd->getParameters());  // force recalculation
+		msd->setMolProto(msd->getMolProto());
+		double d = cmpResults(r1, msd->getResults(), maxErr);
+		if (d > maxErr) {
+			cout << "(random MSD) Max error reached: n = " << n << ", periodic = " << msd->getPeriodicL() << ", "
+			     << msd->getPeriodicR() << ", d = " << d << "\n";
+			return 1;
+		}
+	}
+
+	// ----- 2. bonds -----
+	for (unsigned int n = 0; n < numIter; n++) {
+		shared_ptr<MSD> msd = randDevice(rng, n);
+		randPeriodic(rng, *msd);
+		MSD::Parameters p;
+		p.JL = p.JR = 1;
+		p.JmL = p.JmR = p.JLR = 0;
+		msd->setParameters(p);
+		for (auto iter = msd->begin(); iter != msd->end(); ++iter)
+			msd->setLocalM(iter.getIndex(), Vector::J, Vector::ZERO);
+		double bonds = countBonds(*msd);
+		MSD::CouplingEnergies c = msd->couplingEnergies();
+		double U = msd->getResults().UL + msd->getResults().UR;
+		if (abs(U + bonds) > maxErr || abs(c.JL + c.JR + bonds) > maxErr) {
+			cout << "(bonds) UL + UR = " << U << ", JL + JR = " << c.JL + c.JR << ", expected " << -bonds
+			     << ": n = " << n << ", periodic = " << msd->getPeriodicL() << ", " << msd->getPeriodicR() << "\n";
+			return 1;
+		}
+	}
+
+	// ----- 3. DMI across the boundaries -----
+	for (unsigned int n = 0; n < numIter; n++) {
+		shared_ptr<MSD> msd = randDevice(rng, n);
+		msd->setSiteOrder(orders[n % 4]);
+		randPeriodic(rng, *msd);
+		MSD::Parameters p = msd->getParameters();
+		p.AL = p.AR = Vector::ZERO;
+		p.bL = p.bR = p.bmL = p.bmR = p.bLR = 0;
+		msd->setParameters(p);
+		Molecule::NodeParameters nodeParams = rng.randPNode();
+		Molecule::EdgeParameters edgeParams = rng.randPEdge();
+		nodeParams.Am = Vector::ZERO;
+		edgeParams.bm = 0;
+		msd->setMolParameters(nodeParams, edgeParams);
+		msd->randomize();
+		double U = msd->getResults().U;
+		for (unsigned int i = 0; i < 10; i++)
+			msd->overrelax();
+		double d = abs(msd->getResults().U - U);
+		if (d > maxErr) {
+			cout << "(DMI) over-relaxation changed the energy: n = " << n << ", d = " << d << "\n";
+			return 1;
+		}
+	}
+
+	// ----- 4. DomainMSD -----
+	for (unsigned int n = 0; n < numIter + 2; n++) {
+		shared_ptr<MSD> msd;
+		unsigned int slabs = 0;  // expected, if not 0
+		if (n == numIter) {  // tall, but FM_L only wraps around rows 2 to 9: slabs along z
+			msd = make_shared<MSD>(6, 12, 4, 3, 2, 2, 9, 0, 3);
+			msd->setPeriodic(MSD::PERIODIC_Y, MSD::PERIODIC_Y | MSD::PERIODIC_Z);
+			slabs = 2;
+		} else if (n == numIter + 1) {  // and FM_R only wraps around planes 1 to 3: one slab
+			msd = make_shared<MSD>(6, 12, 4, 3, 2, 2, 9, 1, 3);
+			msd->setPeriodic(MSD::PERIODIC_Y, MSD::PERIODIC_Z);
+			slabs = 1;
+		} else {
+			msd = rng.randMSD(10);
+			randPeriodic(rng, *msd);
+		}
+		msd->setParameters(rng.randP());
+		msd->setMolParameters(rng.randPNode(), rng.randPEdge());
+		msd->flippingAlgorithm = n % 2 == 0 ? MSD::CONTINUOUS_SPIN_MODEL : MSD::UP_DOWN_MODEL;
+		msd->randomize();
+		DomainMSD domain(*msd, 4);
+		domain.sweep(20);
+		domain.exportState(*msd);
+		msd->setParameters(msd->getParameters());  // force recalculation
+		msd->setMolProto(msd->getMolProto());
+		double d = cmpResults(domain.getResults(), msd->getResults(), maxErr);
+		if (d > maxErr || (slabs != 0 && domain.getSlabs() != slabs)) {
+			cout << "(DomainMSD) Max error reached, or wrong slabs: n = " << n << ", slabs = " << domain.getSlabs()
+			     << ", d = " << d << "\n";
+			return 1;
+		}
+	}
+
+	// ----- 5. bulk, and bad axes -----
+	{	MSD msd(5, 5, 5, 5, 4, 0, 4, 0, 4);  // only FM_L
+		msd.setPeriodic(MSD::PERIODIC_X | MSD::PERIODIC_Y | MSD::PERIODIC_Z, MSD::OPEN);
+		MSD::Parameters p;
+		p.JL = 1;
+		p.FL = 0;
+		p.B = Vector::ZERO;
+		msd.setParameters(p);
+		if (abs(msd.getResults().U + 3.0 * msd.getN()) > maxErr) {
+			cout << "(bulk) U = " << msd.getResults().U << ", expected " << -3.0 * msd.getN() << "\n";
+			return 1;
+		}
+
+		MSD device(5, 5, 5, 2, 2, 0, 4, 0, 4);
+		const unsigned int bad[][2] = { { 8, 0 }, { 0, MSD::PERIODIC_X }, { MSD::PERIODIC_X, 0 } };
+		for (const auto &axes : bad)
+			try {
+				device.setPeriodic(axes[0], axes[1]);
+				cout << "(bad axes) accepted " << axes[0] << ", " << axes[1] << "\n";
+				return 1;
+			} catch (const invalid_argument &) {
+				// expected
+			}
+		if (device.getPeriodicL() != MSD::OPEN || device.getPeriodicR() != MSD::OPEN) {
+			cout << "(bad axes) changed the periodic axes\n";
+			return 1;
+		}
+	}
+
+	cout << "Done. (Passed)\n";
+	return 0;
+}
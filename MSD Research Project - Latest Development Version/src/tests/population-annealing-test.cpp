@@ -0,0 +1,83 @@
+/**
+ * @file population-annealing-test.cpp
+ * @brief Tests PopulationAnnealing.
+ *
+ * An 8 atom Ising chain (UP_DOWN_MODEL, F == 0) in a magnetic field is annealed from kT = 4 to kT = 0.5:
+ * <U>, c, and ln(Z(kT) / Z(4)) at each kT must match the exact values found by enumerating all 2^8 states.
+ */
+
+#include <cmath>
+#include <cstdlib>
+#include <iostream>
+#include <vector>
+#include "../MSD.h"
+#include "../PopulationAnnealing.h"
+#include "test-util.h"
+
+using namespace std;
+using namespace udc;
+
+int main(int argc, char *argv[]) {
+	const unsigned int N = 8;
+	MSD::Parameters p;
+	p.JL = 1;
+	p.B = Vector(0, 0.3, 0);  // spins start along the y-axis
+	auto factory = [&]() {
+		shared_ptr<MSD> msd(new MSD(N, 1, 1, N, N - 1, 0, 0, 0, 0));  // a chain of FM_L atoms
+		msd->setParameters(p);
+		msd->flippingAlgorithm = MSD::UP_DOWN_MODEL;
+		return msd;
+	};
+
+	// exact energies
+	vector<double> U;
+	{	shared_ptr<MSD> msd = factory();
+		for (unsigned int state = 0; state < (1u << N); state++) {
+			for (unsigned int a = 0; a < N; a++)
+				msd->setLocalM(a, Vector(0, (state >> a & 1) ? 1 : -1, 0), Vector::ZERO);
+			U.push_back(msd->getResults().U);
+		}
+	}
+	auto lnZ = [&](double kT) {
+		double Z = 0;
+		for (double u : U)
+			Z += exp(-u / kT);
+		return log(Z);
+	};
+
+	vector<double> schedule;
+	for (double kT = 4; kT > 0.49; kT -= 0.25)
+		schedule.push_back(kT);
+
+	PopulationAnnealing pa(factory, 2000);
+	pa.sweeps = 50;
+	pa.run(schedule);
+
+	if (pa.getSteps().size() != schedule.size()) {
+		cout << "getSteps().size() = " << pa.getSteps().size() << ", expected " << schedule.size() << "\n";
+		return 1;
+	}
+	for (const PopulationAnnealing::Step &s : pa.getSteps()) {
+		double Z = 0, sumU = 0, sumU2 = 0;
+		for (double u : U) {
+			double w = exp(-u / s.kT);
+			Z += w;
+			sumU += w * u;
+			sumU2 += w * u * u;
+		}
+		double expectedU = sumU / Z;
+		double expectedC = (sumU2 / Z - expectedU * expectedU) / (N * s.kT * s.kT);
+		double expectedLnZ = lnZ(s.kT) - lnZ(schedule[0]);
+		double sigmaU = sqrt((sumU2 / Z - expectedU * expectedU) / s.effectiveFamilies);  // standard error
+		if (abs(s.meanU - expectedU) > 4 * sigmaU + 0.01 || abs(s.specificHeat - expectedC) > 0.25 * expectedC + 0.01
+				|| abs(s.lnZ - expectedLnZ) > 0.02 * abs(expectedLnZ) + 0.02) {
+			cout << "kT = " << s.kT << ": <U> = " << s.meanU << ", c = " << s.specificHeat << ", ln Z = " << s.lnZ
+			     << ", families = " << s.effectiveFamilies
+			     << ", expected <U> = " << expectedU << ", c = " << expectedC << ", ln Z = " << expectedLnZ << "\n";
+			return 1;
+		}
+	}
+
+	cout << "Done. (Passed)\n";
+	return 0;
+}
@@ -0,0 +1,138 @@
+/**
+ * @file replicas-test.cpp
+ * @brief Tests Replicas and HysteresisFeatures.
+ *
+ * 1. Replicas with the same seed must make the same rows no matter how many threads are used, every replica must
+ *    make different rows (including after stage resets), and each summary must be the mean and standard error
+ *    of the replicas' rows.
+ * 2. fork must copy the state of one replica into every other one.
+ * 3. HysteresisFeatures of a loop with known coercive fields and remanences, and Replicas::errorColumns.
+ */
+
+#include <cmath>
+#include <cstdlib>
+#include <iostream>
+#include <memory>
+#include <vector>
+#include "../MSD.h"
+#include "../Replicas.h"
+#include "test-util.h"
+
+using namespace std;
+using namespace udc;
+using namespace udc::test;
+
+const unsigned int R = 6;
+double maxErr = 1e-9;
+
+int main(int argc, char *argv[]) {
+	if (argc > 1)
+		maxErr = atof(argv[1]);
+
+	Random rng;
+	const unsigned long seed = rng.randI(1u << 30);
+	auto factory = [&]() {
+		shared_ptr<MSD> msd = make_shared<MSD>(6, 4, 4, 2, 3, 0, 3, 0, 3);
+		MSD::Parameters p;
+		p.kT = 0.5;
+		msd->setParameters(p);
+		msd->setSeed(seed);
+		return msd;
+	};
+	MSD::Schedule schedule;
+	schedule.hold(2000, 0.5, Vector(0, 0, 0.2)).ramp(2000, 0.5, 1.0, Vector(0, 0, 0.2), Vector(0, 0, -0.2), 200);
+	schedule.hold(1000, 1.0, Vector::ZERO).repeat(2);
+	schedule.stages[2].reset = MSD::Schedule::RANDOMIZE;
+	auto stageRow = [](size_t stage, const MSD &msd) {
+		return stage == 0 ? Replicas::Row() : Replicas::Row{ { msd.getResults().U }, { msd.getResults().M.x, msd.getResults().M.z } };
+	};
+
+	// ----- 1. rows -----
+	Replicas a(factory, R), b(factory, R);
+	a.threads = 1;
+	b.threads = 4;
+	a.stageRow = b.stageRow = stageRow;
+	a.recordRow = b.recordRow = [](size_t, const MSD &msd, const MSD::Results &r) {
+		return Replicas::Row{ { msd.getParameters().kT, r.U } };
+	};
+	a.randomize();
+	b.randomize();
+	a.run(schedule);
+	b.run(schedule);
+	const size_t rows = 5 + 11 * 2;  // stages 1 to 5 (not 0), and 11 records in each ramp
+	if (a.getRows().size() != rows || a.getRows(0).size() != rows) {
+		cout << "(rows) " << a.getRows().size() << " rows, expected " << rows << "\n";
+		return 1;
+	}
+	for (unsigned int i = 0; i < R; i++)
+		for (size_t j = 0; j < rows; j++)
+			if (a.getRows(i)[j] != b.getRows(i)[j]) {
+				cout << "(rows) replica " << i << ", row " << j << " depends on the number of threads\n";
+				return 1;
+			}
+	for (size_t j = 0; j < rows; j++) {
+		const Replicas::Summary &s = a.getRows()[j];
+		for (size_t g = 0; g < s.mean.size(); g++)
+			for (size_t v = 0; v < s.mean[g].size(); v++) {
+				double sum = 0, sum2 = 0;
+				for (unsigned int i = 0; i < R; i++)
+					sum += a.getRows(i)[j][g][v];
+				double mean = sum / R;
+				for (unsigned int i = 0; i < R; i++)
+					sum2 += pow(a.getRows(i)[j][g][v] - mean, 2);
+				double se = sqrt(sum2 / (R - 1) / R);
+				if (abs(s.mean[g][v] - mean) > maxErr || abs(s.stdError[g][v] - se) > maxErr * (1 + se)) {
+					cout << "(rows) row " << j << ": mean = " << s.mean[g][v] << ", SE = " << s.stdError[g][v]
+					     << ", expected " << mean << ", " << se << "\n";
+					return 1;
+				}
+			}
+	}
+	for (size_t j : { (size_t) 0, rows / 2 + 1, rows - 1 })  // before, after the first reset, and at the end
+		for (unsigned int i = 1; i < R; i++)
+			if (a.getRows(i)[j] == a.getRows(0)[j]) {
+				cout << "(rows) replicas 0 and " << i << " made the same row " << j << "\n";
+				return 1;
+			}
+
+	// ----- 2. fork -----
+	a.fork(a.getReplica(2));
+	for (unsigned int i = 0; i < R; i++) {
+		double d = cmpResults(a.getReplica(i).getResults(), a.getReplica(2).getResults(), maxErr);
+		if (d > maxErr || a.getReplica(i).getSpin(5, 3, 3) != a.getReplica(2).getSpin(5, 3, 3)) {
+			cout << "(fork) replica " << i << " wasn't copied\n";
+			return 1;
+		}
+	}
+
+	// ----- 3. hysteresis -----
+	{	vector<double> h, m;
+		for (double x = 1; x >= -1; x -= 0.125) {  // down: m = h + 0.25
+			h.push_back(x);
+			m.push_back(x + 0.25);
+		}
+		for (double x = -0.875; x <= 1; x += 0.125) {  // up: m = h - 0.25
+			h.push_back(x);
+			m.push_back(x - 0.25);
+		}
+		HysteresisFeatures f(h, m);
+		if (abs(f.coerciveDown + 0.25) > maxErr || abs(f.coerciveUp - 0.25) > maxErr
+				|| abs(f.remanenceDown - 0.25) > maxErr || abs(f.remanenceUp + 0.25) > maxErr) {
+			cout << "(hysteresis) Hc = " << f.coerciveDown << ", " << f.coerciveUp
+			     << "; Mr = " << f.remanenceDown << ", " << f.remanenceUp << "\n";
+			return 1;
+		}
+		HysteresisFeatures none(vector<double>{ 1, 0.5 }, vector<double>{ 1, 1 });
+		if (!std::isnan(none.coerciveDown) || !std::isnan(none.coerciveUp)) {
+			cout << "(hysteresis) expected NaN for a loop which doesn't switch\n";
+			return 1;
+		}
+		if (Replicas::errorColumns("U,UL,,M_x,") != "U_se,UL_se,,M_x_se,") {
+			cout << "(hysteresis) errorColumns = " << Replicas::errorColumns("U,UL,,M_x,") << "\n";
+			return 1;
+		}
+	}
+
+	cout << "Done. (Passed)\n";
+	return 0;
+}
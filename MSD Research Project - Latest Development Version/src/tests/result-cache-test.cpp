@@ -0,0 +1,195 @@
+/**
+ * @file result-cache-test.cpp
+ * @brief Tests ResultCache.
+ *
+ * 1. ResultCache::key must be the same for identically set up MSDs, and change with a parameter, a spin, the
+ *    MolProto, the flipping algorithm, or the run. The seed must only matter if withSeed is true.
+ * 2. Results must persist when the cache is reopened, and a key stored twice must give the last payload.
+ * 3. With a size limit, the least recently used results must be evicted, and flush must shrink the file to just
+ *    the cached records.
+ * 4. An incomplete record at the end of the file must be ignored, and a file that isn't a cache must be rejected.
+ * 5. ResultCache::load must restore the record and state saved by ResultCache::save, appending only the Results
+ *    added after the given index.
+ */
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+#include "../ResultCache.h"
+
+using namespace std;
+using namespace udc;
+
+const char *PATH = "result-cache-test.tmp";
+
+unsigned long long fileSize(const char *path) {
+	ifstream in(path, ios::binary | ios::ate);
+	return static_cast<unsigned long long>(in.tellg());
+}
+
+MSD * makeMSD() {
+	MSD *msd = new MSD(6, 4, 4, MSD::LINEAR_MOL, 2, 3, 0, 3, 0, 3);
+	MSD::Parameters p;
+	p.kT = 0.5;
+	p.JL = p.JR = 1;
+	msd->setParameters(p);
+	return msd;
+}
+
+int main(int argc, char *argv[]) {
+	remove(PATH);
+
+	// ----- 1. keys -----
+	{	MSD *a = makeMSD(), *b = makeMSD();
+		const ResultCache::Key k = ResultCache::key(*a, "run");
+		bool ok = ResultCache::key(*b, "run") == k && ResultCache::key(*a, "other run") != k;
+		MSD::Parameters p = b->getParameters();
+		p.JmL = 0.25;
+		b->setParameters(p);
+		ok = ok && ResultCache::key(*b, "run") != k;
+		delete b;
+
+		b = makeMSD();
+		b->setSpin(0, 0, 0, Vector(0, 0, 1));
+		ok = ok && ResultCache::key(*b, "run") != k;
+		delete b;
+
+		b = makeMSD();
+		MSD::MolProto::NodeParameters node;
+		MSD::MolProto::EdgeParameters edge;
+		edge.Jm = 0.5;
+		b->setMolParameters(node, edge);
+		ok = ok && ResultCache::key(*b, "run") != k;
+		delete b;
+
+		b = makeMSD();
+		b->flippingAlgorithm = MSD::UP_DOWN_MODEL;
+		ok = ok && ResultCache::key(*b, "run") != k;
+		delete b;
+
+		b = makeMSD();
+		b->setSeed(a->getSeed() + 1);
+		ok = ok && ResultCache::key(*b, "run") == k
+		        && ResultCache::key(*b, "run", true) != ResultCache::key(*a, "run", true);
+		delete b;
+		delete a;
+		if (!ok) {
+			cout << "(key) keys didn't match the configurations\n";
+			return 1;
+		}
+	}
+
+	// ----- 2. persistence -----
+	{	{	ResultCache cache(PATH);
+			cache.put(1, "one");
+			cache.put(2, "two");
+			cache.put(1, "uno");
+			string s;
+			if (!cache.get(1, s) || s != "uno" || cache.get(3, s) || cache.getHits() != 1 || cache.getMisses() != 1) {
+				cout << "(persistence) wrong results before reopening\n";
+				return 1;
+			}
+		}
+		ResultCache cache(PATH);
+		string one, two;
+		if (cache.size() != 2 || !cache.get(1, one) || one != "uno" || !cache.get(2, two) || two != "two") {
+			cout << "(persistence) wrong results after reopening: " << cache.size() << " cached\n";
+			return 1;
+		}
+	}
+	remove(PATH);
+
+	// ----- 3. eviction -----
+	{	const string payload(100, 'x');
+		const unsigned long long record = 16 + payload.size();
+		{	ResultCache cache(PATH, 2 * record);
+			cache.put(1, payload);
+			cache.put(2, payload);
+			cache.put(3, payload);  // evicts 1
+			string s;
+			cache.get(2, s);
+			cache.put(4, payload);  // evicts 3 (2 was used more recently)
+			if (cache.size() != 2 || cache.bytes() != 2 * record || cache.get(1, s) || cache.get(3, s)
+					|| !cache.get(2, s) || !cache.get(4, s)) {
+				cout << "(eviction) wrong results cached\n";
+				return 1;
+			}
+			cache.flush();
+			if (fileSize(PATH) != 16 + 2 * record) {
+				cout << "(eviction) file is " << fileSize(PATH) << " bytes after flush\n";
+				return 1;
+			}
+		}
+		ResultCache cache(PATH, 2 * record);
+		string s;
+		if (cache.size() != 2 || !cache.get(2, s) || !cache.get(4, s)) {
+			cout << "(eviction) wrong results after reopening\n";
+			return 1;
+		}
+	}
+
+	// ----- 4. damaged and foreign files -----
+	{	{	ofstream out(PATH, ios::binary | ios::app);
+			out << "incomplete";
+		}
+		{	ResultCache cache(PATH);
+			string s;
+			if (cache.size() != 2 || !cache.get(2, s)) {
+				cout << "(damaged) lost the complete records\n";
+				return 1;
+			}
+			cache.put(5, "five");
+		}
+		ResultCache cache(PATH);
+		string s;
+		if (cache.size() != 3 || !cache.get(5, s) || s != "five") {
+			cout << "(damaged) the record after the incomplete one was lost\n";
+			return 1;
+		}
+	}
+	remove(PATH);
+	{	{	ofstream out(PATH);
+			out << "Nope, there's only trash here.\n";
+		}
+		bool threw = false;
+		try {
+			ResultCache cache(PATH);
+		} catch(runtime_error &) {
+			threw = true;
+		}
+		if (!threw) {
+			cout << "(foreign) opened a file that isn't a cache\n";
+			return 1;
+		}
+	}
+	remove(PATH);
+
+	// ----- 5. save and load -----
+	{	MSD *a = makeMSD(), *b = makeMSD();
+		a->randomize();
+		a->metropolis(5000, 500);
+		string payload = ResultCache::save(*a);
+		bool ok = ResultCache::load(*b, payload) && b->record == a->record
+		          && (b->getResults().M - a->getResults().M).norm() < 1e-9 && abs(b->getResults().U - a->getResults().U) < 1e-9;
+		for (auto i = a->begin(), j = b->begin(); ok && i != a->end(); ++i, ++j)
+			ok = i.getSpin() == j.getSpin() && i.getFlux() == j.getFlux();
+		MSD c(3, 3, 3);
+		ok = ok && !ResultCache::load(c, payload) && !ResultCache::load(*b, payload.substr(1));
+		const size_t size = a->record.size();
+		ok = ok && ResultCache::load(*b, ResultCache::save(*a, size - 3)) && b->record.size() == size + 3
+		        && equal(b->record.begin() + size, b->record.end(), a->record.end() - 3);
+		delete a;
+		delete b;
+		if (!ok) {
+			cout << "(load) didn't restore the saved run\n";
+			return 1;
+		}
+	}
+
+	cout << "Done. (Passed)\n";
+	return 0;
+}
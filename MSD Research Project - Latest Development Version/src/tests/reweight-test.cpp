@@ -0,0 +1,130 @@
+/**
+ * @file reweight-test.cpp
+ * @brief Tests Reweighting (single and multiple histogram reweighting).
+ *
+ * 1. Random MSDs: reweighting a record to its own (kT, B) must give the plain sample means.
+ * 2. An 8 atom Ising chain (UP_DOWN_MODEL, F == 0): <U>, c, and <M_y> reweighted to other kT and B, from one run
+ *    and from two runs (WHAM), must match the exact values found by enumerating all 2^8 states.
+ */
+
+#include <cmath>
+#include <cstdlib>
+#include <iostream>
+#include <vector>
+#include "../MSD.h"
+#include "../Reweighting.h"
+#include "test-util.h"
+
+using namespace std;
+using namespace udc;
+using namespace udc::test;
+
+const unsigned int numIter = 20;
+double maxErr = 1e-9;
+
+struct Exact {
+	double U, c, My;
+};
+
+int main(int argc, char *argv[]) {
+	if (argc > 1)
+		maxErr = atof(argv[1]);
+
+	Random rng;
+
+	for (unsigned int n = 0; n < numIter; n++) {
+		shared_ptr<MSD> msd = rng.randMSD(8);
+		msd->randomize();
+		msd->metropolis(5000, 50);
+		double sumU = 0;
+		Vector sumM = Vector::ZERO;
+		for (const MSD::Results &r : msd->record) {
+			sumU += r.U;
+			sumM += r.M;
+		}
+		double meanU = sumU / msd->record.size();
+		Vector meanM = (1.0 / msd->record.size()) * sumM;
+
+		Reweighting rw;
+		rw.addRun(*msd);
+		MSD::Parameters p = msd->getParameters();
+		Reweighting::Estimate est = rw.at(p.kT, p.B);
+		double d = abs(est.meanU - meanU) + (est.meanM - meanM).norm();
+		if (d > maxErr * (1 + abs(meanU) + meanM.norm())) {
+			cout << "(random MSD) n = " << n << ": <U> = " << est.meanU << ", <M> = " << est.meanM
+			     << ", expected <U> = " << meanU << ", <M> = " << meanM << "\n";
+			return 1;
+		}
+	}
+
+	{	const unsigned int N = 8;
+		MSD msd(N, 1, 1, N, N - 1, 0, 0, 0, 0);  // a chain of FM_L atoms
+		MSD::Parameters p;
+		p.JL = 1;
+		p.B = Vector(0, 0.3, 0);  // spins start along the y-axis
+		msd.setParameters(p);
+		msd.flippingAlgorithm = MSD::UP_DOWN_MODEL;
+
+		// exact energies (without B) and magnetizations
+		vector<double> E, My;
+		for (unsigned int state = 0; state < (1u << N); state++) {
+			for (unsigned int a = 0; a < N; a++)
+				msd.setLocalM(a, Vector(0, (state >> a & 1) ? 1 : -1, 0), Vector::ZERO);
+			MSD::Results r = msd.getResults();
+			E.push_back(r.U + p.B * r.M);
+			My.push_back(r.M.y);
+		}
+		auto exact = [&](double kT, double By) {
+			double Z = 0, sumU = 0, sumU2 = 0, sumM = 0, min = INFINITY;
+			for (size_t i = 0; i < E.size(); i++)
+				min = fmin(min, E[i] - By * My[i]);
+			for (size_t i = 0; i < E.size(); i++) {
+				double U = E[i] - By * My[i];
+				double w = exp(-(U - min) / kT);
+				Z += w;
+				sumU += w * U;
+				sumU2 += w * U * U;
+				sumM += w * My[i];
+			}
+			Exact ex;
+			ex.U = sumU / Z;
+			ex.c = (sumU2 / Z - ex.U * ex.U) / (N * kT * kT);
+			ex.My = sumM / Z;
+			return ex;
+		};
+		auto run = [&](double kT) {
+			msd.set_kT(kT);
+			msd.reinitialize();
+			msd.metropolis(10000);
+			msd.metropolis(2000000, 16);
+		};
+		auto check = [&](const string &name, const Reweighting &rw, double kT, double By) {
+			Reweighting::Estimate est = rw.at(kT, Vector(0, By, 0));
+			Exact ex = exact(kT, By);
+			if (!est.valid || abs(est.meanU - ex.U) > 0.05 || abs(est.specificHeat - ex.c) > 0.1 * ex.c
+					|| abs(est.meanM.y - ex.My) > 0.05) {
+				cout << "(" << name << ") kT = " << kT << ", B_y = " << By << ": <U> = " << est.meanU
+				     << ", c = " << est.specificHeat << ", <M_y> = " << est.meanM.y << ", N_eff = " << est.effectiveSamples
+				     << ", expected <U> = " << ex.U << ", c = " << ex.c << ", <M_y> = " << ex.My << "\n";
+				return false;
+			}
+			return true;
+		};
+
+		Reweighting single;
+		run(1.2);
+		single.addRun(msd);
+		if (!check("single", single, 1.3, 0.3) || !check("single", single, 1.2, 0.4))
+			return 1;
+
+		Reweighting multi;
+		multi.addRun(msd);
+		run(1.8);
+		multi.addRun(msd);
+		if (!check("WHAM", multi, 1.5, 0.3) || !check("WHAM", multi, 1.6, 0.35))
+			return 1;
+	}
+
+	cout << "Done. (Passed)\n";
+	return 0;
+}
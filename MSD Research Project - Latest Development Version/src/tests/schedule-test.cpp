@@ -0,0 +1,120 @@
+/**
+ * @file schedule-test.cpp
+ * @brief Tests MSD::run and MSD::Schedule.
+ *
+ * 1. Constant stages must give exactly the same record (and state) as the metropolis calls they replace.
+ * 2. Ramps: every record must have the kT and B given by the schedule at that step, and after the run the
+ *    incrementally updated Results must match a full recalculation.
+ * 3. The builders (temperatureSteps, fieldSteps, fieldRamp, repeat) must make the expected stages.
+ */
+
+#include <cmath>
+#include <cstdlib>
+#include <iostream>
+#include <stdexcept>
+#include <vector>
+#include "../MSD.h"
+#include "test-util.h"
+
+using namespace std;
+using namespace udc;
+using namespace udc::test;
+
+const unsigned int numIter = 20;
+double maxErr = 1e-9;
+
+int main(int argc, char *argv[]) {
+	if (argc > 1)
+		maxErr = atof(argv[1]);
+
+	Random rng;
+
+	for (unsigned int n = 0; n < numIter; n++) {
+		const long long seed = rng.randI(1u << 30);
+		shared_ptr<MSD> a = Random(seed).randMSD(6), c = Random(seed).randMSD(6);  // the same MSD
+		a->setSeed(n);
+		c->setSeed(n);
+		MSD::Parameters p = a->getParameters();
+
+		// ----- 1. constant stages -----
+		a->metropolis(500);
+		a->metropolis(1000, 30);
+		MSD::Schedule schedule;
+		schedule.hold(500, p.kT, p.B).hold(1000, p.kT, p.B, 30);
+		c->run(schedule);
+		if (a->record.size() != c->record.size()) {
+			cout << "(constant) record.size() = " << c->record.size() << ", expected " << a->record.size() << "\n";
+			return 1;
+		}
+		for (size_t i = 0; i < a->record.size(); i++)
+			if (a->record[i] != c->record[i]) {
+				cout << "(constant) n = " << n << ": record[" << i << "] is different\n";
+				return 1;
+			}
+
+		// ----- 2. ramps -----
+		const unsigned long long N = 1000, freq = 7;
+		const double kT0 = 0.1 + rng.rand(), kT1 = 0.1 + rng.rand();
+		const Vector B0 = rng.randV(), B1 = rng.randV();
+		schedule = MSD::Schedule();
+		schedule.ramp(N, kT0, kT1, B0, B1, freq);
+		schedule.stages.back().clearRecord = true;
+		unsigned long long count = 0;
+		bool ok = true;
+		schedule.onRecord = [&](size_t stage, const MSD::Results &r) {
+			double f = static_cast<double>(count * freq) / N;
+			MSD::Parameters q = c->getParameters();
+			ok = ok && stage == 0 && abs(q.kT - (kT0 + (kT1 - kT0) * f)) < maxErr
+					&& (q.B - (B0 + f * (B1 - B0))).norm() < maxErr && r == c->record.back();
+			count++;
+		};
+		c->run(schedule);
+		if (!ok || count != N / freq + 1 || c->record.size() != count) {
+			cout << "(ramp) n = " << n << ": wrong kT, B, or number of records (" << count << ")\n";
+			return 1;
+		}
+		if (c->getParameters().kT != kT1 || c->getParameters().B != B1 || c->getResults().t != 2500) {
+			cout << "(ramp) n = " << n << ": wrong kT, B, or t after the run\n";
+			return 1;
+		}
+		MSD::Results r = c->getResults();
+		c->setParameters(c->getParameters());  // force recalculation
+		c->setMolProto(c->getMolProto());
+		double d = cmpResults(r, c->getResults(), maxErr);
+		if (d > maxErr) {
+			cout << "(ramp) Max error reached: n = " << n << ", d = " << d << "\n";
+			return 1;
+		}
+	}
+
+	// ----- 3. builders -----
+	{	MSD::Schedule s;
+		s.temperatureSteps(0.5, 1.0, 0.25, Vector(0, 0, 1), 10, 20, 5, MSD::Schedule::RANDOMIZE);
+		bool ok = s.stages.size() == 6;
+		for (size_t k = 0; ok && k < s.stages.size(); k++) {
+			const MSD::Schedule::Stage &st = s.stages[k];
+			ok = st.kT == st.kT_end && abs(st.kT - (0.5 + 0.25 * (k / 2))) < 1e-12 && st.B == Vector(0, 0, 1)
+					&& st.steps == (k % 2 == 0 ? 10u : 20u) && st.freq == (k % 2 == 0 ? 0u : 5u)
+					&& st.reset == (k % 2 == 0 ? MSD::Schedule::RANDOMIZE : MSD::Schedule::NOOP)
+					&& st.clearRecord == (k % 2 == 0);
+		}
+		s = MSD::Schedule();
+		s.fieldSteps(-1, 1, 0.5, 0, 0, 0.2, 10, 20, 5);  // 1, 0.5, 0, -0.5, then -1, -0.5, 0, 0.5, 1
+		ok = ok && s.stages.size() == 18 && abs(s.stages[1].B.x - 1) < 1e-12 && abs(s.stages[8].B.x + 1) < 1e-12
+				&& abs(s.stages[17].B.x - 1) < 1e-12;
+		s = MSD::Schedule();
+		s.fieldRamp(2, -2, 0.01, 0, 0, 0.2, 10).repeat(3);
+		ok = ok && s.stages.size() == 3 && s.stages[2].steps == 400 && abs(s.stages[2].B_end.x + 2) < 1e-12;
+		try {
+			s.temperatureSteps(1, 2, 0, Vector::ZERO, 1, 1, 1);
+			ok = false;
+		} catch (invalid_argument &) {}
+		if (!ok) {
+			cout << "(builders) unexpected stages\n";
+			return 1;
+		}
+	}
+
+	cout << "Done. (Passed)\n";
+	return 0;
+}
@@ -0,0 +1,193 @@
+/**
+ * @file site-order-test.cpp
+ * @brief Tests MSD::setSiteOrder (MORTON and HILBERT memory layouts).
+ *
+ * 1. For the same seed, metropolis (RANDOM_SITE) must give the same states in every order, and every atom must keep
+ *    its coordinates.
+ * 2. Random MSDs: changing the order in the middle of a run must keep every state and weight, and the Results must
+ *    still match a full recalculation.
+ * 3. On a full 8x8x8 MSD, MORTON indices must be the interleaved bits of (z, y, x), and consecutive HILBERT indices
+ *    must be neighbors.
+ * 4. MSDGraph must find the same sites in any order, and invalid orders must be rejected.
+ * 5. With DL, DR, and Dm all non-zero, heat bath with over-relaxation (which use MSD::localField) must give the same
+ *    states and Results in HILBERT order as in ROW_MAJOR, so the DMI of each bond must be oriented by position.
+ */
+
+#include <cstdlib>
+#include <iostream>
+#include <map>
+#include <stdexcept>
+#include "../MSD.h"
+#include "../MSDGraph.h"
+#include "test-util.h"
+
+using namespace std;
+using namespace udc;
+using namespace udc::test;
+
+const MSD::SiteOrder ORDERS[] = { MSD::ROW_MAJOR, MSD::MORTON, MSD::HILBERT };
+const char *NAMES[] = { "ROW_MAJOR", "MORTON", "HILBERT" };
+double maxErr = 1e-9;
+
+MSD * makeMSD() {
+	MSD *msd = new MSD(7, 5, 6, MSD::LINEAR_MOL, 2, 4, 1, 3, 0, 4);
+	MSD::Parameters p;
+	p.kT = 0.5;
+	p.JL = p.JR = 1;
+	p.JmL = p.JmR = 0.5;
+	p.FL = 0.25;
+	msd->setParameters(p);
+	return msd;
+}
+
+int main(int argc, char *argv[]) {
+	if (argc > 1)
+		maxErr = atof(argv[1]);
+
+	// ----- 1. same run in every order -----
+	{	MSD *ref = makeMSD();
+		ref->randomize(false);
+		ref->metropolis(20000);
+		for (int k = 1; k < 3; k++) {
+			MSD *msd = makeMSD();
+			msd->setSeed(ref->getSeed());
+			msd->setSiteOrder(ORDERS[k]);
+			msd->randomize(false);
+			msd->metropolis(20000);
+			bool ok = msd->getSiteOrder() == ORDERS[k];
+			for (auto i = ref->begin(), j = msd->begin(); ok && i != ref->end(); ++i, ++j)
+				ok = i.getX() == j.getX() && i.getY() == j.getY() && i.getZ() == j.getZ()
+				     && i.getSpin() == j.getSpin() && i.getFlux() == j.getFlux()
+				     && msd->getSpin(j.getX(), j.getY(), j.getZ()) == j.getSpin();
+			delete msd;
+			if (!ok) {
+				cout << "(same run) " << NAMES[k] << " changed the run, or moved an atom\n";
+				return 1;
+			}
+		}
+		delete ref;
+	}
+
+	// ----- 2. random MSDs -----
+	Random rng;
+	for (unsigned int n = 0; n < 20; n++) {
+		shared_ptr<MSD> msd = rng.randMSD(8);
+		msd->setMolParameters(rng.randPNode(), rng.randPEdge());
+		msd->sweepMode = n % 2 == 0 ? MSD::RANDOM_SITE : MSD::TYPEWRITER;
+		msd->clusterFreq = n % 3 == 0 ? 10 : 0;
+		msd->randomize();
+		msd->setRegionWeights(0.5, 1, 2);
+		msd->metropolis(5000);
+		map<unsigned int, Vector> spins;  // by position in the iteration order
+		map<unsigned int, double> weights;
+		unsigned int k = 0;
+		for (auto i = msd->begin(); i != msd->end(); ++i, ++k) {
+			spins[k] = i.getSpin();
+			weights[k] = msd->getSiteWeight(i.getIndex());
+		}
+		msd->setSiteOrder(ORDERS[1 + n % 2]);
+		bool ok = true;
+		k = 0;
+		for (auto i = msd->begin(); ok && i != msd->end(); ++i, ++k)
+			ok = spins[k] == i.getSpin() && weights[k] == msd->getSiteWeight(i.getIndex());
+		msd->metropolis(5000);
+		msd->setSiteOrder(ORDERS[(n + 1) % 3]);
+		msd->metropolis(5000);
+		MSD::Results r1 = msd->getResults();
+		msd->setParameters(msd->getParameters());  // force recalculation
+		msd->setMolProto(msd->getMolProto());
+		double d = cmpResults(r1, msd->getResults(), maxErr);
+		if (!ok || d > maxErr) {
+			cout << "(random MSD) lost a state or weight, or max error reached: n = " << n << ", d = " << d << "\n";
+			return 1;
+		}
+	}
+
+	// ----- 3. curves -----
+	{	MSD msd(8, 8, 8, 8, 7, 0, 7, 0, 7);  // FM_L only
+		msd.setSiteOrder(MSD::MORTON);
+		bool ok = true;
+		for (auto i = msd.begin(); ok && i != msd.end(); ++i) {
+			unsigned int key = 0;
+			for (int b = 2; b >= 0; b--)
+				key = (key << 3) | (((i.getZ() >> b) & 1) << 2) | (((i.getY() >> b) & 1) << 1) | ((i.getX() >> b) & 1);
+			ok = i.getIndex() == key;
+		}
+		if (!ok) {
+			cout << "(curves) MORTON indices aren't interleaved coordinates\n";
+			return 1;
+		}
+		msd.setSiteOrder(MSD::HILBERT);
+		map<unsigned int, unsigned int> coords;  // x + 8 * y + 64 * z of each index
+		for (auto i = msd.begin(); i != msd.end(); ++i)
+			coords[i.getIndex()] = i.getX() + 8 * i.getY() + 64 * i.getZ();
+		ok = coords.size() == 512 && coords.rbegin()->first == 511;
+		for (unsigned int a = 1; ok && a < 512; a++) {
+			int d = abs(int(coords[a]) - int(coords[a - 1]));
+			ok = d == 1 || d == 8 || d == 64;
+		}
+		if (!ok) {
+			cout << "(curves) consecutive HILBERT indices aren't neighbors\n";
+			return 1;
+		}
+	}
+
+	// ----- 4. MSDGraph and bad orders -----
+	{	MSD *msd = makeMSD();
+		msd->setSiteOrder(MSD::HILBERT);
+		MSDGraph graph(*msd);
+		bool ok = graph.size() == msd->getN();
+		for (auto i = msd->begin(); ok && i != msd->end(); ++i)
+			ok = graph.site(i.getX(), i.getY(), i.getZ()) == graph.site(i.getIndex())
+			     && graph.indices[graph.site(i.getIndex())] == i.getIndex();
+		try {
+			msd->setSiteOrder(static_cast<MSD::SiteOrder>(4));
+			ok = false;
+		} catch (const invalid_argument &) {
+			// expected
+		}
+		ok = ok && msd->getSiteOrder() == MSD::HILBERT;
+		delete msd;
+		if (!ok) {
+			cout << "(graph) MSDGraph sites didn't match, or an invalid order was accepted\n";
+			return 1;
+		}
+	}
+
+	// ----- 5. DMI in the local field -----
+	{	MSD *ref = NULL;
+		for (int k = 0; k < 3; k += 2) {  // ROW_MAJOR, then HILBERT
+			MSD *msd = makeMSD();
+			MSD::Parameters p = msd->getParameters();
+			p.DL = Vector(0.3, -0.2, 0.5);
+			p.DR = Vector(-0.4, 0.1, 0.2);
+			msd->setParameters(p);
+			Molecule::EdgeParameters edgeParams;
+			edgeParams.Dm = Vector(0.2, 0.4, -0.3);
+			msd->setMolParameters(Molecule::NodeParameters(), edgeParams);
+			msd->flippingAlgorithm = MSD::HEAT_BATH_MODEL;
+			msd->overrelaxRatio = 1;
+			if (ref != NULL)
+				msd->setSeed(ref->getSeed());
+			msd->setSiteOrder(ORDERS[k]);
+			msd->randomize(false);
+			msd->metropolis(20000);
+			if (ref == NULL) {
+				ref = msd;
+				continue;
+			}
+			bool ok = cmpResults(ref->getResults(), msd->getResults(), maxErr) <= maxErr;
+			for (auto i = ref->begin(), j = msd->begin(); ok && i != ref->end(); ++i, ++j)
+				ok = (i.getSpin() - j.getSpin()).norm() <= maxErr && (i.getFlux() - j.getFlux()).norm() <= maxErr;
+			delete msd;
+			if (!ok) {
+				cout << "(DMI) " << NAMES[k] << " changed heat bath with over-relaxation\n";
+				return 1;
+			}
+		}
+		delete ref;
+	}
+
+	cout << "Done. (Passed)\n";
+	return 0;
+}
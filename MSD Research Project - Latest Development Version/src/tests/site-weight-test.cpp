@@ -0,0 +1,175 @@
+/**
+ * @file site-weight-test.cpp
+ * @brief Tests weighted site selection (MSD::setSiteWeight, MSD::setRegionWeights, and MSD::skipZeroSpins).
+ *
+ * 1. Weights of 1 (even if set explicitly) must give the same run as an MSD without weights, for the same seed.
+ * 2. Atoms with weight 0 must never change in metropolis, clusterFlip, overrelax, or nFoldWay, and the Results must
+ *    still match a full recalculation.
+ * 3. Independent spins (S = 1, UP_DOWN_MODEL) in a magnetic field B with different weights in each region:
+ *    every region must still have <M * B / |B|> = tanh(|B| / kT), i.e. weights don't change the distribution.
+ * 4. Atoms with spin 0 and F = 0 must never be picked (unless skipZeroSpins is false), and weights must be
+ *    finite and >= 0.
+ */
+
+#include <cmath>
+#include <iostream>
+#include <limits>
+#include <map>
+#include <stdexcept>
+#include "../MSD.h"
+#include "test-util.h"
+
+using namespace std;
+using namespace udc;
+using namespace udc::test;
+
+MSD * makeMSD() {
+	MSD *msd = new MSD(6, 4, 4, MSD::LINEAR_MOL, 2, 3, 0, 3, 0, 3);
+	MSD::Parameters p;
+	p.kT = 0.5;
+	p.JL = p.JR = 1;
+	p.JmL = p.JmR = 0.5;
+	msd->setParameters(p);
+	return msd;
+}
+
+int main(int argc, char *argv[]) {
+	// ----- 1. uniform weights -----
+	{	MSD *a = makeMSD(), *b = makeMSD();
+		b->setSeed(a->getSeed());
+		b->setRegionWeights(1, 1, 1);
+		b->setSiteWeight(0, 0, 0, 2);
+		b->setSiteWeight(0, 0, 0, 1);
+		a->randomize(false);
+		b->randomize(false);
+		a->metropolis(20000, 1000);
+		b->metropolis(20000, 1000);
+		bool ok = a->record.size() == b->record.size();
+		for (auto i = a->begin(), j = b->begin(); ok && i != a->end(); ++i, ++j)
+			ok = i.getSpin() == j.getSpin() && i.getFlux() == j.getFlux();
+		delete a;
+		delete b;
+		if (!ok) {
+			cout << "(uniform) weights of 1 changed the run\n";
+			return 1;
+		}
+	}
+
+	// ----- 2. frozen atoms -----
+	for (int algo = 0; algo < 4; algo++) {
+		MSD *msd = makeMSD();
+		MSD::Parameters p = msd->getParameters();
+		if (algo == 3) {  // nFoldWay needs F == 0
+			p.FL = p.FR = 0;
+			Molecule::NodeParameters node;
+			node.Fm = 0;
+			msd->setMolParameters(node, Molecule::EdgeParameters());
+		}
+		msd->setParameters(p);
+		msd->flippingAlgorithm = algo == 3 ? MSD::UP_DOWN_MODEL : MSD::CONTINUOUS_SPIN_MODEL;
+		msd->clusterFreq = algo == 1 ? 10 : 0;
+		msd->overrelaxRatio = algo == 2 ? 1 : 0;
+		msd->randomize();
+		msd->setRegionWeights(0, 1, 1);
+		for (auto i = msd->begin(); i != msd->end(); ++i)
+			if (i.getX() == msd->getMolPosL()) {
+				msd->setSiteWeight(i.getIndex(), 0);  // a mol. atom
+				break;
+			}
+		map<unsigned int, Vector> before;
+		unsigned int frozen = 0;
+		for (auto i = msd->begin(); i != msd->end(); ++i) {
+			before[i.getIndex()] = i.getSpin();
+			frozen += msd->getSiteWeight(i.getIndex()) == 0;
+		}
+		if (algo == 3)
+			msd->nFoldWay(20000);
+		else
+			msd->metropolis(20000);
+		bool ok = frozen == msd->getNL() + 1;
+		unsigned int changed = 0;
+		for (auto i = msd->begin(); ok && i != msd->end(); ++i)
+			if (msd->getSiteWeight(i.getIndex()) == 0)
+				ok = before[i.getIndex()] == i.getSpin();
+			else if (before[i.getIndex()] != i.getSpin())
+				changed++;
+		MSD::Results r1 = msd->getResults();
+		msd->setParameters(msd->getParameters());  // force recalculation
+		msd->setMolProto(msd->getMolProto());
+		ok = ok && changed > 0 && cmpResults(r1, msd->getResults(), 1e-9) <= 1e-9;
+		delete msd;
+		if (!ok) {
+			cout << "(frozen) a frozen atom changed, or the Results were wrong: algorithm " << algo << "\n";
+			return 1;
+		}
+	}
+
+	// ----- 3. distribution -----
+	{	MSD msd(5, 2, 2, 2, 2, 0, 1, 0, 1);
+		MSD::Parameters p;
+		p.kT = 0.5;
+		p.B = Vector(0, 0.5, 0);  // spins start along the y-axis
+		p.JL = p.JR = p.JmL = p.JmR = p.JLR = 0;
+		msd.setParameters(p);
+		Molecule::NodeParameters node;
+		Molecule::EdgeParameters edge;
+		edge.Jm = 0;
+		msd.setMolParameters(node, edge);
+		msd.flippingAlgorithm = MSD::UP_DOWN_MODEL;
+		msd.setRegionWeights(0.1, 1, 4);
+		msd.metropolis(2000000, 10);
+		double expected = tanh(p.B.norm() / p.kT);
+		double L = 0, R = 0, m = 0;
+		for (const MSD::Results &r : msd.record) {
+			L += r.ML.y;
+			R += r.MR.y;
+			m += r.Mm.y;
+		}
+		L /= msd.record.size() * msd.getNL();
+		R /= msd.record.size() * msd.getNR();
+		m /= msd.record.size() * msd.getNm();
+		if (abs(L - expected) > 0.02 || abs(R - expected) > 0.02 || abs(m - expected) > 0.02) {
+			cout << "(distribution) <M_y> per atom = " << L << ", " << R << ", " << m << ", expected " << expected << "\n";
+			return 1;
+		}
+	}
+
+	// ----- 4. zero spins and bad weights -----
+	{	MSD *msd = makeMSD();
+		msd->randomize();
+		for (auto i = msd->begin(); i != msd->end(); ++i)
+			if (i.getX() != 0)
+				msd->setSpin(i.getIndex(), Vector::ZERO);
+		msd->resetAcceptanceStats();
+		msd->metropolis(1000);
+		MSD::AcceptanceStats stats = msd->getAcceptanceStats();
+		bool ok = stats.triedL == 1000 && stats.triedR == 0 && stats.triedm == 0;
+		msd->skipZeroSpins = false;
+		msd->metropolis(1000);
+		stats = msd->getAcceptanceStats();
+		ok = ok && stats.triedR > 0 && stats.triedm > 0;
+		MSD::Parameters p = msd->getParameters();
+		p.FR = 0.5;
+		msd->setParameters(p);
+		msd->skipZeroSpins = true;
+		msd->resetAcceptanceStats();
+		msd->metropolis(1000);
+		stats = msd->getAcceptanceStats();
+		ok = ok && stats.triedR > 0 && stats.triedm == 0;
+		for (double w : { -1.0, numeric_limits<double>::infinity(), numeric_limits<double>::quiet_NaN() })
+			try {
+				msd->setSiteWeight(0, 0, 0, w);
+				ok = false;
+			} catch (const invalid_argument &) {
+				// expected
+			}
+		delete msd;
+		if (!ok) {
+			cout << "(zero spins) picked an atom with spin 0, or accepted a bad weight\n";
+			return 1;
+		}
+	}
+
+	cout << "Done. (Passed)\n";
+	return 0;
+}
@@ -0,0 +1,251 @@
+/**
+ * @file state-library-test.cpp
+ * @brief Tests StateLibrary.
+ *
+ * 1. StateLibrary::shape must be the same for identically set up MSDs (even with different parameters), and change
+ *    with the geometry or the flipping algorithm. StateLibrary::features must change with the parameters.
+ * 2. StateLibrary::takeOption must remove the option (in either form) from the command line, and return its file.
+ * 3. warmStart must copy the direction of every spin of the nearest stored state of the same shape, keeping the
+ *    magnitudes (so the new S), and fail (without changing the MSD) if there's no state of the same shape.
+ * 4. States must persist when the library is reopened, a state stored with the same features must replace the old
+ *    one, and flush must shrink the file to just the current states.
+ * 5. An incomplete record at the end of the file must be ignored, and a file that isn't a library must be rejected.
+ * 6. Keyed after the warm start (like in metropolis and iterate), the same run must miss the ResultCache once a
+ *    nearer (different) state is stored, and hit it again when it starts from the same state. * 7. A custom spin magnitude (like metropolis sets before the warm start) must survive warmStart.
+ */
+
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+#include "../StateLibrary.h"
+
+using namespace std;
+using namespace udc;
+
+const char *PATH = "state-library-test.tmp";
+const char *CACHE_PATH = "state-library-test-cache.tmp";
+
+unsigned long long fileSize(const char *path) {
+	ifstream in(path, ios::binary | ios::ate);
+	return static_cast<unsigned long long>(in.tellg());
+}
+
+MSD * makeMSD(double kT, double SL = 1) {
+	MSD *msd = new MSD(6, 4, 4, MSD::LINEAR_MOL, 2, 3, 0, 3, 0, 3);
+	MSD::Parameters p;
+	p.kT = kT;
+	p.SL = SL;
+	p.JL = p.JR = 1;
+	msd->setParameters(p);
+	return msd;
+}
+
+// do the spins of a and b point the same way, with the magnitudes of b's parameters?
+bool sameDirections(const MSD &a, const MSD &b) {
+	const double SL = b.getParameters().SL;
+	for (auto i = a.begin(), j = b.begin(); i != a.end(); ++i, ++j) {
+		Vector s = i.getSpin(), t = j.getSpin();
+		if (((1 / s.norm()) * s - (1 / t.norm()) * t).norm() > 1e-9)
+			return false;
+		if (j.getX() < b.getMolPosL() && abs(t.norm() - SL) > 1e-9)
+			return false;
+	}
+	return true;
+}
+
+int main(int argc, char *argv[]) {
+	remove(PATH);
+
+	// ----- 1. shape and features -----
+	{	MSD *a = makeMSD(0.5), *b = makeMSD(0.75);
+		MSD c(5, 4, 4, MSD::LINEAR_MOL, 2, 3, 0, 3, 0, 3);
+		bool ok = StateLibrary::shape(*a) == StateLibrary::shape(*b) && StateLibrary::shape(*a) != StateLibrary::shape(c)
+		          && StateLibrary::features(*a) != StateLibrary::features(*b)
+		          && StateLibrary::features(*a).size() == StateLibrary::features(*b).size();
+		b->flippingAlgorithm = MSD::UP_DOWN_MODEL;
+		ok = ok && StateLibrary::shape(*a) != StateLibrary::shape(*b);
+		delete a;
+		delete b;
+		if (!ok) {
+			cout << "(shape) shapes or features didn't match the configurations\n";
+			return 1;
+		}
+	}
+
+	// ----- 2. command line -----
+	{	char prgm[] = "app", x[] = "x", opt[] = "--warm-start-from-library", file[] = "lib.bin", y[] = "y",
+		     optEq[] = "--warm-start-from-library=other.bin";
+		char *args[] = { prgm, x, opt, file, y, NULL };
+		int count = 5;
+		string lib = StateLibrary::takeOption(count, args);
+		bool ok = lib == "lib.bin" && count == 3 && strcmp(args[1], "x") == 0 && strcmp(args[2], "y") == 0 && args[3] == NULL;
+		char *args2[] = { prgm, optEq, x, NULL };
+		count = 3;
+		ok = ok && StateLibrary::takeOption(count, args2) == "other.bin" && count == 2 && strcmp(args2[1], "x") == 0;
+		ok = ok && StateLibrary::takeOption(count, args2).empty() && count == 2;
+		char *args3[] = { prgm, opt, NULL };
+		count = 2;
+		try {
+			StateLibrary::takeOption(count, args3);
+			ok = false;
+		} catch(invalid_argument &) {
+		}
+		if (!ok) {
+			cout << "(option) didn't parse the command line\n";
+			return 1;
+		}
+	}
+
+	// ----- 3. warm start -----
+	{	StateLibrary lib(PATH);
+		MSD *cold = makeMSD(0.1), *hot = makeMSD(2.0);
+		cold->randomize();
+		cold->metropolis(20000);
+		hot->randomize();
+		hot->metropolis(20000);
+		lib.store(*cold);
+		lib.store(*hot);
+
+		MSD *b = makeMSD(0.2, 1.5);
+		double d;
+		bool ok = lib.warmStart(*b, &d) && sameDirections(*cold, *b) && d > 0.1 && d < 1;
+		delete b;
+
+		b = makeMSD(1.5);
+		ok = ok && lib.warmStart(*b) && sameDirections(*hot, *b) && b->record.empty();
+		delete b;
+
+		b = makeMSD(0.1);
+		b->flippingAlgorithm = MSD::UP_DOWN_MODEL;
+		Vector s = b->getSpin(0, 0, 0);
+		ok = ok && !lib.warmStart(*b, &d) && isinf(d) && b->getSpin(0, 0, 0) == s;
+		delete b;
+		delete cold;
+		delete hot;
+		if (!ok) {
+			cout << "(warm start) didn't start from the nearest state\n";
+			return 1;
+		}
+	}
+
+	// ----- 4. persistence and replacement -----
+	{	const unsigned long long size = fileSize(PATH);
+		{	StateLibrary lib(PATH);
+			MSD *a = makeMSD(0.1);
+			a->randomize();
+			lib.store(*a);  // replaces the first state of 3.
+			if (lib.size() != 2 || fileSize(PATH) <= size) {
+				cout << "(persistence) wrong number of states: " << lib.size() << '\n';
+				return 1;
+			}
+			lib.flush();
+			MSD *b = makeMSD(0.1);
+			bool ok = fileSize(PATH) == size && lib.warmStart(*b) && sameDirections(*a, *b);
+			delete a;
+			delete b;
+			if (!ok) {
+				cout << "(persistence) the replaced state is still used, or flush didn't compact the file\n";
+				return 1;
+			}
+		}
+		StateLibrary lib(PATH);
+		if (lib.size() != 2) {
+			cout << "(persistence) lost states after reopening\n";
+			return 1;
+		}
+	}
+
+	// ----- 5. damaged and foreign files -----
+	{	const unsigned long long size = fileSize(PATH);
+		{	ofstream out(PATH, ios::binary | ios::app);
+			out << "incomplete";
+		}
+		StateLibrary lib(PATH);
+		if (lib.size() != 2 || fileSize(PATH) != size) {
+			cout << "(damaged) didn't drop the incomplete record\n";
+			return 1;
+		}
+	}
+	remove(PATH);
+	{	{	ofstream out(PATH);
+			out << "Nope, there's only trash here.\n";
+		}
+		bool threw = false;
+		try {
+			StateLibrary lib(PATH);
+		} catch(runtime_error &) {
+			threw = true;
+		}
+		if (!threw) {
+			cout << "(foreign) opened a file that isn't a library\n";
+			return 1;
+		}
+	}
+	remove(PATH);
+
+	// ----- 6. warm starts and the result cache -----
+	remove(CACHE_PATH);
+	{	StateLibrary lib(PATH);
+		ResultCache cache(CACHE_PATH);
+		const string run = "metropolis,t_eq=1000,warmStart";
+		MSD *a = makeMSD(0.1), *b = makeMSD(0.2);
+		a->randomize();
+		lib.store(*a);
+
+		MSD *msd = makeMSD(0.2);
+		lib.warmStart(*msd);
+		ResultCache::Key first = ResultCache::key(*msd, run);
+		cache.put(first, "results from a");
+		delete msd;
+
+		b->randomize();
+		lib.store(*b);  // the same point: now the nearest state
+		msd = makeMSD(0.2);
+		string payload;
+		lib.warmStart(*msd);
+		bool ok = sameDirections(*b, *msd) && ResultCache::key(*msd, run) != first
+		          && !cache.get(ResultCache::key(*msd, run), payload);
+		delete msd;
+
+		msd = makeMSD(0.2);
+		lib.warmStart(*msd);
+		cache.put(ResultCache::key(*msd, run), "results from b");
+		delete msd;
+		msd = makeMSD(0.2);
+		lib.warmStart(*msd);
+		ok = ok && cache.get(ResultCache::key(*msd, run), payload) && payload == "results from b";
+		delete msd;
+		delete a;
+		delete b;
+		if (!ok) {
+			cout << "(cache) a warm start from a different state was served the cached results\n";
+			return 1;
+		}
+	}
+	remove(PATH);
+	remove(CACHE_PATH);
+
+	// ----- 7. custom spin magnitudes -----
+	{	StateLibrary lib(PATH);
+		MSD *a = makeMSD(0.1), *b = makeMSD(0.1);
+		a->randomize();
+		lib.store(*a);
+		b->setSpin(0, 1, 2, Vector::sphericalForm(2.5, 1, 2));  // in FM_L
+		bool ok = lib.warmStart(*b) && abs(b->getSpin(0, 1, 2).norm() - 2.5) < 1e-9
+		          && ((1 / 2.5) * b->getSpin(0, 1, 2) - (1 / a->getSpin(0, 1, 2).norm()) * a->getSpin(0, 1, 2)).norm() < 1e-9;
+		delete a;
+		delete b;
+		if (!ok) {
+			cout << "(custom spin) warmStart lost the custom magnitude, or the direction\n";
+			return 1;
+		}
+	}
+	remove(PATH);
+
+	cout << "Done. (Passed)\n";
+	return 0;
+}
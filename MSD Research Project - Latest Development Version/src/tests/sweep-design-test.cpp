@@ -0,0 +1,114 @@
+/**
+ * @file sweep-design-test.cpp
+ * @brief Tests SweepDesign and LineRefiner.
+ *
+ * 1. SweepDesign::sobol must match the first points of the Sobol sequence, and the first 2^k points must have
+ *    exactly one point in each of the 2^k slices of every axis.
+ * 2. SweepDesign::latinHypercube must have exactly one point in each slice of every axis, and the same seed must
+ *    give the same design.
+ * 3. LineRefiner on a step and a narrow peak: the points it adds must close in on the step and the peak, and no
+ *    interval may be split beyond maxLevel.
+ */
+
+#include <cmath>
+#include <iostream>
+#include <vector>
+#include "../SweepDesign.h"
+
+using namespace std;
+using namespace udc;
+
+// does each of the "points" slices of every axis have exactly one point?
+bool stratified(const vector< vector<double> > &design, size_t dims) {
+	for (size_t d = 0; d < dims; d++) {
+		vector<int> count(design.size(), 0);
+		for (const vector<double> &pt : design) {
+			if (!(pt[d] >= 0 && pt[d] < 1))
+				return false;
+			count[static_cast<size_t>(pt[d] * design.size())]++;
+		}
+		for (int c : count)
+			if (c != 1)
+				return false;
+	}
+	return true;
+}
+
+// refines f on the line [0, 10] (11 initial points) one point at a time; returns the points' u
+vector<double> refine(double (*f)(double), unsigned int points, unsigned int maxLevel = 10) {
+	LineRefiner refiner;
+	refiner.maxLevel = maxLevel;
+	vector<double> us;
+	for (int i = 0; i <= 10; i++) {
+		refiner.add(0, i, f(i));
+		us.push_back(i);
+	}
+	while (us.size() < points) {
+		vector<LineRefiner::Task> tasks = refiner.next(1);
+		if (tasks.empty())
+			break;
+		refiner.add(tasks[0].line, tasks[0].u, f(tasks[0].u), tasks[0].level);
+		us.push_back(tasks[0].u);
+	}
+	return us;
+}
+
+double step(double u) { return u < 5.3 ? 0 : 1; }
+double peak(double u) { return exp(-(u - 2.7) * (u - 2.7) / (2 * 0.1 * 0.1)); }
+
+int main(int argc, char *argv[]) {
+	// ----- 1. sobol -----
+	{	const double first[8][3] = {
+			{ 0, 0, 0 }, { 0.5, 0.5, 0.5 }, { 0.75, 0.25, 0.25 }, { 0.25, 0.75, 0.75 },
+			{ 0.375, 0.375, 0.625 }, { 0.875, 0.875, 0.125 }, { 0.625, 0.125, 0.875 }, { 0.125, 0.625, 0.375 } };
+		vector< vector<double> > design = SweepDesign::sobol(8, 3);
+		for (int i = 0; i < 8; i++)
+			for (int d = 0; d < 3; d++)
+				if (design[i][d] != first[i][d]) {
+					cout << "(sobol) point " << i << ", dim " << d << " = " << design[i][d] << ", expected " << first[i][d] << "\n";
+					return 1;
+				}
+		if (!stratified(SweepDesign::sobol(256, SweepDesign::SOBOL_DIMS), SweepDesign::SOBOL_DIMS)) {
+			cout << "(sobol) 256 points aren't stratified\n";
+			return 1;
+		}
+	}
+
+	// ----- 2. latin hypercube -----
+	{	vector< vector<double> > design = SweepDesign::latinHypercube(37, 5, 12345);
+		if (!stratified(design, 5)) {
+			cout << "(lhs) 37 points aren't stratified\n";
+			return 1;
+		}
+		if (design != SweepDesign::latinHypercube(37, 5, 12345) || design == SweepDesign::latinHypercube(37, 5, 54321)) {
+			cout << "(lhs) designs don't depend only on the seed\n";
+			return 1;
+		}
+	}
+
+	// ----- 3. refinement -----
+	{	struct Case {
+			const char *name;
+			double (*f)(double);
+			double at;  // location of the feature
+		} cases[] = { { "step", step, 5.3 }, { "peak", peak, 2.7 } };
+		for (const Case &c : cases) {
+			vector<double> us = refine(c.f, 40);
+			double closest = 10;
+			for (double u : us)
+				closest = min(closest, abs(u - c.at));
+			if (us.size() != 40 || closest > 0.1) {
+				cout << "(refine) " << c.name << ": " << us.size() << " points, closest to " << c.at << " is " << closest << " away\n";
+				return 1;
+			}
+		}
+		vector<double> us = refine(step, 1000, 2);  // only 1 point of level 1 and 2 of level 2 per initial interval
+		if (us.size() != 11 + 10 * 3) {
+			cout << "(refine) maxLevel = 2 gave " << us.size() << " points\n";
+			return 1;
+		}
+	}
+
+	cout << "Done. (Passed)\n";
+	return 0;
+}
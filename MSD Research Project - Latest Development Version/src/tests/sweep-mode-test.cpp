@@ -0,0 +1,128 @@
+/**
+ * @file sweep-mode-test.cpp
+ * @brief Tests MSD::sweepMode and MSD::sweep.
+ *
+ * 1. Every mode except RANDOM_SITE must visit each atom exactly once per sweep: with UP_DOWN_MODEL and kT so large
+ *    that every flip is accepted, one sweep must flip every spin (except frozen ones, which aren't in the sweep).
+ * 2. Random MSDs: after sweeps in each mode, the Results must match a full recalculation.
+ * 3. Independent spins (S = 1, UP_DOWN_MODEL) in a magnetic field B: every mode must give
+ *    <M * B / |B|> = tanh(|B| / kT) per atom.
+ * 4. sweep(sweeps, freq) must count time and freq in sweeps, and BLOCKED must reject blockSize == 0.
+ */
+
+#include <cmath>
+#include <cstdlib>
+#include <iostream>
+#include <map>
+#include <stdexcept>
+#include "../MSD.h"
+#include "test-util.h"
+
+using namespace std;
+using namespace udc;
+using namespace udc::test;
+
+const MSD::SweepMode MODES[] = { MSD::RANDOM_SITE, MSD::TYPEWRITER, MSD::CHECKERBOARD, MSD::RANDOM_PERMUTATION,
+                                 MSD::BLOCKED };
+const char *NAMES[] = { "RANDOM_SITE", "TYPEWRITER", "CHECKERBOARD", "RANDOM_PERMUTATION", "BLOCKED" };
+double maxErr = 1e-9;
+
+int main(int argc, char *argv[]) {
+	if (argc > 1)
+		maxErr = atof(argv[1]);
+
+	// ----- 1. one visit per sweep -----
+	for (int k = 1; k < 5; k++) {
+		MSD msd(7, 5, 5, MSD::LINEAR_MOL, 2, 4, 0, 4, 0, 4);
+		MSD::Parameters p;
+		p.kT = 1e300;
+		p.FL = p.FR = 0;
+		msd.setParameters(p);
+		Molecule::NodeParameters node;
+		node.Fm = 0;
+		msd.setMolParameters(node, Molecule::EdgeParameters());
+		msd.flippingAlgorithm = MSD::UP_DOWN_MODEL;
+		msd.sweepMode = MODES[k];
+		msd.blockSize = 2;
+		msd.randomize();
+		msd.setSiteWeight(0, 0, 0, 0);
+		map<unsigned int, Vector> before;
+		for (auto i = msd.begin(); i != msd.end(); ++i)
+			before[i.getIndex()] = i.getSpin();
+		msd.sweep(1);
+		bool ok = msd.sweepLength() == msd.getN() - 1;
+		for (auto i = msd.begin(); ok && i != msd.end(); ++i)
+			ok = i.getSpin() == (i.getIndex() == 0 ? before[0] : -before[i.getIndex()]);
+		if (!ok) {
+			cout << "(one visit) " << NAMES[k] << " didn't visit every atom exactly once\n";
+			return 1;
+		}
+	}
+
+	// ----- 2. random MSDs -----
+	Random rng;
+	for (unsigned int n = 0; n < 20; n++) {
+		shared_ptr<MSD> msd = rng.randMSD(8);
+		msd->setMolParameters(rng.randPNode(), rng.randPEdge());
+		msd->sweepMode = MODES[n % 5];
+		msd->blockSize = 1 + n % 3;
+		msd->randomize();
+		msd->sweep(20);
+		MSD::Results r1 = msd->getResults();
+		msd->setParameters(msd->getParameters());  // force recalculation
+		msd->setMolProto(msd->getMolProto());
+		double d = cmpResults(r1, msd->getResults(), maxErr);
+		if (d > maxErr) {
+			cout << "(random MSD) " << NAMES[n % 5] << ": Max error reached: n = " << n << ", d = " << d << "\n";
+			return 1;
+		}
+	}
+
+	// ----- 3. distribution -----
+	for (int k = 0; k < 5; k++) {
+		MSD msd(3, 2, 2, 1, 1, 0, 1, 0, 1);
+		MSD::Parameters p;
+		p.kT = 0.5;
+		p.B = Vector(0, 0.5, 0);  // spins start along the y-axis
+		p.JL = p.JR = p.JmL = p.JmR = p.JLR = 0;
+		msd.setParameters(p);
+		Molecule::NodeParameters node;
+		Molecule::EdgeParameters edge;
+		edge.Jm = 0;
+		msd.setMolParameters(node, edge);
+		msd.flippingAlgorithm = MSD::UP_DOWN_MODEL;
+		msd.sweepMode = MODES[k];
+		msd.sweep(100000, 1);
+		double M = 0;
+		for (const MSD::Results &r : msd.record)
+			M += r.M.y;
+		M /= msd.record.size() * msd.getN();
+		double expected = tanh(p.B.norm() / p.kT);
+		if (abs(M - expected) > 0.01) {
+			cout << "(distribution) " << NAMES[k] << ": <M_y> per atom = " << M << ", expected " << expected << "\n";
+			return 1;
+		}
+	}
+
+	// ----- 4. time in sweeps -----
+	{	MSD msd(6, 4, 4, MSD::LINEAR_MOL, 2, 3, 0, 3, 0, 3);
+		msd.sweepMode = MSD::CHECKERBOARD;
+		msd.sweep(10, 2);
+		bool ok = msd.getSweeps() == 10 && msd.getResults().t == 10 * msd.getN() && msd.record.size() == 6;
+		msd.sweepMode = MSD::BLOCKED;
+		msd.blockSize = 0;
+		try {
+			msd.sweep(1);
+			ok = false;
+		} catch (const invalid_argument &) {
+			// expected
+		}
+		if (!ok) {
+			cout << "(time) wrong time in sweeps: " << msd.getSweeps() << ", or blockSize 0 was accepted\n";
+			return 1;
+		}
+	}
+
+	cout << "Done. (Passed)\n";
+	return 0;
+}
@@ -0,0 +1,232 @@
+/**
+ * @file voxel-mask-test.cpp
+ * @brief Tests MSDs constructed from an MSD::VoxelMask.
+ *
+ * 1. Random (box shaped) MSDs: a mask of the same shape must give the same atoms, region sizes, and Results.
+ * 2. Random masks (with holes, and missing mols.): the MSD must have an atom exactly where the mask isn't EMPTY, and
+ *    only store those in COMPACT order. With only J couplings (all 1) and every spin along y, U must be minus the
+ *    number of bonds between neighboring voxels. After metropolis (in each site order), the Results must match a
+ *    full recalculation.
+ * 3. VoxelMask::write then VoxelMask::read must give the same mask, and a sparse shape must need less memory than
+ *    its bounding box.
+ * 4. Masks with the regions out of order, incomplete mols., or bad text must be rejected.
+ */
+
+#include <cstdlib>
+#include <iostream>
+#include <sstream>
+#include <stdexcept>
+#include "../MSD.h"
+#include "test-util.h"
+
+using namespace std;
+using namespace udc;
+using namespace udc::test;
+
+typedef MSD::VoxelMask VoxelMask;
+
+const unsigned int numIter = 40;
+double maxErr = 1e-9;
+
+// random shape: FM_L voxels left of molPosL, whole mols. (or none) up to molPosR, and FM_R voxels after it
+VoxelMask randMask(Random &rng, unsigned int maxDim) {
+	VoxelMask mask(rng.randI(2, maxDim + 1), rng.randI(1, maxDim + 1), rng.randI(1, maxDim + 1));
+	unsigned int molPosL = rng.randI(1, mask.width);
+	unsigned int molPosR = rng.randI(molPosL - 1, mask.width);
+	double fill = rng.rand();
+	for (unsigned int z = 0; z < mask.depth; z++)
+		for (unsigned int y = 0; y < mask.height; y++) {
+			bool mol = rng.rand() < 0.5;
+			for (unsigned int x = 0; x < mask.width; x++)
+				if (x < molPosL)
+					mask.set(x, y, z, rng.rand() < fill ? VoxelMask::FM_L : VoxelMask::EMPTY);
+				else if (x <= molPosR)
+					mask.set(x, y, z, mol ? VoxelMask::MOL : VoxelMask::EMPTY);
+				else
+					mask.set(x, y, z, rng.rand() < fill ? VoxelMask::FM_R : VoxelMask::EMPTY);
+		}
+	mask.set(0, 0, 0, VoxelMask::FM_L);  // (a mask needs FM_L or MOL voxels)
+	return mask;
+}
+
+// J bonds between neighboring voxels (see: MSD::setParameters)
+unsigned int countBonds(const MSD &msd, const VoxelMask &mask) {
+	const unsigned int molPosL = msd.getMolPosL(), molPosR = msd.getMolPosR();
+	unsigned int bonds = 0;
+	for (unsigned int z = 0; z < mask.depth; z++)
+		for (unsigned int y = 0; y < mask.height; y++) {
+			for (unsigned int x = 0; x < mask.width; x++) {
+				VoxelMask::Label label = mask.get(x, y, z);
+				if (label != VoxelMask::FM_L && label != VoxelMask::FM_R)
+					continue;
+				bonds += (x + 1 < mask.width && mask.get(x + 1, y, z) == label)
+				       + (y + 1 < mask.height && mask.get(x, y + 1, z) == label)
+				       + (z + 1 < mask.depth && mask.get(x, y, z + 1) == label);
+			}
+			bool left = molPosL != 0 && mask.get(molPosL - 1, y, z) == VoxelMask::FM_L;
+			bool right = molPosR + 1 < mask.width && mask.get(molPosR + 1, y, z) == VoxelMask::FM_R;
+			if (molPosL <= molPosR && mask.get(molPosL, y, z) == VoxelMask::MOL)
+				bonds += left + right;  // mL, mR
+			bonds += left && right;  // LR
+		}
+	return bonds;
+}
+
+int main(int argc, char *argv[]) {
+	if (argc > 1)
+		maxErr = atof(argv[1]);
+
+	Random rng;
+
+	// ----- 1. box shapes -----
+	unsigned int compared = 0;
+	for (unsigned int n = 0; n < 4 * numIter && compared < numIter; n++) {
+		shared_ptr<MSD> box = rng.randMSD(8);
+		VoxelMask mask(box->getWidth(), box->getHeight(), box->getDepth());
+		for (auto iter = box->begin(); iter != box->end(); ++iter) {
+			unsigned int x = iter.getX();
+			mask.set(x, iter.getY(), iter.getZ(), x < box->getMolPosL() ? VoxelMask::FM_L
+					: x <= box->getMolPosR() ? VoxelMask::MOL : VoxelMask::FM_R);
+		}
+		MSD *msd;
+		try {
+			msd = new MSD(mask, MSD::LINEAR_MOL, n % 2 == 0 ? MSD::COMPACT : MSD::ROW_MAJOR);
+		} catch (const invalid_argument &) {
+			continue;  // e.g. only FM_R
+		}
+		if (msd->getMolPosL() != box->getMolPosL() || msd->getMolPosR() != box->getMolPosR()) {
+			delete msd;
+			continue;  // e.g. an empty FM_L, or no mols.: the mask can't tell where they would have been
+		}
+		compared++;
+		msd->setParameters(box->getParameters());
+		msd->setMolProto(box->getMolProto());
+		box->randomize();
+		for (auto iter = box->begin(); iter != box->end(); ++iter)
+			msd->setLocalM(iter.getX(), iter.getY(), iter.getZ(), iter.getSpin(), iter.getFlux());
+		bool ok = msd->getN() == box->getN() && msd->getNL() == box->getNL() && msd->getNR() == box->getNR()
+		          && msd->getNm() == box->getNm() && msd->getNmL() == box->getNmL() && msd->getNmR() == box->getNmR()
+		          && msd->getNLR() == box->getNLR();
+		for (unsigned int z = 0; ok && z < mask.depth; z++)
+			for (unsigned int y = 0; y < mask.height; y++)
+				for (unsigned int x = 0; x < mask.width; x++)
+					ok = ok && msd->hasAtom(x, y, z) == box->hasAtom(x, y, z);
+		double d = cmpResults(msd->getResults(), box->getResults(), maxErr);
+		delete msd;
+		if (!ok || d > maxErr) {
+			cout << "(box) the mask gave different atoms, or Results: n = " << n << ", d = " << d << "\n";
+			return 1;
+		}
+	}
+	if (compared < numIter / 2) {
+		cout << "(box) only " << compared << " masks were compared\n";
+		return 1;
+	}
+
+	// ----- 2. random masks -----
+	const MSD::SiteOrder orders[] = { MSD::COMPACT, MSD::ROW_MAJOR, MSD::HILBERT, MSD::MORTON };
+	for (unsigned int n = 0; n < numIter; n++) {
+		VoxelMask mask = randMask(rng, 8);
+		MSD::SiteOrder order = orders[n % 4];
+		MSD msd(mask, MSD::LINEAR_MOL, order);
+
+		unsigned int atoms = 0;
+		bool ok = msd.hasVoxelMask() && (order != MSD::COMPACT || msd.getCapacity() == msd.getN());
+		for (unsigned int z = 0; z < mask.depth; z++)
+			for (unsigned int y = 0; y < mask.height; y++)
+				for (unsigned int x = 0; x < mask.width; x++) {
+					bool occupied = mask.get(x, y, z) != VoxelMask::EMPTY;
+					atoms += occupied;
+					ok = ok && msd.hasAtom(x, y, z) == occupied;
+				}
+		if (!ok || atoms != msd.getN()) {
+			cout << "(mask) the atoms don't match the mask: n = " << n << "\n";
+			return 1;
+		}
+
+		// bonds
+		MSD::Parameters p;
+		p.JmR = p.JLR = 1;
+		msd.setParameters(p);
+		Molecule::EdgeParameters edge;
+		edge.Jm = 0;
+		msd.setMolParameters(Molecule::NodeParameters(), edge);
+		for (auto iter = msd.begin(); iter != msd.end(); ++iter)
+			msd.setLocalM(iter.getIndex(), Vector::J, Vector::ZERO);
+		double bonds = countBonds(msd, mask);
+		if (abs(msd.getResults().U + bonds) > maxErr) {
+			cout << "(mask) U = " << msd.getResults().U << ", expected " << -bonds << ": n = " << n << "\n";
+			return 1;
+		}
+
+		// random run
+		msd.setParameters(rng.randP());
+		msd.setMolParameters(rng.randPNode(), rng.randPEdge());
+		msd.clusterFreq = n % 3 == 0 ? 10 : 0;
+		msd.overrelaxRatio = n % 5 == 0 ? 1 : 0;
+		msd.sweepMode = n % 2 == 0 ? MSD::RANDOM_SITE : MSD::CHECKERBOARD;
+		msd.randomize();
+		msd.metropolis(5000);
+		MSD::Results r1 = msd.getResults();
+		msd.setParameters(msd.getParameters());  // force recalculation
+		msd.setMolProto(msd.getMolProto());
+		double d = cmpResults(r1, msd.getResults(), maxErr);
+		if (d > maxErr) {
+			cout << "(mask) Max error reached: n = " << n << ", d = " << d << "\n";
+			return 1;
+		}
+	}
+
+	// ----- 3. text format, and memory -----
+	{	VoxelMask mask = randMask(rng, 8);
+		stringstream text;
+		mask.write(text);
+		VoxelMask copy = VoxelMask::read(text);
+		if (copy.width != mask.width || copy.height != mask.height || copy.depth != mask.depth
+		    || copy.labels != mask.labels) {
+			cout << "(text) VoxelMask::read didn't give back the written mask\n";
+			return 1;
+		}
+
+		VoxelMask tip(100, 100, 100);  // a thin wire, with a 1 atom mol. in the middle
+		for (unsigned int x = 0; x < 100; x++)
+			tip.set(x, 50, 50, x < 50 ? VoxelMask::FM_L : x == 50 ? VoxelMask::MOL : VoxelMask::FM_R);
+		MSD msd(tip);
+		unsigned long long box = MSD::estimateMemory(100, 100, 100, 50, 50, 0, 99, 0, 99, MSD::ROW_MAJOR);
+		if (msd.getN() != 100 || msd.getCapacity() != 100 || MSD::estimateMemory(tip) * 10 > box) {
+			cout << "(memory) the wire wasn't stored compactly\n";
+			return 1;
+		}
+	}
+
+	// ----- 4. bad masks -----
+	{	const char *bad[] = {
+			"3 1 1  LRM",      // FM_R left of the mol.
+			"3 1 1  MLR",      // FM_L right of the mol.
+			"4 2 1  LMMR LM.R",  // incomplete mol.
+			"3 1 1  ..R",      // no FM_L or MOL
+			"3 1 1  LXR",      // bad voxel
+			"3 2 1  LMR",      // missing row
+			"3 1 1  LMRR",     // row too long
+			"0 1 1",           // empty
+		};
+		for (const char *text : bad)
+			try {
+				stringstream in(text);
+				MSD msd(VoxelMask::read(in));
+				cout << "(bad masks) accepted \"" << text << "\"\n";
+				return 1;
+			} catch (const invalid_argument &) {
+				// expected
+			}
+		stringstream in("# comment\n3 1 2 # width height depth\n LMR\n\n L.R # z = 1\n");
+		VoxelMask ok = VoxelMask::read(in);
+		if (MSD(ok).getN() != 5) {
+			cout << "(bad masks) a good mask (with comments) was misread\n";
+			return 1;
+		}
+	}
+
+	cout << "Done. (Passed)\n";
+	return 0;
+}
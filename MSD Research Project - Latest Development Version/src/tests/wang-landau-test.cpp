@@ -0,0 +1,103 @@
+/**
+ * @file wang-landau-test.cpp
+ * @brief Tests MSD::metropolis(N, lnW, visit) and WangLandau.
+ *
+ * 1. Random MSDs: after metropolis with a generalized ensemble, the incrementally updated Results must match
+ *    a full recalculation.
+ * 2. An 8 atom Ising chain (UP_DOWN_MODEL, F == 0) in a magnetic field: <U> and c from the (2 window) Wang-Landau
+ *    density of states must match the exact values found by enumerating all 2^8 states.
+ */
+
+#include <cmath>
+#include <cstdlib>
+#include <iostream>
+#include <vector>
+#include "../MSD.h"
+#include "../WangLandau.h"
+#include "test-util.h"
+
+using namespace std;
+using namespace udc;
+using namespace udc::test;
+
+const unsigned int numIter = 50;
+double maxErr = 1e-9;
+
+int main(int argc, char *argv[]) {
+	if (argc > 1)
+		maxErr = atof(argv[1]);
+
+	Random rng;
+
+	for (unsigned int n = 0; n < numIter; n++) {
+		shared_ptr<MSD> msd = rng.randMSD(8);
+		msd->randomize();
+		unsigned long long visits = 0;
+		msd->metropolis(5000, [](double U) { return -0.5 * U; }, [&](const MSD::Results &) { visits++; });
+
+		MSD::Results r1 = msd->getResults();
+		if (visits != 5000) {
+			cout << "(random MSD) visit was called " << visits << " times, expected 5000\n";
+			return 1;
+		}
+		msd->setParameters(msd->getParameters());  // force recalculation
+		msd->setMolProto(msd->getMolProto());
+		MSD::Results r2 = msd->getResults();
+		double d = cmpResults(r1, r2, maxErr);
+		if (d > maxErr) {
+			cout << "(random MSD) Max error reached: n = " << n << ", d = " << d << "\n";
+			return 1;
+		}
+	}
+
+	{	const unsigned int N = 8;
+		MSD::Parameters p;
+		p.JL = 1;
+		p.B = Vector(0, 0.3, 0);  // spins start along the y-axis
+		auto factory = [&]() {
+			shared_ptr<MSD> msd(new MSD(N, 1, 1, N, N - 1, 0, 0, 0, 0));  // a chain of FM_L atoms
+			msd->setParameters(p);
+			msd->flippingAlgorithm = MSD::UP_DOWN_MODEL;
+			return msd;
+		};
+
+		// exact energies
+		vector<double> U;
+		shared_ptr<MSD> msd = factory();
+		for (unsigned int state = 0; state < (1u << N); state++) {
+			for (unsigned int a = 0; a < N; a++)
+				msd->setLocalM(a, Vector(0, (state >> a & 1) ? 1 : -1, 0), Vector::ZERO);
+			U.push_back(msd->getResults().U);
+		}
+		double Umin = U[0], Umax = U[0];
+		for (double u : U) {
+			Umin = u < Umin ? u : Umin;
+			Umax = u > Umax ? u : Umax;
+		}
+
+		WangLandau wl(factory, Umin - 0.01, Umax + 0.01, 200, 2, 0.5);
+		wl.lnfFinal = 1e-5;
+		wl.run();
+
+		for (double kT : {0.5, 1.0, 2.0}) {
+			double Z = 0, sumU = 0, sumU2 = 0;
+			for (double u : U) {
+				double w = exp(-(u - Umin) / kT);
+				Z += w;
+				sumU += w * u;
+				sumU2 += w * u * u;
+			}
+			double expectedU = sumU / Z;
+			double expectedC = (sumU2 / Z - expectedU * expectedU) / (N * kT * kT);
+			double actualU = wl.meanU(kT), actualC = wl.specificHeat(kT);
+			if (abs(actualU - expectedU) > 0.04 || abs(actualC - expectedC) > 0.1 * expectedC) {
+				cout << "(Ising chain) kT = " << kT << ": <U> = " << actualU << ", c = " << actualC
+				     << ", expected <U> = " << expectedU << ", c = " << expectedC << "\n";
+				return 1;
+			}
+		}
+	}
+
+	cout << "Done. (Passed)\n";
+	return 0;
+}
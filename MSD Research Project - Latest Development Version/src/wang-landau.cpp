@@ -0,0 +1,309 @@
+
+/**
+ * @file wang-landau.cpp
+ * @brief An app for finding <U> and c over a range of kT from one Wang-Landau run (see: WangLandau.h),
+ *        instead of a separate simulation for each kT (like heat.cpp).
+ * @date 2026-10-18
+ * 
+ * @copyright Copyright (c) 2023
+ */
+
+#include <fstream>
+#include <iostream>
+#include <string>
+#include "MSD.h"
+#include "WangLandau.h"
+
+using namespace std;
+using namespace udc;
+
+
+template <typename T> void ask(string msg, T &val) {
+	cout << msg;
+	cin >> val;
+}
+
+void ask(string msg, Vector &vec) {
+	cout << msg;
+	cin >> vec.x >> vec.y >> vec.z;
+}
+
+int main(int argc, char *argv[]) {
+	//get command line argument(s)
+	if( argc > 1 ) {
+		ifstream test(argv[1]);
+		if( test.good() ) {
+			char ans;
+			cout << "File \"" << argv[1] << "\" already exists. Overwrite it (Y/N)? ";
+			cin >> ans;
+			cin.sync();
+			if( ans != 'Y' && ans != 'y' ) {
+				cout << "Terminated early.\n";
+				return 0;
+			}
+		}
+	} else {
+		cout << "Supply an output file as an argument.\n";
+		return 1;
+	}
+	
+	MSD::FlippingAlgorithm arg2 = MSD::CONTINUOUS_SPIN_MODEL;
+	if( argc > 2 ) {
+		string s(argv[2]);
+		if( s == string("CONTINUOUS_SPIN_MODEL") )
+			arg2 = MSD::CONTINUOUS_SPIN_MODEL;
+		else if( s == string("UP_DOWN_MODEL") )
+			arg2 = MSD::UP_DOWN_MODEL;
+		else if( s == string("CONE_MODEL") )
+			arg2 = MSD::CONE_MODEL;
+		else
+			cout << "Unrecognized third argument! Defaulting to 'CONTINUOUS_SPIN_MODEL'.\n";
+	} else
+		cout << "Defaulting to 'CONTINUOUS_SPIN_MODEL'.\n";
+	
+	bool usingMMB = false;
+	MSD::MolProto molProto;  // iff usingMMB
+	MSD::MolProtoFactory molType = MSD::LINEAR_MOL;
+	if (argc > 3) {
+		string s(argv[3]);
+		if (s == "LINEAR")
+			molType = MSD::LINEAR_MOL;
+		else if (s == "CIRCULAR")
+			molType = MSD::CIRCULAR_MOL;
+		else {
+			try {
+				molProto = MSD::MolProto::load(ifstream(argv[3], istream::binary));
+				usingMMB = true;
+			} catch(Molecule::DeserializationException &ex) {
+				cerr << "Unrecognized MOL_TYPE, and invalid .mmb file!";
+				return 2;
+			}
+		}
+	} else
+		cout << "Defaulting to 'LINEAR'.\n";
+
+	ofstream file(argv[1]);
+	file.exceptions( ios::badbit | ios::failbit );
+	
+	//get parameters
+	unsigned int width, height, depth, molPosL, molPosR, topL, bottomL, frontR, backR;
+	double Umin, Umax, overlap, lnfFinal;
+	unsigned int bins, windows;
+	double kT_min, kT_max, kT_inc;  // only for the output; ln g(U) is independent of kT
+	MSD::Parameters p;
+	Molecule::NodeParameters p_node;
+	Molecule::EdgeParameters p_edge;
+	
+	cin.exceptions( ios::badbit | ios::failbit | ios::eofbit );
+	try {
+		ask("> width  = ", width);
+		ask("> height = ", height);
+		ask("> depth  = ", depth);
+		cout << '\n';
+		ask("> molPosL = ", molPosL);
+		ask("> molPosR = ", molPosR);
+		unsigned int molLen = molPosR + 1 - molPosL;
+		if (usingMMB && molLen != molProto.nodeCount()) {
+			cerr << "Using .mmb file, but molLen=" << molLen << " doesn't equal mmb nodeCount=" << molProto.nodeCount() << '\n';
+			return 2;
+		}
+		cout << '\n';
+		ask("> topL    = ", topL);
+		ask("> bottomL = ", bottomL);
+		ask("> frontR  = ", frontR);
+		ask("> backR   = ", backR);
+		cout << '\n';
+		ask("> Umin     = ", Umin);
+		ask("> Umax     = ", Umax);
+		ask("> bins     = ", bins);
+		ask("> windows  = ", windows);
+		ask("> overlap  = ", overlap);
+		ask("> lnfFinal = ", lnfFinal);
+		cout << '\n';
+		ask("> kT_min = ", kT_min);
+		ask("> kT_max = ", kT_max);
+		ask("> kT_inc = ", kT_inc);
+		cout << '\n';
+		ask("> B = ", p.B);
+		cout << '\n';
+		ask("> SL = ", p.SL);
+		ask("> SR = ", p.SR);
+		if (!usingMMB)  ask("> Sm = ", p_node.Sm);
+		ask("> FL = ", p.FL);
+		ask("> FR = ", p.FR);
+		if (!usingMMB)  ask("> Fm = ", p_node.Fm);
+		cout << '\n';
+		ask("> JL  = ", p.JL);
+		ask("> JR  = ", p.JR);
+		if (!usingMMB)  ask("> Jm  = ", p_edge.Jm);
+		ask("> JmL = ", p.JmL);
+		ask("> JmR = ", p.JmR);
+		ask("> JLR = ", p.JLR);
+		cout << '\n';
+		ask("> Je0L  = ", p.Je0L);
+		ask("> Je0R  = ", p.Je0R);
+		if (!usingMMB)  ask("> Je0m  = ", p_node.Je0m);
+		cout << '\n';
+		ask("> Je1L  = ", p.Je1L);
+		ask("> Je1R  = ", p.Je1R);
+		if (!usingMMB)  ask("> Je1m  = ", p_edge.Je1m);
+		ask("> Je1mL = ", p.Je1mL);
+		ask("> Je1mR = ", p.Je1mR);
+		ask("> Je1LR = ", p.Je1LR);
+		cout << '\n';
+		ask("> JeeL  = ", p.JeeL);
+		ask("> JeeR  = ", p.JeeR);
+		if (!usingMMB) ask("> Jeem  = ", p_edge.Jeem);
+		ask("> JeemL = ", p.JeemL);
+		ask("> JeemR = ", p.JeemR);
+		ask("> JeeLR = ", p.JeeLR);
+		cout << '\n';
+		ask("> AL = ", p.AL);
+		ask("> AR = ", p.AR);
+		if (!usingMMB)  ask("> Am = ", p_node.Am);
+		cout << '\n';
+		ask("> bL  = ", p.bL);
+		ask("> bR  = ", p.bR);
+		if (!usingMMB)  ask("> bm  = ", p_edge.bm);
+		ask("> bmL = ", p.bmL);
+		ask("> bmR = ", p.bmR);
+		ask("> bLR = ", p.bLR);
+		cout << '\n';
+		ask("> DL  = ", p.DL);
+		ask("> DR  = ", p.DR);
+		if (!usingMMB)  ask("> Dm  = ", p_edge.Dm);
+		ask("> DmL = ", p.DmL);
+		ask("> DmR = ", p.DmR);
+		ask("> DLR = ", p.DLR);
+		cout << '\n';
+	} catch(ios::failure &e) {
+		cerr << "Invalid parameter: " << e.what() << '\n';
+		return 2;
+	}
+	
+	//create MSD model (one for each window)
+	auto factory = [&]() {
+		shared_ptr<MSD> msd(usingMMB
+				? new MSD(width, height, depth, molProto, molPosL, topL, bottomL, frontR, backR)
+				: new MSD(width, height, depth, molType, molPosL, molPosR, topL, bottomL, frontR, backR));
+		msd->setParameters(p);
+		if (!usingMMB)
+			msd->setMolParameters(p_node, p_edge);
+		msd->flippingAlgorithm = arg2;
+		return msd;
+	};
+	shared_ptr<MSD> msd = factory();  // only used for the file header
+	unique_ptr<WangLandau> wl;
+	try {
+		wl = unique_ptr<WangLandau>(new WangLandau(factory, Umin, Umax, bins, windows, overlap));
+		wl->lnfFinal = lnfFinal;
+	} catch(invalid_argument &e) {
+		cerr << "Invalid parameter: " << e.what() << '\n';
+		return 2;
+	}
+	
+	try {
+		//print info/headings
+		file << "U,ln g(U),,"
+				"kT,<U>,c,"
+			 << ",width = " << msd->getWidth()
+			 << ",height = " << msd->getHeight()
+			 << ",depth = " << msd->getDepth()
+			 << ",molPosL = " << msd->getMolPosL()
+			 << ",molPosR = " << msd->getMolPosR()
+			 << ",topL = " << msd->getTopL()
+			 << ",bottomL = " << msd->getBottomL()
+			 << ",frontR = " << msd->getFrontR()
+			 << ",backR = " << msd->getBackR()
+			 << ",Umin = " << Umin
+			 << ",Umax = " << Umax
+			 << ",bins = " << bins
+			 << ",windows = " << windows
+			 << ",overlap = " << overlap
+			 << ",lnfFinal = " << lnfFinal
+			 << ",\"B = " << p.B << '"'
+			 << ",SL = " << p.SL
+			 << ",SR = " << p.SR;
+		if (!usingMMB)  file << ",Sm = " << p_node.Sm;
+		file << ",FL = " << p.FL
+			 << ",FR = " << p.FR;
+		if (!usingMMB)  file << ",Fm = " << p_node.Fm;
+		file << ",JL = " << p.JL
+			 << ",JR = " << p.JR;
+		if (!usingMMB)  file << ",Jm = " << p_edge.Jm;
+		file << ",JmL = " << p.JmL
+			 << ",JmR = " << p.JmR
+			 << ",JLR = " << p.JLR
+			 << ",Je0L = " << p.Je0L
+			 << ",Je0R = " << p.Je0R;
+		if (!usingMMB)  file << ",Je0m = " << p_node.Je0m;
+		file << ",Je1L = " << p.Je1L
+			 << ",Je1R = " << p.Je1R;
+		if (!usingMMB)  file << ",Je1m = " << p_edge.Je1m;
+		file << ",Je1mL = " << p.Je1mL
+			 << ",Je1mR = " << p.Je1mR
+			 << ",Je1LR = " << p.Je1LR
+			 << ",JeeL = " << p.JeeL
+			 << ",JeeR = " << p.JeeR;
+		if (!usingMMB)  file << ",Jeem = " << p_edge.Jeem;
+		file << ",JeemL = " << p.JeemL
+			 << ",JeemR = " << p.JeemR
+			 << ",JeeLR = " << p.JeeLR
+			 << ",\"AL = " << p.AL << '"'
+			 << ",\"AR = " << p.AR << '"';
+		if (!usingMMB)  file << ",\"Am = " << p_node.Am << '"';
+		file << ",bL = " << p.bL
+			 << ",bR = " << p.bR;
+		if (!usingMMB)  file << ",bm = " << p_edge.bm;
+		file << ",bmL = " << p.bmL
+			 << ",bmR = " << p.bmR
+			 << ",bLR = " << p.bLR
+			 << ",\"DL = " << p.DL << '"'
+			 << ",\"DR = " << p.DR << '"';
+		if (!usingMMB)  file << ",\"Dm = " << p_edge.Dm << '"';
+		file << ",\"DmL = " << p.DmL << '"'
+			 << ",\"DmR = " << p.DmR << '"'
+			 << ",\"DLR = " << p.DLR << '"'
+			 << ",molType = " << (argc > 3 ? argv[3] : "LINEAR")
+			 << ",,msd_version = " << UDC_MSD_VERSION
+			 << '\n';
+	
+		//run simulation
+		cout << "Starting simulation...\n";
+		try {
+			wl->run();
+		} catch(runtime_error &e) {
+			cerr << e.what() << '\n';
+			return 4;
+		}
+		cout << "Rounds: " << wl->getRounds() << ", replica exchange rate: " << wl->exchangeRate() << '\n';
+		
+		cout << "Saving data...\n";
+		vector<double> kTs;
+		if (kT_inc > 0) {
+			for (double kT = kT_min; kT <= kT_max; kT += kT_inc)
+				kTs.push_back(kT);
+		} else if (kT_inc < 0) {
+			for (double kT = kT_max; kT >= kT_min; kT += kT_inc)
+				kTs.push_back(kT);
+		} else {
+			cerr << "kT_inc == 0: infinite loop!\n";
+			return 8;
+		}
+		const vector<double> &lnG = wl->lnG();
+		for (size_t i = 0; i < lnG.size() || i < kTs.size(); i++) {
+			if (i < lnG.size() && lnG[i] != -INFINITY)
+				file << wl->energy(static_cast<unsigned int>(i)) << ',' << lnG[i] << ",,";
+			else
+				file << ",,,";
+			if (i < kTs.size())
+				file << kTs[i] << ',' << wl->meanU(kTs[i]) << ',' << wl->specificHeat(kTs[i]);
+			file << '\n';
+		}
+	} catch(ios::failure &e) {
+		cerr << "Couldn't write to output file \"" << argv[1] << "\": " << e.what() << '\n';
+		return 3;
+	}
+	
+	return 0;
+}